@@ -0,0 +1,73 @@
+#ifndef BATCHSRC_H
+#define BATCHSRC_H
+
+#include "clientheader.h"
+#include <gst/base/gstbasesrc.h>
+#include <sys/socket.h>
+
+/* A batchudpsrc reads up to BATCH_DEFAULT_PACKETS datagrams per recvmmsg
+ * into buffers of BATCH_PACKET_SIZE bytes from its own pool and pushes them
+ * downstream as one buffer list */
+#define BATCH_DEFAULT_PACKETS 64
+#define BATCH_MAX_PACKETS 1024
+#define BATCH_PACKET_SIZE 2048
+
+/* The pool holds what the jitterbuffer keeps for NETCLOCK_LATENCY_MS at
+ * BATCH_POOL_RATE packets per second, plus two batches. A faster stream
+ * gets plain buffers once the pool is empty */
+#define BATCH_POOL_RATE 1000
+
+/* Jitterbuffer check: a BATCH_CHECK_PTIME_MS payloader sends to
+ * BATCH_CHECK_PORT on loopback, received with the latency of the players */
+#define BATCH_CHECK_PORT 5991
+#define BATCH_CHECK_PTIME_MS 1
+
+/* Receive benchmark: a sending process floods BATCH_BENCH_PORT on
+ * loopback with BATCH_BENCH_PAYLOAD byte datagrams. The system calls of
+ * udpsrc are counted for BATCH_BENCH_TRACE_SECONDS beforehand */
+#define BATCH_BENCH_PORT 5990
+#define BATCH_BENCH_PAYLOAD 1200
+#define BATCH_BENCH_TRACE_SECONDS 1
+
+#define GST_TYPE_BATCH_UDP_SRC (batch_udp_src_get_type ())
+#define GST_BATCH_UDP_SRC(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST ((obj), GST_TYPE_BATCH_UDP_SRC, GstBatchUdpSrc))
+#define GST_IS_BATCH_UDP_SRC(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GST_TYPE_BATCH_UDP_SRC))
+
+/* Structure for the batchudpsrc element. slots are pool buffers mapped and
+ * waiting for a datagram, the ones a read leaves empty wait for the next */
+typedef struct _GstBatchUdpSrc {
+    GstBaseSrc parent;
+    gint fd;
+    GstPoll *poll;
+    GstPollFD pollfd;
+    GstBufferPool *pool;
+    GstCaps *caps;
+    gchar *address;
+    gint port;
+    gint buffer_size;
+    guint batch;
+    GstBuffer *slots[BATCH_MAX_PACKETS];
+    GstMapInfo maps[BATCH_MAX_PACKETS];
+    struct iovec iov[BATCH_MAX_PACKETS];
+    struct mmsghdr msgs[BATCH_MAX_PACKETS];
+    guint64 packets;
+    guint64 syscalls;
+}GstBatchUdpSrc;
+
+typedef struct _GstBatchUdpSrcClass {
+    GstBaseSrcClass parent_class;
+}GstBatchUdpSrcClass;
+
+extern GType batch_udp_src_get_type (void);
+
+extern void batch_receive_enable (gboolean);
+
+extern GstElement *batch_receive_make ();
+
+extern void batch_receive_benchmark (gint);
+
+extern gboolean batch_receive_check (gint);
+
+#endif
@@ -14,7 +14,6 @@ typedef struct _RemoteMp4 {
 
     GstElement *udp_audio_source;
     GstElement *audio_watchdog;
-    GstElement *audio_rtp_buffer;
     GstElement *audio_rtp_depay;
     GstElement *audio_decoder;
     GstElement *audio_queue;
@@ -41,7 +40,6 @@ typedef struct _RemoteWebM {
     GstElement *pipeline;
     GstElement *udp_video_source;
     GstElement *video_watchdog;
-    GstElement *video_rtp_buffer;
     GstElement *video_rtp_depay;
     GstElement *video_queue;
     GstElement *video_decoder;
@@ -50,7 +48,6 @@ typedef struct _RemoteWebM {
 
     GstElement *udp_audio_source;
     GstElement *audio_watchdog;
-    GstElement *audio_rtp_buffer;
     GstElement *audio_rtp_depay;
     GstElement *audio_decoder;
     GstElement *audio_queue;
@@ -63,7 +60,6 @@ typedef struct _RemoteAvi {
     GstElement *pipeline;
     GstElement *udp_video_source;
     GstElement *video_watchdog;
-    GstElement *video_rtp_buffer;
     GstElement *video_rtp_depay;
     GstElement *video_queue;
     GstElement *video_decoder;
@@ -72,7 +68,6 @@ typedef struct _RemoteAvi {
 
     GstElement *udp_audio_source;
     GstElement *audio_watchdog;
-    GstElement *audio_rtp_buffer;
     GstElement *audio_rtp_depay;
     GstElement *audio_decoder;
     GstElement *audio_queue;
@@ -93,6 +88,142 @@ typedef struct _Thumbnail {
     GMainLoop *loop;
 }Thumbnail;
 
+/* Structure for a stream played from the shared memory of a server on
+ * this host, one shmsrc per RTP session. offset moves the server running
+ * time of both streams onto this pipeline */
+typedef struct _RemoteLocal {
+    GstElement *pipeline;
+    GstElement *video_source;
+    GstElement *video_depay;
+    GstElement *video_watchdog;
+    GstElement *video_decoder;
+    GstElement *video_queue;
+    GstElement *video_convert;
+    GstElement *video_sink;
+
+    GstElement *audio_source;
+    GstElement *audio_depay;
+    GstElement *audio_watchdog;
+    GstElement *audio_decoder;
+    GstElement *audio_queue;
+    GstElement *audio_convert;
+    GstElement *audio_resample;
+    GstElement *audio_sink;
+    GMutex lock;
+    gboolean offset_set;
+    gint64 offset;
+    GMainLoop *loop;
+}RemoteLocal;
+
+/* Structure for the memory accounting of a client pipeline. A jitterbuffer
+ * counts as the packets it received and did not push, drop as late or
+ * take as duplicates, times their mean size. A decoder pool counts as its
+ * frame size times the buffers it keeps allocated. live is whether a
+ * source of the pipeline is live, lock guards the jitterbuffers */
+typedef struct _MemBudget {
+    GMutex lock;
+    GPtrArray *queues;
+    GPtrArray *jitterbuffers;
+    GPtrArray *decoders;
+    gint budget_mb;
+    gboolean live;
+    guint source;
+    gsize peak;
+    gsize peak_queues;
+    gsize peak_jitter;
+    gsize peak_pools;
+}MemBudget;
+
+/* Structure for the packets one jitterbuffer of a pipeline received */
+typedef struct _MemBudgetJitter {
+    MemBudget *budget;
+    GstElement *jitterbuffer;
+    guint64 packets;
+    guint64 bytes;
+}MemBudgetJitter;
+
+/* Structure for the receiving side of one video codec: its RTP encoding
+ * name, depayloader and decoders to try in order */
+typedef struct _VideoCodec {
+    const gchar *name;
+    const gchar *encoding_name;
+    const gchar *depayloader;
+    const gchar *decoders[3];
+}VideoCodec;
+
+/* Address of the streaming server */
+#define SERVER_ADDRESS "10.1.137.49"
+
+/* RTP sessions, numbered like on the server. RTP of session N arrives on
+ * RTP_PORT_BASE + N, sender reports on RTCP_PORT_BASE + N and receiver
+ * reports go back to the server on RTCP_RR_PORT_BASE + N. The server
+ * tells the port base of its stream, which shifts all of them */
+#define RTP_SESSION_VIDEO 0
+#define RTP_SESSION_AUDIO 1
+#define RTP_PORT_BASE 5000
+#define RTCP_PORT_BASE 5005
+#define RTCP_RR_PORT_BASE 5007
+
+/* Kernel receive buffer of the RTP sockets in bytes, room for the keyframe
+ * bursts the server paces out, and the seconds between two looks at the
+ * UDP receive buffer drops of the host */
+#define RTP_RECV_BUFFER_SIZE (4 * 1024 * 1024)
+#define RTP_DROP_REPORT_INTERVAL 5
+
+/* Milliseconds without packets after which the stream of an SSRC counts
+ * as started again, its first keyframe then makes it the active one */
+#define RTP_SWITCH_IDLE_MS 500
+
+/* Seconds a client offered the local transport waits for the video socket
+ * of the server before it plays over the network, and the milliseconds it
+ * gives the audio socket after that */
+#define LOCAL_CONNECT_TIMEOUT 5
+#define LOCAL_AUDIO_WAIT_MS 500
+
+/* Every client pipeline has a memory budget of MEMBUDGET_DEFAULT_MB, 0
+ * keeps the stock queue limits. Its queues share what the decoder pools
+ * and the jitterbuffers, MEMBUDGET_POOL_WEIGHT and MEMBUDGET_JITTER_WEIGHT
+ * shares of one queue, leave of the budget, and no queue gets less than
+ * MEMBUDGET_MIN_QUEUE bytes. The memory they hold is sampled every
+ * MEMBUDGET_SAMPLE_MS and its peak printed when the pipeline goes away */
+#define MEMBUDGET_DEFAULT_MB 32
+#define MEMBUDGET_MIN_QUEUE (1024 * 1024)
+#define MEMBUDGET_POOL_WEIGHT 4
+#define MEMBUDGET_JITTER_WEIGHT 2
+#define MEMBUDGET_SAMPLE_MS 200
+
+/* Port of the server network clock, and the latency every client plays
+ * with so that they render in step */
+#define NETCLOCK_PORT 8554
+#define NETCLOCK_LATENCY_MS 200
+
+extern const VideoCodec *video_codec_find (int, char *[], const gchar *);
+
+extern GstElement *video_codec_make_decoder (const VideoCodec *);
+
+extern void rtp_session_set_port_base (gint);
+
+extern gint rtp_session_port (guint);
+
+extern gboolean rtp_session_add (GstElement *, GstElement *, GstElement *,
+    guint);
+
+extern void netclock_use (GstElement *);
+
+extern void netclock_release (GstElement *);
+
+extern void netclock_report_render (GstClockTime);
+
+extern void membudget_set_default (gint);
+
+extern void membudget_attach (GstElement *);
+
+extern void avsync_enable (gboolean);
+
+extern void avsync_attach (GstElement *, GstElement *);
+
+extern void avsync_report ();
+
 extern int remotehost_Mp4_pipeline (int, char *[]);
 
 extern int remotehost_Mp3_pipeline (int, char *[]);
@@ -103,4 +234,6 @@ extern int remotehost_Avi_pipeline (int, char *[]);
 
 extern int thumbnail_pipeline (int, char *[]);
 
+extern int remotehost_local_pipeline (const gchar *);
+
 #endif
\ No newline at end of file
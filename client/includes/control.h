@@ -0,0 +1,45 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include "clientheader.h"
+
+/* Commands received from the server over the control connection */
+#define CONTROL_PAUSE "PAUSE"
+#define CONTROL_RESUME "RESUME"
+#define CONTROL_KEEPALIVE "KEEPALIVE"
+#define CONTROL_SEEK "SEEK"
+
+/* Commands sent to the server */
+#define CONTROL_RENDER "RENDER"
+#define CONTROL_LOCAL "LOCAL"
+
+/* A paused stream is given up after this many seconds without keepalive */
+#define CONTROL_KEEPALIVE_TIMEOUT 5
+
+/* Structure for the control channel state of one pipeline */
+typedef struct _ControlData {
+    GstElement *pipeline;
+    GstElement *video_watchdog;
+    GstElement *audio_watchdog;
+    GstElement *sink;
+    gint video_timeout;
+    gint audio_timeout;
+    gboolean paused;
+    gint64 last_keepalive;
+    gint64 seek_start;
+    gulong seek_probe;
+    GIOChannel *channel;
+    guint watch_id;
+    guint check_id;
+    GMainLoop *loop;
+}ControlData;
+
+extern void control_set_socket (int);
+
+extern void control_send (const gchar *);
+
+extern void control_attach (ControlData *);
+
+extern void control_detach (ControlData *);
+
+#endif
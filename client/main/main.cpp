@@ -1,4 +1,6 @@
 #include "clientheader.h"
+#include "control.h"
+#include "batchsrc.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -29,7 +31,7 @@ void receive_extention(){
     servaddr.sin_port = htons(PORT);
 
     /* Convert IPv4 and IPv6 addresses from text to binary form */
-    if (inet_pton(AF_INET, "10.1.137.49", &servaddr.sin_addr) <= 0) {
+    if (inet_pton(AF_INET, SERVER_ADDRESS, &servaddr.sin_addr) <= 0) {
         perror("Invalid address/ Address not supported");
         exit(EXIT_FAILURE);
     }
@@ -40,15 +42,40 @@ void receive_extention(){
         exit(EXIT_FAILURE);
     }
 
-    /* Receive string from server and print it */
-	recv(sockfd, &buffer, sizeof(buffer), 0);
+    /* Receive string from server and print it, the video codec follows
+     * the extension after a space */
+	recv(sockfd, &buffer, sizeof(buffer) - 1, 0);
 	printf("\nFile: %s\n", buffer);
 
-    int argc;
-    char *argv[] = {0};
+    /* The port base of the stream follows as "port=", and a server on
+     * this host offers its shared memory sockets as "local=" */
+    char *codec = NULL, *local = NULL;
+    int port_base = RTP_PORT_BASE;
+    strtok(buffer, " ");
+    for(char *token = strtok(NULL, " "); token != NULL;
+            token = strtok(NULL, " ")){
+        if(g_str_has_prefix(token, "local="))
+            local = token + strlen("local=");
+        else if(g_str_has_prefix(token, "port="))
+            port_base = atoi(token + strlen("port="));
+        else
+            codec = token;
+    }
+    rtp_session_set_port_base(port_base);
+
+    /* Keep the connection as control channel while the stream plays */
+    control_set_socket(sockfd);
 
-    /* Checking the buffer and playing the appropriate pipeline */
-    if(strcmp(buffer, "mp3") == 0){
+    /* The pipelines take the video codec as their argument */
+    int argc = codec != NULL ? 1 : 0;
+    char *argv[] = {codec, NULL};
+
+    /* Checking the buffer and playing the appropriate pipeline, locally
+     * when the server opens its sockets */
+    if(local != NULL && remotehost_local_pipeline(local) == 0){
+        if(strcmp(buffer, "mp3") != 0 && strcmp(buffer, "avsync") != 0)
+            thumbnail_pipeline(argc, argv);
+    }else if(strcmp(buffer, "mp3") == 0){
         remotehost_Mp3_pipeline(argc, argv);
     }else if(strcmp(buffer, "webm") == 0){
         remotehost_WebM_pipeline(argc, argv);
@@ -56,6 +83,11 @@ void receive_extention(){
     }else if(strcmp(buffer, "mp4") == 0){
         remotehost_Mp4_pipeline(argc, argv);
         thumbnail_pipeline(argc, argv);
+    }else if(strcmp(buffer, "avsync") == 0){
+        /* A/V sync test pattern, H264 and Opus like mp4 */
+        avsync_enable(TRUE);
+        remotehost_Mp4_pipeline(argc, argv);
+        avsync_enable(FALSE);
     }else if(strcmp(buffer, "avi") == 0){
         remotehost_Avi_pipeline(argc, argv);
         thumbnail_pipeline(argc, argv);
@@ -64,11 +96,60 @@ void receive_extention(){
     }
 
     /* Close the socket */
+    control_set_socket(-1);
     close(sockfd);
 }
 
+/* Options of the client, a mode runs and exits, the rest set up the
+ * pipelines of the streams received */
+static gboolean opt_bench_receive = FALSE;
+static gboolean opt_check_receive = FALSE;
+static gboolean opt_batch_receive = FALSE;
+static gint opt_mem_budget = -1;
+
+static GOptionEntry option_entries[] = {
+    {"bench-receive", 0, 0, G_OPTION_ARG_NONE, &opt_bench_receive,
+        "Measure the packets per second udpsrc and batchudpsrc receive "
+        "[seconds]", NULL},
+    {"check-receive", 0, 0, G_OPTION_ARG_NONE, &opt_check_receive,
+        "Check a batchudpsrc keeps up behind a jitterbuffer with the "
+        "latency of the players [seconds]", NULL},
+    {"batch-receive", 0, 0, G_OPTION_ARG_NONE, &opt_batch_receive,
+        "Read the RTP many datagrams per system call", NULL},
+    {"mem-budget", 0, 0, G_OPTION_ARG_INT, &opt_mem_budget,
+        "Bound the memory of each pipeline, 0 keeps the stock queue limits",
+        "MiB"},
+    {NULL}
+};
+
 int main (int argc, char *argv[]) {
-        
+
+    GOptionContext *context;
+    GError *error = NULL;
+
+    /* The options may come in any order, what remains is the seconds of
+     * a mode */
+    context = g_option_context_new("[SECONDS]");
+    g_option_context_add_main_entries(context, option_entries, NULL);
+    if(!g_option_context_parse(context, &argc, &argv, &error)){
+        g_printerr("%s\n", error->message);
+        g_error_free(error);
+        g_option_context_free(context);
+        return 1;
+    }
+    g_option_context_free(context);
+
+    if(opt_bench_receive){
+        batch_receive_benchmark(argc > 1 ? atoi(argv[1]) : 10);
+        return 0;
+    }
+    if(opt_check_receive)
+        return batch_receive_check(argc > 1 ? atoi(argv[1]) : 5) ? 0 : 1;
+
+    batch_receive_enable(opt_batch_receive);
+    if(opt_mem_budget >= 0)
+        membudget_set_default(opt_mem_budget);
+
     while(1){
         receive_extention();
     }
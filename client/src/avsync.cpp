@@ -0,0 +1,184 @@
+#include "clientheader.h"
+#include <string.h>
+
+/* A flash and a beep closer than this belong to the same second */
+#define AVSYNC_MATCH_WINDOW (500 * GST_MSECOND)
+
+/* Print a summary every this many measurements */
+#define AVSYNC_REPORT_INTERVAL 60
+
+/* Structure for the A/V offset measurement at the client sinks */
+typedef struct _AVSyncStats {
+    gboolean enabled;
+    gboolean in_flash;
+    gboolean in_beep;
+    GstClockTime flash;
+    GstClockTime beep;
+    guint count;
+    gdouble sum;
+    gdouble min;
+    gdouble max;
+}AVSyncStats;
+
+static AVSyncStats stats;
+
+/* Running time at which the sink renders the buffer */
+static GstClockTime
+running_time (GstPad * pad, GstBuffer * buffer)
+{
+  GstEvent *event = gst_pad_get_sticky_event (pad, GST_EVENT_SEGMENT, 0);
+  const GstSegment *segment;
+  GstClockTime time;
+
+  if (event == NULL)
+    return GST_CLOCK_TIME_NONE;
+  gst_event_parse_segment (event, &segment);
+  time = gst_segment_to_running_time (segment, GST_FORMAT_TIME,
+      GST_BUFFER_PTS (buffer));
+  gst_event_unref (event);
+  return time;
+}
+
+/* Pair flashes and beeps and account the offset, positive means the video
+ * is rendered after the audio */
+static void
+match (void)
+{
+  gdouble offset;
+
+  if (stats.flash == GST_CLOCK_TIME_NONE || stats.beep == GST_CLOCK_TIME_NONE)
+    return;
+  if (GST_CLOCK_DIFF (stats.flash, stats.beep) > (GstClockTimeDiff)
+      AVSYNC_MATCH_WINDOW || GST_CLOCK_DIFF (stats.beep, stats.flash)
+      > (GstClockTimeDiff) AVSYNC_MATCH_WINDOW)
+    return;
+
+  offset = GST_CLOCK_DIFF (stats.beep, stats.flash) / (gdouble) GST_MSECOND;
+  stats.flash = stats.beep = GST_CLOCK_TIME_NONE;
+  stats.sum += offset;
+  stats.min = stats.count ? MIN (stats.min, offset) : offset;
+  stats.max = stats.count ? MAX (stats.max, offset) : offset;
+  stats.count++;
+
+  g_print ("A/V offset: %+.1f ms\n", offset);
+  if (stats.count % AVSYNC_REPORT_INTERVAL == 0)
+    avsync_report ();
+}
+
+/* Detect the white frame at the start of every second */
+static GstPadProbeReturn
+video_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  GstCaps *caps = gst_pad_get_current_caps (pad);
+  gint width = 0, height = 0;
+  const gchar *format = NULL;
+  GstMapInfo map;
+  guint64 sum = 0, samples = 0;
+
+  if (caps == NULL)
+    return GST_PAD_PROBE_OK;
+  GstStructure *s = gst_caps_get_structure (caps, 0);
+  format = gst_structure_get_string (s, "format");
+  gst_structure_get_int (s, "width", &width);
+  gst_structure_get_int (s, "height", &height);
+
+  /* Planar YUV formats start with the luma plane */
+  if (format && (!strcmp (format, "I420") || !strcmp (format, "YV12")
+          || !strcmp (format, "NV12"))
+      && gst_buffer_map (buffer, &map, GST_MAP_READ)) {
+    gsize size = MIN (map.size, (gsize) width * height);
+    for (gsize i = 0; i < size; i += 61, samples++)
+      sum += map.data[i];
+    gst_buffer_unmap (buffer, &map);
+  }
+  gst_caps_unref (caps);
+
+  if (samples > 0) {
+    gboolean flash = sum / samples > 128;
+    if (flash && !stats.in_flash) {
+      stats.flash = running_time (pad, buffer);
+      netclock_report_render (stats.flash);
+      match ();
+    }
+    stats.in_flash = flash;
+  }
+  return GST_PAD_PROBE_OK;
+}
+
+/* Detect the beep at the start of every second */
+static GstPadProbeReturn
+audio_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  GstCaps *caps = gst_pad_get_current_caps (pad);
+  const gchar *format = NULL;
+  GstMapInfo map;
+  gdouble peak = 0.0;
+
+  if (caps == NULL)
+    return GST_PAD_PROBE_OK;
+  format = gst_structure_get_string (gst_caps_get_structure (caps, 0),
+      "format");
+
+  if (format && gst_buffer_map (buffer, &map, GST_MAP_READ)) {
+    if (!strcmp (format, "S16LE")) {
+      const gint16 *samples = (const gint16 *) map.data;
+      for (gsize i = 0; i < map.size / 2; i++)
+        peak = MAX (peak, ABS (samples[i]) / 32768.0);
+    } else if (!strcmp (format, "F32LE")) {
+      const gfloat *samples = (const gfloat *) map.data;
+      for (gsize i = 0; i < map.size / 4; i++)
+        peak = MAX (peak, ABS (samples[i]));
+    }
+    gst_buffer_unmap (buffer, &map);
+  }
+  gst_caps_unref (caps);
+
+  gboolean beep = peak > 0.1;
+  if (beep && !stats.in_beep) {
+    stats.beep = running_time (pad, buffer);
+    match ();
+  }
+  stats.in_beep = beep;
+  return GST_PAD_PROBE_OK;
+}
+
+/* Measure the A/V offset on the next pipeline */
+void
+avsync_enable (gboolean enable)
+{
+  memset (&stats, 0, sizeof (stats));
+  stats.enabled = enable;
+  stats.flash = stats.beep = GST_CLOCK_TIME_NONE;
+}
+
+/* Add the measurement probes to the sinks when measuring is enabled */
+void
+avsync_attach (GstElement * video_sink, GstElement * audio_sink)
+{
+  GstPad *pad;
+
+  if (!stats.enabled)
+    return;
+
+  g_print ("\nMeasuring A/V offset of the sync test pattern\n");
+  pad = gst_element_get_static_pad (video_sink, "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, video_probe, NULL, NULL);
+  gst_object_unref (pad);
+  pad = gst_element_get_static_pad (audio_sink, "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, audio_probe, NULL, NULL);
+  gst_object_unref (pad);
+}
+
+/* Print the A/V offset statistics so far */
+void
+avsync_report ()
+{
+  if (!stats.enabled || stats.count == 0)
+    return;
+  g_print ("\n*..........A/V sync after %u seconds..........*\n"
+      " mean %+.1f ms, min %+.1f ms, max %+.1f ms, drift %+.1f ms\n\n",
+      stats.count, stats.sum / stats.count, stats.min, stats.max,
+      stats.max - stats.min);
+}
@@ -0,0 +1,864 @@
+#include "batchsrc.h"
+#include "sysstat.h"
+#include <errno.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+enum
+{
+  PROP_0,
+  PROP_CAPS,
+  PROP_ADDRESS,
+  PROP_PORT,
+  PROP_BUFFER_SIZE,
+  PROP_BATCH,
+  PROP_PACKETS,
+  PROP_SYSCALLS
+};
+
+/* Whether the RTP of the pipelines is received through batchudpsrcs */
+static gboolean batch_enabled = FALSE;
+
+static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC, GST_PAD_ALWAYS, GST_STATIC_CAPS_ANY);
+
+G_DEFINE_TYPE (GstBatchUdpSrc, batch_udp_src, GST_TYPE_BASE_SRC);
+
+static void
+batch_udp_src_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstBatchUdpSrc *src = GST_BATCH_UDP_SRC (object);
+
+  GST_OBJECT_LOCK (src);
+  switch (prop_id) {
+    case PROP_CAPS:
+      gst_caps_replace (&src->caps, (GstCaps *) gst_value_get_caps (value));
+      break;
+    case PROP_ADDRESS:
+      g_free (src->address);
+      src->address = g_value_dup_string (value);
+      break;
+    case PROP_PORT:
+      src->port = g_value_get_int (value);
+      break;
+    case PROP_BUFFER_SIZE:
+      src->buffer_size = g_value_get_int (value);
+      break;
+    case PROP_BATCH:
+      src->batch = g_value_get_uint (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+  GST_OBJECT_UNLOCK (src);
+}
+
+static void
+batch_udp_src_get_property (GObject * object, guint prop_id, GValue * value,
+    GParamSpec * pspec)
+{
+  GstBatchUdpSrc *src = GST_BATCH_UDP_SRC (object);
+
+  GST_OBJECT_LOCK (src);
+  switch (prop_id) {
+    case PROP_CAPS:
+      gst_value_set_caps (value, src->caps);
+      break;
+    case PROP_ADDRESS:
+      g_value_set_string (value, src->address);
+      break;
+    case PROP_PORT:
+      g_value_set_int (value, src->port);
+      break;
+    case PROP_BUFFER_SIZE:
+      g_value_set_int (value, src->buffer_size);
+      break;
+    case PROP_BATCH:
+      g_value_set_uint (value, src->batch);
+      break;
+    case PROP_PACKETS:
+      g_value_set_uint64 (value, src->packets);
+      break;
+    case PROP_SYSCALLS:
+      g_value_set_uint64 (value, src->syscalls);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+  GST_OBJECT_UNLOCK (src);
+}
+
+static GstCaps *
+batch_udp_src_get_caps (GstBaseSrc * basesrc, GstCaps * filter)
+{
+  GstBatchUdpSrc *src = GST_BATCH_UDP_SRC (basesrc);
+  GstCaps *caps, *result;
+
+  GST_OBJECT_LOCK (src);
+  caps = src->caps ? gst_caps_ref (src->caps) : gst_caps_new_any ();
+  GST_OBJECT_UNLOCK (src);
+  if (filter == NULL)
+    return caps;
+  result = gst_caps_intersect_full (filter, caps, GST_CAPS_INTERSECT_FIRST);
+  gst_caps_unref (caps);
+  return result;
+}
+
+static gboolean
+batch_udp_src_stop (GstBaseSrc * basesrc)
+{
+  GstBatchUdpSrc *src = GST_BATCH_UDP_SRC (basesrc);
+
+  for (guint i = 0; i < BATCH_MAX_PACKETS; i++) {
+    if (src->slots[i] == NULL)
+      continue;
+    gst_buffer_unmap (src->slots[i], &src->maps[i]);
+    gst_buffer_unref (src->slots[i]);
+    src->slots[i] = NULL;
+  }
+  if (src->pool != NULL) {
+    gst_buffer_pool_set_active (src->pool, FALSE);
+    gst_object_unref (src->pool);
+    src->pool = NULL;
+  }
+  if (src->poll != NULL)
+    gst_poll_free (src->poll);
+  src->poll = NULL;
+  if (src->fd >= 0)
+    close (src->fd);
+  src->fd = -1;
+  return TRUE;
+}
+
+/* Bind the socket and fill the pool, the batch of slots is taken from it
+ * on the first read */
+static gboolean
+batch_udp_src_start (GstBaseSrc * basesrc)
+{
+  GstBatchUdpSrc *src = GST_BATCH_UDP_SRC (basesrc);
+  GstStructure *config;
+  struct sockaddr_in address;
+  gint reuse = 1;
+  guint pooled;
+
+  memset (&address, 0, sizeof (address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons (src->port);
+  if (inet_pton (AF_INET, src->address, &address.sin_addr) <= 0) {
+    GST_ELEMENT_ERROR (src, RESOURCE, SETTINGS, (NULL),
+        ("Invalid address %s", src->address));
+    return FALSE;
+  }
+  src->fd = socket (AF_INET, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+  if (src->fd < 0) {
+    GST_ELEMENT_ERROR (src, RESOURCE, OPEN_READ, (NULL),
+        ("socket: %s", g_strerror (errno)));
+    return FALSE;
+  }
+  setsockopt (src->fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof (reuse));
+  if (src->buffer_size > 0)
+    setsockopt (src->fd, SOL_SOCKET, SO_RCVBUF, &src->buffer_size,
+        sizeof (src->buffer_size));
+  if (bind (src->fd, (struct sockaddr *) &address, sizeof (address)) < 0) {
+    GST_ELEMENT_ERROR (src, RESOURCE, OPEN_READ, (NULL),
+        ("bind %s:%d: %s", src->address, src->port, g_strerror (errno)));
+    close (src->fd);
+    src->fd = -1;
+    return FALSE;
+  }
+
+  src->poll = gst_poll_new (TRUE);
+  gst_poll_fd_init (&src->pollfd);
+  src->pollfd.fd = src->fd;
+  gst_poll_add_fd (src->poll, &src->pollfd);
+  gst_poll_fd_ctl_read (src->poll, &src->pollfd, TRUE);
+
+  /* Every packet the jitterbuffer holds for its latency, and two
+   * batches, one being read into while the last is downstream */
+  pooled = NETCLOCK_LATENCY_MS * BATCH_POOL_RATE / 1000 + 2 * src->batch;
+  src->pool = gst_buffer_pool_new ();
+  config = gst_buffer_pool_get_config (src->pool);
+  gst_buffer_pool_config_set_params (config, NULL, BATCH_PACKET_SIZE,
+      pooled, pooled);
+  if (!gst_buffer_pool_set_config (src->pool, config)
+      || !gst_buffer_pool_set_active (src->pool, TRUE)) {
+    GST_ELEMENT_ERROR (src, RESOURCE, NO_SPACE_LEFT, (NULL),
+        ("Buffer pool could not be activated"));
+    batch_udp_src_stop (basesrc);
+    return FALSE;
+  }
+  src->packets = 0;
+  src->syscalls = 0;
+  return TRUE;
+}
+
+static gboolean
+batch_udp_src_unlock (GstBaseSrc * basesrc)
+{
+  GstBatchUdpSrc *src = GST_BATCH_UDP_SRC (basesrc);
+
+  if (src->poll != NULL)
+    gst_poll_set_flushing (src->poll, TRUE);
+  return TRUE;
+}
+
+static gboolean
+batch_udp_src_unlock_stop (GstBaseSrc * basesrc)
+{
+  GstBatchUdpSrc *src = GST_BATCH_UDP_SRC (basesrc);
+
+  if (src->poll != NULL)
+    gst_poll_set_flushing (src->poll, FALSE);
+  return TRUE;
+}
+
+/* Give every empty slot of the batch a mapped pool buffer. The source
+ * never waits for downstream to release one, the socket would overflow
+ * meanwhile, a plain buffer is allocated when the pool is empty */
+static GstFlowReturn
+fill_slots (GstBatchUdpSrc * src, guint batch)
+{
+  GstBufferPoolAcquireParams params = { GST_FORMAT_UNDEFINED, 0, 0,
+    GST_BUFFER_POOL_ACQUIRE_FLAG_DONTWAIT
+  };
+
+  for (guint i = 0; i < batch; i++) {
+    GstFlowReturn ret;
+
+    if (src->slots[i] != NULL)
+      continue;
+    ret = gst_buffer_pool_acquire_buffer (src->pool, &src->slots[i],
+        &params);
+    if (ret == GST_FLOW_EOS) {
+      src->slots[i] = gst_buffer_new_allocate (NULL, BATCH_PACKET_SIZE, NULL);
+      ret = src->slots[i] != NULL ? GST_FLOW_OK : GST_FLOW_ERROR;
+    }
+    if (ret != GST_FLOW_OK)
+      return ret;
+    if (!gst_buffer_map (src->slots[i], &src->maps[i], GST_MAP_WRITE)) {
+      gst_buffer_unref (src->slots[i]);
+      src->slots[i] = NULL;
+      GST_ELEMENT_ERROR (src, RESOURCE, NO_SPACE_LEFT, (NULL),
+          ("Pool buffer could not be mapped"));
+      return GST_FLOW_ERROR;
+    }
+  }
+  return GST_FLOW_OK;
+}
+
+/* Read every datagram waiting, up to a batch, in one recvmmsg. The socket
+ * is only polled when a read finds it empty */
+static GstFlowReturn
+read_batch (GstBatchUdpSrc * src, guint batch, gint * n)
+{
+  for (;;) {
+    GstFlowReturn ret = fill_slots (src, batch);
+
+    if (ret != GST_FLOW_OK)
+      return ret;
+    memset (src->msgs, 0, batch * sizeof (struct mmsghdr));
+    for (guint i = 0; i < batch; i++) {
+      src->iov[i].iov_base = src->maps[i].data;
+      src->iov[i].iov_len = src->maps[i].size;
+      src->msgs[i].msg_hdr.msg_iov = &src->iov[i];
+      src->msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    *n = recvmmsg (src->fd, src->msgs, batch, MSG_DONTWAIT, NULL);
+    src->syscalls++;
+    if (*n > 0)
+      return GST_FLOW_OK;
+    if (*n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+      GST_ELEMENT_ERROR (src, RESOURCE, READ, (NULL),
+          ("recvmmsg: %s", g_strerror (errno)));
+      return GST_FLOW_ERROR;
+    }
+    src->syscalls++;
+    if (gst_poll_wait (src->poll, GST_CLOCK_TIME_NONE) < 0) {
+      if (errno == EBUSY)
+        return GST_FLOW_FLUSHING;
+      if (errno != EINTR && errno != EAGAIN) {
+        GST_ELEMENT_ERROR (src, RESOURCE, READ, (NULL),
+            ("poll: %s", g_strerror (errno)));
+        return GST_FLOW_ERROR;
+      }
+    }
+  }
+}
+
+/* Hand the datagrams of a read to the base class as one buffer list, the
+ * slots they filled are taken from the pool again on the next read */
+static GstFlowReturn
+batch_udp_src_create (GstBaseSrc * basesrc, guint64 offset, guint size,
+    GstBuffer ** buf)
+{
+  GstBatchUdpSrc *src = GST_BATCH_UDP_SRC (basesrc);
+  guint batch = MIN (MAX (src->batch, 1), BATCH_MAX_PACKETS);
+  GstBufferList *list = NULL;
+
+  while (list == NULL) {
+    GstClockTime now = GST_CLOCK_TIME_NONE;
+    GstClock *clock;
+    GstFlowReturn ret;
+    gint n;
+
+    ret = read_batch (src, batch, &n);
+    if (ret != GST_FLOW_OK)
+      return ret;
+
+    /* One arrival time for the batch, as udpsrc stamps a single packet */
+    clock = gst_element_get_clock (GST_ELEMENT (src));
+    if (clock != NULL) {
+      now = gst_clock_get_time (clock) - GST_ELEMENT (src)->base_time;
+      gst_object_unref (clock);
+    }
+
+    list = gst_buffer_list_new_sized (n);
+    for (gint i = 0; i < n; i++) {
+      GstBuffer *buffer = src->slots[i];
+
+      /* Larger than a slot, the datagram is not RTP from the server */
+      if (src->msgs[i].msg_hdr.msg_flags & MSG_TRUNC)
+        continue;
+      gst_buffer_unmap (buffer, &src->maps[i]);
+      gst_buffer_resize (buffer, 0, src->msgs[i].msg_len);
+      GST_BUFFER_DTS (buffer) = now;
+      GST_BUFFER_PTS (buffer) = now;
+      gst_buffer_list_add (list, buffer);
+      src->slots[i] = NULL;
+    }
+    src->packets += gst_buffer_list_length (list);
+    if (gst_buffer_list_length (list) == 0) {
+      gst_buffer_list_unref (list);
+      list = NULL;
+    }
+  }
+  gst_base_src_submit_buffer_list (basesrc, list);
+  *buf = NULL;
+  return GST_FLOW_OK;
+}
+
+static void
+batch_udp_src_finalize (GObject * object)
+{
+  GstBatchUdpSrc *src = GST_BATCH_UDP_SRC (object);
+
+  gst_caps_replace (&src->caps, NULL);
+  g_free (src->address);
+  G_OBJECT_CLASS (batch_udp_src_parent_class)->finalize (object);
+}
+
+static void
+batch_udp_src_class_init (GstBatchUdpSrcClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GstElementClass *element_class = GST_ELEMENT_CLASS (klass);
+  GstBaseSrcClass *basesrc_class = GST_BASE_SRC_CLASS (klass);
+
+  gobject_class->set_property = batch_udp_src_set_property;
+  gobject_class->get_property = batch_udp_src_get_property;
+  gobject_class->finalize = batch_udp_src_finalize;
+
+  g_object_class_install_property (gobject_class, PROP_CAPS,
+      g_param_spec_boxed ("caps", "Caps", "Caps of the received packets",
+          GST_TYPE_CAPS,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (gobject_class, PROP_ADDRESS,
+      g_param_spec_string ("address", "Address", "IPv4 address to bind",
+          "0.0.0.0",
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (gobject_class, PROP_PORT,
+      g_param_spec_int ("port", "Port", "UDP port to receive on", 0, 65535,
+          5004, (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (gobject_class, PROP_BUFFER_SIZE,
+      g_param_spec_int ("buffer-size", "Buffer size",
+          "Kernel receive buffer in bytes, 0 for the default", 0, G_MAXINT,
+          0, (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (gobject_class, PROP_BATCH,
+      g_param_spec_uint ("batch", "Batch",
+          "Datagrams read per recvmmsg", 1, BATCH_MAX_PACKETS,
+          BATCH_DEFAULT_PACKETS,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (gobject_class, PROP_PACKETS,
+      g_param_spec_uint64 ("packets", "Packets", "Datagrams received", 0,
+          G_MAXUINT64, 0,
+          (GParamFlags) (G_PARAM_READABLE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (gobject_class, PROP_SYSCALLS,
+      g_param_spec_uint64 ("syscalls", "Syscalls",
+          "recvmmsg and poll calls made", 0, G_MAXUINT64, 0,
+          (GParamFlags) (G_PARAM_READABLE | G_PARAM_STATIC_STRINGS)));
+
+  gst_element_class_set_static_metadata (element_class, "Batch UDP source",
+      "Source/Network", "Reads datagrams with recvmmsg into pooled buffers "
+      "and pushes them as buffer lists", "gstreamer-remote-streaming");
+  gst_element_class_add_static_pad_template (element_class, &src_template);
+
+  basesrc_class->get_caps = batch_udp_src_get_caps;
+  basesrc_class->start = batch_udp_src_start;
+  basesrc_class->stop = batch_udp_src_stop;
+  basesrc_class->unlock = batch_udp_src_unlock;
+  basesrc_class->unlock_stop = batch_udp_src_unlock_stop;
+  basesrc_class->create = batch_udp_src_create;
+}
+
+static void
+batch_udp_src_init (GstBatchUdpSrc * src)
+{
+  src->fd = -1;
+  src->address = g_strdup ("0.0.0.0");
+  src->port = 5004;
+  src->batch = BATCH_DEFAULT_PACKETS;
+  gst_base_src_set_live (GST_BASE_SRC (src), TRUE);
+  gst_base_src_set_format (GST_BASE_SRC (src), GST_FORMAT_TIME);
+}
+
+static gpointer
+register_element (gpointer data)
+{
+  gst_element_register (NULL, "batchudpsrc", GST_RANK_NONE,
+      GST_TYPE_BATCH_UDP_SRC);
+  return NULL;
+}
+
+/* Receive the RTP of the pipelines through batchudpsrcs */
+void
+batch_receive_enable (gboolean enabled)
+{
+  batch_enabled = enabled;
+}
+
+/* The source of an RTP stream, a udpsrc unless batched receiving is on.
+ * Both take the caps, port and buffer-size of the pipelines */
+GstElement *
+batch_receive_make ()
+{
+  static GOnce once = G_ONCE_INIT;
+
+  if (!batch_enabled)
+    return gst_element_factory_make ("udpsrc", NULL);
+  g_once (&once, (GThreadFunc) register_element, NULL);
+  return gst_element_factory_make ("batchudpsrc", NULL);
+}
+
+/* Count the packets reaching the benchmark sink, one or a list */
+static GstPadProbeReturn
+count_probe (GstPad * pad, GstPadProbeInfo * info, guint64 * packets)
+{
+  if (info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST)
+    *packets += gst_buffer_list_length (GST_PAD_PROBE_INFO_BUFFER_LIST (info));
+  else
+    *packets += 1;
+  return GST_PAD_PROBE_OK;
+}
+
+/* Sending side of the benchmark, run in a child process so that its CPU
+ * is not counted: flood the port for seconds, return the datagrams sent */
+static guint64
+bench_send (gint seconds)
+{
+  struct sockaddr_in address;
+  struct mmsghdr msgs[BATCH_DEFAULT_PACKETS];
+  struct iovec iov;
+  gchar payload[BATCH_BENCH_PAYLOAD];
+  gint64 end = g_get_monotonic_time () + seconds * G_USEC_PER_SEC;
+  guint64 sent = 0;
+  gint fd = socket (AF_INET, SOCK_DGRAM, 0);
+
+  memset (&address, 0, sizeof (address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons (BATCH_BENCH_PORT);
+  address.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  if (fd < 0 || connect (fd, (struct sockaddr *) &address,
+          sizeof (address)) < 0)
+    return 0;
+
+  memset (payload, 0x80, sizeof (payload));
+  iov.iov_base = payload;
+  iov.iov_len = sizeof (payload);
+  memset (msgs, 0, sizeof (msgs));
+  for (guint i = 0; i < BATCH_DEFAULT_PACKETS; i++) {
+    msgs[i].msg_hdr.msg_iov = &iov;
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+  while (g_get_monotonic_time () < end) {
+    gint n = sendmmsg (fd, msgs, BATCH_DEFAULT_PACKETS, 0);
+    if (n > 0)
+      sent += n;
+  }
+  close (fd);
+  return sent;
+}
+
+/* Fork the sending side, its datagram count comes back through *result */
+static pid_t
+bench_sender_start (gint seconds, gint * result)
+{
+  int fds[2];
+  pid_t child;
+
+  if (pipe (fds) < 0) {
+    perror ("pipe");
+    return -1;
+  }
+  child = fork ();
+  if (child == 0) {
+    guint64 sent;
+
+    close (fds[0]);
+    sent = bench_send (seconds);
+    if (write (fds[1], &sent, sizeof (sent)) < 0)
+      _exit (1);
+    _exit (0);
+  }
+  close (fds[1]);
+  *result = fds[0];
+  return child;
+}
+
+static guint64
+bench_sender_wait (pid_t child, gint result)
+{
+  guint64 sent = 0;
+
+  if (child > 0) {
+    if (read (result, &sent, sizeof (sent)) != sizeof (sent))
+      sent = 0;
+    waitpid (child, NULL, 0);
+  }
+  close (result);
+  return sent;
+}
+
+/* Remember the thread the source pushes from */
+static GstPadProbeReturn
+thread_probe (GstPad * pad, GstPadProbeInfo * info, gint * tid)
+{
+  if (g_atomic_int_get (tid) == 0)
+    g_atomic_int_set (tid, (gint) syscall (SYS_gettid));
+  return GST_PAD_PROBE_OK;
+}
+
+/* Tracing side of the system call count, run in a child process: once
+ * told to go, stop the thread at every system call for seconds and
+ * return how many it entered, G_MAXUINT64 if it could not be traced */
+static guint64
+bench_trace_thread (pid_t tid, gint go, gint seconds)
+{
+  gint64 end;
+  guint64 stops = 0;
+  gchar byte;
+  int status;
+
+  if (read (go, &byte, 1) != 1
+      || ptrace (PTRACE_SEIZE, tid, NULL, (void *) PTRACE_O_TRACESYSGOOD) < 0
+      || ptrace (PTRACE_INTERRUPT, tid, NULL, NULL) < 0)
+    return G_MAXUINT64;
+  end = g_get_monotonic_time () + seconds * G_USEC_PER_SEC;
+  while (waitpid (tid, &status, __WALL) == tid) {
+    gint sig = 0;
+
+    if (WIFEXITED (status) || WIFSIGNALED (status))
+      break;
+    /* Syscall stops come in pairs, at the entry and at the exit */
+    if (WSTOPSIG (status) == (SIGTRAP | 0x80))
+      stops++;
+    else if ((status >> 16) != PTRACE_EVENT_STOP)
+      sig = WSTOPSIG (status);
+    if (g_get_monotonic_time () >= end) {
+      ptrace (PTRACE_DETACH, tid, NULL, (void *) (glong) sig);
+      break;
+    }
+    ptrace (PTRACE_SYSCALL, tid, NULL, (void *) (glong) sig);
+  }
+  return (stops + 1) / 2;
+}
+
+/* System calls a udpsrc makes per packet, counted with ptrace on its
+ * streaming thread in a run of its own. udpsrc reads one datagram per
+ * call, so the count does not depend on how fast the thread runs. 0 when
+ * the thread can not be traced */
+static gdouble
+bench_trace_udpsrc ()
+{
+  GstElement *pipeline = gst_pipeline_new ("trace-bench");
+  GstElement *source = gst_element_factory_make ("udpsrc", NULL);
+  GstElement *sink = gst_element_factory_make ("fakesink", NULL);
+  guint64 received = 0, before, calls = G_MAXUINT64;
+  gint tid = 0, sent_fd, go[2], result[2];
+  pid_t sender, tracer;
+  GstPad *pad;
+
+  if (!pipeline || !source || !sink || pipe (go) < 0)
+    return 0.0;
+  if (pipe (result) < 0) {
+    close (go[0]);
+    close (go[1]);
+    return 0.0;
+  }
+  g_object_set (G_OBJECT (source), "port", BATCH_BENCH_PORT, "buffer-size",
+      RTP_RECV_BUFFER_SIZE, NULL);
+  g_object_set (G_OBJECT (sink), "sync", FALSE, "async", FALSE, NULL);
+  gst_bin_add_many (GST_BIN (pipeline), source, sink, NULL);
+  gst_element_link (source, sink);
+  pad = gst_element_get_static_pad (source, "src");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+      (GstPadProbeCallback) thread_probe, &tid, NULL);
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+      (GstPadProbeCallback) count_probe, &received, NULL);
+  gst_object_unref (pad);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  sender = bench_sender_start (BATCH_BENCH_TRACE_SECONDS + 1, &sent_fd);
+  for (gint i = 0; i < 1000 && g_atomic_int_get (&tid) == 0; i++)
+    g_usleep (1000);
+
+  tracer = g_atomic_int_get (&tid) != 0 ? fork () : -1;
+  if (tracer == 0) {
+    close (go[1]);
+    close (result[0]);
+    calls = bench_trace_thread (tid, go[0], BATCH_BENCH_TRACE_SECONDS);
+    if (write (result[1], &calls, sizeof (calls)) < 0)
+      _exit (1);
+    _exit (0);
+  }
+  close (go[0]);
+  close (result[1]);
+  before = received;
+  if (tracer > 0) {
+    /* Only the parent may trace a process where Yama is on */
+    prctl (PR_SET_PTRACER, tracer, 0, 0, 0);
+    if (write (go[1], "g", 1) != 1
+        || read (result[0], &calls, sizeof (calls)) != sizeof (calls))
+      calls = G_MAXUINT64;
+    waitpid (tracer, NULL, 0);
+  }
+  received -= before;
+  close (go[1]);
+  close (result[0]);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  bench_sender_wait (sender, sent_fd);
+  gst_object_unref (pipeline);
+  if (calls == G_MAXUINT64 || received == 0) {
+    g_printerr ("The udpsrc streaming thread could not be traced.\n");
+    return 0.0;
+  }
+  return calls / (gdouble) received;
+}
+
+/* Receive the flood through one source into a fakesink and print the
+ * packets per second it keeps up with and what each costs. A udpsrc does
+ * calls_per_packet system calls for every datagram */
+static void
+bench_run (const gchar * name, gint seconds, gdouble calls_per_packet)
+{
+  GstElement *pipeline = gst_pipeline_new ("receive-bench");
+  GstElement *source = gst_element_factory_make (name, NULL);
+  GstElement *sink = gst_element_factory_make ("fakesink", NULL);
+  guint64 received = 0, sent = 0;
+  gdouble cpu, syscalls;
+  GstMessage *msg;
+  GstBus *bus;
+  GstPad *pad;
+  gint result;
+  pid_t child;
+
+  if (!pipeline || !source || !sink) {
+    g_printerr ("Not all benchmark elements could be created.\n");
+    return;
+  }
+  g_object_set (G_OBJECT (source), "port", BATCH_BENCH_PORT, "buffer-size",
+      RTP_RECV_BUFFER_SIZE, NULL);
+  g_object_set (G_OBJECT (sink), "sync", FALSE, "async", FALSE, NULL);
+  gst_bin_add_many (GST_BIN (pipeline), source, sink, NULL);
+  if (!gst_element_link (source, sink)) {
+    g_printerr ("Benchmark pipeline not linked.\n");
+    gst_object_unref (pipeline);
+    return;
+  }
+  pad = gst_element_get_static_pad (sink, "sink");
+  gst_pad_add_probe (pad, (GstPadProbeType) (GST_PAD_PROBE_TYPE_BUFFER
+          | GST_PAD_PROBE_TYPE_BUFFER_LIST),
+      (GstPadProbeCallback) count_probe, &received, NULL);
+  gst_object_unref (pad);
+
+  /* The socket is bound once the pipeline is playing */
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  child = bench_sender_start (seconds, &result);
+  if (child < 0) {
+    gst_element_set_state (pipeline, GST_STATE_NULL);
+    gst_object_unref (pipeline);
+    return;
+  }
+
+  cpu = sysstat_cpu_seconds ();
+  bus = gst_element_get_bus (pipeline);
+  msg = gst_bus_timed_pop_filtered (bus, seconds * GST_SECOND,
+      GST_MESSAGE_ERROR);
+  cpu = sysstat_cpu_seconds () - cpu;
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  sent = bench_sender_wait (child, result);
+
+  if (msg != NULL) {
+    g_printerr ("Benchmark pipeline of %s failed.\n", name);
+    gst_message_unref (msg);
+  } else {
+    /* batchudpsrc counts its own calls */
+    syscalls = received * calls_per_packet;
+    if (GST_IS_BATCH_UDP_SRC (source)) {
+      guint64 calls;
+
+      g_object_get (G_OBJECT (source), "syscalls", &calls, NULL);
+      syscalls = calls;
+    }
+    g_print ("%-12s %12.0f %12.0f %7.1f%% %12.0f %10.2f\n", name,
+        sent / (gdouble) seconds, received / (gdouble) seconds,
+        sent ? 100.0 * (sent - MIN (received, sent)) / sent : 0.0,
+        syscalls / seconds, received ? cpu * 1e6 / received : 0.0);
+  }
+  gst_object_unref (bus);
+  gst_object_unref (pipeline);
+}
+
+/* Packets per second udpsrc and batchudpsrc receive from a flood over
+ * loopback, with the system calls and receiving CPU per packet */
+void
+batch_receive_benchmark (gint seconds)
+{
+  gdouble calls_per_packet;
+
+  gst_init (NULL, NULL);
+  batch_receive_enable (TRUE);
+  gst_object_unref (gst_object_ref_sink (batch_receive_make ()));
+
+  calls_per_packet = bench_trace_udpsrc ();
+  g_print ("Receiving %d byte datagrams over loopback for %d s, udpsrc "
+      "making %.2f system calls per datagram\n", BATCH_BENCH_PAYLOAD,
+      seconds, calls_per_packet);
+  g_print ("%-12s %12s %12s %8s %12s %10s\n", "source", "sent/s",
+      "received/s", "lost", "syscalls/s", "us/packet");
+  bench_run ("udpsrc", seconds, calls_per_packet);
+  bench_run ("batchudpsrc", seconds, 0.0);
+}
+
+/* Largest number of packets the source has pushed that the sink has not
+ * received yet, they are held in the jitterbuffer */
+typedef struct _BatchCheck {
+  GMutex lock;
+  guint64 pushed;
+  guint64 received;
+  guint64 held;
+} BatchCheck;
+
+static GstPadProbeReturn
+pushed_probe (GstPad * pad, GstPadProbeInfo * info, BatchCheck * check)
+{
+  g_mutex_lock (&check->lock);
+  count_probe (pad, info, &check->pushed);
+  g_mutex_unlock (&check->lock);
+  return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn
+received_probe (GstPad * pad, GstPadProbeInfo * info, BatchCheck * check)
+{
+  g_mutex_lock (&check->lock);
+  count_probe (pad, info, &check->received);
+  if (check->pushed > check->received)
+    check->held = MAX (check->held, check->pushed - check->received);
+  g_mutex_unlock (&check->lock);
+  return GST_PAD_PROBE_OK;
+}
+
+/* Send a live stream of BATCH_CHECK_PTIME_MS packets on loopback and
+ * receive it through a batchudpsrc and a jitterbuffer with the latency of
+ * the players for seconds. The jitterbuffer holds more packets than two
+ * batches, none must be lost while the source keeps reading. Returns
+ * whether none was */
+gboolean
+batch_receive_check (gint seconds)
+{
+  GstElement *sender, *pipeline, *source, *jitter, *sink, *pay;
+  guint64 lost = 0, pushed = 0;
+  BatchCheck check;
+  GstStructure *stats;
+  gboolean passed;
+  GstCaps *caps;
+  GstPad *pad;
+
+  gst_init (NULL, NULL);
+  memset (&check, 0, sizeof (check));
+  g_mutex_init (&check.lock);
+  sender = gst_parse_launch ("audiotestsrc is-live=true "
+      "samplesperbuffer=48 ! audio/x-raw,rate=48000,channels=2 ! "
+      "rtpL16pay name=pay ! udpsink host=127.0.0.1 port="
+      G_STRINGIFY (BATCH_CHECK_PORT) " sync=false async=false", NULL);
+  pipeline = gst_pipeline_new ("batch-check");
+  batch_receive_enable (TRUE);
+  source = batch_receive_make ();
+  jitter = gst_element_factory_make ("rtpjitterbuffer", NULL);
+  sink = gst_element_factory_make ("fakesink", NULL);
+  if (!sender || !pipeline || !source || !jitter || !sink) {
+    g_printerr ("Not all check elements could be created.\n");
+    return FALSE;
+  }
+  pay = gst_bin_get_by_name (GST_BIN (sender), "pay");
+  g_object_set (G_OBJECT (pay), "max-ptime",
+      (gint64) (BATCH_CHECK_PTIME_MS * GST_MSECOND), NULL);
+  gst_object_unref (pay);
+
+  caps = gst_caps_from_string ("application/x-rtp,media=audio,"
+      "clock-rate=48000,encoding-name=L16,channels=2,payload=96");
+  g_object_set (G_OBJECT (source), "port", BATCH_CHECK_PORT, "buffer-size",
+      RTP_RECV_BUFFER_SIZE, "caps", caps, NULL);
+  gst_caps_unref (caps);
+  g_object_set (G_OBJECT (jitter), "latency", NETCLOCK_LATENCY_MS, NULL);
+  g_object_set (G_OBJECT (sink), "sync", FALSE, "async", FALSE, NULL);
+  gst_bin_add_many (GST_BIN (pipeline), source, jitter, sink, NULL);
+  if (!gst_element_link_many (source, jitter, sink, NULL)) {
+    g_printerr ("Check pipeline not linked.\n");
+    gst_object_unref (pipeline);
+    gst_object_unref (sender);
+    return FALSE;
+  }
+  pad = gst_element_get_static_pad (source, "src");
+  gst_pad_add_probe (pad, (GstPadProbeType) (GST_PAD_PROBE_TYPE_BUFFER
+          | GST_PAD_PROBE_TYPE_BUFFER_LIST),
+      (GstPadProbeCallback) pushed_probe, &check, NULL);
+  gst_object_unref (pad);
+  pad = gst_element_get_static_pad (sink, "sink");
+  gst_pad_add_probe (pad, (GstPadProbeType) (GST_PAD_PROBE_TYPE_BUFFER
+          | GST_PAD_PROBE_TYPE_BUFFER_LIST),
+      (GstPadProbeCallback) received_probe, &check, NULL);
+  gst_object_unref (pad);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  gst_element_set_state (sender, GST_STATE_PLAYING);
+  g_usleep (seconds * G_USEC_PER_SEC);
+  gst_element_set_state (sender, GST_STATE_NULL);
+  g_object_get (G_OBJECT (jitter), "stats", &stats, NULL);
+  gst_structure_get_uint64 (stats, "num-lost", &lost);
+  gst_structure_get_uint64 (stats, "num-pushed", &pushed);
+  gst_structure_free (stats);
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+
+  passed = pushed > 0 && lost == 0
+      && check.held > 2 * (guint64) BATCH_DEFAULT_PACKETS;
+  g_print ("Batch receive check: %" G_GUINT64_FORMAT " packets through a "
+      "%d ms jitterbuffer, up to %" G_GUINT64_FORMAT " held, %"
+      G_GUINT64_FORMAT " lost: %s\n", pushed, NETCLOCK_LATENCY_MS,
+      check.held, lost, passed ? "PASS" : "FAIL");
+  gst_object_unref (pipeline);
+  gst_object_unref (sender);
+  g_mutex_clear (&check.lock);
+  return passed;
+}
@@ -0,0 +1,190 @@
+#include "control.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+
+/* Socket of the control connection to the server */
+static int control_socket = -1;
+
+/* Remember the connection the file extension was received on */
+void
+control_set_socket (int fd)
+{
+  control_socket = fd;
+}
+
+/* Send one command line to the server */
+void
+control_send (const gchar * command)
+{
+  gchar *line;
+
+  if (control_socket < 0)
+    return;
+  line = g_strdup_printf ("%s\n", command);
+  if (send (control_socket, line, strlen (line), MSG_NOSIGNAL) < 0)
+    perror ("control send");
+  g_free (line);
+}
+
+/* Watchdog timeout 0 disables the watchdog while the server is paused */
+static void
+set_watchdogs (ControlData * control, gboolean enable)
+{
+  if (control->video_watchdog)
+    g_object_set (G_OBJECT (control->video_watchdog), "timeout",
+        enable ? control->video_timeout : 0, NULL);
+  if (control->audio_watchdog)
+    g_object_set (G_OBJECT (control->audio_watchdog), "timeout",
+        enable ? control->audio_timeout : 0, NULL);
+}
+
+/* Give up a paused stream when the server stopped sending keepalives */
+static gboolean
+check_keepalive (ControlData * control)
+{
+  gint64 idle;
+
+  if (!control->paused)
+    return TRUE;
+
+  idle = g_get_monotonic_time () - control->last_keepalive;
+  if (idle > CONTROL_KEEPALIVE_TIMEOUT * G_USEC_PER_SEC) {
+    g_printerr ("\nNo keepalive from server for %d seconds.\n",
+        CONTROL_KEEPALIVE_TIMEOUT);
+    gst_element_set_state (control->pipeline, GST_STATE_NULL);
+    g_main_loop_quit (control->loop);
+    control->check_id = 0;
+    return FALSE;
+  }
+  return TRUE;
+}
+
+/* Print the time from the seek notification to the first rendered buffer */
+static GstPadProbeReturn
+first_frame_probe (GstPad * pad, GstPadProbeInfo * info,
+    ControlData * control)
+{
+  g_print ("\nSeek to first frame : %" G_GINT64_FORMAT " ms\n",
+      (g_get_monotonic_time () - control->seek_start) / 1000);
+  control->seek_probe = 0;
+  return GST_PAD_PROBE_REMOVE;
+}
+
+/* Drop everything buffered from before the seek, the server sends a new
+ * keyframe right after it */
+static void
+handle_seek (ControlData * control, const gchar * args)
+{
+  GstPad *sinkpad;
+
+  g_print ("\nServer seeked:%s\n", args);
+  control->seek_start = g_get_monotonic_time ();
+  gst_element_send_event (control->pipeline, gst_event_new_flush_start ());
+  gst_element_send_event (control->pipeline, gst_event_new_flush_stop (FALSE));
+
+  if (control->sink == NULL)
+    return;
+  sinkpad = gst_element_get_static_pad (control->sink, "sink");
+  if (control->seek_probe != 0)
+    gst_pad_remove_probe (sinkpad, control->seek_probe);
+  control->seek_probe = gst_pad_add_probe (sinkpad, GST_PAD_PROBE_TYPE_BUFFER,
+      (GstPadProbeCallback) first_frame_probe, control, NULL);
+  gst_object_unref (sinkpad);
+}
+
+/* Handle one command line sent by the server */
+static void
+handle_command (ControlData * control, const gchar * command)
+{
+  control->last_keepalive = g_get_monotonic_time ();
+
+  if (g_strcmp0 (command, CONTROL_PAUSE) == 0) {
+    /* Keep the decoder state and the last frame on screen */
+    g_print ("\nServer paused the stream.\n");
+    control->paused = TRUE;
+    set_watchdogs (control, FALSE);
+    gst_element_set_state (control->pipeline, GST_STATE_PAUSED);
+  } else if (g_strcmp0 (command, CONTROL_RESUME) == 0) {
+    g_print ("\nServer resumed the stream.\n");
+    control->paused = FALSE;
+    gst_element_set_state (control->pipeline, GST_STATE_PLAYING);
+    set_watchdogs (control, TRUE);
+  } else if (g_str_has_prefix (command, CONTROL_SEEK)) {
+    handle_seek (control, command + strlen (CONTROL_SEEK));
+  } else if (g_strcmp0 (command, CONTROL_KEEPALIVE) != 0) {
+    g_printerr ("Unknown control command '%s'\n", command);
+  }
+}
+
+/* Read the commands that arrived on the control connection */
+static gboolean
+control_callback (GIOChannel * source, GIOCondition cond,
+    ControlData * control)
+{
+  gchar *line = NULL;
+  GIOStatus status;
+
+  if (cond & (G_IO_HUP | G_IO_ERR)) {
+    control->watch_id = 0;
+    return FALSE;
+  }
+
+  status = g_io_channel_read_line (source, &line, NULL, NULL, NULL);
+  if (status == G_IO_STATUS_EOF || status == G_IO_STATUS_ERROR) {
+    control->watch_id = 0;
+    return FALSE;
+  }
+  if (line != NULL) {
+    g_strstrip (line);
+    handle_command (control, line);
+    g_free (line);
+  }
+  return TRUE;
+}
+
+/* Start listening for server commands for the given pipeline */
+void
+control_attach (ControlData * control)
+{
+  if (control_socket < 0)
+    return;
+
+  /* Remember the configured watchdog timeouts for resuming */
+  if (control->video_watchdog)
+    g_object_get (G_OBJECT (control->video_watchdog), "timeout",
+        &control->video_timeout, NULL);
+  if (control->audio_watchdog)
+    g_object_get (G_OBJECT (control->audio_watchdog), "timeout",
+        &control->audio_timeout, NULL);
+
+  control->last_keepalive = g_get_monotonic_time ();
+  control->channel = g_io_channel_unix_new (control_socket);
+  g_io_channel_set_encoding (control->channel, NULL, NULL);
+  control->watch_id = g_io_add_watch (control->channel,
+      (GIOCondition) (G_IO_IN | G_IO_HUP | G_IO_ERR),
+      (GIOFunc) control_callback, control);
+  control->check_id = g_timeout_add_seconds (1,
+      (GSourceFunc) check_keepalive, control);
+}
+
+/* Stop listening for server commands */
+void
+control_detach (ControlData * control)
+{
+  if (control->watch_id != 0)
+    g_source_remove (control->watch_id);
+  if (control->check_id != 0)
+    g_source_remove (control->check_id);
+  if (control->channel != NULL)
+    g_io_channel_unref (control->channel);
+  if (control->seek_probe != 0) {
+    GstPad *sinkpad = gst_element_get_static_pad (control->sink, "sink");
+    gst_pad_remove_probe (sinkpad, control->seek_probe);
+    gst_object_unref (sinkpad);
+  }
+  control->watch_id = 0;
+  control->check_id = 0;
+  control->channel = NULL;
+  control->seek_probe = 0;
+}
@@ -0,0 +1,223 @@
+#include "clientheader.h"
+#include <gst/video/video.h>
+#include <gst/base/gstbasesrc.h>
+
+/* Budget of the client pipelines started from now on, in MiB */
+static gint default_budget_mb = MEMBUDGET_DEFAULT_MB;
+
+void
+membudget_set_default (gint budget_mb)
+{
+  default_budget_mb = MAX (budget_mb, 0);
+}
+
+/* Collect the queues and the video decoders of the pipeline and note a
+ * live source */
+static void
+collect_element (const GValue * item, MemBudget * budget)
+{
+  GstElement *element = GST_ELEMENT (g_value_get_object (item));
+  GstElementFactory *factory = gst_element_get_factory (element);
+  const gchar *name = factory != NULL
+      ? gst_plugin_feature_get_name (GST_PLUGIN_FEATURE (factory)) : NULL;
+
+  if (g_strcmp0 (name, "queue") == 0)
+    g_ptr_array_add (budget->queues, gst_object_ref (element));
+  else if (GST_IS_VIDEO_DECODER (element))
+    g_ptr_array_add (budget->decoders, gst_object_ref (element));
+  else if (GST_IS_BASE_SRC (element)
+      && gst_base_src_is_live (GST_BASE_SRC (element)))
+    budget->live = TRUE;
+}
+
+/* Count the packets and bytes going into a jitterbuffer */
+static GstPadProbeReturn
+receive_probe (GstPad * pad, GstPadProbeInfo * info, MemBudgetJitter * jitter)
+{
+  guint packets = 1;
+  gsize bytes;
+
+  if (info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+    GstBufferList *list = GST_PAD_PROBE_INFO_BUFFER_LIST (info);
+
+    packets = gst_buffer_list_length (list);
+    bytes = gst_buffer_list_calculate_size (list);
+  } else {
+    bytes = gst_buffer_get_size (GST_PAD_PROBE_INFO_BUFFER (info));
+  }
+  g_mutex_lock (&jitter->budget->lock);
+  jitter->packets += packets;
+  jitter->bytes += bytes;
+  g_mutex_unlock (&jitter->budget->lock);
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+jitter_free (MemBudgetJitter * jitter)
+{
+  gst_object_unref (jitter->jitterbuffer);
+  g_free (jitter);
+}
+
+/* rtpbin made the jitterbuffer of a new SSRC, account it from now on */
+static void
+new_jitterbuffer (GstElement * rtpbin, GstElement * jitterbuffer,
+    guint session, guint ssrc, MemBudget * budget)
+{
+  MemBudgetJitter *jitter = g_new0 (MemBudgetJitter, 1);
+  GstPad *sinkpad = gst_element_get_static_pad (jitterbuffer, "sink");
+
+  jitter->budget = budget;
+  jitter->jitterbuffer = (GstElement *) gst_object_ref (jitterbuffer);
+  g_mutex_lock (&budget->lock);
+  g_ptr_array_add (budget->jitterbuffers, jitter);
+  g_mutex_unlock (&budget->lock);
+  if (sinkpad == NULL)
+    return;
+  gst_pad_add_probe (sinkpad, (GstPadProbeType) (GST_PAD_PROBE_TYPE_BUFFER
+          | GST_PAD_PROBE_TYPE_BUFFER_LIST),
+      (GstPadProbeCallback) receive_probe, jitter, NULL);
+  gst_object_unref (sinkpad);
+}
+
+/* Mean size of the packets a jitterbuffer received times those it still
+ * holds. Called with the lock of the budget */
+static gsize
+jitter_bytes (MemBudgetJitter * jitter)
+{
+  GstStructure *stats = NULL;
+  guint64 pushed = 0, late = 0, duplicates = 0, gone;
+
+  g_object_get (G_OBJECT (jitter->jitterbuffer), "stats", &stats, NULL);
+  if (stats != NULL) {
+    gst_structure_get_uint64 (stats, "num-pushed", &pushed);
+    gst_structure_get_uint64 (stats, "num-late", &late);
+    gst_structure_get_uint64 (stats, "num-duplicates", &duplicates);
+    gst_structure_free (stats);
+  }
+  gone = pushed + late + duplicates;
+  if (jitter->packets <= gone)
+    return 0;
+  return (jitter->packets - gone) * jitter->bytes / jitter->packets;
+}
+
+/* Frame size times the buffers the pool of the decoder keeps allocated */
+static gsize
+decoder_pool_bytes (GstElement * decoder)
+{
+  GstBufferPool *pool =
+      gst_video_decoder_get_buffer_pool (GST_VIDEO_DECODER (decoder));
+  GstStructure *config;
+  guint size = 0, min = 0, max = 0;
+
+  if (pool == NULL)
+    return 0;
+  config = gst_buffer_pool_get_config (pool);
+  gst_buffer_pool_config_get_params (config, NULL, &size, &min, &max);
+  gst_structure_free (config);
+  gst_object_unref (pool);
+  return (gsize) size * min;
+}
+
+/* Sum what the queues, jitterbuffers and pools hold and keep the peak */
+static gboolean
+sample_cb (MemBudget * budget)
+{
+  gsize queues = 0, jitter = 0, pools = 0;
+
+  for (guint i = 0; i < budget->queues->len; i++) {
+    guint level = 0;
+
+    g_object_get (g_ptr_array_index (budget->queues, i),
+        "current-level-bytes", &level, NULL);
+    queues += level;
+  }
+  g_mutex_lock (&budget->lock);
+  for (guint i = 0; i < budget->jitterbuffers->len; i++)
+    jitter += jitter_bytes ((MemBudgetJitter *)
+        g_ptr_array_index (budget->jitterbuffers, i));
+  g_mutex_unlock (&budget->lock);
+  for (guint i = 0; i < budget->decoders->len; i++)
+    pools += decoder_pool_bytes ((GstElement *)
+        g_ptr_array_index (budget->decoders, i));
+
+  if (queues + jitter + pools > budget->peak) {
+    budget->peak = queues + jitter + pools;
+    budget->peak_queues = queues;
+    budget->peak_jitter = jitter;
+    budget->peak_pools = pools;
+  }
+  return G_SOURCE_CONTINUE;
+}
+
+/* The pipeline is gone, report its peak */
+static void
+budget_report (MemBudget * budget, GObject * pipeline)
+{
+  g_source_remove (budget->source);
+  g_print ("\nPeak memory %.1f MiB (queues %.1f, jitterbuffers %.1f, "
+      "pools %.1f)", budget->peak / 1048576.0,
+      budget->peak_queues / 1048576.0, budget->peak_jitter / 1048576.0,
+      budget->peak_pools / 1048576.0);
+  if (budget->budget_mb > 0)
+    g_print (" of %d MiB\n", budget->budget_mb);
+  else
+    g_print ("\n");
+  g_ptr_array_unref (budget->queues);
+  g_ptr_array_unref (budget->jitterbuffers);
+  g_ptr_array_unref (budget->decoders);
+  g_mutex_clear (&budget->lock);
+  g_free (budget);
+}
+
+/* Bound the queues of the pipeline by the budget, leaky when a source is
+ * live as the packets would be lost in the socket otherwise, and sample
+ * the memory they, the jitterbuffers of its rtpbin and the decoder pools
+ * hold while the pipeline exists */
+void
+membudget_attach (GstElement * pipeline)
+{
+  MemBudget *budget = g_new0 (MemBudget, 1);
+  GstIterator *iter = gst_bin_iterate_recurse (GST_BIN (pipeline));
+  GstElement *rtpbin = gst_bin_get_by_name (GST_BIN (pipeline), "rtpbin");
+  gint total = MEMBUDGET_POOL_WEIGHT;
+
+  g_mutex_init (&budget->lock);
+  budget->budget_mb = default_budget_mb;
+  budget->queues = g_ptr_array_new_with_free_func (gst_object_unref);
+  budget->jitterbuffers =
+      g_ptr_array_new_with_free_func ((GDestroyNotify) jitter_free);
+  budget->decoders = g_ptr_array_new_with_free_func (gst_object_unref);
+  while (gst_iterator_foreach (iter, (GstIteratorForeachFunction)
+          collect_element, budget) == GST_ITERATOR_RESYNC) {
+    g_ptr_array_set_size (budget->queues, 0);
+    g_ptr_array_set_size (budget->decoders, 0);
+    budget->live = FALSE;
+    gst_iterator_resync (iter);
+  }
+  gst_iterator_free (iter);
+
+  /* The jitterbuffers come with the SSRCs */
+  if (rtpbin != NULL) {
+    g_signal_connect (rtpbin, "new-jitterbuffer",
+        G_CALLBACK (new_jitterbuffer), budget);
+    total += MEMBUDGET_JITTER_WEIGHT;
+    gst_object_unref (rtpbin);
+  }
+  total += budget->queues->len;
+  for (guint i = 0; budget->budget_mb > 0 && i < budget->queues->len; i++) {
+    GstElement *queue = (GstElement *) g_ptr_array_index (budget->queues, i);
+    gsize bytes = ((gsize) budget->budget_mb << 20) / total;
+
+    g_object_set (G_OBJECT (queue), "max-size-bytes",
+        (guint) MIN (MAX (bytes, (gsize) MEMBUDGET_MIN_QUEUE), G_MAXUINT),
+        NULL);
+    if (budget->live)
+      g_object_set (G_OBJECT (queue), "leaky", 2, NULL);
+  }
+
+  budget->source = g_timeout_add (MEMBUDGET_SAMPLE_MS,
+      (GSourceFunc) sample_cb, budget);
+  g_object_weak_ref (G_OBJECT (pipeline), (GWeakNotify) budget_report,
+      budget);
+}
@@ -0,0 +1,78 @@
+#include "clientheader.h"
+#include "control.h"
+#include <gst/net/net.h>
+
+/* Seconds to wait for the first synchronisation with the server clock */
+#define NETCLOCK_SYNC_TIMEOUT 5
+
+/* Clock of the server, NULL when it could not be reached */
+static GstClock *net_clock = NULL;
+
+/* Pipeline running on the network clock, for the render reports */
+static GstElement *net_pipeline = NULL;
+
+/* Slave the jitterbuffers of the pipeline to the server clock */
+static void
+configure_rtpbin (GstElement * pipeline)
+{
+  GstElement *rtpbin = gst_bin_get_by_name (GST_BIN (pipeline), "rtpbin");
+
+  if (rtpbin == NULL)
+    return;
+  /* Buffer mode 4 (synced) plays the RTP timestamps as mapped to the
+   * server clock by the sender reports */
+  g_object_set (G_OBJECT (rtpbin), "ntp-sync", TRUE, "ntp-time-source", 3,
+      "buffer-mode", 4, "latency", NETCLOCK_LATENCY_MS, NULL);
+  gst_object_unref (rtpbin);
+}
+
+/* Run the pipeline on the clock published by the server with the same
+ * fixed latency on every client, so all clients render a frame together */
+void
+netclock_use (GstElement * pipeline)
+{
+  if (net_clock == NULL) {
+    net_clock = gst_net_client_clock_new ("net_clock", SERVER_ADDRESS,
+        NETCLOCK_PORT, 0);
+    g_print ("Synchronising with the server clock...\n");
+    if (!gst_clock_wait_for_sync (net_clock,
+            NETCLOCK_SYNC_TIMEOUT * GST_SECOND)) {
+      g_printerr ("Could not synchronise with the server clock, "
+          "playing on the local clock.\n");
+      gst_object_unref (net_clock);
+      net_clock = NULL;
+      return;
+    }
+  }
+
+  gst_pipeline_use_clock (GST_PIPELINE (pipeline), net_clock);
+  gst_pipeline_set_latency (GST_PIPELINE (pipeline),
+      NETCLOCK_LATENCY_MS * GST_MSECOND);
+  configure_rtpbin (pipeline);
+  net_pipeline = pipeline;
+}
+
+/* Stop reporting for the pipeline */
+void
+netclock_release (GstElement * pipeline)
+{
+  if (net_pipeline == pipeline)
+    net_pipeline = NULL;
+}
+
+/* Tell the server at which time of the shared clock a marked frame with
+ * the given running time was rendered */
+void
+netclock_report_render (GstClockTime running_time)
+{
+  GstClockTime time;
+  gchar *command;
+
+  if (net_pipeline == NULL || !GST_CLOCK_TIME_IS_VALID (running_time))
+    return;
+  time = gst_element_get_base_time (net_pipeline) + running_time
+      + gst_pipeline_get_latency (GST_PIPELINE (net_pipeline));
+  command = g_strdup_printf ("%s %" G_GUINT64_FORMAT, CONTROL_RENDER, time);
+  control_send (command);
+  g_free (command);
+}
@@ -1,6 +1,8 @@
 #include "clientheader.h"
 #include "probe.h"
 #include "msghandler.h"
+#include "control.h"
+#include "batchsrc.h"
 
 int
 remotehost_WebM_pipeline (int argc, char *argv[])
@@ -11,10 +13,13 @@ remotehost_WebM_pipeline (int argc, char *argv[])
   GstCaps *audio_caps = NULL;
   GstCaps *video_caps = NULL;
   CustomData data;
+  ControlData control;
+  const VideoCodec *codec = video_codec_find (argc, argv, "vp8");
 
   /* Initialize RemoteHost structure */
   memset (&remote_host, 0, sizeof (remote_host));
   memset (&data, 0, sizeof (data));
+  memset (&control, 0, sizeof (control));
 
 
   /* Initialize gstreamer */
@@ -22,20 +27,17 @@ remotehost_WebM_pipeline (int argc, char *argv[])
 
   /* Initialize gstremer elements */
   remote_host.pipeline = gst_pipeline_new ("Remote-host-Avi");
-  remote_host.udp_video_source = gst_element_factory_make ("udpsrc", NULL);
+  remote_host.udp_video_source = batch_receive_make ();
   remote_host.video_watchdog = gst_element_factory_make ("watchdog", NULL);
-  remote_host.video_rtp_buffer =
-      gst_element_factory_make ("rtpjitterbuffer", NULL);
-  remote_host.video_rtp_depay = gst_element_factory_make ("rtpvp8depay", NULL);
+  remote_host.video_rtp_depay =
+      gst_element_factory_make (codec->depayloader, NULL);
   remote_host.video_queue = gst_element_factory_make ("queue", NULL);
-  remote_host.video_decoder = gst_element_factory_make ("vp8dec", NULL);
+  remote_host.video_decoder = video_codec_make_decoder (codec);
   remote_host.video_convert = gst_element_factory_make ("videoconvert", NULL);
   remote_host.video_sink = gst_element_factory_make ("autovideosink", "vsink");
 
-  remote_host.udp_audio_source = gst_element_factory_make ("udpsrc", NULL);
+  remote_host.udp_audio_source = batch_receive_make ();
   remote_host.audio_watchdog = gst_element_factory_make ("watchdog", NULL);
-  remote_host.audio_rtp_buffer =
-      gst_element_factory_make ("rtpjitterbuffer", NULL);
   remote_host.audio_rtp_depay = gst_element_factory_make ("rtpopusdepay", NULL);
   remote_host.audio_decoder = gst_element_factory_make ("opusdec", NULL);
   remote_host.audio_queue = gst_element_factory_make ("queue", NULL);
@@ -44,12 +46,12 @@ remotehost_WebM_pipeline (int argc, char *argv[])
 
   /* Check if the elements are created */
   if (!remote_host.pipeline || !remote_host.udp_video_source
-      || !remote_host.video_rtp_depay || !remote_host.video_rtp_buffer
-      || !remote_host.video_watchdog || !remote_host.video_decoder
+      || !remote_host.video_rtp_depay || !remote_host.video_watchdog
+      || !remote_host.video_decoder
       || !remote_host.video_queue || !remote_host.video_convert
       || !remote_host.video_sink || !remote_host.audio_watchdog
-      || !remote_host.udp_audio_source || !remote_host.audio_rtp_buffer
-      || !remote_host.audio_rtp_depay || !remote_host.audio_decoder
+      || !remote_host.udp_audio_source || !remote_host.audio_rtp_depay
+      || !remote_host.audio_decoder
       || !remote_host.audio_queue || !remote_host.audio_convert
       || !remote_host.audio_sink) {
     g_printerr ("Not all video elements could be created.\n");
@@ -58,56 +60,61 @@ remotehost_WebM_pipeline (int argc, char *argv[])
 
   /* Add elements to bin */
   gst_bin_add_many (GST_BIN (remote_host.pipeline),
-      remote_host.udp_video_source, remote_host.video_rtp_buffer,
-      remote_host.video_rtp_depay, remote_host.video_watchdog,
+      remote_host.udp_video_source, remote_host.video_rtp_depay,
+      remote_host.video_watchdog,
       remote_host.video_decoder, remote_host.video_queue,
       remote_host.video_convert, remote_host.video_sink,
       remote_host.audio_watchdog, remote_host.udp_audio_source,
-      remote_host.audio_rtp_buffer, remote_host.audio_rtp_depay,
+      remote_host.audio_rtp_depay,
       remote_host.audio_decoder, remote_host.audio_queue,
       remote_host.audio_convert, remote_host.audio_sink, NULL);
 
   /* Set the video Capability */
   video_caps = gst_caps_new_simple ("application/x-rtp",
       "media", G_TYPE_STRING, "video",
-      "encoding-name", G_TYPE_STRING, "VP8",
+      "encoding-name", G_TYPE_STRING, codec->encoding_name,
       "clock-rate", G_TYPE_INT, 90000, NULL);
 
   /* Set the video element properties */
   g_object_set (G_OBJECT (remote_host.udp_video_source), "caps", video_caps,
-      "port", 5000, NULL);
+      "port", rtp_session_port (RTP_SESSION_VIDEO), NULL);
   /* Set the video watchdog property */
   g_object_set (G_OBJECT (remote_host.video_watchdog), "timeout", 10000, NULL);
 
   /* Set the audio Capability */
   audio_caps = gst_caps_new_simple ("application/x-rtp",
       "media", G_TYPE_STRING, "audio",
-      "encoding-name", G_TYPE_STRING, "OPUS", "payload", G_TYPE_INT, 96, NULL);
+      "encoding-name", G_TYPE_STRING, "OPUS", "payload", G_TYPE_INT, 96,
+      "clock-rate", G_TYPE_INT, 48000, NULL);
 
   /* Set the audio element properties */
   g_object_set (G_OBJECT (remote_host.udp_audio_source), "caps", audio_caps,
-      "port", 5001, NULL);
+      "port", rtp_session_port (RTP_SESSION_AUDIO), NULL);
   /* Set the audio watchdog property */
   g_object_set (G_OBJECT (remote_host.audio_watchdog), "timeout", 10000, NULL);
 
 
-  /* Link the video elements */
+  /* Link the video elements, rtpbin sits between watchdog and depayloader */
   if (gst_element_link_many (remote_host.udp_video_source,
-          remote_host.video_watchdog, remote_host.video_rtp_buffer,
-          remote_host.video_rtp_depay, remote_host.video_queue,
-          remote_host.video_decoder, remote_host.video_convert,
-          remote_host.video_sink, NULL) != TRUE) {
+          remote_host.video_watchdog, NULL) != TRUE
+      || rtp_session_add (remote_host.pipeline, remote_host.video_watchdog,
+          remote_host.video_rtp_depay, RTP_SESSION_VIDEO) != TRUE
+      || gst_element_link_many (remote_host.video_rtp_depay,
+          remote_host.video_queue, remote_host.video_decoder,
+          remote_host.video_convert, remote_host.video_sink, NULL) != TRUE) {
     g_printerr ("Video elements not linked.\n");
     exit (EXIT_FAILURE);
   }
 
 
-  /* Link the audio elements */
+  /* Link the audio elements, rtpbin sits between watchdog and depayloader */
   if (gst_element_link_many (remote_host.udp_audio_source,
-          remote_host.audio_watchdog, remote_host.audio_rtp_buffer,
-          remote_host.audio_rtp_depay, remote_host.audio_queue,
-          remote_host.audio_decoder, remote_host.audio_convert,
-          remote_host.audio_sink, NULL) != TRUE) {
+          remote_host.audio_watchdog, NULL) != TRUE
+      || rtp_session_add (remote_host.pipeline, remote_host.audio_watchdog,
+          remote_host.audio_rtp_depay, RTP_SESSION_AUDIO) != TRUE
+      || gst_element_link_many (remote_host.audio_rtp_depay,
+          remote_host.audio_queue, remote_host.audio_decoder,
+          remote_host.audio_convert, remote_host.audio_sink, NULL) != TRUE) {
     g_printerr ("Audio elements not linked.\n");
     exit (EXIT_FAILURE);
   }
@@ -125,6 +132,12 @@ remotehost_WebM_pipeline (int argc, char *argv[])
   gst_pad_add_probe (sinkpad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
       probe_callback, NULL, NULL);
 
+  /* Play in step with the other clients on the server clock */
+  netclock_use (remote_host.pipeline);
+
+  /* Bound the queues by the memory budget and account the pipeline */
+  membudget_attach (remote_host.pipeline);
+
   /* Set the pipeline to playing state */
   ret = gst_element_set_state (remote_host.pipeline, GST_STATE_PLAYING);
   if (ret == GST_STATE_CHANGE_FAILURE) {
@@ -144,8 +157,18 @@ remotehost_WebM_pipeline (int argc, char *argv[])
   /* Connect signal messages that came from bus */
   g_signal_connect (bus, "message", G_CALLBACK (callback_message), &data);
 
+  /* Listen for pause/resume commands from the server */
+  control.pipeline = remote_host.pipeline;
+  control.video_watchdog = remote_host.video_watchdog;
+  control.audio_watchdog = remote_host.audio_watchdog;
+  control.sink = remote_host.video_sink;
+  control.loop = remote_host.loop;
+  control_attach (&control);
+
   /* Start the Main event loop */
   g_main_loop_run (remote_host.loop);
+  control_detach (&control);
+  netclock_release (remote_host.pipeline);
 
   /* Unrefrence the pipeline */
   gst_element_set_state (remote_host.pipeline, GST_STATE_NULL);
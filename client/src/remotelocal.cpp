@@ -0,0 +1,248 @@
+#include "clientheader.h"
+#include "probe.h"
+#include "msghandler.h"
+#include "control.h"
+
+/* Wait for the server to open a shmsink socket */
+static gboolean
+wait_for_socket (const gchar * path, gint timeout_ms)
+{
+  gint64 end = g_get_monotonic_time () + timeout_ms * G_GINT64_CONSTANT (1000);
+
+  while (!g_file_test (path, G_FILE_TEST_EXISTS)) {
+    if (g_get_monotonic_time () >= end)
+      return FALSE;
+    g_usleep (50000);
+  }
+  return TRUE;
+}
+
+/* The server running time of the first buffer of either stream becomes
+ * the running time it arrived at here. Both streams get the same offset,
+ * so they stay in step as the server sent them */
+static GstPadProbeReturn
+offset_probe (GstPad * pad, GstPadProbeInfo * info, RemoteLocal * local)
+{
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  GstEvent *event = gst_pad_get_sticky_event (pad, GST_EVENT_SEGMENT, 0);
+  GstClock *clock = gst_element_get_clock (local->pipeline);
+  const GstSegment *segment;
+  guint64 running_time = GST_CLOCK_TIME_NONE;
+
+  if (event != NULL && GST_BUFFER_PTS_IS_VALID (buffer)) {
+    gst_event_parse_segment (event, &segment);
+    running_time = gst_segment_to_running_time (segment, GST_FORMAT_TIME,
+        GST_BUFFER_PTS (buffer));
+  }
+  if (event != NULL)
+    gst_event_unref (event);
+  if (clock == NULL || !GST_CLOCK_TIME_IS_VALID (running_time)) {
+    if (clock != NULL)
+      gst_object_unref (clock);
+    return GST_PAD_PROBE_OK;
+  }
+
+  g_mutex_lock (&local->lock);
+  if (!local->offset_set) {
+    GstClockTime now = gst_clock_get_time (clock)
+        - gst_element_get_base_time (local->pipeline);
+    local->offset = (gint64) now - (gint64) running_time;
+    local->offset_set = TRUE;
+  }
+  gst_pad_set_offset (pad, local->offset);
+  g_mutex_unlock (&local->lock);
+  gst_object_unref (clock);
+  return GST_PAD_PROBE_REMOVE;
+}
+
+/* Link a decoded stream to the branch of its media type */
+static void
+decoder_pad_added (GstElement * decoder, GstPad * pad, RemoteLocal * local)
+{
+  GstCaps *caps = gst_pad_get_current_caps (pad);
+  const gchar *name;
+  GstElement *queue = NULL;
+  GstPad *sinkpad;
+
+  if (caps == NULL)
+    caps = gst_pad_query_caps (pad, NULL);
+  name = gst_structure_get_name (gst_caps_get_structure (caps, 0));
+  if (g_str_has_prefix (name, "video/"))
+    queue = local->video_queue;
+  else if (g_str_has_prefix (name, "audio/"))
+    queue = local->audio_queue;
+  gst_caps_unref (caps);
+  if (queue == NULL)
+    return;
+
+  sinkpad = gst_element_get_static_pad (queue, "sink");
+  if (!gst_pad_is_linked (sinkpad)
+      && GST_PAD_LINK_FAILED (gst_pad_link (pad, sinkpad)))
+    g_printerr ("Local %s stream not linked.\n", name);
+  gst_object_unref (sinkpad);
+}
+
+/* The first video buffer came through shared memory: tell the server,
+ * which then stops sending this host the RTP of the stream */
+static GstPadProbeReturn
+confirm_probe (GstPad * pad, GstPadProbeInfo * info, const gchar * prefix)
+{
+  gchar *command = g_strdup_printf ("%s %s", CONTROL_LOCAL, prefix);
+
+  control_send (command);
+  g_free (command);
+  return GST_PAD_PROBE_REMOVE;
+}
+
+/* shmsrc ! gdpdepay ! watchdog ! decodebin for the socket of one RTP
+ * session, the decoded stream goes on from queue */
+static gboolean
+add_stream (RemoteLocal * local, const gchar * path, GstElement ** source,
+    GstElement ** depay, GstElement ** watchdog, GstElement ** decoder)
+{
+  GstPad *pad;
+
+  *source = gst_element_factory_make ("shmsrc", NULL);
+  *depay = gst_element_factory_make ("gdpdepay", NULL);
+  *watchdog = gst_element_factory_make ("watchdog", NULL);
+  *decoder = gst_element_factory_make ("decodebin", NULL);
+  if (!*source || !*depay || !*watchdog || !*decoder) {
+    g_printerr ("Not all local elements could be created.\n");
+    return FALSE;
+  }
+  g_object_set (G_OBJECT (*source), "socket-path", path, "is-live", TRUE,
+      NULL);
+  g_object_set (G_OBJECT (*watchdog), "timeout", 10000, NULL);
+  gst_bin_add_many (GST_BIN (local->pipeline), *source, *depay, *watchdog,
+      *decoder, NULL);
+  g_signal_connect (*decoder, "pad-added", G_CALLBACK (decoder_pad_added),
+      local);
+
+  pad = gst_element_get_static_pad (*depay, "src");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+      (GstPadProbeCallback) offset_probe, local, NULL);
+  gst_object_unref (pad);
+  return gst_element_link_many (*source, *depay, *watchdog, *decoder, NULL);
+}
+
+/* Play the encoded streams a server on this host writes to the shared
+ * memory sockets starting with prefix, decoded without RTP. Returns -1
+ * when the server did not open the video socket, the stream is then
+ * played over the network */
+int
+remotehost_local_pipeline (const gchar * prefix)
+{
+  RemoteLocal local;
+  CustomData data;
+  ControlData control;
+  gchar *video_path = g_strdup_printf ("%s-%u", prefix, RTP_SESSION_VIDEO);
+  gchar *audio_path = g_strdup_printf ("%s-%u", prefix, RTP_SESSION_AUDIO);
+  gboolean audio, linked;
+  GstStateChangeReturn ret;
+  GstBus *bus;
+  GstPad *sinkpad;
+
+  memset (&local, 0, sizeof (local));
+  memset (&data, 0, sizeof (data));
+  memset (&control, 0, sizeof (control));
+
+  if (!wait_for_socket (video_path, LOCAL_CONNECT_TIMEOUT * 1000)) {
+    g_printerr ("No local stream on %s, playing over the network.\n",
+        video_path);
+    g_free (video_path);
+    g_free (audio_path);
+    return -1;
+  }
+  audio = wait_for_socket (audio_path, LOCAL_AUDIO_WAIT_MS);
+  g_print ("Playing from shared memory %s%s\n", video_path,
+      audio ? " with audio" : "");
+
+  gst_init (NULL, NULL);
+  g_mutex_init (&local.lock);
+  local.pipeline = gst_pipeline_new ("Remote-host-local");
+  local.video_queue = gst_element_factory_make ("queue", NULL);
+  local.video_convert = gst_element_factory_make ("videoconvert", NULL);
+  local.video_sink = gst_element_factory_make ("autovideosink", "vsink");
+  if (!local.pipeline || !local.video_queue || !local.video_convert
+      || !local.video_sink) {
+    g_printerr ("Not all video elements could be created.\n");
+    exit (EXIT_FAILURE);
+  }
+  gst_bin_add_many (GST_BIN (local.pipeline), local.video_queue,
+      local.video_convert, local.video_sink, NULL);
+  linked = add_stream (&local, video_path, &local.video_source,
+      &local.video_depay, &local.video_watchdog, &local.video_decoder)
+      && gst_element_link_many (local.video_queue, local.video_convert,
+      local.video_sink, NULL);
+
+  if (audio) {
+    local.audio_queue = gst_element_factory_make ("queue", NULL);
+    local.audio_convert = gst_element_factory_make ("audioconvert", NULL);
+    local.audio_resample = gst_element_factory_make ("audioresample", NULL);
+    local.audio_sink = gst_element_factory_make ("autoaudiosink", "asink");
+    if (!local.audio_queue || !local.audio_convert || !local.audio_resample
+        || !local.audio_sink) {
+      g_printerr ("Not all audio elements could be created.\n");
+      exit (EXIT_FAILURE);
+    }
+    gst_bin_add_many (GST_BIN (local.pipeline), local.audio_queue,
+        local.audio_convert, local.audio_resample, local.audio_sink, NULL);
+    linked = linked && add_stream (&local, audio_path, &local.audio_source,
+        &local.audio_depay, &local.audio_watchdog, &local.audio_decoder)
+        && gst_element_link_many (local.audio_queue, local.audio_convert,
+        local.audio_resample, local.audio_sink, NULL);
+  }
+  if (!linked) {
+    g_printerr ("Local elements not linked.\n");
+    exit (EXIT_FAILURE);
+  }
+
+  sinkpad = gst_element_get_static_pad (local.video_source, "src");
+  gst_pad_add_probe (sinkpad, GST_PAD_PROBE_TYPE_BUFFER,
+      (GstPadProbeCallback) confirm_probe, g_strdup (prefix), g_free);
+  gst_object_unref (sinkpad);
+
+  /* Probe for video */
+  sinkpad = gst_element_get_static_pad (local.video_sink, "sink");
+  gst_pad_add_probe (sinkpad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+      probe_callback, NULL, NULL);
+  gst_object_unref (sinkpad);
+
+  /* Play in step with the other clients on the server clock */
+  netclock_use (local.pipeline);
+
+  /* Bound the queues by the memory budget and account the pipeline */
+  membudget_attach (local.pipeline);
+
+  ret = gst_element_set_state (local.pipeline, GST_STATE_PLAYING);
+  if (ret == GST_STATE_CHANGE_FAILURE)
+    g_printerr ("Colud not set the pipeline to playing state.\n");
+
+  bus = gst_element_get_bus (local.pipeline);
+  gst_bus_add_signal_watch (bus);
+  local.loop = g_main_loop_new (NULL, FALSE);
+  data.pipeline = local.pipeline;
+  data.loop = local.loop;
+  g_signal_connect (bus, "message", G_CALLBACK (callback_message), &data);
+
+  /* Listen for pause/resume commands from the server */
+  control.pipeline = local.pipeline;
+  control.video_watchdog = local.video_watchdog;
+  control.audio_watchdog = local.audio_watchdog;
+  control.sink = local.video_sink;
+  control.loop = local.loop;
+  control_attach (&control);
+
+  g_main_loop_run (local.loop);
+  control_detach (&control);
+  netclock_release (local.pipeline);
+
+  gst_element_set_state (local.pipeline, GST_STATE_NULL);
+  gst_object_unref (local.pipeline);
+  gst_object_unref (bus);
+  g_main_loop_unref (local.loop);
+  g_mutex_clear (&local.lock);
+  g_free (video_path);
+  g_free (audio_path);
+  return 0;
+}
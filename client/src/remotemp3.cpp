@@ -1,6 +1,8 @@
 #include "clientheader.h"
 #include "probe.h"
 #include "msghandler.h"
+#include "control.h"
+#include "batchsrc.h"
 
 int
 remotehost_Mp3_pipeline (int argc, char *argv[])
@@ -10,17 +12,19 @@ remotehost_Mp3_pipeline (int argc, char *argv[])
   RemoteMp3 remote_host;
   GstCaps *audio_caps = NULL;
   CustomData data;
+  ControlData control;
 
   /* Initialize RemoteHost structure */
   memset (&remote_host, 0, sizeof (remote_host));
   memset (&data, 0, sizeof (data));
+  memset (&control, 0, sizeof (control));
 
   /* Initialize gstreamer */
   gst_init (NULL, NULL);
 
   /* Initialize gstremer elements */
   remote_host.pipeline = gst_pipeline_new ("Remote-host-mp3");
-  remote_host.udp_source = gst_element_factory_make ("udpsrc", NULL);
+  remote_host.udp_source = batch_receive_make ();
   remote_host.watchdog = gst_element_factory_make ("watchdog", NULL);
   remote_host.rtp_depay = gst_element_factory_make ("rtpmpadepay", NULL);
   remote_host.parser = gst_element_factory_make ("mpegaudioparse", NULL);
@@ -52,7 +56,7 @@ remotehost_Mp3_pipeline (int argc, char *argv[])
 
   /* Set the element properties */
   g_object_set (G_OBJECT (remote_host.udp_source), "caps", audio_caps,
-      "port", 5000, NULL);
+      "port", rtp_session_port (RTP_SESSION_VIDEO), NULL);
 
   /* Set the watchdog property */
   g_object_set (G_OBJECT (remote_host.watchdog), "timeout", 7000, NULL);
@@ -73,6 +77,9 @@ remotehost_Mp3_pipeline (int argc, char *argv[])
   gst_pad_add_probe (sinkpad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
       probe_callback, NULL, NULL);
 
+  /* Bound the queues by the memory budget and account the pipeline */
+  membudget_attach (remote_host.pipeline);
+
   /* Set the pipeline to playing state */
   ret = gst_element_set_state (remote_host.pipeline, GST_STATE_PLAYING);
   if (ret == GST_STATE_CHANGE_FAILURE) {
@@ -92,8 +99,16 @@ remotehost_Mp3_pipeline (int argc, char *argv[])
   /* Connect signal messages that came from bus */
   g_signal_connect (bus, "message", G_CALLBACK (callback_message), &data);
 
+  /* Listen for pause/resume commands from the server */
+  control.pipeline = remote_host.pipeline;
+  control.audio_watchdog = remote_host.watchdog;
+  control.sink = remote_host.audio_sink;
+  control.loop = remote_host.loop;
+  control_attach (&control);
+
   /* Start the Main event loop */
   g_main_loop_run (remote_host.loop);
+  control_detach (&control);
 
   /* Unreference the pipeline */
   gst_element_set_state (remote_host.pipeline, GST_STATE_NULL);
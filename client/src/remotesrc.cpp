@@ -1,6 +1,8 @@
 #include "clientheader.h"
 #include "probe.h"
 #include "msghandler.h"
+#include "control.h"
+#include "batchsrc.h"
 
 int
 remotehost_Mp4_pipeline (int argc, char *argv[])
@@ -12,26 +14,29 @@ remotehost_Mp4_pipeline (int argc, char *argv[])
   GstCaps *audio_caps = NULL;
   guint bus_watch_id;
   CustomData data;
+  ControlData control;
+  const VideoCodec *codec = video_codec_find (argc, argv, "h264");
 
   /* Initialize RemoteHost structure */
   memset (&remote_host, 0, sizeof (remote_host));
   memset (&data, 0, sizeof (data));
+  memset (&control, 0, sizeof (control));
 
   /* Initialize gstreamer */
   gst_init (NULL, NULL);
 
   /* Initialize gstremer elements */
   remote_host.pipeline = gst_pipeline_new ("Remote-host-Mp4");
-  remote_host.udp_source = gst_element_factory_make ("udpsrc", NULL);
+  remote_host.udp_source = batch_receive_make ();
   remote_host.video_watchdog = gst_element_factory_make ("watchdog", NULL);
-  remote_host.rtp_depay = gst_element_factory_make ("rtph264depay", NULL);
+  remote_host.rtp_depay =
+      gst_element_factory_make (codec->depayloader, NULL);
   remote_host.video_queue = gst_element_factory_make ("queue", NULL);
-  remote_host.video_decoder = gst_element_factory_make ("avdec_h264", NULL);
+  remote_host.video_decoder = video_codec_make_decoder (codec);
   remote_host.video_sink = gst_element_factory_make ("autovideosink", "vsink");
 
-  remote_host.udp_audio_source = gst_element_factory_make ("udpsrc", NULL);
+  remote_host.udp_audio_source = batch_receive_make ();
   remote_host.audio_watchdog = gst_element_factory_make ("watchdog", NULL);
-  // remote_host.audio_rtp_buffer = gst_element_factory_make("rtpjitterbuffer", NULL);
   remote_host.audio_rtp_depay = gst_element_factory_make ("rtpopusdepay", NULL);
   remote_host.audio_decoder = gst_element_factory_make ("opusdec", NULL);
   remote_host.audio_queue = gst_element_factory_make ("queue", NULL);
@@ -66,38 +71,47 @@ remotehost_Mp4_pipeline (int argc, char *argv[])
 
   /* Set the Video Capability */
   video_caps = gst_caps_new_simple ("application/x-rtp",
-      "encoding-name", G_TYPE_STRING, "H264", "payload", G_TYPE_INT, 96, NULL);
+      "media", G_TYPE_STRING, "video",
+      "clock-rate", G_TYPE_INT, 90000,
+      "encoding-name", G_TYPE_STRING, codec->encoding_name,
+      "payload", G_TYPE_INT, 96, NULL);
 
   /* Set the Video element properties */
   g_object_set (G_OBJECT (remote_host.udp_source), "caps", video_caps,
-      "port", 5000, NULL);
+      "port", rtp_session_port (RTP_SESSION_VIDEO), NULL);
   /* Set the watchdog property for video-source */
   g_object_set (G_OBJECT (remote_host.video_watchdog), "timeout", 10000, NULL);
 
   /* Set the Audio Capability */
   audio_caps = gst_caps_new_simple ("application/x-rtp",
-      /*"media", G_TYPE_STRING, "audio", */
-      /*"clock-rate", G_TYPE_INT, 48000, */
+      "media", G_TYPE_STRING, "audio",
+      "clock-rate", G_TYPE_INT, 48000,
       "encoding-name", G_TYPE_STRING, "OPUS", "payload", G_TYPE_INT, 96, NULL);
 
   /* Set the Audio element properties */
   g_object_set (G_OBJECT (remote_host.udp_audio_source), "caps", audio_caps,
-      "port", 5001, NULL);
+      "port", rtp_session_port (RTP_SESSION_AUDIO), NULL);
 
   /* Set the watchdog properties */
   g_object_set (G_OBJECT (remote_host.audio_watchdog), "timeout", 10000, NULL);
 
-  /* Link the video elements */
+  /* Link the video elements, rtpbin sits between watchdog and depayloader */
   if (gst_element_link_many (remote_host.udp_source, remote_host.video_watchdog,
-          remote_host.rtp_depay, remote_host.video_queue,
+          NULL) != TRUE
+      || rtp_session_add (remote_host.pipeline, remote_host.video_watchdog,
+          remote_host.rtp_depay, RTP_SESSION_VIDEO) != TRUE
+      || gst_element_link_many (remote_host.rtp_depay, remote_host.video_queue,
           remote_host.video_decoder, remote_host.video_sink, NULL) != TRUE) {
     g_printerr ("Udpsource to sink elements not linked.\n");
     exit (EXIT_FAILURE);
   }
 
-  /* Link the audio elements */
+  /* Link the audio elements, rtpbin sits between watchdog and queue */
   if (gst_element_link_many (remote_host.udp_audio_source,
-          remote_host.audio_watchdog, remote_host.audio_queue,
+          remote_host.audio_watchdog, NULL) != TRUE
+      || rtp_session_add (remote_host.pipeline, remote_host.audio_watchdog,
+          remote_host.audio_queue, RTP_SESSION_AUDIO) != TRUE
+      || gst_element_link_many (remote_host.audio_queue,
           remote_host.audio_rtp_depay, remote_host.audio_decoder,
           remote_host.audio_sink, NULL) != TRUE) {
     g_printerr ("Audio elements not linked.\n");
@@ -117,6 +131,12 @@ remotehost_Mp4_pipeline (int argc, char *argv[])
   gst_pad_add_probe (sinkpad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
       probe_callback, NULL, NULL);
 
+  /* Play in step with the other clients on the server clock */
+  netclock_use (remote_host.pipeline);
+
+  /* Bound the queues by the memory budget and account the pipeline */
+  membudget_attach (remote_host.pipeline);
+
   /* Set the pipeline to playing state */
   ret = gst_element_set_state (remote_host.pipeline, GST_STATE_PLAYING);
 
@@ -139,8 +159,22 @@ remotehost_Mp4_pipeline (int argc, char *argv[])
   /* Connect signal messages that came from bus */
   g_signal_connect (bus, "message", G_CALLBACK (callback_message), &data);
 
+  /* Listen for pause/resume commands from the server */
+  control.pipeline = remote_host.pipeline;
+  control.video_watchdog = remote_host.video_watchdog;
+  control.audio_watchdog = remote_host.audio_watchdog;
+  control.sink = remote_host.video_sink;
+  control.loop = remote_host.loop;
+  control_attach (&control);
+
+  /* Measure the A/V offset when playing the sync test pattern */
+  avsync_attach (remote_host.video_sink, remote_host.audio_sink);
+
   /* Start the Main event loop */
   g_main_loop_run (remote_host.loop);
+  control_detach (&control);
+  netclock_release (remote_host.pipeline);
+  avsync_report ();
 
   /* Unreference the pipeline */
   gst_element_set_state (remote_host.pipeline, GST_STATE_NULL);
@@ -0,0 +1,238 @@
+#include "clientheader.h"
+#include "sysstat.h"
+#include <stdio.h>
+#include <string.h>
+
+/* Structure for the input-selector of an RTP session, active is the pad
+ * it was last switched to */
+typedef struct _RtpSelect
+{
+  GstElement *selector;
+  GMutex lock;
+  GstPad *active;
+} RtpSelect;
+
+/* Structure for one SSRC pad of the selector: when its packets were last
+ * seen, and whether it waits for a keyframe to become the active one */
+typedef struct _RtpSwitch
+{
+  RtpSelect *select;
+  gint64 last_seen;
+  gboolean pending;
+} RtpSwitch;
+
+/* UDP receive buffer drops of the host when they were last reported */
+static guint64 udp_drops = 0;
+static guint drop_source = 0;
+
+/* Port base of the stream the server announced */
+static gint port_base = RTP_PORT_BASE;
+
+/* Tell when packets were dropped for a full socket receive buffer */
+static gboolean
+drops_report (gpointer user_data)
+{
+  guint64 drops;
+
+  if (sysstat_udp_counter ("RcvbufErrors", &drops) && drops > udp_drops) {
+    g_print ("\nUDP receive buffer drops: %" G_GUINT64_FORMAT " (+%"
+        G_GUINT64_FORMAT ")\n", drops, drops - udp_drops);
+    udp_drops = drops;
+  }
+  return G_SOURCE_CONTINUE;
+}
+
+/* Give the udpsrc or batchudpsrc feeding an RTP session its receive
+ * buffer, it sits upstream of the element handed to rtpbin */
+static void
+set_receive_buffer (GstElement * element)
+{
+  gst_object_ref (element);
+  while (element != NULL) {
+    GstPad *sinkpad = gst_element_get_static_pad (element, "sink");
+    GstPad *peer = sinkpad ? gst_pad_get_peer (sinkpad) : NULL;
+    GstElementFactory *factory = gst_element_get_factory (element);
+
+    if (factory != NULL && (strcmp (GST_OBJECT_NAME (factory), "udpsrc") == 0
+            || strcmp (GST_OBJECT_NAME (factory), "batchudpsrc") == 0))
+      g_object_set (G_OBJECT (element), "buffer-size", RTP_RECV_BUFFER_SIZE,
+          NULL);
+    gst_object_unref (element);
+    element = peer ? gst_pad_get_parent_element (peer) : NULL;
+    if (peer != NULL)
+      gst_object_unref (peer);
+    if (sinkpad != NULL)
+      gst_object_unref (sinkpad);
+  }
+}
+
+/* Receive on the ports of the stream with this port base */
+void
+rtp_session_set_port_base (gint base)
+{
+  port_base = base;
+}
+
+/* Port the RTP of the session arrives on */
+gint
+rtp_session_port (guint session)
+{
+  return port_base + session;
+}
+
+static void
+select_free (RtpSelect * select)
+{
+  g_mutex_clear (&select->lock);
+  g_free (select);
+}
+
+/* Make the pad of an SSRC the active one of its session once, on the
+ * first keyframe after its stream started or came back after
+ * RTP_SWITCH_IDLE_MS without packets. Late packets of the SSRC switched
+ * away from keep arriving without a pause, so they do not switch back */
+static GstPadProbeReturn
+activate_probe (GstPad * pad, GstPadProbeInfo * info, RtpSwitch * sw)
+{
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  RtpSelect *select = sw->select;
+  gint64 now = g_get_monotonic_time ();
+  gboolean activate = FALSE;
+
+  g_mutex_lock (&select->lock);
+  if (select->active == pad) {
+    sw->pending = FALSE;
+  } else {
+    if (now - sw->last_seen > RTP_SWITCH_IDLE_MS * G_TIME_SPAN_MILLISECOND)
+      sw->pending = TRUE;
+    if (sw->pending
+        && !GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT)) {
+      select->active = pad;
+      sw->pending = FALSE;
+      activate = TRUE;
+    }
+  }
+  sw->last_seen = now;
+  g_mutex_unlock (&select->lock);
+
+  if (activate) {
+    g_object_set (G_OBJECT (select->selector), "active-pad", pad, NULL);
+    g_print ("\nRTP: receiving %s\n", GST_PAD_NAME (pad));
+  }
+  return GST_PAD_PROBE_OK;
+}
+
+/* Link the stream of a new SSRC to the selector of its session, it
+ * becomes the active one on its first keyframe and replaces the previous
+ * stream of that session. The pads of the earlier SSRCs stay linked, so
+ * that the stream comes back when the server switches to one of them
+ * again */
+static void
+rtpbin_pad_added (GstElement * rtpbin, GstPad * pad, gpointer user_data)
+{
+  guint session, ssrc, pt;
+  gchar *name = gst_pad_get_name (pad);
+
+  if (sscanf (name, "recv_rtp_src_%u_%u_%u", &session, &ssrc, &pt) == 3) {
+    gchar *key = g_strdup_printf ("session-%u", session);
+    GstElement *selector =
+        (GstElement *) g_object_get_data (G_OBJECT (rtpbin), key);
+    if (selector != NULL) {
+      GstPad *sinkpad = gst_element_request_pad_simple (selector, "sink_%u");
+      RtpSwitch *sw = g_new0 (RtpSwitch, 1);
+
+      sw->select = (RtpSelect *) g_object_get_data (G_OBJECT (selector),
+          "rtp-select");
+      gst_pad_add_probe (sinkpad, GST_PAD_PROBE_TYPE_BUFFER,
+          (GstPadProbeCallback) activate_probe, sw, g_free);
+      if (GST_PAD_LINK_FAILED (gst_pad_link (pad, sinkpad)))
+        g_printerr ("RTP session %u not linked.\n", session);
+      else
+        g_print ("\nRTP session %u: new SSRC %u\n", session, ssrc);
+      gst_object_unref (sinkpad);
+    }
+    g_free (key);
+  }
+  g_free (name);
+}
+
+/* Receive one RTP stream through the pipeline's rtpbin. The rtpbin takes
+ * the place of the jitterbuffer and uses the server's RTCP sender reports
+ * to play audio and video on a common NTP timeline */
+gboolean
+rtp_session_add (GstElement * pipeline, GstElement * rtp_src,
+    GstElement * rtp_sink, guint session)
+{
+  GstElement *rtpbin, *rtcp_src, *rtcp_sink, *selector;
+  GstCaps *rtcp_caps;
+  gchar *recv_rtp_sink, *recv_rtcp_sink, *send_rtcp_src, *key;
+  RtpSelect *select;
+  gint shift = port_base - RTP_PORT_BASE;
+  gboolean ret;
+
+  /* One rtpbin per pipeline, so that its sessions are synchronised */
+  rtpbin = gst_bin_get_by_name (GST_BIN (pipeline), "rtpbin");
+  if (rtpbin == NULL) {
+    rtpbin = gst_element_factory_make ("rtpbin", "rtpbin");
+    if (rtpbin == NULL) {
+      g_printerr ("rtpbin could not be created.\n");
+      return FALSE;
+    }
+    gst_bin_add (GST_BIN (pipeline), GST_ELEMENT (gst_object_ref (rtpbin)));
+    g_signal_connect (rtpbin, "pad-added", G_CALLBACK (rtpbin_pad_added),
+        NULL);
+  }
+
+  rtcp_src = gst_element_factory_make ("udpsrc", NULL);
+  rtcp_sink = gst_element_factory_make ("udpsink", NULL);
+  selector = gst_element_factory_make ("input-selector", NULL);
+  if (!rtcp_src || !rtcp_sink || !selector) {
+    g_printerr ("RTCP elements could not be created.\n");
+    gst_object_unref (rtpbin);
+    return FALSE;
+  }
+
+  /* Sender reports from the server, receiver reports back to it */
+  rtcp_caps = gst_caps_new_empty_simple ("application/x-rtcp");
+  g_object_set (G_OBJECT (rtcp_src), "caps", rtcp_caps, "port",
+      RTCP_PORT_BASE + shift + session, NULL);
+  gst_caps_unref (rtcp_caps);
+  g_object_set (G_OBJECT (rtcp_sink), "host", SERVER_ADDRESS, "port",
+      RTCP_RR_PORT_BASE + shift + session, "sync", FALSE, "async", FALSE,
+      NULL);
+  /* Only the stream of the active SSRC goes on to the session's element,
+   * without waiting for the others */
+  g_object_set (G_OBJECT (selector), "sync-streams", FALSE, NULL);
+  gst_bin_add_many (GST_BIN (pipeline), rtcp_src, rtcp_sink, selector, NULL);
+
+  recv_rtp_sink = g_strdup_printf ("recv_rtp_sink_%u", session);
+  recv_rtcp_sink = g_strdup_printf ("recv_rtcp_sink_%u", session);
+  send_rtcp_src = g_strdup_printf ("send_rtcp_src_%u", session);
+  key = g_strdup_printf ("session-%u", session);
+  g_object_set_data (G_OBJECT (rtpbin), key, selector);
+  select = g_new0 (RtpSelect, 1);
+  select->selector = selector;
+  g_mutex_init (&select->lock);
+  g_object_set_data_full (G_OBJECT (selector), "rtp-select", select,
+      (GDestroyNotify) select_free);
+  set_receive_buffer (rtp_src);
+  if (drop_source == 0) {
+    sysstat_udp_counter ("RcvbufErrors", &udp_drops);
+    drop_source = g_timeout_add_seconds (RTP_DROP_REPORT_INTERVAL,
+        drops_report, NULL);
+  }
+
+  ret = gst_element_link_pads (rtp_src, "src", rtpbin, recv_rtp_sink)
+      && gst_element_link_pads (rtcp_src, "src", rtpbin, recv_rtcp_sink)
+      && gst_element_link_pads (rtpbin, send_rtcp_src, rtcp_sink, "sink")
+      && gst_element_link (selector, rtp_sink);
+  if (!ret)
+    g_printerr ("RTP session %u not linked.\n", session);
+
+  g_free (recv_rtp_sink);
+  g_free (recv_rtcp_sink);
+  g_free (send_rtcp_src);
+  g_free (key);
+  gst_object_unref (rtpbin);
+  return ret;
+}
@@ -0,0 +1,42 @@
+#include "clientheader.h"
+
+/* Depayloader and decoders of every video codec the server streams in,
+ * by the name it sends after the file extension. The first installed
+ * decoder is used */
+static const VideoCodec video_codecs[] = {
+  {"h264", "H264", "rtph264depay", {"avdec_h264", "openh264dec", NULL}},
+  {"vp8", "VP8", "rtpvp8depay", {"vp8dec", NULL}},
+  {"vp9", "VP9", "rtpvp9depay", {"vp9dec", NULL}},
+  {"av1", "AV1", "rtpav1depay", {"dav1ddec", "av1dec", NULL}},
+  {"h265", "H265", "rtph265depay", {"avdec_h265", NULL}},
+};
+
+/* The codec named by the first argument of a pipeline function, fallback
+ * when the server sent none, as older servers do */
+const VideoCodec *
+video_codec_find (int argc, char *argv[], const gchar * fallback)
+{
+  const gchar *name = argc > 0 && argv[0] != NULL ? argv[0] : fallback;
+
+  for (guint i = 0; i < G_N_ELEMENTS (video_codecs); i++)
+    if (!g_ascii_strcasecmp (name, video_codecs[i].name))
+      return &video_codecs[i];
+  g_printerr ("Unknown video codec '%s', trying %s\n", name, fallback);
+  return name != fallback ? video_codec_find (0, NULL, fallback) :
+      &video_codecs[0];
+}
+
+/* Create the first installed decoder of the codec */
+GstElement *
+video_codec_make_decoder (const VideoCodec * codec)
+{
+  for (gint i = 0; codec->decoders[i] != NULL; i++) {
+    GstElementFactory *factory = gst_element_factory_find (codec->decoders[i]);
+
+    if (factory != NULL) {
+      gst_object_unref (factory);
+      return gst_element_factory_make (codec->decoders[i], NULL);
+    }
+  }
+  return NULL;
+}
@@ -0,0 +1,14 @@
+#ifndef SYSSTAT_H
+#define SYSSTAT_H
+#include <glib.h>
+
+/* Process and host counters the benchmarks and reports of the server and
+ * the client read */
+
+/* function declaration for the system statistics */
+
+extern gdouble sysstat_cpu_seconds ();
+
+extern gboolean sysstat_udp_counter (const gchar *, guint64 *);
+
+#endif
@@ -0,0 +1,46 @@
+#include "sysstat.h"
+#include <sys/resource.h>
+
+/* User and system CPU time of the whole process so far, in seconds */
+gdouble
+sysstat_cpu_seconds ()
+{
+  struct rusage usage;
+
+  getrusage (RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6
+      + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+/* A counter of the Udp lines of /proc/net/snmp, such as RcvbufErrors or
+ * SndbufErrors, for the whole host since boot */
+gboolean
+sysstat_udp_counter (const gchar * name, guint64 * value)
+{
+  gchar *contents = NULL;
+  gchar **lines, **names = NULL, **values = NULL;
+  gboolean found = FALSE;
+
+  if (!g_file_get_contents ("/proc/net/snmp", &contents, NULL, NULL))
+    return FALSE;
+  lines = g_strsplit (contents, "\n", -1);
+  for (gchar ** line = lines; *line != NULL && *(line + 1) != NULL; line++) {
+    if (!g_str_has_prefix (*line, "Udp:") || !g_str_has_prefix (*(line + 1),
+            "Udp:"))
+      continue;
+    names = g_strsplit (*line, " ", -1);
+    values = g_strsplit (*(line + 1), " ", -1);
+    for (guint i = 0; names[i] != NULL && values[i] != NULL; i++) {
+      if (g_strcmp0 (names[i], name) == 0) {
+        *value = g_ascii_strtoull (values[i], NULL, 10);
+        found = TRUE;
+      }
+    }
+    break;
+  }
+  g_strfreev (names);
+  g_strfreev (values);
+  g_strfreev (lines);
+  g_free (contents);
+  return found;
+}
@@ -0,0 +1,73 @@
+#ifndef AUDIOFUSE_H
+#define AUDIOFUSE_H
+#include "header.h"
+#include <gst/base/gstbasetransform.h>
+#include <gst/audio/audio.h>
+
+/* An audiofuse converts the decoded audio to S16LE, resamples it to the
+ * rate the encoder takes and applies the volume in one pass, in place when
+ * S16LE comes in at that rate already. The resampler is a polyphase
+ * windowed sinc of AUDIOFUSE_TAPS taps, with one phase per output sample
+ * between two input samples up to AUDIOFUSE_MAX_PHASES and the nearest of
+ * those beyond, its cutoff AUDIOFUSE_CUTOFF of the lower Nyquist rate */
+#define AUDIOFUSE_TAPS 32
+#define AUDIOFUSE_MAX_PHASES 1024
+#define AUDIOFUSE_CUTOFF 0.95
+#define AUDIOFUSE_MAX_CHANNELS 8
+#define AUDIOFUSE_DEFAULT_VOLUME 1.0
+#define AUDIOFUSE_MAX_VOLUME 10.0
+
+/* Benchmark: white noise in buffers of AUDIOFUSE_BENCH_FRAMES stereo
+ * frames, through the stock chain and through an audiofuse */
+#define AUDIOFUSE_BENCH_FRAMES 1024
+
+#define GST_TYPE_AUDIO_FUSE (audio_fuse_get_type ())
+#define GST_AUDIO_FUSE(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST ((obj), GST_TYPE_AUDIO_FUSE, GstAudioFuse))
+#define GST_IS_AUDIO_FUSE(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GST_TYPE_AUDIO_FUSE))
+
+/* Structure for the audiofuse element. The history holds the input of
+ * each channel as float, scaled by the volume, from AUDIOFUSE_TAPS / 2 - 1
+ * frames before the next output sample on. index is the history frame of
+ * that sample and phase how far past it the sample lies, in 1 / up of a
+ * frame. next_pts is where the output of the last buffer ended, for the
+ * samples drained at EOS */
+typedef struct _GstAudioFuse
+{
+  GstBaseTransform parent;
+  gdouble volume;
+  gboolean mute;
+  GstAudioInfo in_info;
+  GstAudioInfo out_info;
+  gboolean resampling;
+  guint up;
+  guint down;
+  guint phases;
+  gfloat *filters;
+  gfloat *history[AUDIOFUSE_MAX_CHANNELS];
+  gsize history_frames;
+  gsize history_size;
+  gsize index;
+  guint phase;
+  GstClockTime next_pts;
+  gfloat *scratch;
+  gsize scratch_size;
+} GstAudioFuse;
+
+typedef struct _GstAudioFuseClass
+{
+  GstBaseTransformClass parent_class;
+} GstAudioFuseClass;
+
+/* function declaration for the fused audio filter */
+
+extern GType audio_fuse_get_type (void);
+
+extern void audiofuse_set_enabled (gboolean);
+
+extern GstElement *audiofuse_chain_new (gboolean, GstElement **);
+
+extern void audiofuse_benchmark (gint);
+
+#endif
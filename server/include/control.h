@@ -0,0 +1,48 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+#include "header.h"
+
+/* Commands sent to the clients over the control connection (port 8090).
+ * Every command is a single line terminated by '\n'. */
+#define CONTROL_PAUSE "PAUSE"
+#define CONTROL_RESUME "RESUME"
+#define CONTROL_KEEPALIVE "KEEPALIVE"
+#define CONTROL_SEEK "SEEK"
+
+/* Commands received from the clients */
+#define CONTROL_RENDER "RENDER"
+#define CONTROL_LOCAL "LOCAL"
+
+/* Keepalive interval while the host pipeline is paused (seconds) */
+#define CONTROL_KEEPALIVE_INTERVAL 1
+
+/* Default seconds to wait for more clients after the last one connected,
+ * changed with control_set_join_window */
+#define CONTROL_JOIN_WINDOW 2
+
+/* Handler for a command sent by a client: client socket, arguments */
+typedef void (*ControlHandler) (int, const gchar *);
+
+/* function declaration for the control channel */
+
+extern void control_add_client (int);
+
+extern void control_add_session_client (int, GMainContext *);
+
+extern void control_add_handler (const gchar *, ControlHandler);
+
+extern guint control_client_count ();
+
+extern void control_set_join_window (gint);
+
+extern gint control_join_window ();
+
+extern void control_close_clients ();
+
+extern void control_send (const gchar *);
+
+extern void control_keepalive_start ();
+
+extern void control_keepalive_stop ();
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef ENCPROFILE_H
+#define ENCPROFILE_H
+#include "header.h"
+
+/* Rate control of a profile: constant bitrate, or constant quality capped
+ * by the bitrate through the VBV */
+typedef enum _EncoderRateControl
+{
+  ENC_RATE_CBR,
+  ENC_RATE_VBR
+} EncoderRateControl;
+
+/* Rate factor (CRF) of the constant quality rate control, not a fixed
+ * quantizer */
+#define ENC_VBR_QUANTIZER 21
+
+/* Most VP8 temporal layers, the base one at a quarter of the frame rate */
+#define ENC_MAX_LAYERS 3
+
+/* Structure for the encoder settings of one latency profile. GOP length
+ * and lookahead are in frames, bitrate in kbit/s and the VBV in ms. VP8 has
+ * no B-frames, it uses an alt-ref frame instead when B-frames are on, and
+ * token partitions in place of sliced threads. max_latency is the mean time
+ * in ms a frame may spend in an encoder picked for the profile */
+typedef struct _EncoderProfileSettings
+{
+  const gchar *name;
+  gint gop;
+  gint lookahead;
+  gint bframes;
+  EncoderRateControl rate_control;
+  gint bitrate;
+  gboolean sliced_threads;
+  gint vbv;
+  gint x264_preset;
+  gint vp8_cpu_used;
+  gint vp8_deadline;
+  gint max_latency;
+} EncoderProfileSettings;
+
+/* function declaration for the encoder profiles */
+
+extern const EncoderProfileSettings *encprofile_settings (EncoderProfile);
+
+extern gboolean encprofile_from_name (const gchar *, EncoderProfile *);
+
+extern void encprofile_set_default (EncoderProfile);
+
+extern EncoderProfile encprofile_default ();
+
+extern void encprofile_apply (GstElement *, EncoderProfile);
+
+extern void encprofile_set_threads (GstElement *, gint);
+
+extern void encprofile_set_bitrate (GstElement *, gint);
+
+extern gboolean encprofile_set_layers (GstElement *, gint, gint);
+
+extern gdouble encprofile_layer_share (gint, gint);
+
+extern void encoder_benchmark (gint);
+
+extern void encoder_thread_benchmark (gint);
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef ENCSELECT_H
+#define ENCSELECT_H
+#include "header.h"
+
+/* Synthetic clip every candidate encodes: seconds of live 720p30 moving
+ * bars for video, of a sine for audio */
+#define ENCSELECT_SECONDS 2
+#define ENCSELECT_WIDTH 1280
+#define ENCSELECT_HEIGHT 720
+#define ENCSELECT_FPS 30
+
+/* Luma PSNR a video encoder must reach at the profile bitrate */
+#define ENCSELECT_MIN_PSNR 35.0
+
+/* function declaration for the encoder selection */
+
+extern void encselect_init (gboolean);
+
+extern GstElement *encselect_make (EncoderCodec);
+
+extern const gchar *encselect_name (EncoderCodec);
+
+extern gboolean encselect_codec_from_name (const gchar *, EncoderCodec *);
+
+extern const gchar *encselect_codec_name (EncoderCodec);
+
+extern gboolean encselect_is_video (EncoderCodec);
+
+extern void encselect_set_video_codec (EncoderCodec);
+
+extern EncoderCodec encselect_default_video_codec ();
+
+extern EncoderCodec encselect_video_codec (StreamSession *, EncoderCodec);
+
+extern GstElement *encselect_make_payloader (EncoderCodec);
+
+extern GstElement *encselect_make_decoder (EncoderCodec);
+
+extern void codec_benchmark (const gchar *, gint);
+
+#endif
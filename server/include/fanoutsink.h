@@ -0,0 +1,65 @@
+#ifndef FANOUTSINK_H
+#define FANOUTSINK_H
+#include "header.h"
+#include <gst/base/gstbasesink.h>
+#include <sys/socket.h>
+
+/* A fanoutsink sends every buffer list to all its clients with sendmmsg,
+ * at most FANOUT_BATCH messages per call. Runs of packets of one size go
+ * out as a single UDP_SEGMENT message of up to FANOUT_MAX_SEGMENTS
+ * packets and FANOUT_MAX_GSO_BYTES, which the kernel splits again */
+#define FANOUT_BATCH 1024
+#define FANOUT_MAX_SEGMENTS 64
+#define FANOUT_MAX_GSO_BYTES 65000
+
+/* Benchmark: destinations on loopback from FANOUT_BENCH_PORT on, fed with
+ * a FANOUT_BENCH_BITRATE kbit/s H.264 stream */
+#define FANOUT_BENCH_PORT 20000
+#define FANOUT_BENCH_BITRATE 2000
+
+#define GST_TYPE_FANOUT_SINK (fanout_sink_get_type ())
+#define GST_FANOUT_SINK(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST ((obj), GST_TYPE_FANOUT_SINK, GstFanoutSink))
+#define GST_IS_FANOUT_SINK(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GST_TYPE_FANOUT_SINK))
+
+/* Structure for one client address of a fanoutsink */
+typedef struct _FanoutDestination
+{
+  struct sockaddr_storage address;
+  socklen_t length;
+} FanoutDestination;
+
+/* Structure for the fanoutsink element. destinations is replaced, never
+ * changed, when the clients change, so a render keeps its own reference.
+ * Packets are the datagrams sent, messages what sendmmsg was given */
+typedef struct _GstFanoutSink
+{
+  GstBaseSink parent;
+  gint fd;
+  gchar *clients;
+  GArray *destinations;
+  gint buffer_size;
+  gboolean gso;
+  gboolean gso_supported;
+  guint64 packets;
+  guint64 messages;
+  guint64 syscalls;
+} GstFanoutSink;
+
+typedef struct _GstFanoutSinkClass
+{
+  GstBaseSinkClass parent_class;
+} GstFanoutSinkClass;
+
+/* function declaration for the fanout sink */
+
+extern GType fanout_sink_get_type (void);
+
+extern void fanoutsink_set_enabled (gboolean);
+
+extern GstElement *fanoutsink_make ();
+
+extern void fanoutsink_benchmark (gint);
+
+#endif
@@ -13,6 +13,7 @@ typedef struct _HostMP4Data
   GstElement *video_decoder;
   GstElement *video_queue;
   GstElement *video_convert;
+  GstElement *video_shed;
   GstElement *video_encoder;
   GstElement *rtp_payload;
   GstElement *udp_sink_video;
@@ -20,7 +21,6 @@ typedef struct _HostMP4Data
   GstElement *audio_volume;
   GstElement *audio_queue;
   GstElement *audio_convert;
-  GstElement *audio_resample;
   GstElement *audio_encoder;
   GstElement *rtp_audio_payload;
   GstElement *udp_sink_audio;
@@ -53,6 +53,7 @@ typedef struct _HostWEBMData
   GstElement *video_queue;
   GstElement *video_decoder;
   GstElement *video_convert;
+  GstElement *video_shed;
   GstElement *video_encoder;
   GstElement *video_payload;
   GstElement *udp_video_sink;
@@ -76,6 +77,7 @@ typedef struct _HostAVIData
   GstElement *video_parser;
   GstElement *video_decoder;
   GstElement *video_convert;
+  GstElement *video_shed;
   GstElement *video_encoder;
   GstElement *video_payload;
   GstElement *udp_video_sink;
@@ -90,6 +92,23 @@ typedef struct _HostAVIData
   GMainLoop *loop;
 } HostAVIData;
 
+/* Structure for the A/V sync test pattern host Pipeline */
+typedef struct _HostAVSyncData
+{
+  GstElement *pipeline;
+  GstElement *video_source;
+  GstElement *video_capsfilter;
+  GstElement *video_encoder;
+  GstElement *video_payload;
+  GstElement *udp_video_sink;
+  GstElement *audio_source;
+  GstElement *audio_capsfilter;
+  GstElement *audio_encoder;
+  GstElement *audio_payload;
+  GstElement *udp_audio_sink;
+  GMainLoop *loop;
+} HostAVSyncData;
+
 /* Structure of Elements for creating thumbnail image */
 typedef struct _ThumbnailData
 {
@@ -126,14 +145,116 @@ typedef struct _ImageData
   GstElement *udp_sink;
 } ImageData;
 
+/* RTP sessions of the host pipelines. RTP of session N goes to the
+ * clients on RTP_PORT_BASE + N, sender reports on RTCP_PORT_BASE + N and
+ * receiver reports come back on RTCP_RR_PORT_BASE + N. A streaming session
+ * with another port base shifts all of them by the same amount */
+#define RTP_SESSION_VIDEO 0
+#define RTP_SESSION_AUDIO 1
+#define RTP_PORT_BASE 5000
+#define RTCP_PORT_BASE 5005
+#define RTCP_RR_PORT_BASE 5007
+
+/* Ports used by one streaming session, port bases are this far apart */
+#define SESSION_PORT_SPAN 10
+
+/* Clients of the interactive session */
+#define SESSION_CLIENTS "10.1.138.194,10.1.137.49"
+
+/* Encoder latency profiles shared by all host pipelines, see encprofile.h */
+typedef enum _EncoderProfile
+{
+  ENC_PROFILE_ULTRA_LOW_LATENCY,
+  ENC_PROFILE_INTERACTIVE,
+  ENC_PROFILE_BROADCAST,
+  ENC_PROFILE_COUNT
+} EncoderProfile;
+
+/* Output codecs of the host pipelines, see encselect.h. ENC_CODEC_COUNT as
+ * the video codec of a session keeps the codec of its host pipeline */
+typedef enum _EncoderCodec
+{
+  ENC_CODEC_H264,
+  ENC_CODEC_VP8,
+  ENC_CODEC_VP9,
+  ENC_CODEC_AV1,
+  ENC_CODEC_H265,
+  ENC_CODEC_OPUS,
+  ENC_CODEC_MP3,
+  ENC_CODEC_COUNT
+} EncoderCodec;
+
+/* Structure for one streaming session: a file streamed to a group of
+ * clients on its own ports, run on its own main context */
+typedef struct _StreamSession
+{
+  guint id;
+  gchar *path;
+  gchar *hosts;
+  gint port_base;
+  gboolean interactive;
+  gboolean realtime;
+  EncoderProfile profile;
+  EncoderCodec video_codec;
+  gint encoder_threads;
+  gint renditions;
+  gint ahead_ms;
+  gchar *local;
+  gint mem_budget_mb;
+  gsize mem_peak;
+  gint topology;
+  struct _KeyIndex *keyindex;
+  GMainContext *context;
+  GMainLoop *loop;
+  GstElement *pipeline;
+  GThread *thread;
+  gint finished;
+  gint result;
+  gint64 elapsed;
+  gint64 position;
+  gpointer sched;
+} StreamSession;
+
+/* Default time a real time session encodes ahead of sending, 0 sends each
+ * packet as it is encoded */
+#define SESSION_AHEAD_MS 0
+
+/* Port of the network clock the clients slave their pipelines to */
+#define NETCLOCK_PORT 8554
+
 /* function declarattion */
-extern int hostmp4_pipeline (char *);
+extern int hostmp4_pipeline (StreamSession *);
+
+extern int hostmp3_pipeline (StreamSession *);
+
+extern int hostwebm_pipeline (StreamSession *);
+
+extern int hostavi_pipeline (StreamSession *);
+
+extern int hostavsync_pipeline (StreamSession *, gint);
+
+extern StreamSession *session_new (const gchar *, const gchar *, gint,
+    gboolean);
 
-extern int hostmp3_pipeline (char *);
+extern void session_free (StreamSession *);
 
-extern int hostwebm_pipeline (char *);
+extern void session_set_encode_ahead (gint);
 
-extern int hostavi_pipeline (char *);
+extern void session_set_clients (StreamSession *, GstElement *, guint);
+
+extern void session_attach (StreamSession *, GstElement *);
+
+extern int session_abort (StreamSession *, GstElement *);
+
+extern int session_run (StreamSession *);
+
+extern void session_start (StreamSession *);
+
+extern void session_stop (StreamSession *);
+
+extern int session_join (StreamSession *);
+
+extern void session_benchmark (const gchar *, gint);
 
 extern int metadata_fun (std::string);
 
@@ -141,6 +262,11 @@ extern int directory_set (std::string);
 
 extern int host_thumbnail ();
 
+extern gboolean rtp_session_link (GstElement *, GstElement *, GstElement *,
+    guint, StreamSession *);
+
+extern void netclock_publish (GstElement *);
+
 extern GstPadProbeReturn my_probe_callback (GstPad *, GstPadProbeInfo *,
     gpointer);
 
@@ -0,0 +1,115 @@
+#ifndef HUGEALLOC_H
+#define HUGEALLOC_H
+#include "header.h"
+
+/* The huge page allocator hands out blocks of one arena, mapped with
+ * MAP_HUGETLB when the system has huge pages reserved and with transparent
+ * huge pages otherwise. Blocks come in size classes of HUGEALLOC_CLASS_STEPS
+ * steps to each doubling from 1 << HUGEALLOC_MIN_SHIFT bytes on, aligned to
+ * HUGEALLOC_ALIGN, and go back to the free list of their class. The raw
+ * frames of a pool are cut to the frame size instead, on a slab of the
+ * pool that gives its blocks back to the arena when the pool is gone. Each
+ * class and slab has its own lock. What the arena can not hold is taken
+ * from the heap */
+#define HUGEALLOC_MEMORY_TYPE "HugePageMemory"
+#define HUGEALLOC_PAGE_SIZE (2 * 1024 * 1024)
+#define HUGEALLOC_DEFAULT_ARENA_MB 256
+#define HUGEALLOC_MIN_SHIFT 8
+#define HUGEALLOC_CLASS_STEPS 4
+#define HUGEALLOC_CLASSES (18 * HUGEALLOC_CLASS_STEPS)
+#define HUGEALLOC_ALIGN (1 << HUGEALLOC_MIN_SHIFT)
+
+/* Buffers a raw video pool proposed on a convert stage keeps around */
+#define HUGEALLOC_POOL_MIN 4
+
+/* Benchmark: a 1080p BGRx test stream converted, encoded to H.264 and
+ * payloaded, counted after HUGEALLOC_BENCH_WARMUP seconds */
+#define HUGEALLOC_BENCH_WIDTH 1920
+#define HUGEALLOC_BENCH_HEIGHT 1080
+#define HUGEALLOC_BENCH_WARMUP 2
+
+/* Structure for a free list of blocks of size bytes, with its counters.
+ * The shared list and the heap counters have no size */
+typedef struct _HugeSlab
+{
+  GMutex lock;
+  gsize size;
+  struct _HugeMemory *free;
+  guint64 allocs;
+  guint64 shares;
+  guint64 reuses;
+  guint64 mallocs;
+} HugeSlab;
+
+/* Structure for one block of the arena, going back to its slab, or of the
+ * heap, or a memory sharing part of another one. Free blocks and shared
+ * memories are kept on lists through next */
+typedef struct _HugeMemory
+{
+  GstMemory mem;
+  guint8 *data;
+  HugeSlab *slab;
+  gboolean heap;
+  struct _HugeMemory *next;
+} HugeMemory;
+
+/* Structure for a part of the arena given back, at offset bytes */
+typedef struct _HugeExtent
+{
+  gsize offset;
+  gsize size;
+} HugeExtent;
+
+/* Structure for the counters of the allocator. mallocs are the heap
+ * allocations it made, for blocks and for the memory structures */
+typedef struct _HugeAllocStats
+{
+  guint64 allocs;
+  guint64 shares;
+  guint64 reuses;
+  guint64 mallocs;
+  gsize arena_used;
+  gsize arena_size;
+  gboolean hugetlb;
+} HugeAllocStats;
+
+/* Structure for the allocator, an empty arena takes every block from the
+ * heap. The allocator of a pool cuts its frames from the arena of its host,
+ * under the lock of the host, and keeps the counters of the pools that are
+ * gone in retired */
+typedef struct _HugeAllocator
+{
+  GstAllocator parent;
+  struct _HugeAllocator *host;
+  guint8 *arena;
+  gsize arena_size;
+  gsize used;
+  gboolean hugetlb;
+  GMutex lock;
+  GSList *extents;
+  GSList *pools;
+  HugeSlab classes[HUGEALLOC_CLASSES];
+  HugeSlab shared;
+  HugeSlab heap;
+  HugeSlab frames;
+  HugeAllocStats retired;
+} HugeAllocator;
+
+typedef struct _HugeAllocatorClass
+{
+  GstAllocatorClass parent_class;
+} HugeAllocatorClass;
+
+/* function declaration for the huge page allocator */
+
+extern GType huge_allocator_get_type (void);
+
+extern gboolean hugealloc_init (gsize);
+
+extern void hugealloc_attach (GstElement *, const gchar *);
+
+extern gboolean hugealloc_stats (HugeAllocStats *);
+
+extern void hugealloc_benchmark (gint);
+
+#endif
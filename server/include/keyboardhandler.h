@@ -1,15 +1,22 @@
 #ifndef KEYBOARDHANDLER_H
 #define KEYBOARDHANDLER_H
 #include "header.h"
+#include "seek.h"
+#include "loadshed.h"
+#include "simulcast.h"
 
 /* Structure for handling the keyboard and messages over the bus*/
 
 typedef struct _Customdata
 {
+  StreamSession *session;
   std::string path;
   GstElement *pipeline;
   GstElement *volume;
   GMainLoop *loop;
+  SeekData seek;
+  LoadShedData shed;
+  SimulcastData simulcast;
 } CustomData;
 
 /* fuction declaration for handling keyboard and messages */
@@ -0,0 +1,50 @@
+#ifndef KEYINDEX_H
+#define KEYINDEX_H
+#include "header.h"
+
+/* Sidecar keyframe index file: a KeyIndexHeader followed by 'count'
+ * KeyIndexEntry records sorted by timestamp. Fast seeks take the exact
+ * keyframe time from it, the byte offset only serves the read-ahead */
+#define KEYINDEX_MAGIC "KIDX"
+#define KEYINDEX_VERSION 1
+
+typedef struct _KeyIndexHeader
+{
+  gchar magic[4];
+  guint32 version;
+  guint64 file_size;
+  gint64 file_mtime;
+  guint32 count;
+  guint32 reserved;
+} KeyIndexHeader;
+
+typedef struct _KeyIndexEntry
+{
+  guint64 timestamp;
+  guint64 offset;
+} KeyIndexEntry;
+
+/* Structure for the keyframe index of one file, held by its session. The
+ * entries stay NULL until the index is loaded or built */
+typedef struct _KeyIndex
+{
+  gint ref_count;
+  gchar *path;
+  GMutex lock;
+  GArray *entries;
+} KeyIndex;
+
+/* function declaration for the keyframe index */
+
+extern KeyIndex *keyindex_prepare (const gchar *);
+
+extern KeyIndex *keyindex_ref (KeyIndex *);
+
+extern void keyindex_unref (KeyIndex *);
+
+extern gboolean keyindex_lookup (KeyIndex *, gint64, GstSeekFlags,
+    KeyIndexEntry *);
+
+extern void keyindex_prefetch (KeyIndex *, const KeyIndexEntry *);
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef LOADSHED_H
+#define LOADSHED_H
+#include "header.h"
+
+/* The controller looks at the video path every SHED_TICK_MS. A tick is
+ * overloaded when encoding a frame takes more than SHED_OVERLOAD of the
+ * frame interval or more than SHED_LATE_HIGH of the packets reach the
+ * video sink SHED_LATE_MS or more after their time, it has headroom when
+ * encoding takes less than SHED_HEADROOM and no packet was late. A full
+ * queue in front of the decoder only means the sink clock holds a file
+ * back, so it is not looked at */
+#define SHED_TICK_MS 1000
+#define SHED_OVERLOAD 0.9
+#define SHED_HEADROOM 0.5
+#define SHED_LATE_MS 40
+#define SHED_LATE_HIGH 0.1
+
+/* Consecutive ticks before stepping down, and before stepping back up */
+#define SHED_OVERLOAD_TICKS 3
+#define SHED_RECOVER_TICKS 10
+
+/* vp8enc cpu-used while shedding, higher is faster */
+#define SHED_VP8_CPU_USED 8
+
+/* Ticks between two metric lines */
+#define SHED_REPORT_INTERVAL 10
+
+/* Check: a live 640x360 stream at 30 fps the encoder keeps up with */
+#define SHED_CHECK_WIDTH 640
+#define SHED_CHECK_HEIGHT 360
+
+/* Steps taken one after the other under sustained overload */
+typedef enum _ShedLevel
+{
+  SHED_LEVEL_NONE,
+  SHED_LEVEL_DROP_FRAMES,
+  SHED_LEVEL_PRESET,
+  SHED_LEVEL_RESOLUTION
+} ShedLevel;
+
+/* Structure for the load shedding state of a host pipeline, shed is set
+ * once any level above SHED_LEVEL_NONE was applied. late is the share of
+ * the packets of the last tick that reached the sink late */
+typedef struct _LoadShedData
+{
+  guint session;
+  GstElement *sink;
+  GstElement *rate;
+  GstElement *capsfilter;
+  GstElement *encoder;
+  ShedLevel level;
+  gboolean shed;
+  gboolean has_preset;
+  gint cpu_used;
+  gint fps_n;
+  gint fps_d;
+  gint width;
+  gint height;
+  GMutex lock;
+  GThread *enter_thread;
+  gint64 enter;
+  gint64 encode_sum;
+  guint encode_count;
+  guint packets;
+  guint late_packets;
+  gdouble load;
+  gdouble late;
+  guint overloaded;
+  guint idle;
+  guint ticks;
+  GSource *source;
+} LoadShedData;
+
+/* function declaration for load shedding */
+
+extern GstElement *loadshed_bin_new ();
+
+extern void loadshed_setup (LoadShedData *, guint, GstElement *, GstElement *,
+    GstElement *);
+
+extern void loadshed_stop (LoadShedData *);
+
+extern gboolean loadshed_check (gint);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef LOCALSHM_H
+#define LOCALSHM_H
+#include "header.h"
+
+/* A session with a client on this host also sends its encoded streams,
+ * before payloading, through a gdppay ! shmsink per RTP session. The
+ * control socket of stream N is stream-N in a private LOCALSHM_PREFIX-XXXXXX
+ * directory of the temp directory, over a shared memory area of
+ * LOCALSHM_SIZE bytes. The local
+ * branch queues at most LOCALSHM_QUEUE_MS and drops behind a slow reader */
+#define LOCALSHM_PREFIX "gstreamer-remote"
+#define LOCALSHM_SIZE (64 * 1024 * 1024)
+#define LOCALSHM_QUEUE_MS 1000
+
+/* Benchmark: a 4K H.264 stream at LOCALSHM_BENCH_BITRATE kbit/s, over
+ * loopback UDP on LOCALSHM_BENCH_PORT and over shared memory */
+#define LOCALSHM_BENCH_WIDTH 3840
+#define LOCALSHM_BENCH_HEIGHT 2160
+#define LOCALSHM_BENCH_BITRATE 20000
+#define LOCALSHM_BENCH_PORT 5970
+
+/* function declaration for the local transport */
+
+extern void localshm_set_enabled (gboolean);
+
+extern gboolean localshm_offer (StreamSession *, int, const gchar *);
+
+extern void localshm_release (StreamSession *);
+
+extern gboolean localshm_link (GstElement *, GstElement *, GstElement *,
+    guint, StreamSession *);
+
+extern void localshm_benchmark (gint);
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef MEMBUDGET_H
+#define MEMBUDGET_H
+#include "header.h"
+
+/* Every session has a memory budget of MEMBUDGET_DEFAULT_MB, 0 keeps the
+ * stock queue limits. The queues of its host pipeline share the budget by
+ * the weight of their kind, the video decoder pools keep a share of
+ * MEMBUDGET_POOL_WEIGHT for themselves. No queue gets less than
+ * MEMBUDGET_MIN_QUEUE bytes. In real time sessions fed by a live source
+ * raw video and local transport queues drop their oldest buffer when full,
+ * the others, and all queues of file sessions, hold back upstream */
+#define MEMBUDGET_DEFAULT_MB 64
+#define MEMBUDGET_MIN_QUEUE (1024 * 1024)
+#define MEMBUDGET_POOL_WEIGHT 4
+
+/* The memory held by the queues and pools of a session is sampled every
+ * MEMBUDGET_SAMPLE_MS, its peak is printed when the pipeline goes away */
+#define MEMBUDGET_SAMPLE_MS 200
+
+/* Kinds of the queues of a host pipeline, untagged queues hold encoded
+ * media in front of a decoder. A boundary queue holds raw video like a raw
+ * one but only starts a streaming thread and never drops a frame */
+typedef enum _MemBudgetKind
+{
+  MEMBUDGET_ENCODED,
+  MEMBUDGET_RAW,
+  MEMBUDGET_PACKETS,
+  MEMBUDGET_LOCAL,
+  MEMBUDGET_BOUNDARY,
+  MEMBUDGET_KINDS
+} MemBudgetKind;
+
+/* Structure for the memory accounting of one session. A decoder pool
+ * counts as its frame size times the buffers it keeps allocated, live is
+ * whether a source of the pipeline is live */
+typedef struct _MemBudgetData
+{
+  StreamSession *session;
+  GPtrArray *queues;
+  GPtrArray *decoders;
+  GSource *source;
+  gboolean live;
+  gsize peak_queues;
+  gsize peak_pools;
+} MemBudgetData;
+
+/* function declaration for the memory budget */
+
+extern void membudget_set_default (gint);
+
+extern gint membudget_default ();
+
+extern void membudget_tag (GstElement *, MemBudgetKind);
+
+extern void membudget_attach (StreamSession *, GstElement *);
+
+#endif
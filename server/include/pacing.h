@@ -0,0 +1,57 @@
+#ifndef PACING_H
+#define PACING_H
+#include "header.h"
+
+/* Every RTP stream leaves its udpsink through a token bucket filled at
+ * PACING_DEFAULT_MULTIPLE times the stream's target bitrate and holding
+ * PACING_BURST_MS of it, at least PACING_MIN_BURST bytes. A keyframe goes
+ * out over a few frame intervals instead of at once */
+#define PACING_DEFAULT_MULTIPLE 4.0
+#define PACING_BURST_MS 5
+#define PACING_MIN_BURST (2 * 1500)
+
+/* Target bitrate of the audio streams in kbit/s */
+#define PACING_AUDIO_BITRATE 128
+
+/* Kernel send buffer of the RTP udpsinks in bytes */
+#define PACING_SEND_BUFFER (1024 * 1024)
+
+/* Burst loss benchmark: a 720p H.264 stream over loopback to a receiver
+ * reading one packet every PACING_BENCH_READ_US through a small receive
+ * buffer, without pacing and at each multiple */
+#define PACING_BENCH_PORT 5980
+#define PACING_BENCH_BITRATE 4000
+#define PACING_BENCH_RECV_BUFFER (64 * 1024)
+#define PACING_BENCH_READ_US 200
+
+/* Structure for the token bucket of one udpsink, rate in bytes per second.
+ * last is the running time of the latest departure, in the segment of the
+ * udpsink. forwarding is set while the pacer pushes the batches of a
+ * buffer list */
+typedef struct _PacerData
+{
+  guint session;
+  guint stream;
+  gdouble rate;
+  gdouble burst;
+  gdouble tokens;
+  GstClockTime last;
+  GstSegment segment;
+  gboolean forwarding;
+  guint64 packets;
+  guint64 delayed;
+  gint64 longest;
+  guint64 sndbuf_errors;
+} PacerData;
+
+/* function declaration for pacing */
+
+extern void pacing_set_multiple (gdouble);
+
+extern void pacing_set_socket_buffer (gint);
+
+extern void pacing_attach (GstElement *, StreamSession *, guint, gint);
+
+extern void pacing_benchmark (gint);
+
+#endif
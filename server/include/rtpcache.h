@@ -0,0 +1,95 @@
+#ifndef RTPCACHE_H
+#define RTPCACHE_H
+#include "header.h"
+#include <stdio.h>
+
+/* Cache file of the RTP packets a session sent for a file: an
+ * RtpCacheHeader, the packets as RtpCachePacket records each followed by
+ * its bytes padded to RTPCACHE_ALIGN, the caps of every stream and the
+ * RtpCacheIndexEntry records of the places a stream can start from */
+#define RTPCACHE_MAGIC "RTPC"
+#define RTPCACHE_VERSION 1
+#define RTPCACHE_ALIGN 8
+
+/* Streams of a cache file, numbered like the RTP sessions */
+#define RTPCACHE_STREAMS 2
+
+/* Audio can start at any packet, one is indexed every
+ * RTPCACHE_AUDIO_INDEX_MS */
+#define RTPCACHE_AUDIO_INDEX_MS 1000
+
+/* Most packets of one frame sent in one go by the replay */
+#define RTPCACHE_BATCH 64
+
+/* Keyframes remembered between the encoder and the recording */
+#define RTPCACHE_MAX_KEYFRAMES 64
+
+/* Packet flag: the first packet of a keyframe */
+#define RTPCACHE_FLAG_KEY 0x01
+
+typedef struct _RtpCacheHeader
+{
+  gchar magic[4];
+  guint32 version;
+  guint64 file_size;
+  gint64 file_mtime;
+  guint64 duration;
+  guint64 packets;
+  guint64 caps_offset;
+  guint32 caps_size[RTPCACHE_STREAMS];
+  guint64 index_offset;
+  guint32 index_count;
+  guint32 reserved;
+} RtpCacheHeader;
+
+typedef struct _RtpCachePacket
+{
+  guint64 pts;
+  guint32 size;
+  guint8 stream;
+  guint8 flags;
+  guint16 reserved;
+} RtpCachePacket;
+
+typedef struct _RtpCacheIndexEntry
+{
+  guint64 timestamp;
+  guint64 offset;
+  guint32 stream;
+  guint32 reserved;
+} RtpCacheIndexEntry;
+
+/* Structure for recording the first play of a file. A seek, a trick mode
+ * or a volume change makes the packets differ from the file's and aborts
+ * the recording, the cache is only written after both streams ended */
+typedef struct _RtpCacheRecord
+{
+  gchar *path;
+  gchar *cache;
+  FILE *file;
+  GMutex lock;
+  guint64 offset;
+  guint64 packets;
+  guint64 duration;
+  gchar *caps[RTPCACHE_STREAMS];
+  gboolean eos[RTPCACHE_STREAMS];
+  guint64 last_index[RTPCACHE_STREAMS];
+  GArray *index;
+  GQueue keyframes;
+  GstElement *volume;
+  gulong volume_id;
+  gboolean aborted;
+} RtpCacheRecord;
+
+/* function declaration for the RTP packet cache */
+
+extern gboolean rtpcache_record_start (RtpCacheRecord *, StreamSession *,
+    EncoderCodec, GstElement *, GstElement *, GstElement *, GstElement *);
+
+extern void rtpcache_record_stop (RtpCacheRecord *, gboolean);
+
+extern gboolean rtpcache_available (StreamSession *, EncoderCodec);
+
+extern int rtpcache_pipeline (StreamSession *, EncoderCodec);
+
+#endif
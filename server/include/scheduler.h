@@ -0,0 +1,68 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+#include "header.h"
+#include <sched.h>
+
+/* Cost model of a session in cores: SCHED_COST_SESSION for demuxing, audio
+ * and payloading, plus the transcode cost per megapixel per second of the
+ * output codec. The factors are seeded from --bench-sessions runs with the
+ * host pipeline encoder settings and corrected from the measured CPU time
+ * of every finished session */
+#define SCHED_COST_SESSION 0.03
+#define SCHED_COST_H264 0.012
+#define SCHED_COST_VP8 0.025
+#define SCHED_COST_VP9 0.060
+#define SCHED_COST_AV1 0.080
+#define SCHED_COST_H265 0.045
+
+/* Share of the cores the sessions may commit when no budget is given */
+#define SCHED_BUDGET_SHARE 0.85
+
+/* Seconds between two accounting samples, and samples between reports */
+#define SCHED_TICK 1
+#define SCHED_REPORT_INTERVAL 10
+
+/* Weight of a finished session's measurement in the cost model */
+#define SCHED_LEARN_RATE 0.25
+
+/* Nice value added per core a session costs, heavy sessions yield to the
+ * light ones under overload */
+#define SCHED_NICE_PER_CORE 2
+#define SCHED_MAX_NICE 10
+
+typedef enum
+{
+  SCHED_QUEUED,
+  SCHED_RUNNING,
+  SCHED_DONE
+} SchedState;
+
+/* Structure for the scheduling and CPU accounting of one session */
+typedef struct _SchedEntry
+{
+  StreamSession *session;
+  SchedState state;
+  const gchar *codec;
+  gint width;
+  gint height;
+  gdouble fps;
+  gdouble cost;
+  gint nice;
+  cpu_set_t cores;
+  gint core_count;
+  gint64 cpu_ticks;
+  gdouble cpu_cores;
+  gint64 started;
+} SchedEntry;
+
+/* function declaration for the session scheduler */
+
+extern void scheduler_init (gdouble);
+
+extern gboolean scheduler_submit (StreamSession *);
+
+extern void scheduler_attach (StreamSession *, GstElement *);
+
+extern void scheduler_run ();
+
+#endif
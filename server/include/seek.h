@@ -0,0 +1,50 @@
+#ifndef SEEK_H
+#define SEEK_H
+#include "header.h"
+#include "keyindex.h"
+
+/* Fast seeks snap to the nearest key unit, accurate seeks decode up to the
+ * exact position */
+typedef enum _SeekMode
+{
+  SEEK_MODE_FAST,
+  SEEK_MODE_ACCURATE
+} SeekMode;
+
+/* Highest fast-forward/rewind rate, trick modes go 2x, 4x, 8x, 16x */
+#define SEEK_MAX_RATE 16.0
+
+/* Structure for the seek state of a host pipeline. video_input, when set,
+ * feeds several video encoders, like the simulcast tee. index is the
+ * keyframe index of the streamed file, if it has one. The seeks are sent
+ * from the main context, the probes read force_key_unit, pending and
+ * trick on the streaming threads, with g_atomic_int only. seek_start is
+ * written before pending is set */
+typedef struct _SeekData
+{
+  GstElement *pipeline;
+  KeyIndex *index;
+  GstElement *video_encoder;
+  GstElement *video_input;
+  GstElement *audio_encoder;
+  SeekMode mode;
+  gdouble rate;
+  GstSegment segment;
+  gboolean normalize;
+  gint force_key_unit;
+  gint pending;
+  gint trick;
+  gint64 seek_start;
+} SeekData;
+
+/* function declaration for seeking */
+
+extern void seek_setup (SeekData *);
+
+extern gboolean seek_absolute (SeekData *, gint64);
+
+extern gboolean seek_relative (SeekData *, gint64);
+
+extern gboolean seek_trick (SeekData *, gdouble);
+
+#endif
@@ -0,0 +1,110 @@
+#ifndef SIMULCAST_H
+#define SIMULCAST_H
+#include "header.h"
+
+/* Renditions of the video of a session: the first one at the source size
+ * with the profile bitrate, the others from the ladder below. A rung at or
+ * above the source height is left out */
+#define SIMULCAST_MAX_RENDITIONS 3
+#define SIMULCAST_DEFAULT_RENDITIONS 1
+
+/* Frames queued in front of each rendition's encoder */
+#define SIMULCAST_QUEUE_BUFFERS 3
+
+/* Temporal layers of every rendition when the encoder is vp8enc, with
+ * more than one rendition */
+#define SIMULCAST_VP8_LAYERS 3
+
+/* The clients are checked every SIMULCAST_TICK_MS. A receiver report with
+ * more than SIMULCAST_LOSS_HIGH packets lost moves the client one step
+ * down the renditions and their temporal layers ordered by bitrate,
+ * SIMULCAST_UP_REPORTS reports in a row below SIMULCAST_LOSS_LOW move it
+ * one step up */
+#define SIMULCAST_TICK_MS 1000
+#define SIMULCAST_LOSS_HIGH 0.10
+#define SIMULCAST_LOSS_LOW 0.02
+#define SIMULCAST_UP_REPORTS 3
+
+struct _SimulcastData;
+
+/* Keyframes of a rendition remembered between its encoder and the router,
+ * more than the encode-ahead buffer holds at the longest GOP */
+#define SIMULCAST_MAX_KEYFRAMES 64
+
+/* Structure for one encoded rendition of the video, keyframes holds the
+ * timestamps of the keyframes on their way from the encoder to the router */
+typedef struct _SimulcastRendition
+{
+  struct _SimulcastData *simulcast;
+  guint index;
+  gint height;
+  gint bitrate;
+  guint ssrc;
+  gint layers;
+  gboolean enabled;
+  GQueue keyframes;
+  GstElement *encoder;
+} SimulcastRendition;
+
+/* Structure for the packet going through the router: its rendition,
+ * whether a keyframe or a VP8 frame starts with it, and its temporal layer
+ * with the sync bit telling that the layer can be joined from it */
+typedef struct _SimulcastPacket
+{
+  guint ssrc;
+  gboolean key;
+  gboolean start;
+  gboolean sync;
+  gint tid;
+} SimulcastPacket;
+
+/* Structure for one client with its own udpsink after the router. It gets
+ * the temporal layers up to layer of its rendition, renumbered by seq so
+ * that dropped layers are no loss to it. pending and pending_layer are
+ * where it moves to at the first packet it can move at, -1 for none */
+typedef struct _SimulcastClient
+{
+  struct _SimulcastData *simulcast;
+  gchar *host;
+  gint port;
+  GstElement *udpsink;
+  gint rendition;
+  gint layer;
+  gint pending;
+  gint pending_layer;
+  guint16 seq;
+  guint good;
+  guint last_seq;
+  gdouble estimate;
+} SimulcastClient;
+
+/* Structure for the simulcast state of a host pipeline */
+typedef struct _SimulcastData
+{
+  guint session;
+  guint count;
+  GstElement *pipeline;
+  GstElement *tee;
+  SimulcastRendition renditions[SIMULCAST_MAX_RENDITIONS];
+  SimulcastPacket packet;
+  GSList *clients;
+  GMutex lock;
+  GSource *source;
+} SimulcastData;
+
+/* function declaration for simulcast */
+
+extern void simulcast_set_renditions (gint);
+
+extern gint simulcast_renditions ();
+
+extern gdouble simulcast_cost_factor (gint, gint);
+
+extern gboolean simulcast_link (SimulcastData *, StreamSession *, GstElement *,
+    GstElement *, GstElement *, GstElement *, GstElement *, GstElement *);
+
+extern void simulcast_stop (SimulcastData *);
+
+extern void simulcast_benchmark (const gchar *, gint);
+
+#endif
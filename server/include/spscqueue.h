@@ -0,0 +1,80 @@
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+#include "header.h"
+
+/* An spscqueue decouples one upstream thread from its streaming thread
+ * like a queue, through a ring of buffers, buffer lists, serialized events
+ * and serialized queries without a lock. Either side waiting for the other
+ * polls the ring spin times before it parks on a condition. The ring holds
+ * max-size-buffers and SPSC_EVENT_SLOTS more for events and queries, or
+ * SPSC_UNBOUNDED_SLOTS without a buffer limit. The size limits default to
+ * the ones of queue */
+#define SPSC_DEFAULT_MAX_BUFFERS 200
+#define SPSC_DEFAULT_MAX_BYTES (10 * 1024 * 1024)
+#define SPSC_DEFAULT_MAX_TIME GST_SECOND
+#define SPSC_DEFAULT_SPIN 200
+#define SPSC_EVENT_SLOTS 64
+#define SPSC_UNBOUNDED_SLOTS 4096
+
+/* Benchmark: empty buffers pushed at 10k, 100k and 1M a second, in bursts
+ * every SPSC_BENCH_TICK_US */
+#define SPSC_BENCH_TICK_US 1000
+
+#define GST_TYPE_SPSC_QUEUE (spsc_queue_get_type ())
+#define GST_SPSC_QUEUE(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST ((obj), GST_TYPE_SPSC_QUEUE, GstSpscQueue))
+#define GST_IS_SPSC_QUEUE(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GST_TYPE_SPSC_QUEUE))
+
+/* Structure for the spscqueue element. head and the in_ counters are
+ * written by the upstream thread only, tail and the out_ counters by the
+ * streaming thread only. The lock and cond are only taken to park and to
+ * wake a parked side, or to hand back the result of a query */
+typedef struct _GstSpscQueue
+{
+  GstElement parent;
+  GstPad *sinkpad;
+  GstPad *srcpad;
+  GstMiniObject **ring;
+  guint capacity;
+  guint head;
+  guint tail;
+  guint64 in_buffers;
+  guint64 out_buffers;
+  guint64 in_bytes;
+  guint64 out_bytes;
+  guint64 in_time;
+  guint64 out_time;
+  GstSegment sink_segment;
+  GstSegment src_segment;
+  guint max_buffers;
+  guint max_bytes;
+  guint64 max_time;
+  guint spin;
+  gint flushing;
+  gint srcresult;
+  gint producer_waiting;
+  gint consumer_waiting;
+  guint64 parks;
+  GMutex lock;
+  GCond cond;
+  gboolean query_handled;
+  gboolean query_result;
+} GstSpscQueue;
+
+typedef struct _GstSpscQueueClass
+{
+  GstElementClass parent_class;
+} GstSpscQueueClass;
+
+/* function declaration for the spsc queue */
+
+extern GType spsc_queue_get_type (void);
+
+extern void spscqueue_set_enabled (gboolean);
+
+extern GstElement *spscqueue_make ();
+
+extern void spscqueue_benchmark (gint);
+
+#endif
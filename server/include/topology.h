@@ -0,0 +1,70 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+#include "header.h"
+
+/* In the automatic topology the video of a file is first decoded alone,
+ * then decoded and converted, then decoded, converted and encoded, each
+ * for TOPOLOGY_WARMUP_FRAMES after TOPOLOGY_WARMUP_SKIP, all on one
+ * thread. The differences are the wall time per frame of the decoder,
+ * convert and encoder. One taking TOPOLOGY_HEAVY_SHARE of the total is
+ * heavy, and a queue of TOPOLOGY_QUEUE_BUFFERS frames starts a new
+ * streaming thread wherever a heavy element would follow another on the
+ * same thread. The stock topology runs all three on one thread. The times
+ * come from pad probes on the warm-up pipelines: the core tracers have no
+ * per-element processing time and write their records to the debug log
+ * only */
+#define TOPOLOGY_WARMUP_SKIP 10
+#define TOPOLOGY_WARMUP_FRAMES 60
+#define TOPOLOGY_WARMUP_TIMEOUT 20
+#define TOPOLOGY_HEAVY_SHARE 0.15
+#define TOPOLOGY_QUEUE_BUFFERS 3
+
+/* Benchmark: a single rendition session streaming to the loopback */
+#define TOPOLOGY_BENCH_HOST "127.0.0.1"
+#define TOPOLOGY_BENCH_PORT_BASE 6000
+
+/* Thread boundaries of the video branch of a host pipeline, after the
+ * decoder and in front of the encoder */
+typedef enum _TopologyBoundary
+{
+  TOPOLOGY_DECODE = 1 << 0,
+  TOPOLOGY_ENCODE = 1 << 1
+} TopologyBoundary;
+
+/* Structure for the warm-up result of one file and encoder, sessions
+ * waiting for it are woken through cond once it is ready */
+typedef struct _TopologyChoice
+{
+  gdouble decode_ms;
+  gdouble convert_ms;
+  gdouble encode_ms;
+  gint boundaries;
+  gboolean ready;
+  GCond cond;
+} TopologyChoice;
+
+/* Structure for the latency from the decoder to the encoder output the
+ * benchmark measures, frames by their timestamp */
+typedef struct _TopologyLatency
+{
+  GMutex lock;
+  GHashTable *decoded;
+  guint64 frames;
+  gint64 total;
+  gint64 longest;
+} TopologyLatency;
+
+/* function declaration for the thread topology */
+
+extern void topology_set_auto (gboolean);
+
+extern void topology_prepare (StreamSession *, EncoderCodec);
+
+extern gboolean topology_link (StreamSession *, GstElement *, GstElement *,
+    GstElement *, TopologyBoundary);
+
+extern void topology_attach (StreamSession *, GstElement *);
+
+extern void topology_benchmark (const gchar *, gint);
+
+#endif
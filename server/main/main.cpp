@@ -1,34 +1,48 @@
 #include "header.h"
+#include "control.h"
+#include "scheduler.h"
+#include "encprofile.h"
+#include "encselect.h"
+#include "simulcast.h"
+#include "pacing.h"
+#include "fanoutsink.h"
+#include "localshm.h"
+#include "hugealloc.h"
+#include "membudget.h"
+#include "spscqueue.h"
+#include "topology.h"
+#include "audiofuse.h"
+#include "loadshed.h"
 #include <iostream>
 #include <string>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <poll.h>
 #define PORT 8090
 
 using namespace std;
-/* send file extension to client using sockets */
-void
-sendExtenstionToClient (std::string extenstion)
-{
 
-  int sockfd, new_socket;
-  struct sockaddr_in servaddr, cliaddr;
-  char *buf = NULL;
-  buf = &extenstion[0];
+/* Listen for the clients on the control port, -1 when that failed */
+static int
+listen_clients ()
+{
+  int sockfd;
+  struct sockaddr_in servaddr;
 
   /* Creating socket file descriptor */
-  if ((sockfd = socket (AF_INET, SOCK_STREAM, 0)) == 0) {
+  if ((sockfd = socket (AF_INET, SOCK_STREAM, 0)) < 0) {
     perror ("socket failed");
-    exit (EXIT_FAILURE);
+    return -1;
   }
   /* for reusing the address */
   int optval = 1;
   if (setsockopt (sockfd, SOL_SOCKET, SO_REUSEADDR, &optval,
           sizeof (optval)) == -1) {
     perror ("");
-    exit (EXIT_FAILURE);
+    close (sockfd);
+    return -1;
   }
   /* Assign IP, PORT */
   memset (&servaddr, 0, sizeof (servaddr));
@@ -39,13 +53,28 @@ sendExtenstionToClient (std::string extenstion)
   /* Bind the socket with the server address */
   if (bind (sockfd, (const struct sockaddr *) &servaddr, sizeof (servaddr)) < 0) {
     perror ("bind failed");
-    exit (EXIT_FAILURE);
+    close (sockfd);
+    return -1;
   }
   /* Listen for connections */
   if (listen (sockfd, 5) < 0) {
     perror ("listen");
-    exit (EXIT_FAILURE);
+    close (sockfd);
+    return -1;
   }
+  return sockfd;
+}
+
+/* send file extension to client using sockets */
+void
+sendExtenstionToClient (StreamSession * session, std::string extenstion)
+{
+
+  int sockfd, new_socket;
+  struct sockaddr_in cliaddr;
+
+  if ((sockfd = listen_clients ()) < 0)
+    exit (EXIT_FAILURE);
   /* Accept the connection */
   socklen_t len = sizeof (cliaddr);
   g_print ("Waiting for clinet to connect....\n");
@@ -54,21 +83,435 @@ sendExtenstionToClient (std::string extenstion)
     exit (EXIT_FAILURE);
   }
 
-  /* Send message to client */
-  send (new_socket, buf, sizeof (buf), 0);
+  /* Keep the connections open as control channel for this stream */
+  control_close_clients ();
+  do {
+    /* Send message to client, a client on this host is offered the
+     * shared memory sockets of the session */
+    string description = extenstion;
+    string extension = extenstion.substr (0, extenstion.find (' '));
+    if (localshm_offer (session, new_socket, extension.c_str ()))
+      description += string (" local=") + session->local;
+    send (new_socket, description.c_str (), description.size () + 1, 0);
+    control_add_client (new_socket);
+
+    /* More displays may join the same stream until none joined for the
+     * join window */
+    struct pollfd pfd = { sockfd, POLLIN, 0 };
+    new_socket = -1;
+    if (poll (&pfd, 1, control_join_window () * 1000) > 0) {
+      len = sizeof (cliaddr);
+      new_socket = accept (sockfd, (struct sockaddr *) &cliaddr, &len);
+    }
+  } while (new_socket >= 0);
+  g_print ("%u client(s) connected\n", control_client_count ());
 
   /* Close the socket */
   close (sockfd);
 }
 
+/* What the client is told about the stream: the extension it builds its
+ * pipeline from, the video codec it builds the decoder from, then the port
+ * base it receives the RTP and RTCP on */
+static string
+stream_description (StreamSession * session, const string & extension)
+{
+  string description = extension;
+  gchar *port = g_strdup_printf (" port=%d", session->port_base);
+
+  if (extension == "mp4" || extension == "avsync")
+    description += string (" ") + encselect_codec_name
+        (encselect_video_codec (session, ENC_CODEC_H264));
+  else if (extension == "webm" || extension == "avi")
+    description += string (" ") + encselect_codec_name
+        (encselect_video_codec (session, ENC_CODEC_VP8));
+  description += port;
+  g_free (port);
+  return description;
+}
+
+/* A client that connects while sessions stream is told about the first
+ * unfinished session it is one of the hosts of, so that it receives on the
+ * port base of that session */
+static gboolean
+session_handshake (GIOChannel * source, GIOCondition cond,
+    GPtrArray * sessions)
+{
+  struct sockaddr_in cliaddr;
+  socklen_t len = sizeof (cliaddr);
+  int client = accept (g_io_channel_unix_get_fd (source),
+      (struct sockaddr *) &cliaddr, &len);
+  const gchar *address;
+
+  if (client < 0)
+    return TRUE;
+  address = inet_ntoa (cliaddr.sin_addr);
+  for (guint i = 0; i < sessions->len; i++) {
+    StreamSession *session = (StreamSession *) g_ptr_array_index (sessions, i);
+    gchar **hosts = g_strsplit (session->hosts, ",", -1);
+    const gchar *dot = strrchr (session->path, '.');
+    gboolean found = !g_atomic_int_get (&session->finished)
+        && g_strv_contains (hosts, address) && dot != NULL;
+
+    g_strfreev (hosts);
+    if (found) {
+      gchar *extension = g_ascii_strdown (dot + 1, -1);
+      string description = stream_description (session, extension);
+      send (client, description.c_str (), description.size () + 1, 0);
+      g_print ("Session %u: %s joined\n", session->id, address);
+      g_free (extension);
+      /* The session reads its commands and sends it PAUSE, SEEK and
+       * the keepalives until it ends. A queued session gets the context
+       * it will run on now */
+      if (session->context == NULL)
+        session->context = g_main_context_new ();
+      control_add_session_client (client, session->context);
+      return TRUE;
+    }
+  }
+  close (client);
+  return TRUE;
+}
+
+/* Stream every "file@host[,host...]:port_base[/threads]" argument
+ * concurrently, each in its own session thread, admitted against the CPU
+ * budget in cores, 0 for a share of the available ones. Without a thread
+ * count the encoder gets one thread per core the scheduler gives the
+ * session */
+static int
+run_sessions (gdouble budget, int count, char *specs[])
+{
+  scheduler_init (budget);
+  GPtrArray *sessions = g_ptr_array_new ();
+  for (int i = 0; i < count; i++) {
+    string spec = specs[i];
+    size_t at = spec.find_last_of ("@");
+    size_t colon = spec.find_last_of (":");
+    if (at == string::npos || colon == string::npos || colon < at) {
+      g_printerr ("Session '%s' is not file@hosts:port\n", specs[i]);
+      continue;
+    }
+    char *file_path = realpath (spec.substr (0, at).c_str (), NULL);
+    if (file_path == NULL) {
+      perror (specs[i]);
+      continue;
+    }
+    StreamSession *session = session_new (file_path,
+        spec.substr (at + 1, colon - at - 1).c_str (),
+        atoi (spec.substr (colon + 1).c_str ()), FALSE);
+    free (file_path);
+    size_t slash = spec.find_last_of ("/");
+    if (slash != string::npos && slash > colon)
+      session->encoder_threads = atoi (spec.substr (slash + 1).c_str ());
+    scheduler_submit (session);
+    g_ptr_array_add (sessions, session);
+  }
+
+  /* Clients learn the port base of their session on the control port */
+  int sockfd = listen_clients ();
+  GIOChannel *channel = NULL;
+  guint watch = 0;
+  if (sockfd >= 0) {
+    channel = g_io_channel_unix_new (sockfd);
+    watch = g_io_add_watch (channel, G_IO_IN, (GIOFunc) session_handshake,
+        sessions);
+  }
+  scheduler_run ();
+  if (channel != NULL) {
+    g_source_remove (watch);
+    g_io_channel_unref (channel);
+    close (sockfd);
+  }
+  g_ptr_array_free (sessions, TRUE);
+  return 0;
+}
+
+/* Settings of the host pipelines, -1 keeps the default */
+static gchar *opt_profile = NULL;
+static gint opt_renditions = -1;
+static gchar *opt_codec = NULL;
+static gdouble opt_encode_ahead = -1.0;
+static gdouble opt_pace = -1.0;
+static gint opt_socket_buffer = -1;
+static gint opt_join_window = -1;
+static gboolean opt_fanout = FALSE;
+static gboolean opt_local = FALSE;
+static gint opt_huge_pages = 0;
+static gint opt_mem_budget = -1;
+static gboolean opt_spsc_queue = FALSE;
+static gboolean opt_auto_topology = FALSE;
+static gboolean opt_fused_audio = FALSE;
+static gdouble opt_budget = 0.0;
+
+/* Modes other than streaming a directory, they take their file and time
+ * from the remaining arguments */
+static gboolean opt_avsync = FALSE;
+static gboolean opt_sessions = FALSE;
+static gboolean opt_select_encoders = FALSE;
+static gboolean opt_bench_threads = FALSE;
+static gboolean opt_bench_encoders = FALSE;
+static gboolean opt_bench_sessions = FALSE;
+static gboolean opt_bench_codecs = FALSE;
+static gboolean opt_bench_pacing = FALSE;
+static gboolean opt_bench_fanout = FALSE;
+static gboolean opt_bench_local = FALSE;
+static gboolean opt_bench_alloc = FALSE;
+static gboolean opt_bench_spsc = FALSE;
+static gboolean opt_bench_simulcast = FALSE;
+static gboolean opt_bench_topology = FALSE;
+static gboolean opt_bench_audio = FALSE;
+static gboolean opt_check_shed = FALSE;
+
+static GOptionEntry option_entries[] = {
+  {"profile", 0, 0, G_OPTION_ARG_STRING, &opt_profile,
+      "Encoder latency profile: ultra-low-latency, interactive or "
+        "broadcast-quality", "NAME"},
+  {"renditions", 0, 0, G_OPTION_ARG_INT, &opt_renditions,
+      "Number of simulcast renditions, 1 streams a single encode", "N"},
+  {"codec", 0, 0, G_OPTION_ARG_STRING, &opt_codec,
+      "Stream the video in h264, vp8, vp9, av1 or h265", "NAME"},
+  {"encode-ahead", 0, 0, G_OPTION_ARG_DOUBLE, &opt_encode_ahead,
+      "Let the encoders of file sessions run that far ahead of sending",
+      "SECONDS"},
+  {"pace", 0, 0, G_OPTION_ARG_DOUBLE, &opt_pace,
+      "Send every RTP stream at most that many times its bitrate, 0 turns "
+        "pacing off", "MULTIPLE"},
+  {"socket-buffer", 0, 0, G_OPTION_ARG_INT, &opt_socket_buffer,
+      "Send buffer of the RTP sockets, 0 keeps the system default", "KB"},
+  {"join-window", 0, 0, G_OPTION_ARG_INT, &opt_join_window,
+      "Wait that long for more displays after the last one joined",
+      "SECONDS"},
+  {"fanout", 0, 0, G_OPTION_ARG_NONE, &opt_fanout,
+      "Send the RTP in batched sendmmsg calls with segmentation offload",
+      NULL},
+  {"local", 0, 0, G_OPTION_ARG_NONE, &opt_local,
+      "Offer clients on this host the shared memory transport", NULL},
+  {"huge-pages", 0, 0, G_OPTION_ARG_INT, &opt_huge_pages,
+      "Allocate the RTP packets and raw frames from a huge page arena",
+      "MIB"},
+  {"mem-budget", 0, 0, G_OPTION_ARG_INT, &opt_mem_budget,
+      "Bound the queues of every session, 0 keeps the stock limits", "MIB"},
+  {"spsc-queue", 0, 0, G_OPTION_ARG_NONE, &opt_spsc_queue,
+      "Queue the RTP packets of encode-ahead in lock-free spscqueues", NULL},
+  {"auto-topology", 0, 0, G_OPTION_ARG_NONE, &opt_auto_topology,
+      "Place the thread boundaries of the video from a warm-up of each file",
+      NULL},
+  {"fused-audio", 0, 0, G_OPTION_ARG_NONE, &opt_fused_audio,
+      "Convert, resample and set the volume of the audio in one element",
+      NULL},
+  {"budget", 0, 0, G_OPTION_ARG_DOUBLE, &opt_budget,
+      "CPU budget of --sessions, 0 for a share of the available cores",
+      "CORES"},
+  {"avsync", 0, 0, G_OPTION_ARG_NONE, &opt_avsync,
+      "Stream the A/V sync test pattern for [seconds]", NULL},
+  {"sessions", 0, 0, G_OPTION_ARG_NONE, &opt_sessions,
+      "Stream every file@host[,host...]:port[/threads] at once", NULL},
+  {"select-encoders", 0, 0, G_OPTION_ARG_NONE, &opt_select_encoders,
+      "Benchmark the candidate encoders again", NULL},
+  {"bench-threads", 0, 0, G_OPTION_ARG_NONE, &opt_bench_threads,
+      "Measure encoder fps against threads on [frames]", NULL},
+  {"bench-encoders", 0, 0, G_OPTION_ARG_NONE, &opt_bench_encoders,
+      "Measure the encoder profiles for [seconds]", NULL},
+  {"bench-sessions", 0, 0, G_OPTION_ARG_NONE, &opt_bench_sessions,
+      "Measure the sessions per core of file [seconds]", NULL},
+  {"bench-codecs", 0, 0, G_OPTION_ARG_NONE, &opt_bench_codecs,
+      "Compare the video codecs on file|directory [seconds]", NULL},
+  {"bench-pacing", 0, 0, G_OPTION_ARG_NONE, &opt_bench_pacing,
+      "Measure burst loss over loopback for [seconds]", NULL},
+  {"bench-fanout", 0, 0, G_OPTION_ARG_NONE, &opt_bench_fanout,
+      "Compare udpsink and fanoutsink for [seconds]", NULL},
+  {"bench-local", 0, 0, G_OPTION_ARG_NONE, &opt_bench_local,
+      "Compare a local 4K stream over UDP and shared memory for [seconds]",
+      NULL},
+  {"bench-alloc", 0, 0, G_OPTION_ARG_NONE, &opt_bench_alloc,
+      "Count the allocations on the heap and the arena for [seconds]", NULL},
+  {"bench-spsc", 0, 0, G_OPTION_ARG_NONE, &opt_bench_spsc,
+      "Compare queue, queue2 and spscqueue for [seconds]", NULL},
+  {"bench-simulcast", 0, 0, G_OPTION_ARG_NONE, &opt_bench_simulcast,
+      "Measure the CPU per rendition of file [seconds]", NULL},
+  {"bench-topology", 0, 0, G_OPTION_ARG_NONE, &opt_bench_topology,
+      "Compare the stock and the automatic topology on file [seconds]",
+      NULL},
+  {"bench-audio", 0, 0, G_OPTION_ARG_NONE, &opt_bench_audio,
+      "Compare the stock audio chain and the audiofuse on [seconds]", NULL},
+  {"check-shed", 0, 0, G_OPTION_ARG_NONE, &opt_check_shed,
+      "Check a stream the encoder keeps up with is never shed [seconds]",
+      NULL},
+  {NULL}
+};
+
+/* Remaining argument number index as a number, or the fallback */
+static gint
+arg_int (int argc, char *argv[], int index, gint fallback)
+{
+  return argc > index ? atoi (argv[index]) : fallback;
+}
+
 int
 main (int argc, char *argv[])
 {
 
   DIR *dir;
   struct dirent *ent;
+  GOptionContext *context;
+  GError *error = NULL;
+
+  /* The only initialization of GStreamer, every mode and session runs
+   * after it */
+  gst_init (&argc, &argv);
+
+  /* The options may come in any order, what remains is the directory to
+   * stream or the file and time of the mode */
+  context = g_option_context_new ("[DIRECTORY | FILE | SPEC...] [SECONDS]");
+  g_option_context_add_main_entries (context, option_entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error)) {
+    g_printerr ("%s\n", error->message);
+    g_error_free (error);
+    g_option_context_free (context);
+    return 1;
+  }
+  g_option_context_free (context);
+
+  if (opt_profile != NULL) {
+    EncoderProfile profile;
+    if (!encprofile_from_name (opt_profile, &profile)) {
+      g_printerr ("Unknown encoder profile '%s'\n", opt_profile);
+      return 1;
+    }
+    encprofile_set_default (profile);
+  }
+  if (opt_renditions >= 0)
+    simulcast_set_renditions (opt_renditions);
+  if (opt_codec != NULL) {
+    EncoderCodec codec;
+    if (!encselect_codec_from_name (opt_codec, &codec)
+        || !encselect_is_video (codec)) {
+      g_printerr ("Unknown video codec '%s'\n", opt_codec);
+      return 1;
+    }
+    encselect_set_video_codec (codec);
+  }
+  if (opt_encode_ahead >= 0.0)
+    session_set_encode_ahead ((gint) (opt_encode_ahead * 1000));
+  if (opt_pace >= 0.0)
+    pacing_set_multiple (opt_pace);
+  if (opt_socket_buffer >= 0)
+    pacing_set_socket_buffer (opt_socket_buffer * 1024);
+  if (opt_join_window >= 0)
+    control_set_join_window (opt_join_window);
+  fanoutsink_set_enabled (opt_fanout);
+  localshm_set_enabled (opt_local);
+  if (opt_huge_pages > 0) {
+    if (!hugealloc_init ((gsize) opt_huge_pages << 20))
+      g_print ("No huge pages reserved, using transparent huge pages.\n");
+  }
+  if (opt_mem_budget >= 0)
+    membudget_set_default (opt_mem_budget);
+  spscqueue_set_enabled (opt_spsc_queue);
+  topology_set_auto (opt_auto_topology);
+  audiofuse_set_enabled (opt_fused_audio);
+
+  if (opt_bench_threads) {
+    encoder_thread_benchmark (arg_int (argc, argv, 1, 300));
+    return 0;
+  }
+
+  if (opt_bench_encoders) {
+    encoder_benchmark (arg_int (argc, argv, 1, 10));
+    return 0;
+  }
+
+  /* Every encoder is picked before the first session starts, the
+   * sessions only look the choice up */
+  encselect_init (opt_select_encoders);
+  if (opt_select_encoders)
+    return 0;
+
+  if (opt_avsync) {
+    gint seconds = arg_int (argc, argv, 1, 3600);
+    StreamSession *session = session_new ("avsync", SESSION_CLIENTS,
+        RTP_PORT_BASE, TRUE);
+    sendExtenstionToClient (session, stream_description (session,
+            "avsync"));
+    hostavsync_pipeline (session, seconds);
+    session_free (session);
+    return 0;
+  }
+
+  if (opt_sessions)
+    return run_sessions (opt_budget, argc - 1, argv + 1);
+
+  /* The remaining modes but the pacing, fanout, local, allocation, spsc
+   * and audio benchmarks take a file */
+  if ((opt_bench_sessions || opt_bench_codecs || opt_bench_simulcast
+          || opt_bench_topology) && argc < 2) {
+    g_printerr ("The benchmark needs a file.\n");
+    return 1;
+  }
+
+  if (opt_bench_sessions) {
+    session_benchmark (argv[1], arg_int (argc, argv, 2, 20));
+    return 0;
+  }
+
+  if (opt_bench_codecs) {
+    codec_benchmark (argv[1], arg_int (argc, argv, 2, 10));
+    return 0;
+  }
+
+  if (opt_bench_pacing) {
+    pacing_benchmark (arg_int (argc, argv, 1, 20));
+    return 0;
+  }
+
+  if (opt_bench_fanout) {
+    fanoutsink_benchmark (arg_int (argc, argv, 1, 10));
+    return 0;
+  }
+
+  if (opt_bench_local) {
+    localshm_benchmark (arg_int (argc, argv, 1, 10));
+    return 0;
+  }
+
+  if (opt_bench_alloc) {
+    hugealloc_benchmark (arg_int (argc, argv, 1, 10));
+    return 0;
+  }
+
+  if (opt_bench_spsc) {
+    spscqueue_benchmark (arg_int (argc, argv, 1, 5));
+    return 0;
+  }
+
+  if (opt_bench_simulcast) {
+    simulcast_benchmark (argv[1], arg_int (argc, argv, 2, 20));
+    return 0;
+  }
+
+  if (opt_bench_topology) {
+    topology_benchmark (argv[1], arg_int (argc, argv, 2, 10));
+    return 0;
+  }
+
+  if (opt_bench_audio) {
+    audiofuse_benchmark (arg_int (argc, argv, 1, 600));
+    return 0;
+  }
+
+  if (opt_check_shed)
+    return loadshed_check (arg_int (argc, argv, 1, 15)) ? 0 : 1;
+
+  if (argc < 2) {
+    g_printerr ("No directory to stream, see --help.\n");
+    return 1;
+  }
   char *uri = argv[1];
   uri = realpath (uri, NULL);
+  if (uri == NULL) {
+    perror (argv[1]);
+    return 1;
+  }
   cout << "uri: " << uri << endl;
   /* open directory */
   if ((dir = opendir (uri)) != NULL) {
@@ -86,25 +529,31 @@ main (int argc, char *argv[])
         std::cout << "File extension is : " << extension << std::endl;
         string path = string (uri) + "/" + string (val);
         char *file_path = (char *) path.c_str ();
+        /* The interactive session streams on the default context */
+        StreamSession *session = session_new (file_path, SESSION_CLIENTS,
+            RTP_PORT_BASE, TRUE);
         /* Function to send extension to client */
-        sendExtenstionToClient (extension);
+        sendExtenstionToClient (session, stream_description (session,
+                extension));
         if (extension == "mp4") {
           directory_set (path);
-          hostmp4_pipeline (file_path);
-          host_thumbnail ();
+          /* A stream that could not start has no thumbnail to follow */
+          if (hostmp4_pipeline (session) == 0)
+            host_thumbnail ();
         } else if (extension == "avi") {
           directory_set (path.c_str ());
-          hostavi_pipeline (file_path);
-          host_thumbnail ();
+          if (hostavi_pipeline (session) == 0)
+            host_thumbnail ();
         } else if (extension == "mp3") {
-          hostmp3_pipeline (file_path);
+          hostmp3_pipeline (session);
         } else if (extension == "webm") {
           directory_set (path.c_str ());
-          hostwebm_pipeline (file_path);
-          host_thumbnail ();
+          if (hostwebm_pipeline (session) == 0)
+            host_thumbnail ();
         } else {
           g_printerr ("Unsuported format.\n");
         }
+        session_free (session);
       }
     }
   }
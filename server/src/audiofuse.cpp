@@ -0,0 +1,1128 @@
+#include "audiofuse.h"
+#include <math.h>
+#include <string.h>
+
+#if defined (__SSE2__)
+#include <immintrin.h>
+#elif defined (__aarch64__)
+#include <arm_neon.h>
+#endif
+
+enum
+{
+  PROP_0,
+  PROP_VOLUME,
+  PROP_MUTE
+};
+
+/* Full scale of the float samples inside the element */
+#define S16_SCALE 32767.0f
+#define S16_IN_SCALE (1.0f / 32768.0f)
+#define S32_IN_SCALE (1.0f / 2147483648.0f)
+
+/* Frames the resampler looks ahead of and behind an output sample */
+#define HALF_TAPS (AUDIOFUSE_TAPS / 2)
+
+/* Whether the host pipelines use an audiofuse for their audio */
+static gboolean fuse_enabled = FALSE;
+
+/* Structure for the kernels of one instruction set. dot is one tap sum of
+ * the resampler, to_s16 scales and saturates float samples to S16,
+ * scale_s16 applies a gain to S16 samples in place and from_s16 scales S16
+ * samples to float */
+typedef struct _AudioFuseKernels
+{
+  const gchar *name;
+  gfloat (*dot) (const gfloat *, const gfloat *, guint);
+  void (*to_s16) (const gfloat *, gint16 *, gsize, gfloat);
+  void (*scale_s16) (gint16 *, gsize, gfloat);
+  void (*from_s16) (const gint16 *, gfloat *, gsize, gfloat);
+} AudioFuseKernels;
+
+/* Structure for the time one benchmark run spends inside the chain */
+typedef struct _AudioFuseBenchTime
+{
+  gint bpf;
+  gint64 enter;
+  gint64 total;
+  guint64 frames;
+} AudioFuseBenchTime;
+
+static GstStaticPadTemplate sink_template = GST_STATIC_PAD_TEMPLATE ("sink",
+    GST_PAD_SINK, GST_PAD_ALWAYS,
+    GST_STATIC_CAPS ("audio/x-raw, format = (string) { S16LE, S32LE, F32LE }, "
+        "layout = (string) { interleaved, non-interleaved }, "
+        "rate = (int) [ 1, MAX ], channels = (int) [ 1, "
+        G_STRINGIFY (AUDIOFUSE_MAX_CHANNELS) " ]"));
+
+static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC, GST_PAD_ALWAYS,
+    GST_STATIC_CAPS ("audio/x-raw, format = (string) S16LE, "
+        "layout = (string) interleaved, rate = (int) [ 1, MAX ], "
+        "channels = (int) [ 1, " G_STRINGIFY (AUDIOFUSE_MAX_CHANNELS) " ]"));
+
+G_DEFINE_TYPE (GstAudioFuse, audio_fuse, GST_TYPE_BASE_TRANSFORM);
+
+static inline gint16
+saturate_s16 (gfloat value)
+{
+  return (gint16) lrintf (CLAMP (value, -32768.0f, 32767.0f));
+}
+
+static gfloat
+dot_scalar (const gfloat * x, const gfloat * h, guint n)
+{
+  gfloat sum = 0.0f;
+
+  for (guint i = 0; i < n; i++)
+    sum += x[i] * h[i];
+  return sum;
+}
+
+static void
+to_s16_scalar (const gfloat * in, gint16 * out, gsize n, gfloat gain)
+{
+  for (gsize i = 0; i < n; i++)
+    out[i] = saturate_s16 (in[i] * gain);
+}
+
+static void
+scale_s16_scalar (gint16 * data, gsize n, gfloat gain)
+{
+  for (gsize i = 0; i < n; i++)
+    data[i] = saturate_s16 (data[i] * gain);
+}
+
+static void
+from_s16_scalar (const gint16 * in, gfloat * out, gsize n, gfloat gain)
+{
+  for (gsize i = 0; i < n; i++)
+    out[i] = in[i] * gain;
+}
+
+static const AudioFuseKernels scalar_kernels = {
+  "scalar", dot_scalar, to_s16_scalar, scale_s16_scalar, from_s16_scalar
+};
+
+#if defined (__SSE2__)
+static gfloat
+dot_sse2 (const gfloat * x, const gfloat * h, guint n)
+{
+  __m128 acc0 = _mm_setzero_ps (), acc1 = _mm_setzero_ps ();
+  gfloat lanes[4];
+  guint i = 0;
+
+  for (; i + 8 <= n; i += 8) {
+    acc0 = _mm_add_ps (acc0, _mm_mul_ps (_mm_loadu_ps (x + i),
+            _mm_loadu_ps (h + i)));
+    acc1 = _mm_add_ps (acc1, _mm_mul_ps (_mm_loadu_ps (x + i + 4),
+            _mm_loadu_ps (h + i + 4)));
+  }
+  _mm_storeu_ps (lanes, _mm_add_ps (acc0, acc1));
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3] + dot_scalar (x + i, h + i,
+      n - i);
+}
+
+/* cvtps_epi32 turns what is out of the int32 range into INT32_MIN, so the
+ * floats are clamped first */
+static void
+to_s16_sse2 (const gfloat * in, gint16 * out, gsize n, gfloat gain)
+{
+  __m128 g = _mm_set1_ps (gain);
+  __m128 lo = _mm_set1_ps (-32768.0f), hi = _mm_set1_ps (32767.0f);
+  gsize i = 0;
+
+  for (; i + 8 <= n; i += 8) {
+    __m128 a = _mm_min_ps (_mm_max_ps (_mm_mul_ps (_mm_loadu_ps (in + i), g),
+            lo), hi);
+    __m128 b = _mm_min_ps (_mm_max_ps (_mm_mul_ps (_mm_loadu_ps (in + i + 4),
+                g), lo), hi);
+
+    _mm_storeu_si128 ((__m128i *) (out + i),
+        _mm_packs_epi32 (_mm_cvtps_epi32 (a), _mm_cvtps_epi32 (b)));
+  }
+  to_s16_scalar (in + i, out + i, n - i, gain);
+}
+
+/* An S16 sample times at most AUDIOFUSE_MAX_VOLUME stays within int32, the
+ * pack saturates it to S16 */
+static void
+scale_s16_sse2 (gint16 * data, gsize n, gfloat gain)
+{
+  __m128 g = _mm_set1_ps (gain);
+  gsize i = 0;
+
+  for (; i + 8 <= n; i += 8) {
+    __m128i v = _mm_loadu_si128 ((__m128i *) (data + i));
+    __m128 a = _mm_cvtepi32_ps (_mm_srai_epi32 (_mm_unpacklo_epi16 (v, v),
+            16));
+    __m128 b = _mm_cvtepi32_ps (_mm_srai_epi32 (_mm_unpackhi_epi16 (v, v),
+            16));
+
+    _mm_storeu_si128 ((__m128i *) (data + i),
+        _mm_packs_epi32 (_mm_cvtps_epi32 (_mm_mul_ps (a, g)),
+            _mm_cvtps_epi32 (_mm_mul_ps (b, g))));
+  }
+  scale_s16_scalar (data + i, n - i, gain);
+}
+
+static void
+from_s16_sse2 (const gint16 * in, gfloat * out, gsize n, gfloat gain)
+{
+  __m128 g = _mm_set1_ps (gain);
+  gsize i = 0;
+
+  for (; i + 8 <= n; i += 8) {
+    __m128i v = _mm_loadu_si128 ((const __m128i *) (in + i));
+
+    _mm_storeu_ps (out + i, _mm_mul_ps (_mm_cvtepi32_ps (_mm_srai_epi32
+                (_mm_unpacklo_epi16 (v, v), 16)), g));
+    _mm_storeu_ps (out + i + 4, _mm_mul_ps (_mm_cvtepi32_ps (_mm_srai_epi32
+                (_mm_unpackhi_epi16 (v, v), 16)), g));
+  }
+  from_s16_scalar (in + i, out + i, n - i, gain);
+}
+
+static const AudioFuseKernels sse2_kernels = {
+  "SSE2", dot_sse2, to_s16_sse2, scale_s16_sse2, from_s16_sse2
+};
+
+/* The AVX2 kernels are built for the CPUs that have it whatever the
+ * compiler flags, and picked at run time */
+__attribute__ ((target ("avx2,fma")))
+static gfloat
+dot_avx2 (const gfloat * x, const gfloat * h, guint n)
+{
+  __m256 acc0 = _mm256_setzero_ps (), acc1 = _mm256_setzero_ps ();
+  gfloat lanes[4];
+  guint i = 0;
+
+  for (; i + 16 <= n; i += 16) {
+    acc0 = _mm256_fmadd_ps (_mm256_loadu_ps (x + i), _mm256_loadu_ps (h + i),
+        acc0);
+    acc1 = _mm256_fmadd_ps (_mm256_loadu_ps (x + i + 8),
+        _mm256_loadu_ps (h + i + 8), acc1);
+  }
+  acc0 = _mm256_add_ps (acc0, acc1);
+  _mm_storeu_ps (lanes, _mm_add_ps (_mm256_castps256_ps128 (acc0),
+          _mm256_extractf128_ps (acc0, 1)));
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3] + dot_scalar (x + i, h + i,
+      n - i);
+}
+
+/* packs_epi32 packs within each 128 bit lane, the permute puts the four
+ * quarters back in order */
+__attribute__ ((target ("avx2,fma")))
+static void
+to_s16_avx2 (const gfloat * in, gint16 * out, gsize n, gfloat gain)
+{
+  __m256 g = _mm256_set1_ps (gain);
+  __m256 lo = _mm256_set1_ps (-32768.0f), hi = _mm256_set1_ps (32767.0f);
+  gsize i = 0;
+
+  for (; i + 16 <= n; i += 16) {
+    __m256 a = _mm256_min_ps (_mm256_max_ps (_mm256_mul_ps (_mm256_loadu_ps
+                (in + i), g), lo), hi);
+    __m256 b = _mm256_min_ps (_mm256_max_ps (_mm256_mul_ps (_mm256_loadu_ps
+                (in + i + 8), g), lo), hi);
+    __m256i p = _mm256_packs_epi32 (_mm256_cvtps_epi32 (a),
+        _mm256_cvtps_epi32 (b));
+
+    _mm256_storeu_si256 ((__m256i *) (out + i),
+        _mm256_permute4x64_epi64 (p, 0xd8));
+  }
+  to_s16_scalar (in + i, out + i, n - i, gain);
+}
+
+__attribute__ ((target ("avx2,fma")))
+static void
+scale_s16_avx2 (gint16 * data, gsize n, gfloat gain)
+{
+  __m256 g = _mm256_set1_ps (gain);
+  gsize i = 0;
+
+  for (; i + 16 <= n; i += 16) {
+    __m256i v = _mm256_loadu_si256 ((__m256i *) (data + i));
+    __m256 a = _mm256_cvtepi32_ps (_mm256_cvtepi16_epi32
+        (_mm256_castsi256_si128 (v)));
+    __m256 b = _mm256_cvtepi32_ps (_mm256_cvtepi16_epi32
+        (_mm256_extracti128_si256 (v, 1)));
+    __m256i p = _mm256_packs_epi32 (_mm256_cvtps_epi32 (_mm256_mul_ps (a, g)),
+        _mm256_cvtps_epi32 (_mm256_mul_ps (b, g)));
+
+    _mm256_storeu_si256 ((__m256i *) (data + i),
+        _mm256_permute4x64_epi64 (p, 0xd8));
+  }
+  scale_s16_scalar (data + i, n - i, gain);
+}
+
+__attribute__ ((target ("avx2,fma")))
+static void
+from_s16_avx2 (const gint16 * in, gfloat * out, gsize n, gfloat gain)
+{
+  __m256 g = _mm256_set1_ps (gain);
+  gsize i = 0;
+
+  for (; i + 8 <= n; i += 8)
+    _mm256_storeu_ps (out + i, _mm256_mul_ps (_mm256_cvtepi32_ps
+            (_mm256_cvtepi16_epi32 (_mm_loadu_si128 ((const __m128i *) (in +
+                            i)))), g));
+  from_s16_scalar (in + i, out + i, n - i, gain);
+}
+
+static const AudioFuseKernels avx2_kernels = {
+  "AVX2", dot_avx2, to_s16_avx2, scale_s16_avx2, from_s16_avx2
+};
+#elif defined (__aarch64__)
+static gfloat
+dot_neon (const gfloat * x, const gfloat * h, guint n)
+{
+  float32x4_t acc0 = vdupq_n_f32 (0.0f), acc1 = vdupq_n_f32 (0.0f);
+  guint i = 0;
+
+  for (; i + 8 <= n; i += 8) {
+    acc0 = vfmaq_f32 (acc0, vld1q_f32 (x + i), vld1q_f32 (h + i));
+    acc1 = vfmaq_f32 (acc1, vld1q_f32 (x + i + 4), vld1q_f32 (h + i + 4));
+  }
+  return vaddvq_f32 (vaddq_f32 (acc0, acc1)) + dot_scalar (x + i, h + i,
+      n - i);
+}
+
+/* The NEON conversions saturate on their own */
+static void
+to_s16_neon (const gfloat * in, gint16 * out, gsize n, gfloat gain)
+{
+  gsize i = 0;
+
+  for (; i + 8 <= n; i += 8) {
+    int32x4_t a = vcvtnq_s32_f32 (vmulq_n_f32 (vld1q_f32 (in + i), gain));
+    int32x4_t b = vcvtnq_s32_f32 (vmulq_n_f32 (vld1q_f32 (in + i + 4),
+            gain));
+
+    vst1q_s16 (out + i, vcombine_s16 (vqmovn_s32 (a), vqmovn_s32 (b)));
+  }
+  to_s16_scalar (in + i, out + i, n - i, gain);
+}
+
+static void
+scale_s16_neon (gint16 * data, gsize n, gfloat gain)
+{
+  gsize i = 0;
+
+  for (; i + 8 <= n; i += 8) {
+    int16x8_t v = vld1q_s16 (data + i);
+    float32x4_t a = vcvtq_f32_s32 (vmovl_s16 (vget_low_s16 (v)));
+    float32x4_t b = vcvtq_f32_s32 (vmovl_s16 (vget_high_s16 (v)));
+
+    vst1q_s16 (data + i, vcombine_s16 (vqmovn_s32 (vcvtnq_s32_f32
+                (vmulq_n_f32 (a, gain))), vqmovn_s32 (vcvtnq_s32_f32
+                (vmulq_n_f32 (b, gain)))));
+  }
+  scale_s16_scalar (data + i, n - i, gain);
+}
+
+static void
+from_s16_neon (const gint16 * in, gfloat * out, gsize n, gfloat gain)
+{
+  gsize i = 0;
+
+  for (; i + 8 <= n; i += 8) {
+    int16x8_t v = vld1q_s16 (in + i);
+
+    vst1q_f32 (out + i, vmulq_n_f32 (vcvtq_f32_s32 (vmovl_s16 (vget_low_s16
+                    (v))), gain));
+    vst1q_f32 (out + i + 4, vmulq_n_f32 (vcvtq_f32_s32 (vmovl_s16
+                (vget_high_s16 (v))), gain));
+  }
+  from_s16_scalar (in + i, out + i, n - i, gain);
+}
+
+static const AudioFuseKernels neon_kernels = {
+  "NEON", dot_neon, to_s16_neon, scale_s16_neon, from_s16_neon
+};
+#endif
+
+static const AudioFuseKernels *kernels = &scalar_kernels;
+
+/* The widest instruction set the CPU runs */
+static void
+select_kernels ()
+{
+#if defined (__SSE2__)
+  kernels = &sse2_kernels;
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("avx2") && __builtin_cpu_supports ("fma"))
+    kernels = &avx2_kernels;
+#elif defined (__aarch64__)
+  kernels = &neon_kernels;
+#endif
+}
+
+static gfloat
+current_gain (GstAudioFuse * fuse)
+{
+  gfloat gain;
+
+  GST_OBJECT_LOCK (fuse);
+  gain = fuse->mute ? 0.0f : (gfloat) fuse->volume;
+  GST_OBJECT_UNLOCK (fuse);
+  return gain;
+}
+
+/* S16 at the rate of the encoder only needs the volume, in place, and
+ * nothing at all at unity volume */
+static void
+update_mode (GstAudioFuse * fuse)
+{
+  GstBaseTransform *trans = GST_BASE_TRANSFORM (fuse);
+  gboolean in_place = !fuse->resampling
+      && GST_AUDIO_INFO_FORMAT (&fuse->in_info) == GST_AUDIO_FORMAT_S16LE
+      && GST_AUDIO_INFO_LAYOUT (&fuse->in_info) ==
+      GST_AUDIO_LAYOUT_INTERLEAVED;
+
+  gst_base_transform_set_in_place (trans, in_place);
+  gst_base_transform_set_passthrough (trans, in_place
+      && current_gain (fuse) == 1.0f);
+}
+
+/* One windowed sinc per phase, each summing up to one so the level stays.
+ * Downsampling moves the cutoff below the output Nyquist rate */
+static void
+build_filters (GstAudioFuse * fuse)
+{
+  guint in_rate = GST_AUDIO_INFO_RATE (&fuse->in_info);
+  guint out_rate = GST_AUDIO_INFO_RATE (&fuse->out_info);
+  guint a = in_rate, b = out_rate;
+  gdouble cutoff;
+
+  while (b != 0) {
+    guint t = a % b;
+
+    a = b;
+    b = t;
+  }
+  fuse->up = out_rate / a;
+  fuse->down = in_rate / a;
+  fuse->phases = MIN (fuse->up, AUDIOFUSE_MAX_PHASES);
+  cutoff = AUDIOFUSE_CUTOFF * MIN (1.0, (gdouble) fuse->up / fuse->down);
+
+  g_free (fuse->filters);
+  fuse->filters = g_new (gfloat, (gsize) fuse->phases * AUDIOFUSE_TAPS);
+  for (guint p = 0; p < fuse->phases; p++) {
+    gfloat *filter = fuse->filters + (gsize) p * AUDIOFUSE_TAPS;
+    gdouble offset = (gdouble) p / fuse->phases, sum = 0.0;
+
+    for (guint k = 0; k < AUDIOFUSE_TAPS; k++) {
+      gdouble x = (gdouble) k - (HALF_TAPS - 1) - offset;
+      gdouble w = x / HALF_TAPS;
+      gdouble window = 0.42 + 0.5 * cos (G_PI * w) + 0.08 * cos (2 * G_PI
+          * w);
+      gdouble sinc = x == 0.0 ? 1.0 : sin (G_PI * cutoff * x)
+          / (G_PI * cutoff * x);
+
+      filter[k] = (gfloat) (cutoff * sinc * window);
+      sum += filter[k];
+    }
+    for (guint k = 0; k < AUDIOFUSE_TAPS; k++)
+      filter[k] = (gfloat) (filter[k] / sum);
+  }
+}
+
+static void
+history_free (GstAudioFuse * fuse)
+{
+  for (guint c = 0; c < AUDIOFUSE_MAX_CHANNELS; c++)
+    g_clear_pointer (&fuse->history[c], g_free);
+  fuse->history_size = 0;
+  fuse->history_frames = 0;
+}
+
+static void
+history_reserve (GstAudioFuse * fuse, gsize frames)
+{
+  if (frames <= fuse->history_size)
+    return;
+  fuse->history_size = MAX (frames, fuse->history_size * 2);
+  for (guint c = 0; c < GST_AUDIO_INFO_CHANNELS (&fuse->in_info); c++)
+    fuse->history[c] = g_renew (gfloat, fuse->history[c], fuse->history_size);
+}
+
+/* Silence before the first input, the first output sample lies on the
+ * first input frame */
+static void
+history_reset (GstAudioFuse * fuse)
+{
+  history_reserve (fuse, HALF_TAPS - 1);
+  for (guint c = 0; c < GST_AUDIO_INFO_CHANNELS (&fuse->in_info); c++)
+    memset (fuse->history[c], 0, (HALF_TAPS - 1) * sizeof (gfloat));
+  fuse->history_frames = HALF_TAPS - 1;
+  fuse->index = HALF_TAPS - 1;
+  fuse->phase = 0;
+  fuse->next_pts = GST_CLOCK_TIME_NONE;
+}
+
+/* Drop what no output sample reaches back to anymore. Downsampling may
+ * step past the end of the history, the frames in between are skipped as
+ * they come in */
+static void
+history_compact (GstAudioFuse * fuse)
+{
+  gsize drop = MIN (fuse->index - (HALF_TAPS - 1), fuse->history_frames);
+
+  if (drop == 0)
+    return;
+  for (guint c = 0; c < GST_AUDIO_INFO_CHANNELS (&fuse->in_info); c++)
+    memmove (fuse->history[c], fuse->history[c] + drop,
+        (fuse->history_frames - drop) * sizeof (gfloat));
+  fuse->history_frames -= drop;
+  fuse->index -= drop;
+}
+
+static gfloat *
+scratch_reserve (GstAudioFuse * fuse, gsize samples)
+{
+  if (samples > fuse->scratch_size) {
+    fuse->scratch_size = samples;
+    fuse->scratch = g_renew (gfloat, fuse->scratch, samples);
+  }
+  return fuse->scratch;
+}
+
+/* Scale one channel of the input to float times gain into out, every
+ * stride floats */
+static void
+load_channel (GstAudioFuse * fuse, GstAudioBuffer * abuf, guint channel,
+    gfloat * out, gsize stride, gfloat gain)
+{
+  guint channels = GST_AUDIO_INFO_CHANNELS (&fuse->in_info);
+  gboolean interleaved = GST_AUDIO_INFO_LAYOUT (&fuse->in_info) ==
+      GST_AUDIO_LAYOUT_INTERLEAVED;
+  gsize frames = abuf->n_samples;
+  gsize step = interleaved ? channels : 1;
+  guint8 *plane = (guint8 *) abuf->planes[interleaved ? 0 : channel];
+
+  switch (GST_AUDIO_INFO_FORMAT (&fuse->in_info)) {
+    case GST_AUDIO_FORMAT_S16LE:{
+      const gint16 *in = (const gint16 *) plane + (interleaved ? channel : 0);
+
+      if (step == 1 && stride == 1)
+        kernels->from_s16 (in, out, frames, gain * S16_IN_SCALE);
+      else
+        for (gsize i = 0; i < frames; i++)
+          out[i * stride] = in[i * step] * gain * S16_IN_SCALE;
+      break;
+    }
+    case GST_AUDIO_FORMAT_S32LE:{
+      const gint32 *in = (const gint32 *) plane + (interleaved ? channel : 0);
+
+      for (gsize i = 0; i < frames; i++)
+        out[i * stride] = in[i * step] * gain * S32_IN_SCALE;
+      break;
+    }
+    default:{
+      const gfloat *in = (const gfloat *) plane + (interleaved ? channel : 0);
+
+      for (gsize i = 0; i < frames; i++)
+        out[i * stride] = in[i * step] * gain;
+      break;
+    }
+  }
+}
+
+/* Same rate, another format or layout. Interleaved float goes to S16 in
+ * one pass, the rest through the scratch */
+static void
+convert_frames (GstAudioFuse * fuse, GstAudioBuffer * abuf, gint16 * out,
+    gfloat gain)
+{
+  guint channels = GST_AUDIO_INFO_CHANNELS (&fuse->in_info);
+  gsize samples = abuf->n_samples * channels;
+  gfloat *scratch;
+
+  if (GST_AUDIO_INFO_FORMAT (&fuse->in_info) == GST_AUDIO_FORMAT_F32LE
+      && GST_AUDIO_INFO_LAYOUT (&fuse->in_info) ==
+      GST_AUDIO_LAYOUT_INTERLEAVED) {
+    kernels->to_s16 ((const gfloat *) abuf->planes[0], out, samples,
+        gain * S16_SCALE);
+    return;
+  }
+  scratch = scratch_reserve (fuse, samples);
+  for (guint c = 0; c < channels; c++)
+    load_channel (fuse, abuf, c, scratch + c, channels, gain);
+  kernels->to_s16 (scratch, out, samples, S16_SCALE);
+}
+
+/* Compute every output sample the history has all the taps of, up to
+ * max_frames, and drop what they no longer need. Returns the frames
+ * written */
+static gsize
+resample_history (GstAudioFuse * fuse, gint16 * out, gsize max_frames)
+{
+  guint channels = GST_AUDIO_INFO_CHANNELS (&fuse->in_info);
+  gfloat *scratch = scratch_reserve (fuse, max_frames * channels);
+  gsize frames = 0;
+
+  while (frames < max_frames
+      && fuse->index + HALF_TAPS < fuse->history_frames) {
+    const gfloat *filter = fuse->filters + (gsize) ((guint64) fuse->phase
+        * fuse->phases / fuse->up) * AUDIOFUSE_TAPS;
+    gsize start = fuse->index - (HALF_TAPS - 1);
+
+    for (guint c = 0; c < channels; c++)
+      scratch[frames * channels + c] = kernels->dot (fuse->history[c] + start,
+          filter, AUDIOFUSE_TAPS);
+    frames++;
+    fuse->phase += fuse->down;
+    fuse->index += fuse->phase / fuse->up;
+    fuse->phase %= fuse->up;
+  }
+  history_compact (fuse);
+  kernels->to_s16 (scratch, out, frames * channels, S16_SCALE);
+  return frames;
+}
+
+/* Append the input to the history and resample what it completes. Returns
+ * the frames written and the offset of the first one from the first input
+ * frame, in ns */
+static gsize
+resample_frames (GstAudioFuse * fuse, GstAudioBuffer * abuf, gint16 * out,
+    gsize max_frames, gfloat gain, gint64 * offset)
+{
+  guint channels = GST_AUDIO_INFO_CHANNELS (&fuse->in_info);
+  gsize before = fuse->history_frames;
+
+  *offset = (((gint64) fuse->index - (gint64) before) * fuse->up
+      + fuse->phase) * (gint64) GST_SECOND
+      / ((gint64) GST_AUDIO_INFO_RATE (&fuse->in_info) * fuse->up);
+
+  history_reserve (fuse, before + abuf->n_samples);
+  for (guint c = 0; c < channels; c++)
+    load_channel (fuse, abuf, c, fuse->history[c] + before, 1, gain);
+  fuse->history_frames += abuf->n_samples;
+  return resample_history (fuse, out, max_frames);
+}
+
+/* At EOS the last input frames still lack the taps ahead of them. They
+ * are followed by HALF_TAPS frames of silence, and the output samples up
+ * to the end of the input are pushed after the last buffer */
+static GstFlowReturn
+drain (GstAudioFuse * fuse)
+{
+  guint channels = GST_AUDIO_INFO_CHANNELS (&fuse->in_info);
+  guint bpf = GST_AUDIO_INFO_BPF (&fuse->out_info);
+  gsize end = fuse->history_frames, max_frames, frames;
+  GstClockTime pts = fuse->next_pts;
+  GstBuffer *outbuf;
+  GstMapInfo map;
+
+  if (fuse->index >= end)
+    return GST_FLOW_OK;
+  max_frames = gst_util_uint64_scale_ceil (end - fuse->index, fuse->up,
+      fuse->down) + 1;
+  history_reserve (fuse, end + HALF_TAPS);
+  for (guint c = 0; c < channels; c++)
+    memset (fuse->history[c] + end, 0, HALF_TAPS * sizeof (gfloat));
+  fuse->history_frames += HALF_TAPS;
+
+  outbuf = gst_buffer_new_allocate (NULL, max_frames * bpf, NULL);
+  if (outbuf == NULL || !gst_buffer_map (outbuf, &map, GST_MAP_WRITE)) {
+    if (outbuf != NULL)
+      gst_buffer_unref (outbuf);
+    history_reset (fuse);
+    return GST_FLOW_ERROR;
+  }
+  frames = resample_history (fuse, (gint16 *) map.data, max_frames);
+  gst_buffer_unmap (outbuf, &map);
+  history_reset (fuse);
+  if (frames == 0) {
+    gst_buffer_unref (outbuf);
+    return GST_FLOW_OK;
+  }
+  gst_buffer_set_size (outbuf, frames * bpf);
+  GST_BUFFER_PTS (outbuf) = pts;
+  GST_BUFFER_DURATION (outbuf) = gst_util_uint64_scale (frames, GST_SECOND,
+      GST_AUDIO_INFO_RATE (&fuse->out_info));
+  return gst_pad_push (GST_BASE_TRANSFORM_SRC_PAD (fuse), outbuf);
+}
+
+static GstFlowReturn
+audio_fuse_transform (GstBaseTransform * trans, GstBuffer * inbuf,
+    GstBuffer * outbuf)
+{
+  GstAudioFuse *fuse = GST_AUDIO_FUSE (trans);
+  guint bpf = GST_AUDIO_INFO_BPF (&fuse->out_info);
+  gfloat gain = current_gain (fuse);
+  GstAudioBuffer abuf;
+  GstMapInfo map;
+  gint64 offset = 0;
+  gsize frames;
+
+  if (!gst_audio_buffer_map (&abuf, &fuse->in_info, inbuf, GST_MAP_READ))
+    return GST_FLOW_ERROR;
+  if (!gst_buffer_map (outbuf, &map, GST_MAP_WRITE)) {
+    gst_audio_buffer_unmap (&abuf);
+    return GST_FLOW_ERROR;
+  }
+  if (!fuse->resampling) {
+    frames = abuf.n_samples;
+    convert_frames (fuse, &abuf, (gint16 *) map.data, gain);
+  } else {
+    if (GST_BUFFER_IS_DISCONT (inbuf))
+      history_reset (fuse);
+    frames = resample_frames (fuse, &abuf, (gint16 *) map.data,
+        map.size / bpf, gain, &offset);
+  }
+  gst_buffer_unmap (outbuf, &map);
+  gst_audio_buffer_unmap (&abuf);
+  gst_buffer_set_size (outbuf, frames * bpf);
+
+  if (fuse->resampling) {
+    GstClockTime pts = GST_BUFFER_PTS (inbuf);
+
+    if (frames == 0)
+      return GST_BASE_TRANSFORM_FLOW_DROPPED;
+    if (GST_CLOCK_TIME_IS_VALID (pts))
+      GST_BUFFER_PTS (outbuf) = offset >= 0 ? pts + offset
+          : pts - MIN (pts, (GstClockTime) - offset);
+    GST_BUFFER_DURATION (outbuf) = gst_util_uint64_scale (frames, GST_SECOND,
+        GST_AUDIO_INFO_RATE (&fuse->out_info));
+    if (GST_CLOCK_TIME_IS_VALID (pts))
+      fuse->next_pts = GST_BUFFER_PTS (outbuf) + GST_BUFFER_DURATION (outbuf);
+    GST_BUFFER_OFFSET (outbuf) = GST_BUFFER_OFFSET_NONE;
+    GST_BUFFER_OFFSET_END (outbuf) = GST_BUFFER_OFFSET_NONE;
+  }
+  return GST_FLOW_OK;
+}
+
+static GstFlowReturn
+audio_fuse_transform_ip (GstBaseTransform * trans, GstBuffer * buffer)
+{
+  GstAudioFuse *fuse = GST_AUDIO_FUSE (trans);
+  gfloat gain = current_gain (fuse);
+  GstMapInfo map;
+
+  if (gain == 1.0f)
+    return GST_FLOW_OK;
+  if (!gst_buffer_map (buffer, &map, GST_MAP_READWRITE))
+    return GST_FLOW_ERROR;
+  kernels->scale_s16 ((gint16 *) map.data, map.size / sizeof (gint16), gain);
+  gst_buffer_unmap (buffer, &map);
+  return GST_FLOW_OK;
+}
+
+/* Anything upstream of S16 at any rate, with the channels kept. The pad
+ * templates narrow the formats down */
+static GstCaps *
+audio_fuse_transform_caps (GstBaseTransform * trans,
+    GstPadDirection direction, GstCaps * caps, GstCaps * filter)
+{
+  GstCaps *result = gst_caps_new_empty ();
+
+  for (guint i = 0; i < gst_caps_get_size (caps); i++) {
+    GstStructure *s = gst_structure_copy (gst_caps_get_structure (caps, i));
+
+    gst_structure_remove_fields (s, "format", "layout", "rate", NULL);
+    gst_structure_set (s, "rate", GST_TYPE_INT_RANGE, 1, G_MAXINT, NULL);
+    result = gst_caps_merge_structure (result, s);
+  }
+  if (filter != NULL) {
+    GstCaps *filtered = gst_caps_intersect_full (filter, result,
+        GST_CAPS_INTERSECT_FIRST);
+
+    gst_caps_unref (result);
+    result = filtered;
+  }
+  return result;
+}
+
+/* Keep the rate when the other side takes it */
+static GstCaps *
+audio_fuse_fixate_caps (GstBaseTransform * trans, GstPadDirection direction,
+    GstCaps * caps, GstCaps * othercaps)
+{
+  GstStructure *s = gst_caps_get_structure (caps, 0);
+  gint rate;
+
+  othercaps = gst_caps_make_writable (gst_caps_truncate (othercaps));
+  if (gst_structure_get_int (s, "rate", &rate))
+    gst_structure_fixate_field_nearest_int (gst_caps_get_structure (othercaps,
+            0), "rate", rate);
+  return gst_caps_fixate (othercaps);
+}
+
+static gboolean
+audio_fuse_set_caps (GstBaseTransform * trans, GstCaps * incaps,
+    GstCaps * outcaps)
+{
+  GstAudioFuse *fuse = GST_AUDIO_FUSE (trans);
+  GstAudioInfo in, out;
+
+  if (!gst_audio_info_from_caps (&in, incaps)
+      || !gst_audio_info_from_caps (&out, outcaps)
+      || GST_AUDIO_INFO_CHANNELS (&in) != GST_AUDIO_INFO_CHANNELS (&out))
+    return FALSE;
+  /* The history is per channel */
+  history_free (fuse);
+  fuse->in_info = in;
+  fuse->out_info = out;
+  fuse->resampling = GST_AUDIO_INFO_RATE (&in) != GST_AUDIO_INFO_RATE (&out);
+  if (fuse->resampling) {
+    build_filters (fuse);
+    history_reset (fuse);
+  }
+  update_mode (fuse);
+  return TRUE;
+}
+
+/* At most the frames the history and the input make at the output rate */
+static gboolean
+audio_fuse_transform_size (GstBaseTransform * trans,
+    GstPadDirection direction, GstCaps * caps, gsize size,
+    GstCaps * othercaps, gsize * othersize)
+{
+  GstAudioFuse *fuse = GST_AUDIO_FUSE (trans);
+  GstAudioInfo info, other;
+  guint64 frames;
+
+  if (!gst_audio_info_from_caps (&info, caps)
+      || !gst_audio_info_from_caps (&other, othercaps)
+      || GST_AUDIO_INFO_BPF (&info) == 0)
+    return FALSE;
+  frames = size / GST_AUDIO_INFO_BPF (&info);
+  if (GST_AUDIO_INFO_RATE (&info) != GST_AUDIO_INFO_RATE (&other)) {
+    if (direction == GST_PAD_SINK)
+      frames += fuse->history_frames;
+    frames = gst_util_uint64_scale_ceil (frames, GST_AUDIO_INFO_RATE (&other),
+        GST_AUDIO_INFO_RATE (&info)) + 1;
+  }
+  *othersize = frames * GST_AUDIO_INFO_BPF (&other);
+  return TRUE;
+}
+
+/* The resampler holds back the frames the taps reach ahead */
+static gboolean
+audio_fuse_query (GstBaseTransform * trans, GstPadDirection direction,
+    GstQuery * query)
+{
+  GstAudioFuse *fuse = GST_AUDIO_FUSE (trans);
+  GstClockTime min, max, delay;
+  gboolean live;
+
+  if (!GST_BASE_TRANSFORM_CLASS (audio_fuse_parent_class)->query (trans,
+          direction, query))
+    return FALSE;
+  if (direction == GST_PAD_SRC && GST_QUERY_TYPE (query) == GST_QUERY_LATENCY
+      && fuse->resampling) {
+    gst_query_parse_latency (query, &live, &min, &max);
+    delay = gst_util_uint64_scale_round (HALF_TAPS, GST_SECOND,
+        GST_AUDIO_INFO_RATE (&fuse->in_info));
+    gst_query_set_latency (query, live, min + delay,
+        GST_CLOCK_TIME_IS_VALID (max) ? max + delay : max);
+  }
+  return TRUE;
+}
+
+static gboolean
+audio_fuse_sink_event (GstBaseTransform * trans, GstEvent * event)
+{
+  GstAudioFuse *fuse = GST_AUDIO_FUSE (trans);
+
+  if (GST_EVENT_TYPE (event) == GST_EVENT_FLUSH_STOP && fuse->resampling)
+    history_reset (fuse);
+  else if (GST_EVENT_TYPE (event) == GST_EVENT_EOS && fuse->resampling)
+    drain (fuse);
+  return GST_BASE_TRANSFORM_CLASS (audio_fuse_parent_class)->sink_event (trans,
+      event);
+}
+
+static gboolean
+audio_fuse_stop (GstBaseTransform * trans)
+{
+  GstAudioFuse *fuse = GST_AUDIO_FUSE (trans);
+
+  history_free (fuse);
+  g_clear_pointer (&fuse->scratch, g_free);
+  g_clear_pointer (&fuse->filters, g_free);
+  fuse->scratch_size = 0;
+  fuse->resampling = FALSE;
+  gst_audio_info_init (&fuse->in_info);
+  gst_audio_info_init (&fuse->out_info);
+  return TRUE;
+}
+
+static void
+audio_fuse_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstAudioFuse *fuse = GST_AUDIO_FUSE (object);
+
+  switch (prop_id) {
+    case PROP_VOLUME:
+      GST_OBJECT_LOCK (fuse);
+      fuse->volume = g_value_get_double (value);
+      GST_OBJECT_UNLOCK (fuse);
+      update_mode (fuse);
+      break;
+    case PROP_MUTE:
+      GST_OBJECT_LOCK (fuse);
+      fuse->mute = g_value_get_boolean (value);
+      GST_OBJECT_UNLOCK (fuse);
+      update_mode (fuse);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+audio_fuse_get_property (GObject * object, guint prop_id, GValue * value,
+    GParamSpec * pspec)
+{
+  GstAudioFuse *fuse = GST_AUDIO_FUSE (object);
+
+  switch (prop_id) {
+    case PROP_VOLUME:
+      GST_OBJECT_LOCK (fuse);
+      g_value_set_double (value, fuse->volume);
+      GST_OBJECT_UNLOCK (fuse);
+      break;
+    case PROP_MUTE:
+      GST_OBJECT_LOCK (fuse);
+      g_value_set_boolean (value, fuse->mute);
+      GST_OBJECT_UNLOCK (fuse);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+audio_fuse_class_init (GstAudioFuseClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GstElementClass *element_class = GST_ELEMENT_CLASS (klass);
+  GstBaseTransformClass *trans_class = GST_BASE_TRANSFORM_CLASS (klass);
+  GParamFlags readwrite = (GParamFlags) (G_PARAM_READWRITE
+      | G_PARAM_STATIC_STRINGS);
+
+  select_kernels ();
+  gobject_class->set_property = audio_fuse_set_property;
+  gobject_class->get_property = audio_fuse_get_property;
+
+  g_object_class_install_property (gobject_class, PROP_VOLUME,
+      g_param_spec_double ("volume", "Volume",
+          "volume factor, 1.0=100%", 0.0, AUDIOFUSE_MAX_VOLUME,
+          AUDIOFUSE_DEFAULT_VOLUME, readwrite));
+  g_object_class_install_property (gobject_class, PROP_MUTE,
+      g_param_spec_boolean ("mute", "Mute", "mute channel", FALSE,
+          readwrite));
+
+  trans_class->transform = audio_fuse_transform;
+  trans_class->transform_ip = audio_fuse_transform_ip;
+  trans_class->transform_caps = audio_fuse_transform_caps;
+  trans_class->fixate_caps = audio_fuse_fixate_caps;
+  trans_class->set_caps = audio_fuse_set_caps;
+  trans_class->transform_size = audio_fuse_transform_size;
+  trans_class->query = audio_fuse_query;
+  trans_class->sink_event = audio_fuse_sink_event;
+  trans_class->stop = audio_fuse_stop;
+
+  gst_element_class_set_static_metadata (element_class, "Audio fuse",
+      "Filter/Converter/Audio", "Converts, resamples and applies the volume "
+      "in one pass", "gstreamer-remote-streaming");
+  gst_element_class_add_static_pad_template (element_class, &sink_template);
+  gst_element_class_add_static_pad_template (element_class, &src_template);
+}
+
+static void
+audio_fuse_init (GstAudioFuse * fuse)
+{
+  fuse->volume = AUDIOFUSE_DEFAULT_VOLUME;
+  gst_audio_info_init (&fuse->in_info);
+  gst_audio_info_init (&fuse->out_info);
+}
+
+static gpointer
+register_element (gpointer data)
+{
+  gst_element_register (NULL, "audiofuse", GST_RANK_NONE,
+      GST_TYPE_AUDIO_FUSE);
+  return NULL;
+}
+
+static void
+ensure_registered ()
+{
+  static GOnce once = G_ONCE_INIT;
+
+  g_once (&once, (GThreadFunc) register_element, NULL);
+}
+
+/* Filter the audio of the host pipelines with an audiofuse */
+void
+audiofuse_set_enabled (gboolean enabled)
+{
+  fuse_enabled = enabled;
+}
+
+/* The audio filter between the decoder and the encoder of a host pipeline,
+ * audioconvert, audioresample if asked for and volume in a bin, or an
+ * audiofuse in the fused mode. volume is set to the element taking the
+ * volume property */
+GstElement *
+audiofuse_chain_new (gboolean resample, GstElement ** volume)
+{
+  GstElement *bin, *convert, *resampler = NULL;
+  GstPad *pad;
+
+  *volume = NULL;
+  if (fuse_enabled) {
+    ensure_registered ();
+    *volume = gst_element_factory_make ("audiofuse", NULL);
+    return *volume;
+  }
+
+  bin = gst_bin_new (NULL);
+  convert = gst_element_factory_make ("audioconvert", NULL);
+  if (resample)
+    resampler = gst_element_factory_make ("audioresample", NULL);
+  *volume = gst_element_factory_make ("volume", NULL);
+  if (!convert || (resample && !resampler) || !*volume) {
+    g_printerr ("Audio filter elements could not be created.\n");
+    gst_object_unref (bin);
+    *volume = NULL;
+    return NULL;
+  }
+  gst_bin_add_many (GST_BIN (bin), convert, *volume, NULL);
+  if (resampler != NULL) {
+    gst_bin_add (GST_BIN (bin), resampler);
+    gst_element_link_many (convert, resampler, *volume, NULL);
+  } else {
+    gst_element_link (convert, *volume);
+  }
+
+  pad = gst_element_get_static_pad (convert, "sink");
+  gst_element_add_pad (bin, gst_ghost_pad_new ("sink", pad));
+  gst_object_unref (pad);
+  pad = gst_element_get_static_pad (*volume, "src");
+  gst_element_add_pad (bin, gst_ghost_pad_new ("src", pad));
+  gst_object_unref (pad);
+  return bin;
+}
+
+/* A buffer enters the chain under test */
+static GstPadProbeReturn
+bench_enter (GstPad * pad, GstPadProbeInfo * info, AudioFuseBenchTime * spent)
+{
+  spent->frames += gst_buffer_get_size (GST_PAD_PROBE_INFO_BUFFER (info))
+      / spent->bpf;
+  spent->enter = g_get_monotonic_time ();
+  return GST_PAD_PROBE_OK;
+}
+
+/* Output leaves the chain, what the fakesink takes is not counted */
+static GstPadProbeReturn
+bench_leave (GstPad * pad, GstPadProbeInfo * info, AudioFuseBenchTime * spent)
+{
+  if (spent->enter != 0) {
+    spent->total += g_get_monotonic_time () - spent->enter;
+    spent->enter = 0;
+  }
+  return GST_PAD_PROBE_OK;
+}
+
+/* Run seconds of stereo white noise from in_rate to S16LE at out_rate
+ * through the chain, all on the source thread, and return the input
+ * samples per second of time spent inside the chain */
+static gdouble
+bench_run (const gchar * format, gint in_rate, gint out_rate,
+    gboolean fused, gint seconds)
+{
+  AudioFuseBenchTime spent = { 0, 0, 0, 0 };
+  GError *error = NULL;
+  GstElement *pipeline, *first, *last;
+  GstPad *pad;
+  GstMessage *msg;
+  GstBus *bus;
+  gchar *desc;
+
+  spent.bpf = g_str_equal (format, "S16LE") ? 4 : 8;
+  desc = g_strdup_printf ("audiotestsrc wave=white-noise num-buffers=%d "
+      "samplesperbuffer=%d ! audio/x-raw,format=%s,layout=interleaved,"
+      "rate=%d,channels=2 ! %s ! audio/x-raw,format=S16LE,rate=%d,"
+      "channels=2 ! fakesink sync=false",
+      (gint) ((gint64) seconds * in_rate / AUDIOFUSE_BENCH_FRAMES),
+      AUDIOFUSE_BENCH_FRAMES, format, in_rate, fused
+      ? "audiofuse name=first volume=0.5"
+      : "audioconvert name=first ! audioresample ! volume volume=0.5 "
+      "name=last", out_rate);
+  pipeline = gst_parse_launch (desc, &error);
+  g_free (desc);
+  if (pipeline == NULL) {
+    g_printerr ("Benchmark pipeline could not be created: %s\n",
+        error->message);
+    g_error_free (error);
+    return 0.0;
+  }
+  first = gst_bin_get_by_name (GST_BIN (pipeline), "first");
+  last = gst_bin_get_by_name (GST_BIN (pipeline), fused ? "first" : "last");
+  pad = gst_element_get_static_pad (first, "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+      (GstPadProbeCallback) bench_enter, &spent, NULL);
+  gst_object_unref (pad);
+  pad = gst_element_get_static_pad (last, "src");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+      (GstPadProbeCallback) bench_leave, &spent, NULL);
+  gst_object_unref (pad);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  bus = gst_element_get_bus (pipeline);
+  msg = gst_bus_timed_pop_filtered (bus, GST_CLOCK_TIME_NONE,
+      (GstMessageType) (GST_MESSAGE_EOS | GST_MESSAGE_ERROR));
+  if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ERROR)
+    g_printerr ("Benchmark pipeline failed.\n");
+  gst_message_unref (msg);
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+
+  gst_object_unref (bus);
+  gst_object_unref (first);
+  gst_object_unref (last);
+  gst_object_unref (pipeline);
+  return spent.total > 0 ? spent.frames * 2.0 * G_USEC_PER_SEC / spent.total
+      : 0.0;
+}
+
+/* Samples per second of audioconvert ! audioresample ! volume against an
+ * audiofuse, for the formats and rates the decoders of the host pipelines
+ * put out */
+void
+audiofuse_benchmark (gint seconds)
+{
+  static const struct
+  {
+    const gchar *format;
+    gint in_rate;
+    gint out_rate;
+  } cases[] = {
+    {"F32LE", 44100, 48000}, {"S16LE", 44100, 48000},
+    {"F32LE", 48000, 48000}, {"S16LE", 48000, 48000}
+  };
+
+  ensure_registered ();
+  g_print ("Audio filters, %d s of stereo audio per run, %s kernels\n\n",
+      seconds, kernels->name);
+  g_print ("%-6s %6s %6s %14s %14s %8s\n", "format", "in", "out",
+      "chain Ms/s", "fused Ms/s", "speedup");
+  for (guint i = 0; i < G_N_ELEMENTS (cases); i++) {
+    gdouble chain = bench_run (cases[i].format, cases[i].in_rate,
+        cases[i].out_rate, FALSE, seconds);
+    gdouble fused = bench_run (cases[i].format, cases[i].in_rate,
+        cases[i].out_rate, TRUE, seconds);
+
+    g_print ("%-6s %6d %6d %14.1f %14.1f %7.1fx\n", cases[i].format,
+        cases[i].in_rate, cases[i].out_rate, chain / 1e6, fused / 1e6,
+        chain > 0.0 ? fused / chain : 0.0);
+  }
+}
@@ -0,0 +1,215 @@
+#include "control.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/* Structure for one client connected on the control port. Its commands
+ * are read on the main context of the stream it joined */
+typedef struct _ControlClient
+{
+  int fd;
+  GIOChannel *channel;
+  GMainContext *context;
+  GSource *watch;
+} ControlClient;
+
+/* Connected control clients of the streams. A stream only sees the
+ * clients of its own main context, the thread default one of the thread
+ * calling */
+static GSList *control_clients = NULL;
+static GMutex control_lock;
+
+/* Handlers for the commands sent by the clients, by command name */
+static GHashTable *control_handlers = NULL;
+
+/* Keepalive timer, NULL when not running */
+static GSource *keepalive = NULL;
+
+/* Seconds a stream waits for more clients after the last one joined */
+static gint join_window = CONTROL_JOIN_WINDOW;
+
+/* Dispatch a command line received from a client to its handler */
+static gboolean
+control_receive (GIOChannel * source, GIOCondition cond,
+    ControlClient * client)
+{
+  gchar *line = NULL;
+  GIOStatus status;
+
+  if (cond & (G_IO_HUP | G_IO_ERR))
+    return FALSE;
+
+  status = g_io_channel_read_line (source, &line, NULL, NULL, NULL);
+  if (status == G_IO_STATUS_EOF || status == G_IO_STATUS_ERROR)
+    return FALSE;
+  if (line != NULL) {
+    gchar **parts = g_strsplit (g_strstrip (line), " ", 2);
+    ControlHandler handler = NULL;
+
+    if (parts[0] != NULL && control_handlers != NULL)
+      handler = (ControlHandler) g_hash_table_lookup (control_handlers,
+          parts[0]);
+    if (handler != NULL)
+      handler (client->fd, parts[1] ? parts[1] : "");
+    g_strfreev (parts);
+    g_free (line);
+  }
+  return TRUE;
+}
+
+/* Remember a client socket accepted on the control port for the stream
+ * running on the context, NULL for the global default one. The socket is
+ * closed with the other clients of that stream */
+void
+control_add_session_client (int fd, GMainContext * context)
+{
+  ControlClient *client = g_new0 (ControlClient, 1);
+
+  client->fd = fd;
+  client->context = context ? g_main_context_ref (context) : NULL;
+  client->channel = g_io_channel_unix_new (fd);
+  g_io_channel_set_encoding (client->channel, NULL, NULL);
+  client->watch = g_io_create_watch (client->channel,
+      (GIOCondition) (G_IO_IN | G_IO_HUP | G_IO_ERR));
+  g_source_set_callback (client->watch, (GSourceFunc) control_receive,
+      client, NULL);
+  g_source_attach (client->watch, context);
+  g_mutex_lock (&control_lock);
+  control_clients = g_slist_append (control_clients, client);
+  g_mutex_unlock (&control_lock);
+}
+
+/* Remember a client socket of the stream of the calling thread */
+void
+control_add_client (int fd)
+{
+  control_add_session_client (fd, g_main_context_get_thread_default ());
+}
+
+/* Whether the client joined the stream of the calling thread */
+static gboolean
+own_client (ControlClient * client)
+{
+  return client->context == g_main_context_get_thread_default ();
+}
+
+/* Call the handler for every line starting with the command */
+void
+control_add_handler (const gchar * command, ControlHandler handler)
+{
+  if (control_handlers == NULL)
+    control_handlers = g_hash_table_new_full (g_str_hash, g_str_equal,
+        g_free, NULL);
+  g_hash_table_replace (control_handlers, g_strdup (command),
+      (gpointer) handler);
+}
+
+/* Number of clients connected for the current stream */
+guint
+control_client_count ()
+{
+  guint count = 0;
+
+  g_mutex_lock (&control_lock);
+  for (GSList * l = control_clients; l != NULL; l = l->next)
+    count += own_client ((ControlClient *) l->data);
+  g_mutex_unlock (&control_lock);
+  return count;
+}
+
+/* Wait that many seconds for more clients after the last one joined, 0
+ * starts streaming to the first client right away */
+void
+control_set_join_window (gint seconds)
+{
+  join_window = MAX (seconds, 0);
+}
+
+/* Seconds to wait for more clients after the last one joined */
+gint
+control_join_window ()
+{
+  return join_window;
+}
+
+/* Close the control sockets of the previous stream */
+void
+control_close_clients ()
+{
+  GMainContext *context = g_main_context_get_thread_default ();
+  GSList *l, *next;
+
+  /* The keepalive of another stream goes on */
+  if (keepalive != NULL && g_source_get_context (keepalive)
+      == (context ? context : g_main_context_default ()))
+    control_keepalive_stop ();
+  g_mutex_lock (&control_lock);
+  for (l = control_clients; l != NULL; l = next) {
+    ControlClient *client = (ControlClient *) l->data;
+
+    next = l->next;
+    if (!own_client (client))
+      continue;
+    control_clients = g_slist_delete_link (control_clients, l);
+    g_source_destroy (client->watch);
+    g_source_unref (client->watch);
+    g_io_channel_unref (client->channel);
+    if (client->context != NULL)
+      g_main_context_unref (client->context);
+    close (client->fd);
+    g_free (client);
+  }
+  g_mutex_unlock (&control_lock);
+}
+
+/* Send one command line to every connected client */
+void
+control_send (const gchar * command)
+{
+  GSList *l;
+  gchar *line = g_strdup_printf ("%s\n", command);
+  size_t len = strlen (line);
+
+  g_mutex_lock (&control_lock);
+  for (l = control_clients; l != NULL; l = l->next) {
+    ControlClient *client = (ControlClient *) l->data;
+    if (own_client (client) && send (client->fd, line, len,
+            MSG_NOSIGNAL) < 0) {
+      perror ("control send");
+    }
+  }
+  g_mutex_unlock (&control_lock);
+  g_free (line);
+}
+
+/* Keep the paused clients alive so that they hold their pipelines */
+static gboolean
+keepalive_cb (gpointer user_data)
+{
+  control_send (CONTROL_KEEPALIVE);
+  return TRUE;
+}
+
+/* Start sending keepalives, called when the host pipeline is paused. The
+ * timer runs on the context of the stream, whose clients it keeps alive */
+void
+control_keepalive_start ()
+{
+  if (keepalive != NULL)
+    return;
+  keepalive = g_timeout_source_new_seconds (CONTROL_KEEPALIVE_INTERVAL);
+  g_source_set_callback (keepalive, keepalive_cb, NULL, NULL);
+  g_source_attach (keepalive, g_main_context_get_thread_default ());
+}
+
+/* Stop sending keepalives */
+void
+control_keepalive_stop ()
+{
+  if (keepalive == NULL)
+    return;
+  g_source_destroy (keepalive);
+  g_source_unref (keepalive);
+  keepalive = NULL;
+}
@@ -0,0 +1,629 @@
+#include "encprofile.h"
+#include "sysstat.h"
+#include "encselect.h"
+#include <gst/video/video.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Synthetic moving content the profiles are measured on */
+#define ENCBENCH_WIDTH 1280
+#define ENCBENCH_HEIGHT 720
+#define ENCBENCH_FPS 30
+
+/* Encoders of the host pipelines with the elements to get back to raw
+ * video the way the clients do */
+static const gchar *encoders[][4] = {
+  {"x264enc", "rtph264pay", "rtph264depay", "avdec_h264"},
+  {"vp8enc", "rtpvp8pay", "rtpvp8depay", "vp8dec"},
+};
+
+/* Structure for the measurement of one profile with one encoder */
+typedef struct _EncBench
+{
+  GMutex lock;
+  GHashTable *frames;
+  GArray *latencies;
+  GstElement *sink;
+  guint64 bytes;
+  GstClockTime first;
+  GstClockTime last;
+  gdouble psnr_sum;
+  guint psnr_count;
+} EncBench;
+
+/* Keep the luma plane of every source frame to compare the decoded one */
+static GstPadProbeReturn
+source_probe (GstPad * pad, GstPadProbeInfo * info, EncBench * bench)
+{
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  GstMapInfo map;
+
+  if (!gst_buffer_map (buffer, &map, GST_MAP_READ))
+    return GST_PAD_PROBE_OK;
+  gint64 *pts = g_new (gint64, 1);
+  *pts = GST_BUFFER_PTS (buffer);
+  /* I420 at this size has no row padding, luma comes first */
+  GBytes *luma = g_bytes_new (map.data,
+      MIN (map.size, (gsize) ENCBENCH_WIDTH * ENCBENCH_HEIGHT));
+  gst_buffer_unmap (buffer, &map);
+
+  g_mutex_lock (&bench->lock);
+  g_hash_table_replace (bench->frames, pts, luma);
+  g_mutex_unlock (&bench->lock);
+  return GST_PAD_PROBE_OK;
+}
+
+/* Count the encoded bytes for the bitrate */
+static GstPadProbeReturn
+encoded_probe (GstPad * pad, GstPadProbeInfo * info, EncBench * bench)
+{
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+
+  g_mutex_lock (&bench->lock);
+  bench->bytes += gst_buffer_get_size (buffer);
+  if (GST_BUFFER_PTS_IS_VALID (buffer)) {
+    if (!GST_CLOCK_TIME_IS_VALID (bench->first))
+      bench->first = GST_BUFFER_PTS (buffer);
+    bench->last = MAX (bench->last, GST_BUFFER_PTS (buffer));
+  }
+  g_mutex_unlock (&bench->lock);
+  return GST_PAD_PROBE_OK;
+}
+
+/* Time from capture to decoded frame, and PSNR of the luma plane */
+static GstPadProbeReturn
+decoded_probe (GstPad * pad, GstPadProbeInfo * info, EncBench * bench)
+{
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  GstClock *clock = gst_element_get_clock (bench->sink);
+  GstCaps *caps = gst_pad_get_current_caps (pad);
+  gint64 pts = GST_BUFFER_PTS (buffer);
+  GstVideoInfo vinfo;
+  GstVideoFrame frame;
+  GBytes *luma = NULL;
+
+  if (clock != NULL) {
+    GstClockTime now = gst_clock_get_time (clock)
+        - gst_element_get_base_time (bench->sink);
+    gdouble latency = GST_CLOCK_DIFF (pts, now) / (gdouble) GST_MSECOND;
+    g_mutex_lock (&bench->lock);
+    g_array_append_val (bench->latencies, latency);
+    g_mutex_unlock (&bench->lock);
+    gst_object_unref (clock);
+  }
+
+  g_mutex_lock (&bench->lock);
+  if (g_hash_table_steal_extended (bench->frames, &pts, NULL,
+          (gpointer *) & luma) == FALSE)
+    luma = NULL;
+  g_mutex_unlock (&bench->lock);
+
+  if (luma != NULL && caps != NULL && gst_video_info_from_caps (&vinfo, caps)
+      && gst_video_frame_map (&frame, &vinfo, buffer, GST_MAP_READ)) {
+    const guint8 *src = (const guint8 *) g_bytes_get_data (luma, NULL);
+    gint width = MIN (GST_VIDEO_FRAME_WIDTH (&frame), ENCBENCH_WIDTH);
+    gint height = MIN (GST_VIDEO_FRAME_HEIGHT (&frame), ENCBENCH_HEIGHT);
+    gint stride = GST_VIDEO_FRAME_PLANE_STRIDE (&frame, 0);
+    const guint8 *dec = (const guint8 *) GST_VIDEO_FRAME_PLANE_DATA (&frame,
+        0);
+    gdouble sse = 0.0;
+
+    for (gint y = 0; y < height; y++) {
+      for (gint x = 0; x < width; x++) {
+        gint d = src[y * ENCBENCH_WIDTH + x] - dec[y * stride + x];
+        sse += d * d;
+      }
+    }
+    gst_video_frame_unmap (&frame);
+    gdouble mse = sse / ((gdouble) width * height);
+    g_mutex_lock (&bench->lock);
+    bench->psnr_sum += mse > 0.0 ? 10.0 * log10 (255.0 * 255.0 / mse) : 99.0;
+    bench->psnr_count++;
+    g_mutex_unlock (&bench->lock);
+  }
+  if (luma != NULL)
+    g_bytes_unref (luma);
+  if (caps != NULL)
+    gst_caps_unref (caps);
+  return GST_PAD_PROBE_OK;
+}
+
+static gint
+compare_double (gconstpointer a, gconstpointer b)
+{
+  gdouble x = *(const gdouble *) a, y = *(const gdouble *) b;
+  return x < y ? -1 : x > y;
+}
+
+static void
+add_probe (GstElement * element, const gchar * pad_name,
+    GstPadProbeCallback callback, gpointer bench)
+{
+  GstPad *pad = gst_element_get_static_pad (element, pad_name);
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, callback, bench, NULL);
+  gst_object_unref (pad);
+}
+
+/* Encode the synthetic content live for the given time with one encoder
+ * and profile and print one row of the table */
+static void
+bench_run (const gchar * const *names, EncoderProfile profile, gint seconds)
+{
+  GstElement *pipeline = gst_pipeline_new ("encbench-pipeline");
+  GstElement *source = gst_element_factory_make ("videotestsrc", NULL);
+  GstElement *capsfilter = gst_element_factory_make ("capsfilter", NULL);
+  GstElement *encoder = gst_element_factory_make (names[0], NULL);
+  GstElement *payloader = gst_element_factory_make (names[1], NULL);
+  GstElement *depayloader = gst_element_factory_make (names[2], NULL);
+  GstElement *decoder = gst_element_factory_make (names[3], NULL);
+  GstElement *sink = gst_element_factory_make ("fakesink", NULL);
+  EncBench bench;
+  GstCaps *caps;
+  GstBus *bus;
+  GstMessage *msg;
+
+  if (!pipeline || !source || !capsfilter || !encoder || !payloader
+      || !depayloader || !decoder || !sink) {
+    g_print ("%-18s %-8s not available\n", encprofile_settings (profile)->name,
+        names[0]);
+    return;
+  }
+
+  memset (&bench, 0, sizeof (bench));
+  g_mutex_init (&bench.lock);
+  bench.frames = g_hash_table_new_full (g_int64_hash, g_int64_equal, g_free,
+      (GDestroyNotify) g_bytes_unref);
+  bench.latencies = g_array_new (FALSE, FALSE, sizeof (gdouble));
+  bench.first = GST_CLOCK_TIME_NONE;
+  bench.sink = sink;
+
+  gst_bin_add_many (GST_BIN (pipeline), source, capsfilter, encoder,
+      payloader, depayloader, decoder, sink, NULL);
+  /* Moving colour bars keep the encoder busy with motion */
+  g_object_set (G_OBJECT (source), "is-live", TRUE, "pattern", 0,
+      "horizontal-speed", 4, NULL);
+  caps = gst_caps_new_simple ("video/x-raw", "format", G_TYPE_STRING, "I420",
+      "width", G_TYPE_INT, ENCBENCH_WIDTH, "height", G_TYPE_INT,
+      ENCBENCH_HEIGHT, "framerate", GST_TYPE_FRACTION, ENCBENCH_FPS, 1, NULL);
+  g_object_set (G_OBJECT (capsfilter), "caps", caps, NULL);
+  gst_caps_unref (caps);
+  encprofile_apply (encoder, profile);
+  /* The decoded frame is taken the moment it is ready */
+  g_object_set (G_OBJECT (sink), "sync", FALSE, NULL);
+
+  if (!gst_element_link_many (source, capsfilter, encoder, payloader,
+          depayloader, decoder, sink, NULL)) {
+    g_printerr ("Benchmark elements for %s are not linked.\n", names[0]);
+    gst_object_unref (pipeline);
+    return;
+  }
+  add_probe (capsfilter, "src", (GstPadProbeCallback) source_probe, &bench);
+  add_probe (encoder, "src", (GstPadProbeCallback) encoded_probe, &bench);
+  add_probe (sink, "sink", (GstPadProbeCallback) decoded_probe, &bench);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  bus = gst_element_get_bus (pipeline);
+  msg = gst_bus_timed_pop_filtered (bus, seconds * GST_SECOND,
+      (GstMessageType) (GST_MESSAGE_ERROR | GST_MESSAGE_EOS));
+  if (msg != NULL) {
+    g_printerr ("Benchmark of %s stopped early.\n", names[0]);
+    gst_message_unref (msg);
+  }
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+
+  gdouble mean = 0.0, p95 = 0.0, kbps = 0.0, psnr = 0.0;
+  guint count = bench.latencies->len;
+  if (count > 0) {
+    g_array_sort (bench.latencies, compare_double);
+    for (guint i = 0; i < count; i++)
+      mean += g_array_index (bench.latencies, gdouble, i) / count;
+    p95 = g_array_index (bench.latencies, gdouble, count * 95 / 100);
+  }
+  if (GST_CLOCK_TIME_IS_VALID (bench.first) && bench.last > bench.first)
+    kbps = bench.bytes * 8.0 / 1000.0
+        / ((bench.last - bench.first) / (gdouble) GST_SECOND);
+  if (bench.psnr_count > 0)
+    psnr = bench.psnr_sum / bench.psnr_count;
+  g_print ("%-18s %-8s %7.1f %7.1f %8.0f %7.2f %8.3f\n",
+      encprofile_settings (profile)->name, names[0], mean, p95, kbps, psnr,
+      kbps * 1000.0 / ((gdouble) ENCBENCH_WIDTH * ENCBENCH_HEIGHT
+          * ENCBENCH_FPS));
+
+  gst_object_unref (bus);
+  gst_object_unref (pipeline);
+  g_hash_table_destroy (bench.frames);
+  g_array_free (bench.latencies, TRUE);
+  g_mutex_clear (&bench.lock);
+}
+
+/* Measure every profile with every host encoder: latency from capture to
+ * decoded frame, without network and display, and bitrate against PSNR
+ * for the bitrate efficiency */
+void
+encoder_benchmark (gint seconds)
+{
+  g_print ("\nEncoder profiles: %dx%d@%d moving bars, %d s per run\n\n",
+      ENCBENCH_WIDTH, ENCBENCH_HEIGHT, ENCBENCH_FPS, seconds);
+  g_print ("%-18s %-8s %7s %7s %8s %7s %8s\n", "profile", "encoder",
+      "lat ms", "p95 ms", "kbit/s", "PSNR", "bits/px");
+  for (gint p = 0; p < ENC_PROFILE_COUNT; p++)
+    for (guint e = 0; e < G_N_ELEMENTS (encoders); e++)
+      bench_run (encoders[e], (EncoderProfile) p, seconds);
+  g_print ("\n");
+}
+
+/* Sizes and thread counts of the scaling benchmark */
+static const gint thread_sizes[][2] = {
+  {1280, 720}, {1920, 1080}, {3840, 2160}
+};
+
+static const gint thread_counts[] = { 1, 2, 4, 8, 16, 32 };
+
+/* Structure for the measurement of one encoder at one thread count */
+typedef struct _ThreadBench
+{
+  GMutex lock;
+  GHashTable *entered;
+  gint64 first_out;
+  gint64 last_out;
+  guint frames;
+  gdouble latency_sum;
+} ThreadBench;
+
+/* Remember when each frame went into the encoder */
+static GstPadProbeReturn
+thread_sink_probe (GstPad * pad, GstPadProbeInfo * info, ThreadBench * bench)
+{
+  gint64 *pts = g_new (gint64, 1);
+  gint64 *now = g_new (gint64, 1);
+
+  *pts = GST_BUFFER_PTS (GST_PAD_PROBE_INFO_BUFFER (info));
+  *now = g_get_monotonic_time ();
+  g_mutex_lock (&bench->lock);
+  g_hash_table_replace (bench->entered, pts, now);
+  g_mutex_unlock (&bench->lock);
+  return GST_PAD_PROBE_OK;
+}
+
+/* Time each frame spent in the encoder, and the output rate */
+static GstPadProbeReturn
+thread_src_probe (GstPad * pad, GstPadProbeInfo * info, ThreadBench * bench)
+{
+  gint64 pts = GST_BUFFER_PTS (GST_PAD_PROBE_INFO_BUFFER (info));
+  gint64 now = g_get_monotonic_time ();
+  gint64 *entered;
+
+  g_mutex_lock (&bench->lock);
+  entered = (gint64 *) g_hash_table_lookup (bench->entered, &pts);
+  if (entered != NULL) {
+    bench->latency_sum += (now - *entered) / 1000.0;
+    g_hash_table_remove (bench->entered, &pts);
+  }
+  if (bench->frames++ == 0)
+    bench->first_out = now;
+  bench->last_out = now;
+  g_mutex_unlock (&bench->lock);
+  return GST_PAD_PROBE_OK;
+}
+
+/* Encode the given number of frames as fast as possible and print fps and
+ * per-frame encoder latency */
+static void
+thread_run (const gchar * name, gint width, gint height, gint threads,
+    gint frames)
+{
+  GstElement *pipeline = gst_pipeline_new ("threadbench-pipeline");
+  GstElement *source = gst_element_factory_make ("videotestsrc", NULL);
+  GstElement *capsfilter = gst_element_factory_make ("capsfilter", NULL);
+  GstElement *queue = gst_element_factory_make ("queue", NULL);
+  GstElement *encoder = gst_element_factory_make (name, NULL);
+  GstElement *sink = gst_element_factory_make ("fakesink", NULL);
+  ThreadBench bench;
+  GstCaps *caps;
+  GstBus *bus;
+  GstMessage *msg;
+
+  if (!pipeline || !source || !capsfilter || !queue || !encoder || !sink) {
+    g_print ("%-8s not available\n", name);
+    return;
+  }
+  memset (&bench, 0, sizeof (bench));
+  g_mutex_init (&bench.lock);
+  bench.entered = g_hash_table_new_full (g_int64_hash, g_int64_equal, g_free,
+      g_free);
+
+  gst_bin_add_many (GST_BIN (pipeline), source, capsfilter, queue, encoder,
+      sink, NULL);
+  /* The queue lets the test source draw the next frames meanwhile */
+  g_object_set (G_OBJECT (source), "pattern", 0, "horizontal-speed", 4,
+      "num-buffers", frames, NULL);
+  caps = gst_caps_new_simple ("video/x-raw", "format", G_TYPE_STRING, "I420",
+      "width", G_TYPE_INT, width, "height", G_TYPE_INT, height,
+      "framerate", GST_TYPE_FRACTION, 30, 1, NULL);
+  g_object_set (G_OBJECT (capsfilter), "caps", caps, NULL);
+  gst_caps_unref (caps);
+  encprofile_apply (encoder, encprofile_default ());
+  encprofile_set_threads (encoder, threads);
+  g_object_set (G_OBJECT (sink), "sync", FALSE, NULL);
+
+  if (!gst_element_link_many (source, capsfilter, queue, encoder, sink, NULL)) {
+    g_printerr ("Benchmark elements for %s are not linked.\n", name);
+    gst_object_unref (pipeline);
+    return;
+  }
+  add_probe (encoder, "sink", (GstPadProbeCallback) thread_sink_probe,
+      &bench);
+  add_probe (encoder, "src", (GstPadProbeCallback) thread_src_probe, &bench);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  bus = gst_element_get_bus (pipeline);
+  msg = gst_bus_timed_pop_filtered (bus, GST_CLOCK_TIME_NONE,
+      (GstMessageType) (GST_MESSAGE_ERROR | GST_MESSAGE_EOS));
+  if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ERROR)
+    g_printerr ("Benchmark of %s failed.\n", name);
+  gst_message_unref (msg);
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+
+  gdouble seconds = (bench.last_out - bench.first_out)
+      / (gdouble) G_USEC_PER_SEC;
+  g_print ("%-8s %5dx%-5d %7d %8.1f %10.1f\n", name, width, height, threads,
+      seconds > 0.0 ? (bench.frames - 1) / seconds : 0.0,
+      bench.frames ? bench.latency_sum / bench.frames : 0.0);
+
+  gst_object_unref (bus);
+  gst_object_unref (pipeline);
+  g_hash_table_destroy (bench.entered);
+  g_mutex_clear (&bench.lock);
+}
+
+/* Encode synthetic 720p, 1080p and 4K with 1 to 32 threads, the fps show
+ * where adding threads stops paying off and the latency what the frame
+ * threads cost */
+void
+encoder_thread_benchmark (gint frames)
+{
+  g_print ("\nEncoder threads: %d frames of moving bars, %s profile, "
+      "%d cores\n\n", frames, encprofile_settings (encprofile_default ())->name,
+      g_get_num_processors ());
+  g_print ("%-8s %11s %7s %8s %10s\n", "encoder", "size", "threads", "fps",
+      "latency ms");
+  for (guint e = 0; e < G_N_ELEMENTS (encoders); e++)
+    for (guint s = 0; s < G_N_ELEMENTS (thread_sizes); s++)
+      for (guint t = 0; t < G_N_ELEMENTS (thread_counts); t++)
+        thread_run (encoders[e][0], thread_sizes[s][0], thread_sizes[s][1],
+            thread_counts[t], frames);
+  g_print ("\n");
+}
+
+/* Link the first decoded video pad, audio is left unlinked */
+static void
+corpus_pad_added (GstElement * decodebin, GstPad * pad, GstElement * queue)
+{
+  GstPad *sinkpad = gst_element_get_static_pad (queue, "sink");
+  GstCaps *caps = gst_pad_get_current_caps (pad);
+
+  if (caps == NULL)
+    caps = gst_pad_query_caps (pad, NULL);
+  if (!gst_pad_is_linked (sinkpad) && g_str_has_prefix (gst_structure_get_name
+          (gst_caps_get_structure (caps, 0)), "video/x-raw"))
+    gst_pad_link (pad, sinkpad);
+  gst_caps_unref (caps);
+  gst_object_unref (sinkpad);
+}
+
+/* Structure for the result of one codec on one file */
+typedef struct _CodecResult
+{
+  gdouble cpu_ms;
+  gdouble kbps;
+  gdouble psnr;
+  gdouble latency_ms;
+} CodecResult;
+
+/* Transcode the file to 720p with the encoder of the codec for the given
+ * time, paced to real time like a host pipeline, and decode it again.
+ * ENC_CODEC_COUNT only decodes and scales, the CPU of the others is
+ * counted from it. CPU is in ms per second of video, latency from the
+ * frame's time to its decoded copy. Returns FALSE when nothing was
+ * transcoded */
+static gboolean
+codec_run (const gchar * path, EncoderCodec codec, gint seconds,
+    CodecResult * result)
+{
+  gboolean baseline = codec == ENC_CODEC_COUNT;
+  GstElement *pipeline = gst_pipeline_new ("codecbench-pipeline");
+  GstElement *source = gst_element_factory_make ("filesrc", NULL);
+  GstElement *decodebin = gst_element_factory_make ("decodebin", NULL);
+  GstElement *queue = gst_element_factory_make ("queue", NULL);
+  GstElement *convert = gst_element_factory_make ("videoconvert", NULL);
+  GstElement *scale = gst_element_factory_make ("videoscale", NULL);
+  GstElement *capsfilter = gst_element_factory_make ("capsfilter", NULL);
+  GstElement *pace = gst_element_factory_make ("identity", NULL);
+  GstElement *encoder = baseline ? gst_element_factory_make ("identity",
+      NULL) : encselect_make (codec);
+  GstElement *decoder = baseline ? gst_element_factory_make ("identity",
+      NULL) : encselect_make_decoder (codec);
+  GstElement *sink = gst_element_factory_make ("fakesink", NULL);
+  EncBench bench;
+  GstCaps *caps;
+  GstBus *bus;
+  GstMessage *msg;
+  gboolean ok = FALSE;
+
+  if (!pipeline || !source || !decodebin || !queue || !convert || !scale
+      || !capsfilter || !pace || !encoder || !decoder || !sink)
+    return FALSE;
+  memset (&bench, 0, sizeof (bench));
+  g_mutex_init (&bench.lock);
+  bench.frames = g_hash_table_new_full (g_int64_hash, g_int64_equal, g_free,
+      (GDestroyNotify) g_bytes_unref);
+  bench.latencies = g_array_new (FALSE, FALSE, sizeof (gdouble));
+  bench.first = GST_CLOCK_TIME_NONE;
+  bench.sink = sink;
+
+  gst_bin_add_many (GST_BIN (pipeline), source, decodebin, queue, convert,
+      scale, capsfilter, pace, encoder, decoder, sink, NULL);
+  g_object_set (G_OBJECT (source), "location", path, NULL);
+  caps = gst_caps_new_simple ("video/x-raw", "format", G_TYPE_STRING, "I420",
+      "width", G_TYPE_INT, ENCBENCH_WIDTH, "height", G_TYPE_INT,
+      ENCBENCH_HEIGHT, NULL);
+  g_object_set (G_OBJECT (capsfilter), "caps", caps, NULL);
+  gst_caps_unref (caps);
+  g_object_set (G_OBJECT (pace), "sync", TRUE, NULL);
+  g_object_set (G_OBJECT (sink), "sync", FALSE, NULL);
+  if (!baseline) {
+    encprofile_apply (encoder, encprofile_default ());
+    encprofile_set_threads (encoder, 0);
+  }
+  g_signal_connect (decodebin, "pad-added", G_CALLBACK (corpus_pad_added),
+      queue);
+
+  if (!gst_element_link (source, decodebin)
+      || !gst_element_link_many (queue, convert, scale, capsfilter, pace,
+          encoder, decoder, sink, NULL)) {
+    gst_object_unref (pipeline);
+    g_hash_table_destroy (bench.frames);
+    g_array_free (bench.latencies, TRUE);
+    g_mutex_clear (&bench.lock);
+    return FALSE;
+  }
+  add_probe (encoder, "src", (GstPadProbeCallback) encoded_probe, &bench);
+  if (!baseline) {
+    add_probe (capsfilter, "src", (GstPadProbeCallback) source_probe,
+        &bench);
+    add_probe (sink, "sink", (GstPadProbeCallback) decoded_probe, &bench);
+  }
+
+  gdouble cpu_start = sysstat_cpu_seconds () * 1000.0;
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  bus = gst_element_get_bus (pipeline);
+  msg = gst_bus_timed_pop_filtered (bus, seconds * GST_SECOND,
+      (GstMessageType) (GST_MESSAGE_ERROR | GST_MESSAGE_EOS));
+  if (msg == NULL) {
+    /* Still running after the given time, drain what is encoded */
+    gst_element_send_event (pipeline, gst_event_new_eos ());
+    msg = gst_bus_timed_pop_filtered (bus, 5 * GST_SECOND,
+        (GstMessageType) (GST_MESSAGE_ERROR | GST_MESSAGE_EOS));
+  }
+  if (msg != NULL) {
+    ok = GST_MESSAGE_TYPE (msg) == GST_MESSAGE_EOS;
+    gst_message_unref (msg);
+  }
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gdouble cpu = sysstat_cpu_seconds () * 1000.0 - cpu_start;
+
+  memset (result, 0, sizeof (CodecResult));
+  if (ok && GST_CLOCK_TIME_IS_VALID (bench.first) && bench.last > bench.first) {
+    gdouble media = (bench.last - bench.first) / (gdouble) GST_SECOND;
+    guint count = bench.latencies->len;
+
+    result->cpu_ms = cpu / media;
+    result->kbps = bench.bytes * 8.0 / 1000.0 / media;
+    for (guint i = 0; i < count; i++)
+      result->latency_ms += g_array_index (bench.latencies, gdouble, i)
+          / count;
+    if (bench.psnr_count > 0)
+      result->psnr = bench.psnr_sum / bench.psnr_count;
+  } else {
+    ok = FALSE;
+  }
+
+  gst_object_unref (bus);
+  gst_object_unref (pipeline);
+  g_hash_table_destroy (bench.frames);
+  g_array_free (bench.latencies, TRUE);
+  g_mutex_clear (&bench.lock);
+  return ok;
+}
+
+static gint
+compare_path (gconstpointer a, gconstpointer b)
+{
+  return g_strcmp0 (*(const gchar * const *) a, *(const gchar * const *) b);
+}
+
+/* Compare the video codecs on a test corpus, a file or the files of a
+ * directory: bitrate and PSNR at the profile bitrate, encoder CPU on top
+ * of decoding the file and latency to the decoded frame. Every codec is
+ * encoded with the encoder picked for it on this host */
+void
+codec_benchmark (const gchar * corpus, gint seconds)
+{
+  GPtrArray *files = g_ptr_array_new_with_free_func (g_free);
+  CodecResult totals[ENC_CODEC_COUNT];
+  guint counts[ENC_CODEC_COUNT];
+  GDir *dir;
+
+  dir = g_dir_open (corpus, 0, NULL);
+  if (dir != NULL) {
+    const gchar *name;
+
+    while ((name = g_dir_read_name (dir)) != NULL) {
+      gchar *path = g_build_filename (corpus, name, NULL);
+      if (g_file_test (path, G_FILE_TEST_IS_REGULAR))
+        g_ptr_array_add (files, path);
+      else
+        g_free (path);
+    }
+    g_dir_close (dir);
+    g_ptr_array_sort (files, compare_path);
+  } else {
+    g_ptr_array_add (files, g_strdup (corpus));
+  }
+  memset (totals, 0, sizeof (totals));
+  memset (counts, 0, sizeof (counts));
+
+  g_print ("\nVideo codecs: %u file(s) at %dx%d, %d s per run, %s profile"
+      "\n\n", files->len, ENCBENCH_WIDTH, ENCBENCH_HEIGHT, seconds,
+      encprofile_settings (encprofile_default ())->name);
+  g_print ("%-24s %-5s %-12s %8s %7s %8s %7s\n", "file", "codec", "encoder",
+      "kbit/s", "PSNR", "cpu ms/s", "lat ms");
+  for (guint f = 0; f < files->len; f++) {
+    const gchar *path = (const gchar *) files->pdata[f];
+    gchar *base = g_path_get_basename (path);
+    CodecResult decode;
+
+    if (!codec_run (path, ENC_CODEC_COUNT, seconds, &decode)) {
+      g_print ("%-24.24s no video\n", base);
+      g_free (base);
+      continue;
+    }
+    for (gint c = 0; c < ENC_CODEC_COUNT; c++) {
+      EncoderCodec codec = (EncoderCodec) c;
+      CodecResult result;
+
+      if (!encselect_is_video (codec))
+        continue;
+      if (!codec_run (path, codec, seconds, &result)) {
+        g_print ("%-24.24s %-5s %-12s not available\n", base,
+            encselect_codec_name (codec), encselect_name (codec));
+        continue;
+      }
+      result.cpu_ms = MAX (result.cpu_ms - decode.cpu_ms, 0.0);
+      g_print ("%-24.24s %-5s %-12s %8.0f %7.2f %8.1f %7.1f\n", base,
+          encselect_codec_name (codec), encselect_name (codec), result.kbps,
+          result.psnr, result.cpu_ms, result.latency_ms);
+      totals[c].kbps += result.kbps;
+      totals[c].psnr += result.psnr;
+      totals[c].cpu_ms += result.cpu_ms;
+      totals[c].latency_ms += result.latency_ms;
+      counts[c]++;
+    }
+    g_free (base);
+  }
+
+  g_print ("\n%-24s %-5s %-12s %8s %7s %8s %7s\n", "mean", "codec",
+      "encoder", "kbit/s", "PSNR", "cpu ms/s", "lat ms");
+  for (gint c = 0; c < ENC_CODEC_COUNT; c++) {
+    if (counts[c] == 0)
+      continue;
+    g_print ("%-24s %-5s %-12s %8.0f %7.2f %8.1f %7.1f\n", "",
+        encselect_codec_name ((EncoderCodec) c),
+        encselect_name ((EncoderCodec) c), totals[c].kbps / counts[c],
+        totals[c].psnr / counts[c], totals[c].cpu_ms / counts[c],
+        totals[c].latency_ms / counts[c]);
+  }
+  g_print ("\n");
+  g_ptr_array_free (files, TRUE);
+}
@@ -0,0 +1,350 @@
+#include "encprofile.h"
+#include <string.h>
+
+/* x264enc tune flag that turns off everything adding frames of delay */
+#define X264_TUNE_ZEROLATENCY 4
+
+/* x264enc pass modes: single pass constant bitrate, and single pass
+ * constant rate factor ("qual"). The latter reads its CRF from the
+ * quantizer property and caps the rate by bitrate and VBV, unlike the
+ * constant quantizer mode 4 */
+#define X264_PASS_CBR 0
+#define X264_PASS_QUAL 5
+
+/* openh264enc rate-control modes */
+#define OPENH264_RC_QUALITY 0
+#define OPENH264_RC_BITRATE 1
+
+/* x265enc tune value of its zerolatency preset */
+#define X265_TUNE_ZEROLATENCY 4
+
+/* SVT-AV1 prediction structure without reordering */
+#define SVTAV1_PRED_LOW_DELAY 1
+
+/* Fastest presets of svtav1enc, rav1enc and av1enc */
+#define SVTAV1_MAX_PRESET 13
+#define RAV1E_MAX_SPEED 10
+#define AOM_MAX_CPU_USED 9
+
+/* Longest lookahead vp8enc accepts, and its most threads and token
+ * partitions (as a power of two) */
+#define VP8_MAX_LAG 25
+#define VP8_MAX_THREADS 64
+#define VP8_MAX_PARTITIONS 3
+
+/* Structure for a VP8 temporal layer pattern: the frame rate divider and
+ * cumulative bitrate share of each layer, then the layer, the reference
+ * flags and the layer sync flag of each frame of the period */
+typedef struct _Vp8LayerPattern
+{
+  gint periodicity;
+  const gchar *decimator;
+  gdouble share[ENC_MAX_LAYERS];
+  const gchar *layer_id;
+  const gchar *flags;
+  const gchar *sync;
+} Vp8LayerPattern;
+
+/* Patterns for 2 and 3 layers. A frame only references the base layer and
+ * the layers below its own, the top layers can be dropped on the way to a
+ * client without breaking the frames it still gets */
+static const Vp8LayerPattern vp8_layers[ENC_MAX_LAYERS - 1] = {
+  {2, "<2,1>", {0.6, 1.0}, "<0,1>",
+        "<no-ref-golden+no-ref-alt+no-upd-golden+no-upd-alt,"
+        "no-ref-golden+no-ref-alt+no-upd-last+no-upd-golden+no-upd-alt"
+        "+no-upd-entropy>",
+      "<false,true>"},
+  {4, "<4,2,1>", {0.4, 0.6, 1.0}, "<0,2,1,2>",
+        "<no-ref-golden+no-ref-alt+no-upd-golden+no-upd-alt,"
+        "no-ref-golden+no-ref-alt+no-upd-last+no-upd-golden+no-upd-alt"
+        "+no-upd-entropy,"
+        "no-ref-golden+no-ref-alt+no-upd-last+no-upd-alt+no-upd-entropy,"
+        "no-ref-alt+no-upd-last+no-upd-golden+no-upd-alt+no-upd-entropy>",
+      "<false,true,true,false>"},
+};
+
+/* Profiles by EncoderProfile. Ultra-low-latency encodes every frame on its
+ * own: no lookahead, no B-frames, slices across threads and a VBV of about
+ * one frame. Interactive allows a short lookahead and a small VBV for
+ * steadier quality, broadcast-quality trades seconds of delay for the best
+ * quality per bit */
+static const EncoderProfileSettings profiles[ENC_PROFILE_COUNT] = {
+  {"ultra-low-latency", 30, 0, 0, ENC_RATE_CBR, 2048, TRUE, 40, 1, 8, 1, 50},
+  {"interactive", 60, 10, 0, ENC_RATE_CBR, 2048, FALSE, 300, 2, 4, 1, 500},
+  {"broadcast-quality", 120, 40, 3, ENC_RATE_VBR, 2048, FALSE, 2000, 3, 1,
+      33000, 3000},
+};
+
+/* Profile of the sessions created from now on */
+static EncoderProfile default_profile = ENC_PROFILE_INTERACTIVE;
+
+const EncoderProfileSettings *
+encprofile_settings (EncoderProfile profile)
+{
+  return &profiles[profile];
+}
+
+gboolean
+encprofile_from_name (const gchar * name, EncoderProfile * profile)
+{
+  for (gint i = 0; i < ENC_PROFILE_COUNT; i++) {
+    if (!g_ascii_strcasecmp (name, profiles[i].name)) {
+      *profile = (EncoderProfile) i;
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+void
+encprofile_set_default (EncoderProfile profile)
+{
+  default_profile = profile;
+}
+
+EncoderProfile
+encprofile_default ()
+{
+  return default_profile;
+}
+
+/* Configure x264enc, openh264enc, x265enc, vp8enc, vp9enc or one of the
+ * AV1 encoders for the profile, other encoders keep their defaults. The
+ * x264 preset also sets the speed of the others, one step faster per
+ * preset */
+void
+encprofile_apply (GstElement * encoder, EncoderProfile profile)
+{
+  const EncoderProfileSettings *p = &profiles[profile];
+  GstElementFactory *factory = gst_element_get_factory (encoder);
+  const gchar *name = factory ? GST_OBJECT_NAME (factory) : "";
+
+  if (!strcmp (name, "x264enc")) {
+    g_object_set (G_OBJECT (encoder), "speed-preset", p->x264_preset,
+        "key-int-max", p->gop, "rc-lookahead", p->lookahead,
+        "bframes", p->bframes, "b-adapt", p->bframes > 0,
+        "sliced-threads", p->sliced_threads, "bitrate", p->bitrate,
+        "vbv-buf-capacity", p->vbv, NULL);
+    if (p->rate_control == ENC_RATE_VBR)
+      g_object_set (G_OBJECT (encoder), "pass", X264_PASS_QUAL, "quantizer",
+          ENC_VBR_QUANTIZER, NULL);
+    else
+      g_object_set (G_OBJECT (encoder), "pass", X264_PASS_CBR, NULL);
+    /* The lookahead thread buffers frames even with rc-lookahead 0 */
+    if (p->lookahead == 0 && p->bframes == 0)
+      g_object_set (G_OBJECT (encoder), "tune", X264_TUNE_ZEROLATENCY,
+          "sync-lookahead", 0, NULL);
+  } else if (!strcmp (name, "x265enc")) {
+    GString *options = g_string_new (NULL);
+
+    /* x265 wants its lookahead longer than the B-frame run */
+    g_string_printf (options, "bframes=%d", p->bframes);
+    if (p->lookahead > 0)
+      g_string_append_printf (options, ":rc-lookahead=%d",
+          MAX (p->lookahead, p->bframes + 1));
+    if (p->rate_control == ENC_RATE_VBR)
+      g_string_append_printf (options, ":crf=%d", ENC_VBR_QUANTIZER);
+    else
+      g_string_append_printf (options, ":vbv-maxrate=%d:vbv-bufsize=%d",
+          p->bitrate, MAX (p->bitrate * p->vbv / 1000, 1));
+    g_object_set (G_OBJECT (encoder), "speed-preset", p->x264_preset,
+        "key-int-max", p->gop, "bitrate", (guint) p->bitrate,
+        "option-string", options->str, NULL);
+    if (p->lookahead == 0 && p->bframes == 0)
+      g_object_set (G_OBJECT (encoder), "tune", X265_TUNE_ZEROLATENCY, NULL);
+    g_string_free (options, TRUE);
+  } else if (!strcmp (name, "vp8enc") || !strcmp (name, "vp9enc")) {
+    g_object_set (G_OBJECT (encoder), "deadline", (gint64) p->vp8_deadline,
+        "cpu-used", p->vp8_cpu_used, "keyframe-max-dist", p->gop,
+        "lag-in-frames", MIN (p->lookahead, VP8_MAX_LAG),
+        "auto-alt-ref", p->bframes > 0,
+        "end-usage", p->rate_control == ENC_RATE_CBR ? 1 : 0,
+        "target-bitrate", p->bitrate * 1000,
+        "buffer-size", p->vbv, "buffer-initial-size", p->vbv * 2 / 3,
+        "buffer-optimal-size", p->vbv * 5 / 6,
+        "token-partitions", p->sliced_threads ? 2 : 0, NULL);
+  } else if (!strcmp (name, "openh264enc")) {
+    /* OpenH264 has neither lookahead nor B-frames, it never delays frames */
+    g_object_set (G_OBJECT (encoder), "bitrate", p->bitrate * 1000,
+        "gop-size", p->gop, "complexity", MIN (p->x264_preset - 1, 2),
+        "rate-control", p->rate_control == ENC_RATE_CBR
+        ? OPENH264_RC_BITRATE : OPENH264_RC_QUALITY, NULL);
+  } else if (!strcmp (name, "svtav1enc")) {
+    g_object_set (G_OBJECT (encoder), "preset",
+        (guint) (SVTAV1_MAX_PRESET - p->x264_preset),
+        "target-bitrate", (guint) p->bitrate, "intra-period-length", p->gop,
+        NULL);
+    if (p->bframes == 0) {
+      gchar *options = g_strdup_printf ("pred-struct=%d:lookahead=%d",
+          SVTAV1_PRED_LOW_DELAY, p->lookahead);
+      g_object_set (G_OBJECT (encoder), "parameters-string", options, NULL);
+      g_free (options);
+    }
+  } else if (!strcmp (name, "av1enc")) {
+    g_object_set (G_OBJECT (encoder), "cpu-used",
+        MIN (p->vp8_cpu_used, AOM_MAX_CPU_USED),
+        "target-bitrate", (guint) p->bitrate,
+        "keyframe-max-dist", (guint) p->gop,
+        "lag-in-frames", (guint) p->lookahead, NULL);
+    gst_util_set_object_arg (G_OBJECT (encoder), "end-usage",
+        p->rate_control == ENC_RATE_CBR ? "cbr" : "vbr");
+    gst_util_set_object_arg (G_OBJECT (encoder), "usage-profile",
+        p->bframes > 0 ? "good" : "realtime");
+  } else if (!strcmp (name, "rav1enc")) {
+    g_object_set (G_OBJECT (encoder), "speed-preset",
+        (guint) MAX (RAV1E_MAX_SPEED + 2 - 2 * p->x264_preset, 0),
+        "bitrate", p->bitrate * 1000,
+        "max-key-frame-interval", (guint64) p->gop,
+        "low-latency", p->bframes == 0, NULL);
+  } else {
+    return;
+  }
+  g_print ("Encoder %s: %s profile\n", name, p->name);
+}
+
+/* Encoder threads, 0 lets x264enc, x265enc and the AV1 encoders pick and
+ * gives vp8enc and vp9enc one per core. VP8 only encodes in parallel
+ * across its token partitions, so it gets enough of them for the threads,
+ * VP9 and AV1 encode rows of tiles in parallel */
+void
+encprofile_set_threads (GstElement * encoder, gint threads)
+{
+  GstElementFactory *factory = gst_element_get_factory (encoder);
+  const gchar *name = factory ? GST_OBJECT_NAME (factory) : "";
+
+  if (!strcmp (name, "x264enc")) {
+    g_object_set (G_OBJECT (encoder), "threads", (guint) MAX (threads, 0),
+        NULL);
+  } else if (!strcmp (name, "x265enc")) {
+    gchar *options = NULL, *all;
+    gchar **list;
+    GString *kept = g_string_new (NULL);
+
+    /* Replace the pools of an earlier call, x265 takes the last one but
+     * the string would grow with every call */
+    g_object_get (G_OBJECT (encoder), "option-string", &options, NULL);
+    list = g_strsplit (options ? options : "", ":", -1);
+    for (gchar ** entry = list; *entry != NULL; entry++) {
+      if (**entry == '\0' || g_str_has_prefix (*entry, "pools="))
+        continue;
+      g_string_append_printf (kept, "%s%s", kept->len ? ":" : "", *entry);
+    }
+    if (threads > 0)
+      g_string_append_printf (kept, "%spools=%d", kept->len ? ":" : "",
+          threads);
+    all = g_string_free (kept, FALSE);
+    g_object_set (G_OBJECT (encoder), "option-string", all, NULL);
+    g_strfreev (list);
+    g_free (options);
+    g_free (all);
+  } else if (!strcmp (name, "vp9enc")) {
+    if (threads <= 0)
+      threads = g_get_num_processors ();
+    g_object_set (G_OBJECT (encoder), "threads", MIN (threads,
+            VP8_MAX_THREADS), "row-mt", TRUE, NULL);
+  } else if (!strcmp (name, "svtav1enc")) {
+    g_object_set (G_OBJECT (encoder), "logical-processors",
+        (guint) MAX (threads, 0), NULL);
+  } else if (!strcmp (name, "av1enc")) {
+    g_object_set (G_OBJECT (encoder), "threads", (guint) MAX (threads, 0),
+        "row-mt", TRUE, NULL);
+  } else if (!strcmp (name, "rav1enc")) {
+    g_object_set (G_OBJECT (encoder), "threads", (guint) MAX (threads, 0),
+        NULL);
+  } else if (!strcmp (name, "vp8enc")) {
+    gint partitions = 0, current = 0;
+
+    if (threads <= 0)
+      threads = g_get_num_processors ();
+    threads = MIN (threads, VP8_MAX_THREADS);
+    while ((1 << partitions) < threads && partitions < VP8_MAX_PARTITIONS)
+      partitions++;
+    g_object_get (G_OBJECT (encoder), "token-partitions", &current, NULL);
+    g_object_set (G_OBJECT (encoder), "threads", threads,
+        "token-partitions", MAX (current, partitions), NULL);
+  } else if (!strcmp (name, "openh264enc")) {
+    g_object_set (G_OBJECT (encoder), "multi-thread", (guint) MAX (threads, 0),
+        NULL);
+  } else {
+    return;
+  }
+  if (threads > 0)
+    g_print ("Encoder %s: %d threads\n", name, threads);
+  else
+    g_print ("Encoder %s: automatic threads\n", name);
+}
+
+/* Bitrate in kbit/s in place of the profile one */
+void
+encprofile_set_bitrate (GstElement * encoder, gint bitrate)
+{
+  GstElementFactory *factory = gst_element_get_factory (encoder);
+  const gchar *name = factory ? GST_OBJECT_NAME (factory) : "";
+
+  if (!strcmp (name, "x264enc"))
+    g_object_set (G_OBJECT (encoder), "bitrate", (guint) bitrate, NULL);
+  else if (!strcmp (name, "openh264enc"))
+    g_object_set (G_OBJECT (encoder), "bitrate", (guint) bitrate * 1000,
+        NULL);
+  else if (!strcmp (name, "vp8enc") || !strcmp (name, "vp9enc"))
+    g_object_set (G_OBJECT (encoder), "target-bitrate", bitrate * 1000, NULL);
+  else if (!strcmp (name, "x265enc"))
+    g_object_set (G_OBJECT (encoder), "bitrate", (guint) bitrate, NULL);
+  else if (!strcmp (name, "svtav1enc") || !strcmp (name, "av1enc"))
+    g_object_set (G_OBJECT (encoder), "target-bitrate", (guint) bitrate,
+        NULL);
+  else if (!strcmp (name, "rav1enc"))
+    g_object_set (G_OBJECT (encoder), "bitrate", bitrate * 1000, NULL);
+}
+
+/* Encode vp8enc in temporal layers at the bitrate in kbit/s, the layer of
+ * every frame goes to the payloader with it. FALSE for other encoders and
+ * for a single layer */
+gboolean
+encprofile_set_layers (GstElement * encoder, gint layers, gint bitrate)
+{
+  GstElementFactory *factory = gst_element_get_factory (encoder);
+  const gchar *name = factory ? GST_OBJECT_NAME (factory) : "";
+  const Vp8LayerPattern *p;
+  GString *bitrates;
+
+  if (strcmp (name, "vp8enc") || layers < 2)
+    return FALSE;
+  layers = MIN (layers, ENC_MAX_LAYERS);
+  p = &vp8_layers[layers - 2];
+
+  bitrates = g_string_new ("<");
+  for (gint i = 0; i < layers; i++)
+    g_string_append_printf (bitrates, "%s%d", i ? "," : "",
+        (gint) (p->share[i] * bitrate * 1000));
+  g_string_append (bitrates, ">");
+
+  /* An alt-ref frame would reference across the layers */
+  g_object_set (G_OBJECT (encoder), "auto-alt-ref", FALSE,
+      "temporal-scalability-number-layers", layers,
+      "temporal-scalability-periodicity", p->periodicity, NULL);
+  gst_util_set_object_arg (G_OBJECT (encoder), "error-resilient", "default");
+  gst_util_set_object_arg (G_OBJECT (encoder),
+      "temporal-scalability-rate-decimator", p->decimator);
+  gst_util_set_object_arg (G_OBJECT (encoder),
+      "temporal-scalability-target-bitrate", bitrates->str);
+  gst_util_set_object_arg (G_OBJECT (encoder),
+      "temporal-scalability-layer-id", p->layer_id);
+  gst_util_set_object_arg (G_OBJECT (encoder),
+      "temporal-scalability-layer-flags", p->flags);
+  gst_util_set_object_arg (G_OBJECT (encoder),
+      "temporal-scalability-layer-sync-flags", p->sync);
+  g_string_free (bitrates, TRUE);
+  g_print ("Encoder %s: %d temporal layers\n", name, layers);
+  return TRUE;
+}
+
+/* Share of the bitrate of the layers up to layer, of layers in all */
+gdouble
+encprofile_layer_share (gint layers, gint layer)
+{
+  if (layers < 2)
+    return 1.0;
+  layers = MIN (layers, ENC_MAX_LAYERS);
+  return vp8_layers[layers - 2].share[CLAMP (layer, 0, layers - 1)];
+}
@@ -0,0 +1,525 @@
+#include "encselect.h"
+#include "encprofile.h"
+#include "sysstat.h"
+#include <glib/gstdio.h>
+#include <gst/video/video.h>
+#include <math.h>
+#include <string.h>
+
+/* Structure for one codec of the matrix. The first candidate encoder is
+ * what the hosts always used, it is kept when no other candidate meets the
+ * targets. Video is decoded with the first installed decoder, to check the
+ * candidates and in the benchmarks, audio is not decoded */
+typedef struct _CodecEntry
+{
+  const gchar *name;
+  const gchar *candidates[4];
+  const gchar *decoders[3];
+  const gchar *payloader;
+} CodecEntry;
+
+static const CodecEntry codecs[ENC_CODEC_COUNT] = {
+  {"h264", {"x264enc", "openh264enc", NULL}, {"avdec_h264", "openh264dec",
+          NULL}, "rtph264pay"},
+  {"vp8", {"vp8enc", NULL}, {"vp8dec", NULL}, "rtpvp8pay"},
+  {"vp9", {"vp9enc", NULL}, {"vp9dec", NULL}, "rtpvp9pay"},
+  {"av1", {"svtav1enc", "av1enc", "rav1enc"}, {"dav1ddec", "av1dec", NULL},
+      "rtpav1pay"},
+  {"h265", {"x265enc", NULL}, {"avdec_h265", NULL}, "rtph265pay"},
+  {"opus", {"opusenc", NULL}, {NULL}, "rtpopuspay"},
+  {"mp3", {"lamemp3enc", "shineenc", NULL}, {NULL}, "rtpmpapay"},
+};
+
+/* Video codec of the sessions created from now on */
+static EncoderCodec default_video_codec = ENC_CODEC_COUNT;
+
+/* Encoder picked for each codec, NULL until encselect_init ran */
+static const gchar *selected[ENC_CODEC_COUNT];
+static GMutex select_lock;
+
+/* Structure for the measurement of one candidate encoder */
+typedef struct _SelectBench
+{
+  GMutex lock;
+  GHashTable *entered;
+  GHashTable *frames;
+  gdouble latency_sum;
+  guint latency_count;
+  gdouble psnr_sum;
+  guint psnr_count;
+} SelectBench;
+
+/* First installed decoder of the codec, NULL when none is */
+static const gchar *
+installed_decoder (EncoderCodec codec)
+{
+  for (gint i = 0; codecs[codec].decoders[i] != NULL; i++) {
+    GstElementFactory *factory =
+        gst_element_factory_find (codecs[codec].decoders[i]);
+
+    if (factory != NULL) {
+      gst_object_unref (factory);
+      return codecs[codec].decoders[i];
+    }
+  }
+  return NULL;
+}
+
+/* Remember when each frame went into the encoder, and its luma plane */
+static GstPadProbeReturn
+enter_probe (GstPad * pad, GstPadProbeInfo * info, SelectBench * bench)
+{
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  gint64 *pts = g_new (gint64, 1);
+  gint64 *now = g_new (gint64, 1);
+  GstMapInfo map;
+
+  *pts = GST_BUFFER_PTS (buffer);
+  *now = g_get_monotonic_time ();
+  g_mutex_lock (&bench->lock);
+  g_hash_table_replace (bench->entered, pts, now);
+  g_mutex_unlock (&bench->lock);
+
+  if (!gst_buffer_map (buffer, &map, GST_MAP_READ))
+    return GST_PAD_PROBE_OK;
+  pts = g_new (gint64, 1);
+  *pts = GST_BUFFER_PTS (buffer);
+  /* I420 at this size has no row padding, luma comes first */
+  GBytes *luma = g_bytes_new (map.data,
+      MIN (map.size, (gsize) ENCSELECT_WIDTH * ENCSELECT_HEIGHT));
+  gst_buffer_unmap (buffer, &map);
+  g_mutex_lock (&bench->lock);
+  g_hash_table_replace (bench->frames, pts, luma);
+  g_mutex_unlock (&bench->lock);
+  return GST_PAD_PROBE_OK;
+}
+
+/* Time the frame spent in the encoder */
+static GstPadProbeReturn
+encoded_probe (GstPad * pad, GstPadProbeInfo * info, SelectBench * bench)
+{
+  gint64 pts = GST_BUFFER_PTS (GST_PAD_PROBE_INFO_BUFFER (info));
+  gint64 now = g_get_monotonic_time ();
+  gint64 *entered;
+
+  g_mutex_lock (&bench->lock);
+  entered = (gint64 *) g_hash_table_lookup (bench->entered, &pts);
+  if (entered != NULL) {
+    bench->latency_sum += (now - *entered) / 1000.0;
+    bench->latency_count++;
+    g_hash_table_remove (bench->entered, &pts);
+  }
+  g_mutex_unlock (&bench->lock);
+  return GST_PAD_PROBE_OK;
+}
+
+/* PSNR of the decoded luma plane against the source frame */
+static GstPadProbeReturn
+decoded_probe (GstPad * pad, GstPadProbeInfo * info, SelectBench * bench)
+{
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  GstCaps *caps = gst_pad_get_current_caps (pad);
+  gint64 pts = GST_BUFFER_PTS (buffer);
+  GBytes *luma = NULL;
+  GstVideoInfo vinfo;
+  GstVideoFrame frame;
+
+  g_mutex_lock (&bench->lock);
+  if (g_hash_table_steal_extended (bench->frames, &pts, NULL,
+          (gpointer *) & luma) == FALSE)
+    luma = NULL;
+  g_mutex_unlock (&bench->lock);
+
+  if (luma != NULL && caps != NULL && gst_video_info_from_caps (&vinfo, caps)
+      && gst_video_frame_map (&frame, &vinfo, buffer, GST_MAP_READ)) {
+    const guint8 *src = (const guint8 *) g_bytes_get_data (luma, NULL);
+    const guint8 *dec = (const guint8 *) GST_VIDEO_FRAME_PLANE_DATA (&frame,
+        0);
+    gint width = MIN (GST_VIDEO_FRAME_WIDTH (&frame), ENCSELECT_WIDTH);
+    gint height = MIN (GST_VIDEO_FRAME_HEIGHT (&frame), ENCSELECT_HEIGHT);
+    gint stride = GST_VIDEO_FRAME_PLANE_STRIDE (&frame, 0);
+    gdouble sse = 0.0;
+
+    for (gint y = 0; y < height; y++) {
+      for (gint x = 0; x < width; x++) {
+        gint d = src[y * ENCSELECT_WIDTH + x] - dec[y * stride + x];
+        sse += d * d;
+      }
+    }
+    gst_video_frame_unmap (&frame);
+    gdouble mse = sse / ((gdouble) width * height);
+    g_mutex_lock (&bench->lock);
+    bench->psnr_sum += mse > 0.0 ? 10.0 * log10 (255.0 * 255.0 / mse) : 99.0;
+    bench->psnr_count++;
+    g_mutex_unlock (&bench->lock);
+  }
+  if (luma != NULL)
+    g_bytes_unref (luma);
+  if (caps != NULL)
+    gst_caps_unref (caps);
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+add_probe (GstElement * element, const gchar * pad_name,
+    GstPadProbeCallback callback, SelectBench * bench)
+{
+  GstPad *pad = gst_element_get_static_pad (element, pad_name);
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, callback, bench, NULL);
+  gst_object_unref (pad);
+}
+
+/* Encode the synthetic clip with one candidate. Video runs live with the
+ * default profile and is decoded again for the PSNR, audio runs as fast as
+ * it can. The result is CPU ms per second of media, which includes the
+ * reference decoder, the same for every candidate of a codec. Returns
+ * FALSE when the candidate failed */
+static gboolean
+select_run (EncoderCodec codec, const gchar * name, gdouble * cpu_ms,
+    gdouble * latency_ms, gdouble * psnr)
+{
+  gboolean video = encselect_is_video (codec);
+  const gchar *decoder_name = video ? installed_decoder (codec) : "identity";
+  GstElement *pipeline = gst_pipeline_new ("encselect-pipeline");
+  GstElement *source = gst_element_factory_make (video ? "videotestsrc" :
+      "audiotestsrc", NULL);
+  GstElement *capsfilter = gst_element_factory_make ("capsfilter", NULL);
+  GstElement *convert = gst_element_factory_make (video ? "identity" :
+      "audioconvert", NULL);
+  GstElement *encoder = gst_element_factory_make (name, NULL);
+  GstElement *decoder = decoder_name ?
+      gst_element_factory_make (decoder_name, NULL) : NULL;
+  GstElement *sink = gst_element_factory_make ("fakesink", NULL);
+  gboolean ok = FALSE;
+  SelectBench bench;
+  GstCaps *caps;
+  GstBus *bus;
+  GstMessage *msg;
+
+  if (!pipeline || !source || !capsfilter || !convert || !encoder
+      || !decoder || !sink)
+    return FALSE;
+  memset (&bench, 0, sizeof (bench));
+  g_mutex_init (&bench.lock);
+  bench.entered = g_hash_table_new_full (g_int64_hash, g_int64_equal, g_free,
+      g_free);
+  if (video)
+    bench.frames = g_hash_table_new_full (g_int64_hash, g_int64_equal,
+        g_free, (GDestroyNotify) g_bytes_unref);
+
+  gst_bin_add_many (GST_BIN (pipeline), source, capsfilter, convert, encoder,
+      decoder, sink, NULL);
+  if (video) {
+    g_object_set (G_OBJECT (source), "is-live", TRUE, "pattern", 0,
+        "horizontal-speed", 4, "num-buffers",
+        ENCSELECT_SECONDS * ENCSELECT_FPS, NULL);
+    caps = gst_caps_new_simple ("video/x-raw", "format", G_TYPE_STRING,
+        "I420", "width", G_TYPE_INT, ENCSELECT_WIDTH, "height", G_TYPE_INT,
+        ENCSELECT_HEIGHT, "framerate", GST_TYPE_FRACTION, ENCSELECT_FPS, 1,
+        NULL);
+    encprofile_apply (encoder, encprofile_default ());
+  } else {
+    /* 10 ms buffers of 48 kHz stereo */
+    g_object_set (G_OBJECT (source), "samplesperbuffer", 480, "num-buffers",
+        ENCSELECT_SECONDS * 100, NULL);
+    caps = gst_caps_new_simple ("audio/x-raw", "rate", G_TYPE_INT, 48000,
+        "channels", G_TYPE_INT, 2, NULL);
+  }
+  g_object_set (G_OBJECT (capsfilter), "caps", caps, NULL);
+  gst_caps_unref (caps);
+  g_object_set (G_OBJECT (sink), "sync", FALSE, NULL);
+
+  if (!gst_element_link_many (source, capsfilter, convert, encoder, decoder,
+          sink, NULL)) {
+    gst_object_unref (pipeline);
+    g_hash_table_destroy (bench.entered);
+    if (bench.frames != NULL)
+      g_hash_table_destroy (bench.frames);
+    g_mutex_clear (&bench.lock);
+    return FALSE;
+  }
+  if (video) {
+    add_probe (encoder, "sink", (GstPadProbeCallback) enter_probe, &bench);
+    add_probe (encoder, "src", (GstPadProbeCallback) encoded_probe, &bench);
+    add_probe (sink, "sink", (GstPadProbeCallback) decoded_probe, &bench);
+  }
+
+  gdouble cpu_start = sysstat_cpu_seconds () * 1000.0;
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  bus = gst_element_get_bus (pipeline);
+  msg = gst_bus_timed_pop_filtered (bus, 4 * ENCSELECT_SECONDS * GST_SECOND,
+      (GstMessageType) (GST_MESSAGE_ERROR | GST_MESSAGE_EOS));
+  if (msg != NULL) {
+    ok = GST_MESSAGE_TYPE (msg) == GST_MESSAGE_EOS;
+    gst_message_unref (msg);
+  }
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+
+  *cpu_ms = (sysstat_cpu_seconds () * 1000.0 - cpu_start)
+      / ENCSELECT_SECONDS;
+  *latency_ms = bench.latency_count ?
+      bench.latency_sum / bench.latency_count : 0.0;
+  *psnr = bench.psnr_count ? bench.psnr_sum / bench.psnr_count : 0.0;
+  /* Audio encoders frame their output differently, only video is timed */
+  if (video && (bench.latency_count == 0 || bench.psnr_count == 0))
+    ok = FALSE;
+
+  gst_object_unref (bus);
+  gst_object_unref (pipeline);
+  g_hash_table_destroy (bench.entered);
+  if (bench.frames != NULL)
+    g_hash_table_destroy (bench.frames);
+  g_mutex_clear (&bench.lock);
+  return ok;
+}
+
+/* Candidates whose plugin is installed */
+static GPtrArray *
+available_candidates (EncoderCodec codec)
+{
+  GPtrArray *available = g_ptr_array_new ();
+
+  for (gint i = 0; i < 4 && codecs[codec].candidates[i] != NULL; i++) {
+    GstElementFactory *factory =
+        gst_element_factory_find (codecs[codec].candidates[i]);
+
+    if (factory == NULL)
+      continue;
+    g_ptr_array_add (available, (gpointer) codecs[codec].candidates[i]);
+    gst_object_unref (factory);
+  }
+  g_ptr_array_add (available, NULL);
+  return available;
+}
+
+/* The cached choice when it was made on this host, with this GStreamer,
+ * from the same candidates and, for video, for the same profile */
+static const gchar *
+cached_choice (GKeyFile * cache, EncoderCodec codec, GPtrArray * available)
+{
+  const gchar *group = codecs[codec].name;
+  gchar *version = g_key_file_get_string (cache, "host", "gstreamer", NULL);
+  gchar **names = g_key_file_get_string_list (cache, group, "candidates",
+      NULL, NULL);
+  gchar *profile = g_key_file_get_string (cache, group, "profile", NULL);
+  gchar *choice = g_key_file_get_string (cache, group, "selected", NULL);
+  gchar *current = gst_version_string ();
+  const gchar *result = NULL;
+  gboolean valid = version != NULL && names != NULL && profile != NULL
+      && choice != NULL && !strcmp (version, current)
+      && (!encselect_is_video (codec)
+      || !strcmp (profile, encprofile_settings (encprofile_default ())->name))
+      && g_strv_length (names) == available->len - 1;
+
+  for (guint i = 0; valid && i < available->len - 1; i++)
+    valid = !strcmp (names[i], (const gchar *) available->pdata[i]);
+  for (guint i = 0; valid && i < available->len - 1; i++)
+    if (!strcmp (choice, (const gchar *) available->pdata[i]))
+      result = (const gchar *) available->pdata[i];
+
+  g_free (version);
+  g_strfreev (names);
+  g_free (profile);
+  g_free (choice);
+  g_free (current);
+  return result;
+}
+
+/* Benchmark the candidates of one codec and keep the one with the least
+ * CPU per second of media among those meeting the quality and latency
+ * targets of the default profile */
+static const gchar *
+select_codec (GKeyFile * cache, EncoderCodec codec, GPtrArray * available)
+{
+  EncoderProfile profile = encprofile_default ();
+  const gchar *best = NULL;
+  gdouble best_cpu = 0.0;
+
+  for (guint i = 0; i < available->len - 1; i++) {
+    const gchar *name = (const gchar *) available->pdata[i];
+    gdouble cpu_ms = 0.0, latency_ms = 0.0, psnr = 0.0;
+    gboolean passed = select_run (codec, name, &cpu_ms, &latency_ms, &psnr);
+
+    if (passed && encselect_is_video (codec))
+      passed = psnr >= ENCSELECT_MIN_PSNR
+          && latency_ms <= encprofile_settings (profile)->max_latency;
+    g_print ("%-6s %-12s %8.1f %8.1f %7.2f %s\n", codecs[codec].name, name,
+        cpu_ms, latency_ms, psnr, passed ? "yes" : "no");
+    gdouble result[] = { cpu_ms, latency_ms, psnr };
+    g_key_file_set_double_list (cache, codecs[codec].name, name, result, 3);
+    if (passed && (best == NULL || cpu_ms < best_cpu)) {
+      best = name;
+      best_cpu = cpu_ms;
+    }
+  }
+  return best;
+}
+
+/* Pick the encoder of the codecs from first to last that have none yet.
+ * The benchmark only runs for codecs with a choice, and only when the
+ * cache of this host does not hold a choice for the installed candidates;
+ * force runs it for all of them anyway */
+static void
+select_codecs (gint first, gint last, gboolean force)
+{
+  static gboolean header = FALSE;
+  GKeyFile *cache;
+  gboolean changed = FALSE, pending = force;
+  gchar *dir, *file, *path;
+
+  g_mutex_lock (&select_lock);
+  for (gint codec = first; codec <= last; codec++)
+    pending |= selected[codec] == NULL;
+  if (!pending) {
+    g_mutex_unlock (&select_lock);
+    return;
+  }
+
+  cache = g_key_file_new ();
+  dir = g_build_filename (g_get_user_cache_dir (),
+      "gstreamer-remote-streaming", NULL);
+  file = g_strdup_printf ("encoders-%s.ini", g_get_host_name ());
+  path = g_build_filename (dir, file, NULL);
+  g_key_file_load_from_file (cache, path, G_KEY_FILE_NONE, NULL);
+
+  for (gint codec = first; codec <= last; codec++) {
+    GPtrArray *available;
+    const gchar *choice = NULL;
+
+    if (selected[codec] != NULL && !force)
+      continue;
+    available = available_candidates ((EncoderCodec) codec);
+    if (available->len <= 2) {
+      choice = available->len == 2 ? (const gchar *) available->pdata[0] :
+          NULL;
+    } else if (!force) {
+      choice = cached_choice (cache, (EncoderCodec) codec, available);
+    }
+    if (choice == NULL && available->len > 2) {
+      if (!header) {
+        g_print ("\nEncoder selection: %d s of %dx%d@%d moving bars, "
+            "%s profile\n\n", ENCSELECT_SECONDS, ENCSELECT_WIDTH,
+            ENCSELECT_HEIGHT, ENCSELECT_FPS,
+            encprofile_settings (encprofile_default ())->name);
+        g_print ("%-6s %-12s %8s %8s %7s %s\n", "codec", "encoder",
+            "cpu ms/s", "lat ms", "PSNR", "meets");
+        header = TRUE;
+      }
+      choice = select_codec (cache, (EncoderCodec) codec, available);
+      g_key_file_set_string_list (cache, codecs[codec].name, "candidates",
+          (const gchar * const *) available->pdata, available->len - 1);
+      g_key_file_set_string (cache, codecs[codec].name, "profile",
+          encprofile_settings (encprofile_default ())->name);
+      g_key_file_set_string (cache, codecs[codec].name, "selected",
+          choice ? choice : codecs[codec].candidates[0]);
+      changed = TRUE;
+    }
+    selected[codec] = choice ? choice : codecs[codec].candidates[0];
+    g_print ("Encoder for %s: %s\n", codecs[codec].name, selected[codec]);
+    g_ptr_array_free (available, TRUE);
+  }
+
+  if (changed) {
+    gchar *version = gst_version_string ();
+    g_key_file_set_string (cache, "host", "name", g_get_host_name ());
+    g_key_file_set_string (cache, "host", "gstreamer", version);
+    g_mkdir_with_parents (dir, 0755);
+    if (!g_key_file_save_to_file (cache, path, NULL))
+      g_printerr ("Could not write the encoder cache %s\n", path);
+    g_free (version);
+  }
+  g_mutex_unlock (&select_lock);
+
+  g_key_file_free (cache);
+  g_free (dir);
+  g_free (file);
+  g_free (path);
+}
+
+/* Pick the encoder of every codec, force benchmarks the candidates again.
+ * Called once at startup, before any session is accepted, so that no
+ * session thread waits for the benchmark */
+void
+encselect_init (gboolean force)
+{
+  select_codecs (0, ENC_CODEC_COUNT - 1, force);
+}
+
+/* Create the encoder picked for the codec by encselect_init, the first
+ * candidate when it did not run */
+GstElement *
+encselect_make (EncoderCodec codec)
+{
+  return gst_element_factory_make (encselect_name (codec), NULL);
+}
+
+const gchar *
+encselect_name (EncoderCodec codec)
+{
+  const gchar *name = selected[codec];
+
+  return name != NULL ? name : codecs[codec].candidates[0];
+}
+
+gboolean
+encselect_codec_from_name (const gchar * name, EncoderCodec * codec)
+{
+  for (gint i = 0; i < ENC_CODEC_COUNT; i++) {
+    if (!g_ascii_strcasecmp (name, codecs[i].name)) {
+      *codec = (EncoderCodec) i;
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+const gchar *
+encselect_codec_name (EncoderCodec codec)
+{
+  return codecs[codec].name;
+}
+
+gboolean
+encselect_is_video (EncoderCodec codec)
+{
+  return codecs[codec].decoders[0] != NULL;
+}
+
+void
+encselect_set_video_codec (EncoderCodec codec)
+{
+  default_video_codec = codec;
+}
+
+EncoderCodec
+encselect_default_video_codec ()
+{
+  return default_video_codec;
+}
+
+/* Video codec the session streams in, the host's own codec unless one was
+ * picked for the session */
+EncoderCodec
+encselect_video_codec (StreamSession * session, EncoderCodec host_codec)
+{
+  if (session->video_codec < ENC_CODEC_COUNT
+      && encselect_is_video (session->video_codec))
+    return session->video_codec;
+  return host_codec;
+}
+
+/* Create the RTP payloader of the codec */
+GstElement *
+encselect_make_payloader (EncoderCodec codec)
+{
+  return gst_element_factory_make (codecs[codec].payloader, NULL);
+}
+
+/* Create the first installed decoder of a video codec */
+GstElement *
+encselect_make_decoder (EncoderCodec codec)
+{
+  const gchar *name = installed_decoder (codec);
+
+  return name ? gst_element_factory_make (name, NULL) : NULL;
+}
@@ -0,0 +1,616 @@
+#include "fanoutsink.h"
+#include "encprofile.h"
+#include "encselect.h"
+#include "sysstat.h"
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Generic segmentation offload on UDP sockets, Linux 4.18 and later */
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+enum
+{
+  PROP_0,
+  PROP_CLIENTS,
+  PROP_BUFFER_SIZE,
+  PROP_GSO,
+  PROP_PACKETS,
+  PROP_SYSCALLS
+};
+
+/* Whether the host pipelines send their RTP through fanoutsinks */
+static gboolean fanout_enabled = FALSE;
+
+/* Structure for a run of packets of a buffer list sent as one message:
+ * its first packet, its iovecs, the size of its segments, all but the last
+ * one full */
+typedef struct _FanoutGroup
+{
+  guint packet;
+  guint iov;
+  guint n_iov;
+  gsize segment;
+  guint count;
+  gsize bytes;
+  gboolean tail;
+  union
+  {
+    struct cmsghdr align;
+    gchar buf[CMSG_SPACE (sizeof (guint16))];
+  } control;
+} FanoutGroup;
+
+/* Structure for counting what a stock udpsink is given in the benchmark,
+ * it sends all clients of a render with sendmmsg as well */
+typedef struct _FanoutBenchCount
+{
+  guint destinations;
+  guint64 packets;
+  guint64 syscalls;
+} FanoutBenchCount;
+
+static GstStaticPadTemplate sink_template = GST_STATIC_PAD_TEMPLATE ("sink",
+    GST_PAD_SINK, GST_PAD_ALWAYS, GST_STATIC_CAPS_ANY);
+
+G_DEFINE_TYPE (GstFanoutSink, fanout_sink, GST_TYPE_BASE_SINK);
+
+/* IPv4 addresses of "host:port,..." clients, the ones that do not resolve
+ * are left out */
+static GArray *
+parse_clients (const gchar * clients)
+{
+  GArray *destinations = g_array_new (FALSE, TRUE,
+      sizeof (FanoutDestination));
+  gchar **list = g_strsplit (clients ? clients : "", ",", -1);
+
+  for (gchar ** client = list; *client != NULL; client++) {
+    gchar *colon = strrchr (*client, ':');
+    struct addrinfo hints, *result = NULL;
+    FanoutDestination destination;
+
+    if (colon == NULL || colon == *client)
+      continue;
+    *colon = '\0';
+    memset (&hints, 0, sizeof (hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = AI_NUMERICSERV;
+    if (getaddrinfo (*client, colon + 1, &hints, &result) != 0) {
+      g_printerr ("fanoutsink: %s could not be resolved.\n", *client);
+      continue;
+    }
+    memset (&destination, 0, sizeof (destination));
+    memcpy (&destination.address, result->ai_addr, result->ai_addrlen);
+    destination.length = result->ai_addrlen;
+    g_array_append_val (destinations, destination);
+    freeaddrinfo (result);
+  }
+  g_strfreev (list);
+  return destinations;
+}
+
+static void
+fanout_sink_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstFanoutSink *sink = GST_FANOUT_SINK (object);
+  GArray *destinations;
+
+  switch (prop_id) {
+    case PROP_CLIENTS:
+      destinations = parse_clients (g_value_get_string (value));
+      GST_OBJECT_LOCK (sink);
+      g_free (sink->clients);
+      sink->clients = g_value_dup_string (value);
+      g_array_unref (sink->destinations);
+      sink->destinations = destinations;
+      GST_OBJECT_UNLOCK (sink);
+      break;
+    case PROP_BUFFER_SIZE:
+      sink->buffer_size = g_value_get_int (value);
+      break;
+    case PROP_GSO:
+      GST_OBJECT_LOCK (sink);
+      sink->gso = g_value_get_boolean (value);
+      GST_OBJECT_UNLOCK (sink);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+fanout_sink_get_property (GObject * object, guint prop_id, GValue * value,
+    GParamSpec * pspec)
+{
+  GstFanoutSink *sink = GST_FANOUT_SINK (object);
+
+  GST_OBJECT_LOCK (sink);
+  switch (prop_id) {
+    case PROP_CLIENTS:
+      g_value_set_string (value, sink->clients);
+      break;
+    case PROP_BUFFER_SIZE:
+      g_value_set_int (value, sink->buffer_size);
+      break;
+    case PROP_GSO:
+      g_value_set_boolean (value, sink->gso);
+      break;
+    case PROP_PACKETS:
+      g_value_set_uint64 (value, sink->packets);
+      break;
+    case PROP_SYSCALLS:
+      g_value_set_uint64 (value, sink->syscalls);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+  GST_OBJECT_UNLOCK (sink);
+}
+
+static gboolean
+fanout_sink_start (GstBaseSink * basesink)
+{
+  GstFanoutSink *sink = GST_FANOUT_SINK (basesink);
+  gint value = 0;
+
+  sink->fd = socket (AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (sink->fd < 0) {
+    GST_ELEMENT_ERROR (sink, RESOURCE, OPEN_WRITE, (NULL),
+        ("socket: %s", g_strerror (errno)));
+    return FALSE;
+  }
+  if (sink->buffer_size > 0)
+    setsockopt (sink->fd, SOL_SOCKET, SO_SNDBUF, &sink->buffer_size,
+        sizeof (sink->buffer_size));
+  /* A segment size of 0 sends as usual, the kernel only tells if it knows
+   * the option */
+  sink->gso_supported = setsockopt (sink->fd, SOL_UDP, UDP_SEGMENT, &value,
+      sizeof (value)) == 0;
+  return TRUE;
+}
+
+static gboolean
+fanout_sink_stop (GstBaseSink * basesink)
+{
+  GstFanoutSink *sink = GST_FANOUT_SINK (basesink);
+
+  if (sink->fd >= 0)
+    close (sink->fd);
+  sink->fd = -1;
+  return TRUE;
+}
+
+/* The messages from index from on again, every packet of a UDP_SEGMENT
+ * message in a message of its own. starts holds the first iovec of every
+ * packet and the end of the last one */
+static struct mmsghdr *
+split_messages (struct mmsghdr *msgs, guint from, guint * total,
+    const FanoutGroup * groups, guint n_groups, const guint * starts,
+    struct iovec *iov)
+{
+  struct mmsghdr *split;
+  guint n = 0, k = 0;
+
+  for (guint m = from; m < *total; m++)
+    n += groups[m % n_groups].count;
+  split = g_new0 (struct mmsghdr, n);
+  for (guint m = from; m < *total; m++) {
+    const FanoutGroup *group = &groups[m % n_groups];
+
+    for (guint p = group->packet; p < group->packet + group->count; p++) {
+      struct msghdr *header = &split[k++].msg_hdr;
+
+      header->msg_name = msgs[m].msg_hdr.msg_name;
+      header->msg_namelen = msgs[m].msg_hdr.msg_namelen;
+      header->msg_iov = &iov[starts[p]];
+      header->msg_iovlen = starts[p + 1] - starts[p];
+    }
+  }
+  g_free (msgs);
+  *total = n;
+  return split;
+}
+
+/* Send every packet of the list to every client. The packets are mapped
+ * memory by memory into iovecs, nothing is copied, and each run of one
+ * size becomes one UDP_SEGMENT message per client */
+static GstFlowReturn
+fanout_sink_render_list (GstBaseSink * basesink, GstBufferList * list)
+{
+  GstFanoutSink *sink = GST_FANOUT_SINK (basesink);
+  guint n = gst_buffer_list_length (list);
+  guint n_mem = 0, n_iov = 0, n_groups = 0, n_packets = 0, total, sent = 0;
+  guint64 packets = 0, messages = 0, syscalls = 0;
+  GArray *destinations;
+  GstMapInfo *maps;
+  guint *starts;
+  struct iovec *iov;
+  struct mmsghdr *msgs;
+  FanoutGroup *groups;
+  gboolean gso;
+
+  GST_OBJECT_LOCK (sink);
+  destinations = g_array_ref (sink->destinations);
+  gso = sink->gso && sink->gso_supported;
+  GST_OBJECT_UNLOCK (sink);
+  if (n == 0 || destinations->len == 0) {
+    g_array_unref (destinations);
+    return GST_FLOW_OK;
+  }
+
+  for (guint i = 0; i < n; i++)
+    n_mem += gst_buffer_n_memory (gst_buffer_list_get (list, i));
+  maps = g_new (GstMapInfo, n_mem);
+  iov = g_new (struct iovec, n_mem);
+  groups = g_new0 (FanoutGroup, n);
+  starts = g_new (guint, n + 1);
+
+  for (guint i = 0; i < n; i++) {
+    GstBuffer *buffer = gst_buffer_list_get (list, i);
+    FanoutGroup *group = n_groups ? &groups[n_groups - 1] : NULL;
+    gsize size = gst_buffer_get_size (buffer);
+    guint first = n_iov;
+    gboolean mapped = TRUE;
+
+    for (guint j = 0; j < gst_buffer_n_memory (buffer); j++) {
+      mapped = gst_memory_map (gst_buffer_peek_memory (buffer, j),
+          &maps[n_iov], GST_MAP_READ);
+      if (!mapped)
+        break;
+      iov[n_iov].iov_base = maps[n_iov].data;
+      iov[n_iov].iov_len = maps[n_iov].size;
+      n_iov++;
+    }
+    /* A packet missing a part would reach the clients corrupt */
+    if (!mapped) {
+      g_printerr ("fanoutsink: packet not readable, dropped.\n");
+      while (n_iov > first) {
+        n_iov--;
+        gst_memory_unmap (maps[n_iov].memory, &maps[n_iov]);
+      }
+      continue;
+    }
+    starts[n_packets++] = first;
+
+    if (gso && group != NULL && !group->tail && size <= group->segment
+        && group->count < FANOUT_MAX_SEGMENTS
+        && group->bytes + size <= FANOUT_MAX_GSO_BYTES) {
+      group->n_iov += n_iov - first;
+      group->count++;
+      group->bytes += size;
+      group->tail = size < group->segment;
+    } else {
+      group = &groups[n_groups++];
+      group->packet = n_packets - 1;
+      group->iov = first;
+      group->n_iov = n_iov - first;
+      group->segment = size;
+      group->count = 1;
+      group->bytes = size;
+    }
+  }
+
+  starts[n_packets] = n_iov;
+  if (n_groups == 0) {
+    g_free (starts);
+    g_free (groups);
+    g_free (iov);
+    g_free (maps);
+    g_array_unref (destinations);
+    return GST_FLOW_OK;
+  }
+
+  for (guint g = 0; g < n_groups; g++) {
+    struct cmsghdr *cmsg = (struct cmsghdr *) groups[g].control.buf;
+
+    cmsg->cmsg_level = SOL_UDP;
+    cmsg->cmsg_type = UDP_SEGMENT;
+    cmsg->cmsg_len = CMSG_LEN (sizeof (guint16));
+    *(guint16 *) CMSG_DATA (cmsg) = groups[g].segment;
+  }
+
+  /* Client after client, each gets its packets in order */
+  total = n_groups * destinations->len;
+  msgs = g_new0 (struct mmsghdr, total);
+  for (guint d = 0; d < destinations->len; d++) {
+    FanoutDestination *destination =
+        &g_array_index (destinations, FanoutDestination, d);
+
+    for (guint g = 0; g < n_groups; g++) {
+      struct msghdr *header = &msgs[d * n_groups + g].msg_hdr;
+
+      header->msg_name = &destination->address;
+      header->msg_namelen = destination->length;
+      header->msg_iov = &iov[groups[g].iov];
+      header->msg_iovlen = groups[g].n_iov;
+      if (groups[g].count > 1) {
+        header->msg_control = groups[g].control.buf;
+        header->msg_controllen = sizeof (groups[g].control.buf);
+      }
+    }
+  }
+
+  while (sent < total) {
+    gint ret = sendmmsg (sink->fd, msgs + sent, MIN (total - sent,
+            FANOUT_BATCH), 0);
+
+    syscalls++;
+    if (ret < 0 && errno == EINTR)
+      continue;
+    if (ret < 0) {
+      /* A device that can not segment fails the message. It goes out
+       * again with the rest of the list packet by packet, and so do the
+       * next lists */
+      if (gso && (errno == EIO || errno == EINVAL)) {
+        g_printerr ("fanoutsink: UDP_SEGMENT not usable, sending packets "
+            "one by one.\n");
+        GST_OBJECT_LOCK (sink);
+        sink->gso_supported = FALSE;
+        GST_OBJECT_UNLOCK (sink);
+        gso = FALSE;
+        msgs = split_messages (msgs, sent, &total, groups, n_groups, starts,
+            iov);
+        sent = 0;
+        continue;
+      }
+      /* Like udpsink, a client that can not be reached is skipped */
+      sent++;
+      continue;
+    }
+    for (gint i = 0; i < ret; i++)
+      packets += gso ? groups[(sent + i) % n_groups].count : 1;
+    messages += ret;
+    sent += ret;
+  }
+
+  GST_OBJECT_LOCK (sink);
+  sink->packets += packets;
+  sink->messages += messages;
+  sink->syscalls += syscalls;
+  GST_OBJECT_UNLOCK (sink);
+
+  for (guint i = 0; i < n_iov; i++)
+    gst_memory_unmap (maps[i].memory, &maps[i]);
+  g_free (msgs);
+  g_free (starts);
+  g_free (groups);
+  g_free (iov);
+  g_free (maps);
+  g_array_unref (destinations);
+  return GST_FLOW_OK;
+}
+
+static GstFlowReturn
+fanout_sink_render (GstBaseSink * basesink, GstBuffer * buffer)
+{
+  GstBufferList *list = gst_buffer_list_new_sized (1);
+  GstFlowReturn ret;
+
+  gst_buffer_list_add (list, gst_buffer_ref (buffer));
+  ret = fanout_sink_render_list (basesink, list);
+  gst_buffer_list_unref (list);
+  return ret;
+}
+
+static void
+fanout_sink_finalize (GObject * object)
+{
+  GstFanoutSink *sink = GST_FANOUT_SINK (object);
+
+  g_free (sink->clients);
+  g_array_unref (sink->destinations);
+  G_OBJECT_CLASS (fanout_sink_parent_class)->finalize (object);
+}
+
+static void
+fanout_sink_class_init (GstFanoutSinkClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GstElementClass *element_class = GST_ELEMENT_CLASS (klass);
+  GstBaseSinkClass *basesink_class = GST_BASE_SINK_CLASS (klass);
+
+  gobject_class->set_property = fanout_sink_set_property;
+  gobject_class->get_property = fanout_sink_get_property;
+  gobject_class->finalize = fanout_sink_finalize;
+
+  g_object_class_install_property (gobject_class, PROP_CLIENTS,
+      g_param_spec_string ("clients", "Clients",
+          "Comma separated host:port list of the destinations", NULL,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (gobject_class, PROP_BUFFER_SIZE,
+      g_param_spec_int ("buffer-size", "Buffer size",
+          "Kernel send buffer in bytes, 0 for the default", 0, G_MAXINT, 0,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (gobject_class, PROP_GSO,
+      g_param_spec_boolean ("gso", "GSO",
+          "Send runs of equal packets as one UDP_SEGMENT message", TRUE,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (gobject_class, PROP_PACKETS,
+      g_param_spec_uint64 ("packets", "Packets",
+          "Datagrams sent to all clients", 0, G_MAXUINT64, 0,
+          (GParamFlags) (G_PARAM_READABLE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (gobject_class, PROP_SYSCALLS,
+      g_param_spec_uint64 ("syscalls", "Syscalls",
+          "sendmmsg calls made", 0, G_MAXUINT64, 0,
+          (GParamFlags) (G_PARAM_READABLE | G_PARAM_STATIC_STRINGS)));
+
+  gst_element_class_set_static_metadata (element_class, "Fanout UDP sink",
+      "Sink/Network", "Sends buffer lists to many UDP clients with sendmmsg "
+      "and UDP_SEGMENT", "gstreamer-remote-streaming");
+  gst_element_class_add_static_pad_template (element_class, &sink_template);
+
+  basesink_class->start = fanout_sink_start;
+  basesink_class->stop = fanout_sink_stop;
+  basesink_class->render = fanout_sink_render;
+  basesink_class->render_list = fanout_sink_render_list;
+}
+
+static void
+fanout_sink_init (GstFanoutSink * sink)
+{
+  sink->fd = -1;
+  sink->gso = TRUE;
+  sink->destinations = g_array_new (FALSE, TRUE, sizeof (FanoutDestination));
+}
+
+static gpointer
+register_element (gpointer data)
+{
+  gst_element_register (NULL, "fanoutsink", GST_RANK_NONE,
+      GST_TYPE_FANOUT_SINK);
+  return NULL;
+}
+
+/* Send the RTP of the host pipelines through fanoutsinks */
+void
+fanoutsink_set_enabled (gboolean enabled)
+{
+  fanout_enabled = enabled;
+}
+
+/* The sink of an RTP stream of a host pipeline, a udpsink unless the
+ * batched send mode is on. Both take the same clients */
+GstElement *
+fanoutsink_make ()
+{
+  static GOnce once = G_ONCE_INIT;
+
+  if (!fanout_enabled)
+    return gst_element_factory_make ("udpsink", NULL);
+  g_once (&once, (GThreadFunc) register_element, NULL);
+  return gst_element_factory_make ("fanoutsink", NULL);
+}
+
+/* A render of the stock udpsink is one sendmmsg per FANOUT_BATCH of its
+ * packets times clients */
+static GstPadProbeReturn
+count_probe (GstPad * pad, GstPadProbeInfo * info, FanoutBenchCount * count)
+{
+  guint packets = 1;
+
+  if (info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST)
+    packets = gst_buffer_list_length (GST_PAD_PROBE_INFO_BUFFER_LIST (info));
+  count->packets += (guint64) packets * count->destinations;
+  count->syscalls += (packets * count->destinations + FANOUT_BATCH - 1)
+      / FANOUT_BATCH;
+  return GST_PAD_PROBE_OK;
+}
+
+/* Stream the benchmark video to the loopback destinations for a number of
+ * seconds through one sink, return the CPU seconds used */
+static gdouble
+bench_run (const gchar * sink_name, guint destinations, gint seconds,
+    gdouble baseline)
+{
+  GstElement *pipeline = gst_pipeline_new ("fanout-bench");
+  GstElement *source = gst_element_factory_make ("videotestsrc", NULL);
+  GstElement *capsfilter = gst_element_factory_make ("capsfilter", NULL);
+  GstElement *encoder = encselect_make (ENC_CODEC_H264);
+  GstElement *payloader = encselect_make_payloader (ENC_CODEC_H264);
+  GstElement *sink = gst_element_factory_make (sink_name, NULL);
+  FanoutBenchCount count;
+  GString *clients = g_string_new (NULL);
+  gdouble cpu;
+  GstCaps *caps;
+  GstMessage *msg;
+  GstBus *bus;
+  GstPad *pad;
+
+  if (!pipeline || !source || !capsfilter || !encoder || !payloader
+      || !sink) {
+    g_printerr ("Not all benchmark elements could be created.\n");
+    return -1.0;
+  }
+  memset (&count, 0, sizeof (count));
+  count.destinations = destinations;
+
+  caps = gst_caps_new_simple ("video/x-raw", "width", G_TYPE_INT, 1280,
+      "height", G_TYPE_INT, 720, "framerate", GST_TYPE_FRACTION, 30, 1, NULL);
+  g_object_set (G_OBJECT (capsfilter), "caps", caps, NULL);
+  gst_caps_unref (caps);
+  g_object_set (G_OBJECT (source), "is-live", TRUE, "pattern", 18, NULL);
+  encprofile_apply (encoder, encprofile_default ());
+  encprofile_set_bitrate (encoder, FANOUT_BENCH_BITRATE);
+  for (guint i = 0; i < destinations; i++)
+    g_string_append_printf (clients, "%s127.0.0.1:%u", i ? "," : "",
+        FANOUT_BENCH_PORT + i);
+  if (destinations > 0)
+    g_object_set (G_OBJECT (sink), "clients", clients->str, NULL);
+  g_string_free (clients, TRUE);
+
+  gst_bin_add_many (GST_BIN (pipeline), source, capsfilter, encoder,
+      payloader, sink, NULL);
+  if (!gst_element_link_many (source, capsfilter, encoder, payloader, sink,
+          NULL)) {
+    g_printerr ("Benchmark pipeline not linked.\n");
+    gst_object_unref (pipeline);
+    return -1.0;
+  }
+  pad = gst_element_get_static_pad (sink, "sink");
+  gst_pad_add_probe (pad, (GstPadProbeType) (GST_PAD_PROBE_TYPE_BUFFER
+          | GST_PAD_PROBE_TYPE_BUFFER_LIST),
+      (GstPadProbeCallback) count_probe, &count, NULL);
+  gst_object_unref (pad);
+
+  cpu = sysstat_cpu_seconds ();
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  bus = gst_element_get_bus (pipeline);
+  msg = gst_bus_timed_pop_filtered (bus, seconds * GST_SECOND,
+      GST_MESSAGE_ERROR);
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  cpu = sysstat_cpu_seconds () - cpu;
+
+  if (msg != NULL) {
+    g_printerr ("Benchmark pipeline failed.\n");
+    gst_message_unref (msg);
+    cpu = -1.0;
+  } else if (destinations > 0) {
+    if (GST_IS_FANOUT_SINK (sink))
+      g_object_get (G_OBJECT (sink), "packets", &count.packets, "syscalls",
+          &count.syscalls, NULL);
+    g_print ("%12u %-11s %14.0f %12.0f %11.1f%%\n", destinations, sink_name,
+        count.packets / (gdouble) seconds, count.syscalls / (gdouble) seconds,
+        100.0 * (cpu - baseline) / seconds);
+  }
+  gst_object_unref (bus);
+  gst_object_unref (pipeline);
+  return cpu;
+}
+
+/* Datagrams, send calls and CPU of udpsink and fanoutsink at 100, 500 and
+ * 1000 loopback destinations, the CPU above encoding to a fakesink */
+void
+fanoutsink_benchmark (gint seconds)
+{
+  const guint destinations[] = { 100, 500, 1000 };
+  gdouble baseline;
+
+  fanoutsink_set_enabled (TRUE);
+  gst_object_unref (gst_object_ref_sink (fanoutsink_make ()));
+
+  baseline = bench_run ("fakesink", 0, seconds, 0.0);
+  if (baseline < 0.0)
+    return;
+  g_print ("Fan-out over loopback, %d kbit/s H.264 for %d s, encoding "
+      "alone %.1f%% CPU\n", FANOUT_BENCH_BITRATE, seconds,
+      100.0 * baseline / seconds);
+  g_print ("%12s %-11s %14s %12s %12s\n", "destinations", "sink",
+      "datagrams/s", "sendmmsg/s", "CPU");
+  for (guint i = 0; i < G_N_ELEMENTS (destinations); i++) {
+    if (bench_run ("udpsink", destinations[i], seconds, baseline) < 0.0
+        || bench_run ("fanoutsink", destinations[i], seconds, baseline) < 0.0)
+      return;
+  }
+}
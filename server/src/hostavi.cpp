@@ -1,5 +1,10 @@
 #include "header.h"
 #include "keyboardhandler.h"
+#include "encprofile.h"
+#include "encselect.h"
+#include "fanoutsink.h"
+#include "topology.h"
+#include "audiofuse.h"
 
 /* This function will be called by the pad-added signal */
 static void
@@ -41,20 +46,21 @@ host_pad_handler (GstElement * src, GstPad * pad, HostAVIData * data)
 }
 
 int
-hostavi_pipeline (char *argv)
+hostavi_pipeline (StreamSession * session)
 {
   GIOChannel *io_stdin;
   GstStateChangeReturn ret;
   GstBus *bus;
   HostAVIData avi;
   CustomData data;
+  EncoderCodec codec = encselect_video_codec (session, ENC_CODEC_VP8);
 
   /* Initialize structure members with zero */
   memset (&avi, 0, sizeof (avi));
   memset (&data, 0, sizeof (data));
 
-  /* Initialize GStreamer */
-  gst_init (NULL, NULL);
+  /* Place the thread boundaries of the video branch */
+  topology_prepare (session, codec);
 
   /* Create the elements */
   avi.pipeline = gst_pipeline_new ("AVI-pipeline");
@@ -64,41 +70,43 @@ hostavi_pipeline (char *argv)
   avi.video_parser = gst_element_factory_make ("mpeg4videoparse", NULL);
   avi.video_decoder = gst_element_factory_make ("avdec_mpeg4", NULL);
   avi.video_convert = gst_element_factory_make ("videoconvert", NULL);
-  avi.video_encoder = gst_element_factory_make ("vp8enc", NULL);
-  avi.video_payload = gst_element_factory_make ("rtpvp8pay", NULL);
-  avi.udp_video_sink = gst_element_factory_make ("udpsink", NULL);
+  avi.video_shed = loadshed_bin_new ();
+  avi.video_encoder = encselect_make (codec);
+  avi.video_payload = encselect_make_payloader (codec);
+  avi.udp_video_sink = fanoutsink_make ();
   avi.audio_queue = gst_element_factory_make ("queue", NULL);
   avi.audio_parser = gst_element_factory_make ("mpegaudioparse", NULL);
   avi.audio_decoder = gst_element_factory_make ("avdec_mp3", NULL);
-  avi.audio_convert = gst_element_factory_make ("audioconvert", NULL);
-  avi.audio_volume = gst_element_factory_make ("volume", NULL);
-  avi.audio_encoder = gst_element_factory_make ("opusenc", NULL);
+  avi.audio_convert = audiofuse_chain_new (FALSE, &avi.audio_volume);
+  avi.audio_encoder = encselect_make (ENC_CODEC_OPUS);
   avi.audio_payload = gst_element_factory_make ("rtpopuspay", NULL);
-  avi.udp_audio_sink = gst_element_factory_make ("udpsink", NULL);
+  avi.udp_audio_sink = fanoutsink_make ();
 
   /* Checking all the elemnents are created or not */
   if (!avi.pipeline || !avi.source || !avi.demux || !avi.video_queue
       || !avi.video_parser || !avi.video_decoder || !avi.video_convert
-      || !avi.video_encoder || !avi.video_payload || !avi.video_payload
-      || !avi.udp_video_sink || !avi.audio_queue || !avi.audio_parser
+      || !avi.video_shed || !avi.video_encoder || !avi.video_payload
+      || !avi.video_payload || !avi.udp_video_sink || !avi.audio_queue
+      || !avi.audio_parser
       || !avi.audio_decoder || !avi.audio_convert || !avi.audio_volume
       || !avi.audio_encoder || !avi.audio_payload || !avi.udp_audio_sink) {
     g_printerr ("Not all elements could be created\n");
+    return -1;
   }
   /* Add all the elements to bin */
   gst_bin_add_many (GST_BIN (avi.pipeline), avi.source, avi.demux,
       avi.video_queue, avi.video_parser, avi.video_decoder, avi.video_convert,
-      avi.video_encoder, avi.video_payload, avi.udp_video_sink, avi.audio_queue,
-      avi.audio_parser, avi.audio_decoder, avi.audio_convert, avi.audio_volume,
+      avi.video_shed, avi.video_encoder, avi.video_payload, avi.udp_video_sink,
+      avi.audio_queue, avi.audio_parser, avi.audio_decoder, avi.audio_convert,
       avi.audio_encoder, avi.audio_payload, avi.udp_audio_sink, NULL);
 
   /* Setting the element properties */
-  g_object_set (G_OBJECT (avi.source), "location", argv, NULL);
-  g_object_set (G_OBJECT (avi.video_encoder), "deadline", 1, NULL);
-  g_object_set (G_OBJECT (avi.udp_video_sink), "host", "10.1.137.49",
-      "port", 5000, "clients", "10.1.138.194:5000,10.1.137.49:5000", NULL);
-  g_object_set (G_OBJECT (avi.udp_audio_sink), "host", "10.1.137.49",
-      "port", 5001, "clients", "10.1.138.194:5001,10.1.137.49:5001", NULL);
+  g_object_set (G_OBJECT (avi.source), "location", session->path, NULL);
+  encprofile_apply (avi.video_encoder, session->profile);
+  encprofile_set_threads (avi.video_encoder, session->encoder_threads);
+  session_set_clients (session, avi.udp_video_sink, RTP_SESSION_VIDEO);
+  session_set_clients (session, avi.udp_audio_sink, RTP_SESSION_AUDIO);
+  g_object_set (G_OBJECT (avi.udp_audio_sink), "async", FALSE, NULL);
   gint initial_volume = 2;
   gdouble linear_val = (initial_volume - 1) / 9.0;
   g_object_set (G_OBJECT (avi.audio_volume), "volume", linear_val, NULL);
@@ -106,22 +114,30 @@ hostavi_pipeline (char *argv)
   /* link the elements */
   if (gst_element_link (avi.source, avi.demux) != TRUE) {
     g_printerr ("Source and demuxer not linked.\n");
-    exit (EXIT_FAILURE);
+    return session_abort (session, avi.pipeline);
   }
 
   if (gst_element_link_many (avi.video_queue, avi.video_parser,
-          avi.video_decoder, avi.video_convert, avi.video_encoder,
-          avi.video_payload, avi.udp_video_sink, NULL) != TRUE) {
+          avi.video_decoder, NULL) != TRUE
+      || topology_link (session, avi.pipeline, avi.video_decoder,
+          avi.video_convert, TOPOLOGY_DECODE) != TRUE
+      || simulcast_link (&data.simulcast, session, avi.pipeline,
+          avi.video_convert, avi.video_shed, avi.video_encoder,
+          avi.video_payload, avi.udp_video_sink) != TRUE) {
     g_printerr ("video elements are not linked.\n");
-    exit (EXIT_FAILURE);
+    simulcast_stop (&data.simulcast);
+    return session_abort (session, avi.pipeline);
   }
 
   if (gst_element_link_many (avi.audio_queue, avi.audio_parser,
-          avi.audio_decoder, avi.audio_convert, avi.audio_volume,
-          avi.audio_encoder, avi.audio_payload, avi.udp_audio_sink,
-          NULL) != TRUE) {
+          avi.audio_decoder, avi.audio_convert, avi.audio_encoder,
+          avi.audio_payload, NULL) != TRUE
+      || rtp_session_link (avi.pipeline, avi.audio_payload,
+          avi.udp_audio_sink, RTP_SESSION_AUDIO,
+          session) != TRUE) {
     g_printerr ("Audio elements are not linked.\n");
-    exit (EXIT_FAILURE);
+    simulcast_stop (&data.simulcast);
+    return session_abort (session, avi.pipeline);
   }
 
   GstPad *sinkpad_audio =
@@ -139,11 +155,18 @@ hostavi_pipeline (char *argv)
   g_signal_connect (avi.demux, "pad-added", G_CALLBACK (host_pad_handler),
       &avi);
 
+  /* Let the session place the streaming threads before they start */
+  session_attach (session, avi.pipeline);
+
+  /* Run on the network clock shared with the clients */
+  netclock_publish (avi.pipeline);
+
   /* Start playing */
   ret = gst_element_set_state (avi.pipeline, GST_STATE_PLAYING);
   if (ret == GST_STATE_CHANGE_FAILURE) {
     g_printerr ("Could not set the pipeline for playing state.\n");
-    exit (EXIT_FAILURE);
+    simulcast_stop (&data.simulcast);
+    return session_abort (session, avi.pipeline);
   }
 
   /* Listen to the bus */
@@ -151,34 +174,54 @@ hostavi_pipeline (char *argv)
   gst_bus_add_signal_watch (bus);
 
   /* Start the Main Loop event */
-  avi.loop = g_main_loop_new (NULL, FALSE);
+  avi.loop = g_main_loop_new (session->context, FALSE);
+  session->loop = avi.loop;
 
   /* Create Struct for Key Board Handler */
+  data.session = session;
   data.pipeline = avi.pipeline;
   data.loop = avi.loop;
-  data.path = argv;
+  data.path = session->path;
   data.volume = avi.audio_volume;
 
+  /* Seeks force a keyframe on the video encoders */
+  data.seek.pipeline = avi.pipeline;
+  data.seek.index = session->keyindex;
+  data.seek.video_encoder = avi.video_encoder;
+  data.seek.video_input = data.simulcast.tee;
+  data.seek.audio_encoder = avi.audio_encoder;
+  seek_setup (&data.seek);
+
+  /* Drop frames, speed up the encoder and scale down when it falls behind */
+  loadshed_setup (&data.shed, session->id, avi.udp_video_sink,
+      avi.video_shed, avi.video_encoder);
+
   /* Connect signal messages that came from bus */
   g_signal_connect (bus, "message", G_CALLBACK (msg_handle), &data);
 
-  g_print ("\n\nPress 'k' to see a list of keyboard shortcuts\n\n");
+  /* Only the interactive session reads the keyboard */
+  guint id = 0;
+  if (session->interactive) {
+    g_print ("\n\nPress 'k' to see a list of keyboard shortcuts\n\n");
 
-  /* Set up IO handler */
+    /* Set up IO handler */
 #ifdef G_OS_WIN32
-  io_stdin = g_io_channel_win32_new_fd (fileno (stdin));
+    io_stdin = g_io_channel_win32_new_fd (fileno (stdin));
 #else
-  io_stdin = g_io_channel_unix_new (fileno (stdin));
+    io_stdin = g_io_channel_unix_new (fileno (stdin));
 #endif
-  guint id =
-      g_io_add_watch (io_stdin, G_IO_IN, (GIOFunc) handle_keyboard, &data);
+    id = g_io_add_watch (io_stdin, G_IO_IN, (GIOFunc) handle_keyboard, &data);
+  }
 
   /* Run the GMainLoop */
   g_main_loop_run (avi.loop);
 
   /* Unreference the resoureces */
-  g_source_remove (id);
+  if (id != 0)
+    g_source_remove (id);
   gst_element_set_state (avi.pipeline, GST_STATE_NULL);
+  loadshed_stop (&data.shed);
+  simulcast_stop (&data.simulcast);
   gst_object_unref (avi.pipeline);
   gst_object_unref (bus);
   g_main_loop_unref (avi.loop);
@@ -0,0 +1,183 @@
+#include "header.h"
+#include "keyboardhandler.h"
+#include "encprofile.h"
+#include "encselect.h"
+#include "fanoutsink.h"
+
+/* Test pattern for A/V sync measurement: a white flash and a 1 kHz beep at
+ * the start of every second of black silence */
+#define AVSYNC_WIDTH 640
+#define AVSYNC_HEIGHT 360
+#define AVSYNC_FPS 30
+#define AVSYNC_RATE 48000
+#define AVSYNC_BEEP_LENGTH (100 * GST_MSECOND)
+
+/* Turn the first frame of every second white */
+static GstPadProbeReturn
+flash_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  GstMapInfo map;
+
+  if (GST_BUFFER_PTS (buffer) % GST_SECOND >= GST_SECOND / AVSYNC_FPS)
+    return GST_PAD_PROBE_OK;
+
+  buffer = gst_buffer_make_writable (buffer);
+  if (gst_buffer_map (buffer, &map, GST_MAP_WRITE)) {
+    /* Luma plane of I420 comes first */
+    memset (map.data, 235, MIN (map.size, AVSYNC_WIDTH * AVSYNC_HEIGHT));
+    gst_buffer_unmap (buffer, &map);
+  }
+  GST_PAD_PROBE_INFO_DATA (info) = buffer;
+  return GST_PAD_PROBE_OK;
+}
+
+/* Keep the tone only for the beep at the start of every second */
+static GstPadProbeReturn
+beep_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+
+  if (GST_BUFFER_PTS (buffer) % GST_SECOND < AVSYNC_BEEP_LENGTH)
+    return GST_PAD_PROBE_OK;
+
+  buffer = gst_buffer_make_writable (buffer);
+  gst_buffer_memset (buffer, 0, 0, gst_buffer_get_size (buffer));
+  GST_PAD_PROBE_INFO_DATA (info) = buffer;
+  return GST_PAD_PROBE_OK;
+}
+
+/* Stream the flash/beep pattern for the given number of seconds, the
+ * client measures the A/V offset at its sinks */
+int
+hostavsync_pipeline (StreamSession * session, gint seconds)
+{
+  HostAVSyncData avsync;
+  CustomData data;
+  EncoderCodec codec = encselect_video_codec (session, ENC_CODEC_H264);
+  GstStateChangeReturn ret;
+  GstCaps *video_caps, *audio_caps;
+  GstBus *bus;
+  GstPad *pad;
+
+  /* Initialize structure members with zero */
+  memset (&avsync, 0, sizeof (avsync));
+  memset (&data, 0, sizeof (data));
+
+  /* Create the elements */
+  avsync.pipeline = gst_pipeline_new ("avsync-pipeline");
+  avsync.video_source = gst_element_factory_make ("videotestsrc", NULL);
+  avsync.video_capsfilter = gst_element_factory_make ("capsfilter", NULL);
+  avsync.video_encoder = encselect_make (codec);
+  avsync.video_payload = encselect_make_payloader (codec);
+  avsync.udp_video_sink = fanoutsink_make ();
+  avsync.audio_source = gst_element_factory_make ("audiotestsrc", NULL);
+  avsync.audio_capsfilter = gst_element_factory_make ("capsfilter", NULL);
+  avsync.audio_encoder = encselect_make (ENC_CODEC_OPUS);
+  avsync.audio_payload = gst_element_factory_make ("rtpopuspay", NULL);
+  avsync.udp_audio_sink = fanoutsink_make ();
+
+  /* Check the elements are created or not */
+  if (!avsync.pipeline || !avsync.video_source || !avsync.video_capsfilter
+      || !avsync.video_encoder || !avsync.video_payload
+      || !avsync.udp_video_sink || !avsync.audio_source
+      || !avsync.audio_capsfilter || !avsync.audio_encoder
+      || !avsync.audio_payload || !avsync.udp_audio_sink) {
+    g_printerr ("Not all the elements could be created.\n");
+    return -1;
+  }
+
+  /* Add elements to bin */
+  gst_bin_add_many (GST_BIN (avsync.pipeline), avsync.video_source,
+      avsync.video_capsfilter, avsync.video_encoder, avsync.video_payload,
+      avsync.udp_video_sink, avsync.audio_source, avsync.audio_capsfilter,
+      avsync.audio_encoder, avsync.audio_payload, avsync.udp_audio_sink,
+      NULL);
+
+  /* Set the element properties */
+  g_object_set (G_OBJECT (avsync.video_source), "is-live", TRUE, "pattern", 2,
+      "num-buffers", seconds * AVSYNC_FPS, NULL);
+  video_caps = gst_caps_new_simple ("video/x-raw",
+      "format", G_TYPE_STRING, "I420",
+      "width", G_TYPE_INT, AVSYNC_WIDTH, "height", G_TYPE_INT, AVSYNC_HEIGHT,
+      "framerate", GST_TYPE_FRACTION, AVSYNC_FPS, 1, NULL);
+  g_object_set (G_OBJECT (avsync.video_capsfilter), "caps", video_caps, NULL);
+  encprofile_apply (avsync.video_encoder, session->profile);
+  encprofile_set_threads (avsync.video_encoder, session->encoder_threads);
+
+  g_object_set (G_OBJECT (avsync.audio_source), "is-live", TRUE,
+      "freq", 1000.0, "samplesperbuffer", AVSYNC_RATE / 100,
+      "num-buffers", seconds * 100, NULL);
+  audio_caps = gst_caps_new_simple ("audio/x-raw",
+      "format", G_TYPE_STRING, "S16LE",
+      "rate", G_TYPE_INT, AVSYNC_RATE, "channels", G_TYPE_INT, 1, NULL);
+  g_object_set (G_OBJECT (avsync.audio_capsfilter), "caps", audio_caps, NULL);
+
+  session_set_clients (session, avsync.udp_video_sink, RTP_SESSION_VIDEO);
+  session_set_clients (session, avsync.udp_audio_sink, RTP_SESSION_AUDIO);
+
+  /* Link the elements */
+  if (gst_element_link_many (avsync.video_source, avsync.video_capsfilter,
+          avsync.video_encoder, avsync.video_payload, NULL) != TRUE
+      || rtp_session_link (avsync.pipeline, avsync.video_payload,
+          avsync.udp_video_sink, RTP_SESSION_VIDEO,
+          session) != TRUE) {
+    g_printerr ("Video elements are not linked.\n");
+    return session_abort (session, avsync.pipeline);
+  }
+  if (gst_element_link_many (avsync.audio_source, avsync.audio_capsfilter,
+          avsync.audio_encoder, avsync.audio_payload, NULL) != TRUE
+      || rtp_session_link (avsync.pipeline, avsync.audio_payload,
+          avsync.udp_audio_sink, RTP_SESSION_AUDIO,
+          session) != TRUE) {
+    g_printerr ("Audio elements are not linked.\n");
+    return session_abort (session, avsync.pipeline);
+  }
+
+  /* Draw the pattern into the test sources */
+  pad = gst_element_get_static_pad (avsync.video_source, "src");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, flash_probe, NULL, NULL);
+  gst_object_unref (pad);
+  pad = gst_element_get_static_pad (avsync.audio_source, "src");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, beep_probe, NULL, NULL);
+  gst_object_unref (pad);
+
+  /* Let the session place the streaming threads before they start */
+  session_attach (session, avsync.pipeline);
+
+  /* Run on the network clock shared with the clients */
+  netclock_publish (avsync.pipeline);
+
+  /* Set the pipeline for playing state */
+  ret = gst_element_set_state (avsync.pipeline, GST_STATE_PLAYING);
+  if (ret == GST_STATE_CHANGE_FAILURE) {
+    g_printerr ("Could not set the pipeline for playing.\n");
+    return session_abort (session, avsync.pipeline);
+  }
+  g_print ("\nStreaming A/V sync pattern for %d seconds\n", seconds);
+
+  /* Start the Main Loop event */
+  avsync.loop = g_main_loop_new (session->context, FALSE);
+  session->loop = avsync.loop;
+  data.session = session;
+  data.pipeline = avsync.pipeline;
+  data.loop = avsync.loop;
+
+  /* Add bus to the pipeline to listen the messages */
+  bus = gst_element_get_bus (avsync.pipeline);
+  gst_bus_add_signal_watch (bus);
+  g_signal_connect (bus, "message", G_CALLBACK (msg_handle), &data);
+
+  /* Run the GMainLoop */
+  g_main_loop_run (avsync.loop);
+
+  /* Unreference the resources */
+  gst_element_set_state (avsync.pipeline, GST_STATE_NULL);
+  gst_object_unref (avsync.pipeline);
+  gst_object_unref (bus);
+  g_main_loop_unref (avsync.loop);
+  gst_caps_unref (video_caps);
+  gst_caps_unref (audio_caps);
+
+  return 0;
+}
@@ -1,5 +1,11 @@
 #include "header.h"
 #include "keyboardhandler.h"
+#include "encprofile.h"
+#include "encselect.h"
+#include "fanoutsink.h"
+#include "topology.h"
+#include "audiofuse.h"
+#include "rtpcache.h"
 
 /* This function will be called by the pad-added signal */
 static void
@@ -38,21 +44,39 @@ host_pad_handler (GstElement * src, GstPad * pad, HostMP4Data * data)
   gst_object_unref (audio_sink_pad);
 }
 
+/* Release the elements of a pipeline that could not be built, none of
+ * them is in a bin yet */
+static int
+elements_abort (GstElement ** elements, guint count)
+{
+  for (guint i = 0; i < count; i++)
+    if (elements[i] != NULL)
+      gst_object_unref (gst_object_ref_sink (elements[i]));
+  return -1;
+}
+
 int
-hostmp4_pipeline (char *argv)
+hostmp4_pipeline (StreamSession * session)
 {
   GIOChannel *io_stdin;
   GstBus *bus;
   GstStateChangeReturn ret;
   HostMP4Data server_data;
   CustomData data;
+  RtpCacheRecord record;
+  EncoderCodec codec = encselect_video_codec (session, ENC_CODEC_H264);
+
+  /* A file played to the end before is sent from its recorded packets */
+  if (rtpcache_available (session, codec))
+    return rtpcache_pipeline (session, codec);
 
   /* Initializing structure varilable to zero */
   memset (&server_data, 0, sizeof (server_data));
   memset (&data, 0, sizeof (data));
+  memset (&record, 0, sizeof (record));
 
-  /* Initialize gstreamer */
-  gst_init (NULL, NULL);
+  /* Place the thread boundaries of the video branch */
+  topology_prepare (session, codec);
 
   /* Initilize elements */
   server_data.pipeline = gst_pipeline_new ("host-pipeline");
@@ -61,60 +85,66 @@ hostmp4_pipeline (char *argv)
   server_data.video_decoder = gst_element_factory_make ("avdec_h264", NULL);
   server_data.video_queue = gst_element_factory_make ("queue", NULL);
   server_data.video_convert = gst_element_factory_make ("videoconvert", NULL);
-  server_data.video_encoder = gst_element_factory_make ("x264enc", NULL);
-  server_data.rtp_payload = gst_element_factory_make ("rtph264pay", NULL);
-  server_data.udp_sink_video = gst_element_factory_make ("udpsink", NULL);
+  server_data.video_shed = loadshed_bin_new ();
+  server_data.video_encoder = encselect_make (codec);
+  server_data.rtp_payload = encselect_make_payloader (codec);
+  server_data.udp_sink_video = fanoutsink_make ();
   server_data.audio_decoder = gst_element_factory_make ("faad", NULL);
   server_data.audio_queue = gst_element_factory_make ("queue", NULL);
-  server_data.audio_convert = gst_element_factory_make ("audioconvert", NULL);
-  server_data.audio_resample = gst_element_factory_make ("audioresample", NULL);
-  server_data.audio_volume = gst_element_factory_make ("volume", NULL);
-  server_data.audio_encoder = gst_element_factory_make ("opusenc", NULL);
+  server_data.audio_convert = audiofuse_chain_new (TRUE,
+      &server_data.audio_volume);
+  server_data.audio_encoder = encselect_make (ENC_CODEC_OPUS);
   server_data.rtp_audio_payload = gst_element_factory_make ("rtpopuspay", NULL);
-  server_data.udp_sink_audio = gst_element_factory_make ("udpsink", NULL);
+  server_data.udp_sink_audio = fanoutsink_make ();
+  GstElement *elements[] = { server_data.pipeline, server_data.source,
+    server_data.demuxer, server_data.video_decoder, server_data.video_queue,
+    server_data.video_convert, server_data.video_shed,
+    server_data.video_encoder, server_data.rtp_payload,
+    server_data.udp_sink_video, server_data.audio_decoder,
+    server_data.audio_queue, server_data.audio_convert,
+    server_data.audio_encoder, server_data.rtp_audio_payload,
+    server_data.udp_sink_audio
+  };
 
   /* Check the video elements are created or not */
   if (!server_data.pipeline || !server_data.source || !server_data.demuxer ||
       !server_data.video_decoder || !server_data.video_queue
-      || !server_data.video_convert || !server_data.video_encoder
+      || !server_data.video_convert || !server_data.video_shed
+      || !server_data.video_encoder
       || !server_data.rtp_payload || !server_data.udp_sink_video) {
     g_printerr ("Not all the elements could be created.\n");
-    exit (EXIT_FAILURE);
+    return elements_abort (elements, G_N_ELEMENTS (elements));
   }
 
   /* Check the audio elements are created or not */
   if (!server_data.audio_decoder || !server_data.audio_queue
-      || !server_data.audio_convert || !server_data.audio_resample
-      || !server_data.audio_volume || !server_data.audio_encoder
+      || !server_data.audio_convert || !server_data.audio_encoder
       || !server_data.rtp_audio_payload || !server_data.udp_sink_audio) {
     g_printerr ("Not all audio elements could be created.\n");
-    exit (EXIT_FAILURE);
+    return elements_abort (elements, G_N_ELEMENTS (elements));
   }
   /* Add elements to bin */
   gst_bin_add_many (GST_BIN (server_data.pipeline), server_data.source,
       server_data.demuxer, server_data.video_decoder, server_data.video_queue,
-      server_data.video_convert, server_data.video_encoder,
-      server_data.rtp_payload, server_data.udp_sink_video,
+      server_data.video_convert, server_data.video_shed,
+      server_data.video_encoder, server_data.rtp_payload,
+      server_data.udp_sink_video,
       server_data.audio_decoder, server_data.audio_queue,
-      server_data.audio_convert, server_data.audio_resample,
-      server_data.audio_volume, server_data.audio_encoder,
+      server_data.audio_convert, server_data.audio_encoder,
       server_data.rtp_audio_payload, server_data.udp_sink_audio, NULL);
 
   /* Set the element properties */
-  g_object_set (G_OBJECT (server_data.source), "location", argv, NULL);
-
-  g_object_set (G_OBJECT (server_data.video_encoder), "speed-preset", 1, NULL);
-  g_object_set (G_OBJECT (server_data.udp_sink_video), "host", "10.1.137.49",
+  g_object_set (G_OBJECT (server_data.source), "location", session->path,
       NULL);
-  g_object_set (G_OBJECT (server_data.udp_sink_video), "port", 5000, NULL);
-  g_object_set (G_OBJECT (server_data.udp_sink_video), "clients",
-      "10.1.138.194:5000,10.1.137.49:5000", NULL);
 
-  g_object_set (G_OBJECT (server_data.udp_sink_audio), "host", "10.1.137.49",
-      NULL);
-  g_object_set (G_OBJECT (server_data.udp_sink_audio), "port", 5001, NULL);
-  g_object_set (G_OBJECT (server_data.udp_sink_audio), "clients",
-      "10.1.138.194:5001,10.1.137.49:5001", NULL);
+  encprofile_apply (server_data.video_encoder, session->profile);
+  encprofile_set_threads (server_data.video_encoder, session->encoder_threads);
+  session_set_clients (session, server_data.udp_sink_video,
+      RTP_SESSION_VIDEO);
+  session_set_clients (session, server_data.udp_sink_audio,
+      RTP_SESSION_AUDIO);
+  /* Audio is dropped in trick modes, so it must not hold the preroll */
+  g_object_set (G_OBJECT (server_data.udp_sink_audio), "async", FALSE, NULL);
 
   gint initial_volume = 2;
   gdouble linear_val = (initial_volume - 1) / 9.0;
@@ -124,25 +154,40 @@ hostmp4_pipeline (char *argv)
   /* Link the elements */
   if (gst_element_link (server_data.source, server_data.demuxer) != TRUE) {
     g_printerr ("Sorce to qtdemux not linked.\n");
-    exit (EXIT_FAILURE);
+    return session_abort (session, server_data.pipeline);
   }
 
-  if (gst_element_link_many (server_data.video_queue, server_data.video_decoder,
-          server_data.video_convert, server_data.video_encoder,
-          server_data.rtp_payload, server_data.udp_sink_video, NULL) != TRUE) {
+  if (gst_element_link (server_data.video_queue,
+          server_data.video_decoder) != TRUE
+      || topology_link (session, server_data.pipeline,
+          server_data.video_decoder, server_data.video_convert,
+          TOPOLOGY_DECODE) != TRUE
+      || simulcast_link (&data.simulcast, session, server_data.pipeline,
+          server_data.video_convert, server_data.video_shed,
+          server_data.video_encoder, server_data.rtp_payload,
+          server_data.udp_sink_video) != TRUE) {
     g_printerr ("Decoder to video udpsink not linked.\n");
-    exit (EXIT_FAILURE);
+    simulcast_stop (&data.simulcast);
+    return session_abort (session, server_data.pipeline);
   }
 
   if (gst_element_link_many (server_data.audio_queue, server_data.audio_decoder,
-          server_data.audio_convert, server_data.audio_resample,
-          server_data.audio_volume, server_data.audio_encoder,
-          server_data.rtp_audio_payload, server_data.udp_sink_audio,
-          NULL) != TRUE) {
+          server_data.audio_convert, server_data.audio_encoder,
+          server_data.rtp_audio_payload, NULL) != TRUE
+      || rtp_session_link (server_data.pipeline, server_data.rtp_audio_payload,
+          server_data.udp_sink_audio, RTP_SESSION_AUDIO,
+          session) != TRUE) {
     g_printerr ("Decoder to audio udpsink not linked.\n");
-    exit (EXIT_FAILURE);
+    simulcast_stop (&data.simulcast);
+    return session_abort (session, server_data.pipeline);
   }
 
+  /* Record the packets of a single encode for the next plays of the file */
+  if (data.simulcast.tee == NULL)
+    rtpcache_record_start (&record, session, codec, server_data.video_encoder,
+        server_data.udp_sink_video, server_data.udp_sink_audio,
+        server_data.audio_volume);
+
   GstPad *sinkpad_audio =
       gst_element_get_static_pad (server_data.udp_sink_audio, "sink");
   GstPad *sinkpad_video =
@@ -159,11 +204,20 @@ hostmp4_pipeline (char *argv)
   g_signal_connect (server_data.demuxer, "pad-added",
       G_CALLBACK (host_pad_handler), &server_data);
 
+  /* Let the session place the streaming threads before they start */
+  session_attach (session, server_data.pipeline);
+
+  /* Run on the network clock shared with the clients */
+  netclock_publish (server_data.pipeline);
+
   /* Set the pipeline for playing state */
   ret = gst_element_set_state (server_data.pipeline, GST_STATE_PLAYING);
   if (ret == GST_STATE_CHANGE_FAILURE) {
     g_printerr ("Could not set the pipeline for playing.\n");
-    exit (EXIT_FAILURE);
+    gst_element_set_state (server_data.pipeline, GST_STATE_NULL);
+    rtpcache_record_stop (&record, FALSE);
+    simulcast_stop (&data.simulcast);
+    return session_abort (session, server_data.pipeline);
   }
 
   /* Add bus to the pipeline to listen the messages */
@@ -171,34 +225,57 @@ hostmp4_pipeline (char *argv)
   gst_bus_add_signal_watch (bus);
 
   /* Start the Main Loop event */
-  server_data.loop = g_main_loop_new (NULL, FALSE);
+  server_data.loop = g_main_loop_new (session->context, FALSE);
+  session->loop = server_data.loop;
 
   /* Create Struct for Key Board Handler */
+  data.session = session;
   data.pipeline = server_data.pipeline;
   data.loop = server_data.loop;
-  data.path = argv;
+  data.path = session->path;
   data.volume = server_data.audio_volume;
 
+  /* Seeks force a keyframe on the video encoders */
+  data.seek.pipeline = server_data.pipeline;
+  data.seek.index = session->keyindex;
+  data.seek.video_encoder = server_data.video_encoder;
+  data.seek.video_input = data.simulcast.tee;
+  data.seek.audio_encoder = server_data.audio_encoder;
+  seek_setup (&data.seek);
+
+  /* Drop frames, speed up the encoder and scale down when it falls behind */
+  loadshed_setup (&data.shed, session->id, server_data.udp_sink_video,
+      server_data.video_shed, server_data.video_encoder);
+
   /* Connect signal messages that came from bus */
   g_signal_connect (bus, "message", G_CALLBACK (msg_handle), &data);
 
-  g_print ("\n\nPress 'k' to see a list of keyboard shortcuts\n\n");
+  /* Only the interactive session reads the keyboard */
+  guint id = 0;
+  if (session->interactive) {
+    g_print ("\n\nPress 'k' to see a list of keyboard shortcuts\n\n");
 
-  /* Set up IO handler */
+    /* Set up IO handler */
 #ifdef G_OS_WIN32
-  io_stdin = g_io_channel_win32_new_fd (fileno (stdin));
+    io_stdin = g_io_channel_win32_new_fd (fileno (stdin));
 #else
-  io_stdin = g_io_channel_unix_new (fileno (stdin));
+    io_stdin = g_io_channel_unix_new (fileno (stdin));
 #endif
-  guint id =
-      g_io_add_watch (io_stdin, G_IO_IN, (GIOFunc) handle_keyboard, &data);
+    id = g_io_add_watch (io_stdin, G_IO_IN, (GIOFunc) handle_keyboard, &data);
+  }
 
   /* Run the GMailLoop */
   g_main_loop_run (server_data.loop);
 
   /* Unreference the resoureces */
-  g_source_remove (id);
+  if (id != 0)
+    g_source_remove (id);
   gst_element_set_state (server_data.pipeline, GST_STATE_NULL);
+  /* Packets sent while shedding load are not kept, even when the
+   * session recovered before the end */
+  rtpcache_record_stop (&record, !data.shed.shed);
+  loadshed_stop (&data.shed);
+  simulcast_stop (&data.simulcast);
   gst_object_unref (server_data.pipeline);
   gst_object_unref (bus);
   g_main_loop_unref (server_data.loop);
@@ -14,9 +14,6 @@ host_thumbnail ()
   memset (&data, 0, sizeof (data));
   memset (&cdata, 0, sizeof (cdata));
 
-  /* Initialize gstreamer */
-  gst_init (NULL, NULL);
-
   /* Initilize elements */
   data.pipeline = gst_pipeline_new ("host-pipeline");
   data.source = gst_element_factory_make ("filesrc", NULL);
@@ -34,7 +31,7 @@ host_thumbnail ()
       || !data.video_scale || !data.capsfilter || !data.img_freeze
       || !data.video_encoder || !data.rtp_payload || !data.udp_sink) {
     g_printerr ("Not all the elements could be created.\n");
-    exit (EXIT_FAILURE);
+    return -1;
   }
 
   /* Add elements to bin */
@@ -66,14 +63,17 @@ host_thumbnail ()
           data.video_encoder, data.rtp_payload, data.udp_sink, NULL)
       != TRUE) {
     g_printerr ("Sorce to qtdemux not linked.\n");
-    exit (EXIT_FAILURE);
+    gst_object_unref (data.pipeline);
+    return -1;
   }
 
   /* Set the pipeline for playing state */
   ret = gst_element_set_state (data.pipeline, GST_STATE_PLAYING);
   if (ret == GST_STATE_CHANGE_FAILURE) {
     g_printerr ("Could not set the pipeline for playing.\n");
-    exit (EXIT_FAILURE);
+    gst_element_set_state (data.pipeline, GST_STATE_NULL);
+    gst_object_unref (data.pipeline);
+    return -1;
   }
 
   /* Start the Main Loop event */
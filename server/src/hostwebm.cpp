@@ -1,5 +1,10 @@
 #include "header.h"
 #include "keyboardhandler.h"
+#include "encprofile.h"
+#include "encselect.h"
+#include "fanoutsink.h"
+#include "topology.h"
+#include "audiofuse.h"
 
 /* This function will be called by the pad-added signal */
 static void
@@ -41,21 +46,22 @@ host_pad_handler (GstElement * src, GstPad * pad, HostWEBMData * data)
 }
 
 int
-hostwebm_pipeline (char *argv)
+hostwebm_pipeline (StreamSession * session)
 {
   GstStateChangeReturn ret;
   GstBus *bus;
   HostWEBMData webm;
   GIOChannel *io_stdin;
   CustomData data;
+  EncoderCodec codec = encselect_video_codec (session, ENC_CODEC_VP8);
 
 
   /* Initialize the structure members with 0 */
   memset (&webm, 0, sizeof (webm));
   memset (&data, 0, sizeof (data));
 
-  /* Initialze the gstreamer */
-  gst_init (NULL, NULL);
+  /* Place the thread boundaries of the video branch */
+  topology_prepare (session, codec);
 
   /* Initialize the elements */
   webm.pipeline = gst_pipeline_new ("WEMB-pipeline");
@@ -64,42 +70,44 @@ hostwebm_pipeline (char *argv)
   webm.video_queue = gst_element_factory_make ("queue", NULL);
   webm.video_decoder = gst_element_factory_make ("vp8dec", NULL);
   webm.video_convert = gst_element_factory_make ("videoconvert", NULL);
-  webm.video_encoder = gst_element_factory_make ("vp8enc", NULL);
-  webm.video_payload = gst_element_factory_make ("rtpvp8pay", NULL);
-  webm.udp_video_sink = gst_element_factory_make ("udpsink", NULL);
+  webm.video_shed = loadshed_bin_new ();
+  webm.video_encoder = encselect_make (codec);
+  webm.video_payload = encselect_make_payloader (codec);
+  webm.udp_video_sink = fanoutsink_make ();
   webm.audio_queue = gst_element_factory_make ("queue", NULL);
   webm.audio_decoder = gst_element_factory_make ("vorbisdec", NULL);
-  webm.audio_convert = gst_element_factory_make ("audioconvert", NULL);
-  webm.audio_volume = gst_element_factory_make ("volume", NULL);
-  webm.audio_encoder = gst_element_factory_make ("opusenc", NULL);
+  webm.audio_convert = audiofuse_chain_new (FALSE, &webm.audio_volume);
+  webm.audio_encoder = encselect_make (ENC_CODEC_OPUS);
   webm.audio_payload = gst_element_factory_make ("rtpopuspay", NULL);
-  webm.udp_audio_sink = gst_element_factory_make ("udpsink", NULL);
+  webm.udp_audio_sink = fanoutsink_make ();
 
   /* Check the elements are created on not */
   if (!webm.pipeline || !webm.source || !webm.demux || !webm.video_queue
-      || !webm.video_decoder || !webm.video_convert || !webm.video_encoder
+      || !webm.video_decoder || !webm.video_convert || !webm.video_shed
+      || !webm.video_encoder
       || !webm.video_payload || !webm.video_payload || !webm.udp_video_sink
       || !webm.audio_queue || !webm.audio_decoder || !webm.audio_convert
       || !webm.audio_volume || !webm.audio_encoder || !webm.audio_payload
       || !webm.udp_audio_sink) {
     g_printerr ("Not all elements could be created\n");
+    return -1;
   }
 
   /* Add elements to the Bin */
   gst_bin_add_many (GST_BIN (webm.pipeline), webm.source, webm.demux,
       webm.video_queue, webm.video_decoder, webm.video_convert,
-      webm.video_encoder, webm.video_payload, webm.udp_video_sink,
+      webm.video_shed, webm.video_encoder, webm.video_payload,
+      webm.udp_video_sink,
       webm.audio_queue, webm.audio_decoder, webm.audio_convert,
-      webm.audio_volume, webm.audio_encoder, webm.audio_payload,
-      webm.udp_audio_sink, NULL);
+      webm.audio_encoder, webm.audio_payload, webm.udp_audio_sink, NULL);
 
   /* Setting the element properties */
-  g_object_set (G_OBJECT (webm.source), "location", argv, NULL);
-  g_object_set (G_OBJECT (webm.video_encoder), "deadline", 1, NULL);
-  g_object_set (G_OBJECT (webm.udp_video_sink), "host", "10.1.137.49",
-      "port", 5000, "clients", "10.1.138.194:5000,10.1.137.49:5000", NULL);
-  g_object_set (G_OBJECT (webm.udp_audio_sink), "host", "10.1.137.49",
-      "port", 5001, "clients", "10.1.138.194:5001,10.1.137.49:5001", NULL);
+  g_object_set (G_OBJECT (webm.source), "location", session->path, NULL);
+  encprofile_apply (webm.video_encoder, session->profile);
+  encprofile_set_threads (webm.video_encoder, session->encoder_threads);
+  session_set_clients (session, webm.udp_video_sink, RTP_SESSION_VIDEO);
+  session_set_clients (session, webm.udp_audio_sink, RTP_SESSION_AUDIO);
+  g_object_set (G_OBJECT (webm.udp_audio_sink), "async", FALSE, NULL);
   gint initial_volume = 2;
   gdouble linear_val = (initial_volume - 1) / 9.0;
   g_object_set (G_OBJECT (webm.audio_volume), "volume", linear_val, NULL);
@@ -107,19 +115,27 @@ hostwebm_pipeline (char *argv)
   /* Linking the elements */
   if (gst_element_link (webm.source, webm.demux) != TRUE) {
     g_printerr ("Source and demuxer not linked.\n");
-    exit (EXIT_FAILURE);
+    return session_abort (session, webm.pipeline);
   }
-  if (gst_element_link_many (webm.video_queue, webm.video_decoder,
-          webm.video_convert, webm.video_encoder, webm.video_payload,
-          webm.udp_video_sink, NULL) != TRUE) {
+  if (gst_element_link (webm.video_queue, webm.video_decoder) != TRUE
+      || topology_link (session, webm.pipeline, webm.video_decoder,
+          webm.video_convert, TOPOLOGY_DECODE) != TRUE
+      || simulcast_link (&data.simulcast, session, webm.pipeline,
+          webm.video_convert, webm.video_shed, webm.video_encoder,
+          webm.video_payload, webm.udp_video_sink) != TRUE) {
     g_printerr ("video elements are not linked.\n");
-    exit (EXIT_FAILURE);
+    simulcast_stop (&data.simulcast);
+    return session_abort (session, webm.pipeline);
   }
   if (gst_element_link_many (webm.audio_queue, webm.audio_decoder,
-          webm.audio_convert, webm.audio_volume, webm.audio_encoder,
-          webm.audio_payload, webm.udp_audio_sink, NULL) != TRUE) {
+          webm.audio_convert, webm.audio_encoder, webm.audio_payload,
+          NULL) != TRUE
+      || rtp_session_link (webm.pipeline, webm.audio_payload,
+          webm.udp_audio_sink, RTP_SESSION_AUDIO,
+          session) != TRUE) {
     g_printerr ("Audio elements are not linked.\n");
-    exit (EXIT_FAILURE);
+    simulcast_stop (&data.simulcast);
+    return session_abort (session, webm.pipeline);
   }
 
   GstPad *sinkpad_audio =
@@ -137,11 +153,18 @@ hostwebm_pipeline (char *argv)
   g_signal_connect (webm.demux, "pad-added", G_CALLBACK (host_pad_handler),
       &webm);
 
+  /* Let the session place the streaming threads before they start */
+  session_attach (session, webm.pipeline);
+
+  /* Run on the network clock shared with the clients */
+  netclock_publish (webm.pipeline);
+
   /* Set the Pipeline to playing state */
   ret = gst_element_set_state (webm.pipeline, GST_STATE_PLAYING);
   if (ret == GST_STATE_CHANGE_FAILURE) {
     g_printerr ("Could not set the pipeline for playing state.\n");
-    exit (EXIT_FAILURE);
+    simulcast_stop (&data.simulcast);
+    return session_abort (session, webm.pipeline);
   }
 
   /* Add bus to the pipeline to listen messages */
@@ -149,34 +172,54 @@ hostwebm_pipeline (char *argv)
   gst_bus_add_signal_watch (bus);
 
   /* Start the Main Loop event */
-  webm.loop = g_main_loop_new (NULL, FALSE);
+  webm.loop = g_main_loop_new (session->context, FALSE);
+  session->loop = webm.loop;
 
   /* Create Struct for Key Board Handler */
+  data.session = session;
   data.pipeline = webm.pipeline;
   data.loop = webm.loop;
-  data.path = argv;
+  data.path = session->path;
   data.volume = webm.audio_volume;
 
+  /* Seeks force a keyframe on the video encoders */
+  data.seek.pipeline = webm.pipeline;
+  data.seek.index = session->keyindex;
+  data.seek.video_encoder = webm.video_encoder;
+  data.seek.video_input = data.simulcast.tee;
+  data.seek.audio_encoder = webm.audio_encoder;
+  seek_setup (&data.seek);
+
+  /* Drop frames, speed up the encoder and scale down when it falls behind */
+  loadshed_setup (&data.shed, session->id, webm.udp_video_sink,
+      webm.video_shed, webm.video_encoder);
+
   /* Connect signal messages that came from bus */
   g_signal_connect (bus, "message", G_CALLBACK (msg_handle), &data);
 
-  g_print ("\n\nPress 'k' to see a list of keyboard shortcuts\n\n");
+  /* Only the interactive session reads the keyboard */
+  guint id = 0;
+  if (session->interactive) {
+    g_print ("\n\nPress 'k' to see a list of keyboard shortcuts\n\n");
 
-  /* Set up IO handler */
+    /* Set up IO handler */
 #ifdef G_OS_WIN32
-  io_stdin = g_io_channel_win32_new_fd (fileno (stdin));
+    io_stdin = g_io_channel_win32_new_fd (fileno (stdin));
 #else
-  io_stdin = g_io_channel_unix_new (fileno (stdin));
+    io_stdin = g_io_channel_unix_new (fileno (stdin));
 #endif
-  guint id =
-      g_io_add_watch (io_stdin, G_IO_IN, (GIOFunc) handle_keyboard, &data);
+    id = g_io_add_watch (io_stdin, G_IO_IN, (GIOFunc) handle_keyboard, &data);
+  }
 
   /* Run the GMainLoop */
   g_main_loop_run (webm.loop);
 
   /* Unreference the resources */
-  g_source_remove (id);
+  if (id != 0)
+    g_source_remove (id);
   gst_element_set_state (webm.pipeline, GST_STATE_NULL);
+  loadshed_stop (&data.shed);
+  simulcast_stop (&data.simulcast);
   gst_object_unref (webm.pipeline);
   gst_object_unref (bus);
   g_main_loop_unref (webm.loop);
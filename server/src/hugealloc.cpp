@@ -0,0 +1,650 @@
+#include "hugealloc.h"
+#include "encprofile.h"
+#include "encselect.h"
+#include <gst/video/video.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+/* Allocator of the host pipelines, the default one once created */
+static HugeAllocator *host_allocator = NULL;
+
+G_DEFINE_TYPE (HugeAllocator, huge_allocator, GST_TYPE_ALLOCATOR);
+
+static gsize
+align_up (gsize size)
+{
+  return (size + HUGEALLOC_ALIGN - 1) / HUGEALLOC_ALIGN * HUGEALLOC_ALIGN;
+}
+
+/* The size classes double every HUGEALLOC_CLASS_STEPS classes, with even
+ * steps between, so a block is less than a step larger than it needs */
+static gsize
+class_size (gint size_class)
+{
+  gsize base = (gsize) 1 << (size_class / HUGEALLOC_CLASS_STEPS
+      + HUGEALLOC_MIN_SHIFT);
+
+  return align_up (base + base / HUGEALLOC_CLASS_STEPS
+      * (size_class % HUGEALLOC_CLASS_STEPS));
+}
+
+/* Smallest class holding size bytes, HUGEALLOC_CLASSES or more when the
+ * block is too large for the arena */
+static gint
+class_of (gsize size)
+{
+  gint size_class = 0;
+
+  while (size_class < HUGEALLOC_CLASSES && class_size (size_class) < size)
+    size_class++;
+  return size_class;
+}
+
+/* The allocator owning the arena */
+static HugeAllocator *
+host_of (HugeAllocator * huge)
+{
+  return huge->host != NULL ? huge->host : huge;
+}
+
+/* Map the arena on reserved huge pages, or on pages the kernel is asked to
+ * back with transparent huge pages */
+static guint8 *
+arena_map (gsize size, gboolean * hugetlb)
+{
+  void *arena = mmap (NULL, size, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+  *hugetlb = arena != MAP_FAILED;
+  if (arena == MAP_FAILED) {
+    arena = mmap (NULL, size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (arena == MAP_FAILED)
+      return NULL;
+    madvise (arena, size, MADV_HUGEPAGE);
+  }
+  return (guint8 *) arena;
+}
+
+/* Cut size bytes from the first part given back that holds them, or from
+ * the end of the arena. Called with the lock of the host */
+static guint8 *
+arena_cut (HugeAllocator * host, gsize size)
+{
+  guint8 *data;
+
+  for (GSList * l = host->extents; l != NULL; l = l->next) {
+    HugeExtent *extent = (HugeExtent *) l->data;
+
+    if (extent->size < size)
+      continue;
+    data = host->arena + extent->offset;
+    extent->offset += size;
+    extent->size -= size;
+    if (extent->size == 0) {
+      host->extents = g_slist_delete_link (host->extents, l);
+      g_free (extent);
+    }
+    return data;
+  }
+  if (host->used + size > host->arena_size)
+    return NULL;
+  data = host->arena + host->used;
+  host->used += size;
+  return data;
+}
+
+static gint
+extent_compare (gconstpointer a, gconstpointer b)
+{
+  gsize first = ((const HugeExtent *) a)->offset;
+  gsize second = ((const HugeExtent *) b)->offset;
+
+  return first < second ? -1 : first > second;
+}
+
+/* Give a block back to the arena, joined with the parts next to it, and
+ * lower the end of the arena over the last part. Called with the lock of
+ * the host */
+static void
+arena_return (HugeAllocator * host, guint8 * data, gsize size)
+{
+  HugeExtent *extent = g_new (HugeExtent, 1);
+  GSList *last;
+
+  extent->offset = data - host->arena;
+  extent->size = size;
+  host->extents = g_slist_insert_sorted (host->extents, extent,
+      extent_compare);
+  for (GSList * l = host->extents; l != NULL && l->next != NULL;) {
+    HugeExtent *first = (HugeExtent *) l->data;
+    HugeExtent *second = (HugeExtent *) l->next->data;
+
+    if (first->offset + first->size != second->offset) {
+      l = l->next;
+      continue;
+    }
+    first->size += second->size;
+    g_free (second);
+    l->next = g_slist_delete_link (l->next, l->next);
+  }
+  last = g_slist_last (host->extents);
+  extent = (HugeExtent *) last->data;
+  if (extent->offset + extent->size == host->used) {
+    host->used = extent->offset;
+    host->extents = g_slist_delete_link (host->extents, last);
+    g_free (extent);
+  }
+}
+
+/* A block from the free list of the frame slab or size class or newly cut
+ * from the arena, else one from the heap as the system allocator would
+ * make. Only the list it comes from is locked, and the arena only while a
+ * block is cut, never both at once */
+static GstMemory *
+huge_alloc (GstAllocator * allocator, gsize size,
+    GstAllocationParams * params)
+{
+  HugeAllocator *huge = (HugeAllocator *) allocator;
+  HugeAllocator *host = host_of (huge);
+  gsize maxsize = size + params->prefix + params->padding;
+  gint size_class = class_of (maxsize);
+  HugeMemory *mem = NULL;
+  guint8 *data = NULL;
+  HugeSlab *slab;
+
+  if (host->arena == NULL || params->align >= HUGEALLOC_ALIGN)
+    slab = &host->heap;
+  else if (huge->frames.size > 0 && align_up (maxsize) == huge->frames.size)
+    slab = &huge->frames;
+  else if (size_class < HUGEALLOC_CLASSES)
+    slab = &host->classes[size_class];
+  else
+    slab = &host->heap;
+
+  g_mutex_lock (&slab->lock);
+  slab->allocs++;
+  if (slab->free != NULL) {
+    mem = slab->free;
+    slab->free = mem->next;
+    slab->reuses++;
+  }
+  g_mutex_unlock (&slab->lock);
+
+  if (mem == NULL && slab->size > 0) {
+    g_mutex_lock (&host->lock);
+    data = arena_cut (host, slab->size);
+    g_mutex_unlock (&host->lock);
+  }
+  if (mem == NULL) {
+    g_mutex_lock (&slab->lock);
+    slab->mallocs += data != NULL ? 1 : 2;
+    g_mutex_unlock (&slab->lock);
+  }
+
+  if (data != NULL) {
+    mem = g_new (HugeMemory, 1);
+    mem->data = data;
+    mem->slab = slab;
+    mem->heap = FALSE;
+  } else if (mem == NULL) {
+    void *block;
+
+    if (posix_memalign (&block, MAX (HUGEALLOC_ALIGN, params->align + 1),
+            maxsize) != 0)
+      return NULL;
+    mem = g_new (HugeMemory, 1);
+    mem->data = (guint8 *) block;
+    mem->slab = NULL;
+    mem->heap = TRUE;
+  }
+  mem->next = NULL;
+  gst_memory_init (GST_MEMORY_CAST (mem), params->flags, allocator, NULL,
+      maxsize, params->align, params->prefix, size);
+  if (params->prefix && (params->flags & GST_MEMORY_FLAG_ZERO_PREFIXED))
+    memset (mem->data, 0, params->prefix);
+  if (params->padding && (params->flags & GST_MEMORY_FLAG_ZERO_PADDED))
+    memset (mem->data + params->prefix + size, 0, params->padding);
+  return GST_MEMORY_CAST (mem);
+}
+
+/* Arena blocks and shared memories go back on the list of their slab, heap
+ * ones are freed */
+static void
+huge_free (GstAllocator * allocator, GstMemory * memory)
+{
+  HugeMemory *mem = (HugeMemory *) memory;
+  HugeSlab *slab = mem->slab;
+
+  if (slab == NULL) {
+    if (mem->heap)
+      free (mem->data);
+    g_free (mem);
+    return;
+  }
+  g_mutex_lock (&slab->lock);
+  mem->next = slab->free;
+  slab->free = mem;
+  g_mutex_unlock (&slab->lock);
+}
+
+static gpointer
+huge_mem_map (GstMemory * memory, gsize maxsize, GstMapFlags flags)
+{
+  return ((HugeMemory *) memory)->data;
+}
+
+static void
+huge_mem_unmap (GstMemory * memory)
+{
+}
+
+/* Payloaders share the encoded frame into every packet, the memory
+ * structures of the shares are recycled like the blocks */
+static GstMemory *
+huge_mem_share (GstMemory * memory, gssize offset, gssize size)
+{
+  HugeAllocator *host = host_of ((HugeAllocator *) memory->allocator);
+  GstMemory *parent = memory->parent ? memory->parent : memory;
+  HugeSlab *slab = &host->shared;
+  HugeMemory *sub = NULL;
+
+  if (size == -1)
+    size = memory->size > (gsize) offset ? memory->size - offset : 0;
+  g_mutex_lock (&slab->lock);
+  slab->shares++;
+  if (host->arena != NULL && slab->free != NULL) {
+    sub = slab->free;
+    slab->free = sub->next;
+    slab->reuses++;
+  } else {
+    slab->mallocs++;
+  }
+  g_mutex_unlock (&slab->lock);
+
+  if (sub == NULL)
+    sub = g_new (HugeMemory, 1);
+  sub->data = ((HugeMemory *) memory)->data;
+  sub->slab = host->arena != NULL ? slab : NULL;
+  sub->heap = FALSE;
+  sub->next = NULL;
+  gst_memory_init (GST_MEMORY_CAST (sub), (GstMemoryFlags)
+      (GST_MINI_OBJECT_FLAGS (parent) | GST_MINI_OBJECT_FLAG_LOCK_READONLY),
+      memory->allocator, parent, memory->maxsize, memory->align,
+      memory->offset + offset, size);
+  return GST_MEMORY_CAST (sub);
+}
+
+static GstMemory *
+huge_mem_copy (GstMemory * memory, gssize offset, gssize size)
+{
+  GstAllocationParams params = { (GstMemoryFlags) 0, memory->align, 0, 0 };
+  GstMemory *copy;
+  GstMapInfo info;
+
+  if (size == -1)
+    size = memory->size > (gsize) offset ? memory->size - offset : 0;
+  copy = gst_allocator_alloc (memory->allocator, size, &params);
+  if (copy == NULL || !gst_memory_map (copy, &info, GST_MAP_WRITE))
+    return copy;
+  memcpy (info.data, ((HugeMemory *) memory)->data + memory->offset + offset,
+      size);
+  gst_memory_unmap (copy, &info);
+  return copy;
+}
+
+static gboolean
+huge_mem_is_span (GstMemory * mem1, GstMemory * mem2, gsize * offset)
+{
+  if (offset != NULL && mem1->parent != NULL)
+    *offset = mem1->offset - mem1->parent->offset;
+  return ((HugeMemory *) mem1)->data + mem1->offset + mem1->size ==
+      ((HugeMemory *) mem2)->data + mem2->offset;
+}
+
+static void
+slab_init (HugeSlab * slab, gsize size)
+{
+  g_mutex_init (&slab->lock);
+  slab->size = size;
+}
+
+/* Free the memory structures on the list, giving their blocks back to the
+ * arena of the host when it is still in use */
+static void
+slab_clear (HugeSlab * slab, HugeAllocator * host)
+{
+  HugeMemory *mem;
+
+  while ((mem = slab->free) != NULL) {
+    slab->free = mem->next;
+    if (host != NULL)
+      arena_return (host, mem->data, slab->size);
+    g_free (mem);
+  }
+  g_mutex_clear (&slab->lock);
+}
+
+/* Add the counters of the slab to stats */
+static void
+slab_count (HugeSlab * slab, HugeAllocStats * stats)
+{
+  g_mutex_lock (&slab->lock);
+  stats->allocs += slab->allocs;
+  stats->shares += slab->shares;
+  stats->reuses += slab->reuses;
+  stats->mallocs += slab->mallocs;
+  g_mutex_unlock (&slab->lock);
+}
+
+/* The allocator of a pool gives its frames back to the arena and leaves
+ * its counters to the host */
+static void
+huge_allocator_finalize (GObject * object)
+{
+  HugeAllocator *huge = (HugeAllocator *) object;
+  HugeAllocator *host = huge->host;
+
+  if (host != NULL) {
+    g_mutex_lock (&host->lock);
+    host->pools = g_slist_remove (host->pools, huge);
+    slab_count (&huge->frames, &host->retired);
+    slab_clear (&huge->frames, host);
+    g_mutex_unlock (&host->lock);
+    gst_object_unref (host);
+  } else {
+    slab_clear (&huge->frames, NULL);
+  }
+  for (gint i = 0; i < HUGEALLOC_CLASSES; i++)
+    slab_clear (&huge->classes[i], NULL);
+  slab_clear (&huge->shared, NULL);
+  slab_clear (&huge->heap, NULL);
+  g_slist_free_full (huge->extents, g_free);
+  if (huge->arena != NULL)
+    munmap (huge->arena, huge->arena_size);
+  g_mutex_clear (&huge->lock);
+  G_OBJECT_CLASS (huge_allocator_parent_class)->finalize (object);
+}
+
+static void
+huge_allocator_class_init (HugeAllocatorClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GstAllocatorClass *allocator_class = GST_ALLOCATOR_CLASS (klass);
+
+  gobject_class->finalize = huge_allocator_finalize;
+  allocator_class->alloc = huge_alloc;
+  allocator_class->free = huge_free;
+}
+
+static void
+huge_allocator_init (HugeAllocator * huge)
+{
+  GstAllocator *allocator = GST_ALLOCATOR (huge);
+
+  allocator->mem_type = HUGEALLOC_MEMORY_TYPE;
+  allocator->mem_map = huge_mem_map;
+  allocator->mem_unmap = huge_mem_unmap;
+  allocator->mem_share = huge_mem_share;
+  allocator->mem_copy = huge_mem_copy;
+  allocator->mem_is_span = huge_mem_is_span;
+  g_mutex_init (&huge->lock);
+  for (gint i = 0; i < HUGEALLOC_CLASSES; i++)
+    slab_init (&huge->classes[i], class_size (i));
+  slab_init (&huge->shared, 0);
+  slab_init (&huge->heap, 0);
+  slab_init (&huge->frames, 0);
+}
+
+/* Make a huge page allocator with an arena of arena_bytes, rounded up to
+ * whole huge pages, and the default allocator of the process. Without an
+ * arena every block comes from the heap, which only counts the allocations.
+ * Returns whether the arena is on reserved huge pages */
+gboolean
+hugealloc_init (gsize arena_bytes)
+{
+  HugeAllocator *huge = (HugeAllocator *)
+      g_object_new (huge_allocator_get_type (), NULL);
+
+  gst_object_ref_sink (huge);
+  arena_bytes = (arena_bytes + HUGEALLOC_PAGE_SIZE - 1)
+      / HUGEALLOC_PAGE_SIZE * HUGEALLOC_PAGE_SIZE;
+  if (arena_bytes > 0) {
+    huge->arena = arena_map (arena_bytes, &huge->hugetlb);
+    if (huge->arena == NULL)
+      g_printerr ("The %" G_GSIZE_FORMAT " MiB arena could not be mapped, "
+          "allocating from the heap.\n", arena_bytes >> 20);
+    else
+      huge->arena_size = arena_bytes;
+  }
+
+  if (host_allocator != NULL)
+    gst_object_unref (host_allocator);
+  host_allocator = huge;
+  gst_allocator_register (HUGEALLOC_MEMORY_TYPE,
+      GST_ALLOCATOR (gst_object_ref (huge)));
+  gst_allocator_set_default (GST_ALLOCATOR (gst_object_ref (huge)));
+  return huge->hugetlb;
+}
+
+/* An allocator for a pool of raw frames of size bytes, cutting them to
+ * that size from the arena of the host and everything else in its classes */
+static GstAllocator *
+pool_allocator_new (gsize size)
+{
+  HugeAllocator *pool = (HugeAllocator *)
+      g_object_new (huge_allocator_get_type (), NULL);
+
+  gst_object_ref_sink (pool);
+  pool->host = (HugeAllocator *) gst_object_ref (host_allocator);
+  pool->frames.size = align_up (size);
+  g_mutex_lock (&host_allocator->lock);
+  host_allocator->pools = g_slist_prepend (host_allocator->pools, pool);
+  g_mutex_unlock (&host_allocator->lock);
+  return GST_ALLOCATOR (pool);
+}
+
+/* Once a stage downstream answered an allocation query, offer the huge page
+ * allocator, and a video pool on it for raw frames, where it proposed
+ * none */
+static GstPadProbeReturn
+allocation_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  GstQuery *query = GST_PAD_PROBE_INFO_QUERY (info);
+  GstAllocationParams params;
+  GstAllocator *allocator;
+  GstBufferPool *pool;
+  GstStructure *config;
+  GstVideoInfo video;
+  GstCaps *caps;
+  gboolean need_pool;
+
+  if (!(info->type & GST_PAD_PROBE_TYPE_PULL)
+      || GST_QUERY_TYPE (query) != GST_QUERY_ALLOCATION
+      || host_allocator == NULL)
+    return GST_PAD_PROBE_OK;
+
+  gst_query_parse_allocation (query, &caps, &need_pool);
+  gst_allocation_params_init (&params);
+  if (gst_query_get_n_allocation_params (query) == 0)
+    gst_query_add_allocation_param (query, GST_ALLOCATOR (host_allocator),
+        &params);
+  if (!need_pool || caps == NULL || gst_query_get_n_allocation_pools (query)
+      > 0 || !gst_video_info_from_caps (&video, caps))
+    return GST_PAD_PROBE_OK;
+
+  pool = gst_video_buffer_pool_new ();
+  config = gst_buffer_pool_get_config (pool);
+  gst_buffer_pool_config_set_params (config, caps, video.size,
+      HUGEALLOC_POOL_MIN, 0);
+  allocator = pool_allocator_new (video.size);
+  gst_buffer_pool_config_set_allocator (config, allocator, &params);
+  gst_object_unref (allocator);
+  gst_buffer_pool_config_add_option (config,
+      GST_BUFFER_POOL_OPTION_VIDEO_META);
+  if (gst_buffer_pool_set_config (pool, config))
+    gst_query_add_allocation_pool (query, pool, video.size,
+        HUGEALLOC_POOL_MIN, 0);
+  gst_object_unref (pool);
+  return GST_PAD_PROBE_OK;
+}
+
+/* Negotiate the huge page allocator on the allocation queries passing a
+ * pad of the element, nothing without an arena */
+void
+hugealloc_attach (GstElement * element, const gchar * pad_name)
+{
+  GstPad *pad;
+
+  if (host_allocator == NULL || host_allocator->arena == NULL)
+    return;
+  pad = gst_element_get_static_pad (element, pad_name);
+  if (pad == NULL)
+    return;
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_QUERY_DOWNSTREAM,
+      (GstPadProbeCallback) allocation_probe, NULL, NULL);
+  gst_object_unref (pad);
+}
+
+/* The counters of the host allocator and of its pools, and the part of
+ * the arena in use */
+gboolean
+hugealloc_stats (HugeAllocStats * stats)
+{
+  if (host_allocator == NULL)
+    return FALSE;
+  g_mutex_lock (&host_allocator->lock);
+  *stats = host_allocator->retired;
+  stats->arena_used = host_allocator->used;
+  for (GSList * l = host_allocator->extents; l != NULL; l = l->next)
+    stats->arena_used -= ((HugeExtent *) l->data)->size;
+  stats->arena_size = host_allocator->arena_size;
+  stats->hugetlb = host_allocator->hugetlb;
+  for (gint i = 0; i < HUGEALLOC_CLASSES; i++)
+    slab_count (&host_allocator->classes[i], stats);
+  slab_count (&host_allocator->shared, stats);
+  slab_count (&host_allocator->heap, stats);
+  for (GSList * l = host_allocator->pools; l != NULL; l = l->next)
+    slab_count (&((HugeAllocator *) l->data)->frames, stats);
+  g_mutex_unlock (&host_allocator->lock);
+  return TRUE;
+}
+
+/* Resident memory of the process and the part on huge pages in kB */
+static void
+memory_usage (guint64 * rss, guint64 * huge)
+{
+  gchar *contents = NULL;
+  gchar **lines;
+
+  *rss = *huge = 0;
+  if (!g_file_get_contents ("/proc/self/smaps_rollup", &contents, NULL,
+          NULL))
+    return;
+  lines = g_strsplit (contents, "\n", -1);
+  for (gchar ** line = lines; *line != NULL; line++) {
+    gchar *value = strchr (*line, ':');
+
+    if (value == NULL)
+      continue;
+    if (g_str_has_prefix (*line, "Rss:"))
+      *rss = g_ascii_strtoull (value + 1, NULL, 10);
+    else if (g_str_has_prefix (*line, "AnonHugePages:")
+        || g_str_has_prefix (*line, "Private_Hugetlb:")
+        || g_str_has_prefix (*line, "Shared_Hugetlb:"))
+      *huge += g_ascii_strtoull (value + 1, NULL, 10);
+  }
+  g_strfreev (lines);
+  g_free (contents);
+}
+
+/* Stream the benchmark pipeline on a new allocator, with the arena and
+ * the pools negotiated on the convert and payloader stages or from the
+ * heap as the system allocator does, and print its allocations per
+ * second after the warm-up */
+static void
+bench_run (const gchar * label, gsize arena_bytes, gint seconds)
+{
+  GstElement *pipeline = gst_pipeline_new ("alloc-bench");
+  GstElement *source = gst_element_factory_make ("videotestsrc", NULL);
+  GstElement *capsfilter = gst_element_factory_make ("capsfilter", NULL);
+  GstElement *convert = gst_element_factory_make ("videoconvert", NULL);
+  GstElement *encoder = encselect_make (ENC_CODEC_H264);
+  GstElement *payloader = encselect_make_payloader (ENC_CODEC_H264);
+  GstElement *sink = gst_element_factory_make ("fakesink", NULL);
+  HugeAllocStats first, last;
+  guint64 rss, huge;
+  GstMessage *msg;
+  GstCaps *caps;
+  GstBus *bus;
+
+  if (!pipeline || !source || !capsfilter || !convert || !encoder
+      || !payloader || !sink) {
+    g_printerr ("Not all benchmark elements could be created.\n");
+    return;
+  }
+  hugealloc_init (arena_bytes);
+
+  caps = gst_caps_new_simple ("video/x-raw", "format", G_TYPE_STRING, "BGRx",
+      "width", G_TYPE_INT, HUGEALLOC_BENCH_WIDTH, "height", G_TYPE_INT,
+      HUGEALLOC_BENCH_HEIGHT, "framerate", GST_TYPE_FRACTION, 30, 1, NULL);
+  g_object_set (G_OBJECT (capsfilter), "caps", caps, NULL);
+  gst_caps_unref (caps);
+  g_object_set (G_OBJECT (source), "is-live", TRUE, "pattern", 18, NULL);
+  encprofile_apply (encoder, encprofile_default ());
+  g_object_set (G_OBJECT (sink), "sync", FALSE, NULL);
+  gst_bin_add_many (GST_BIN (pipeline), source, capsfilter, convert, encoder,
+      payloader, sink, NULL);
+  if (!gst_element_link_many (source, capsfilter, convert, encoder,
+          payloader, sink, NULL)) {
+    g_printerr ("Benchmark pipeline not linked.\n");
+    gst_object_unref (pipeline);
+    return;
+  }
+  hugealloc_attach (convert, "src");
+  hugealloc_attach (payloader, "sink");
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  bus = gst_element_get_bus (pipeline);
+  msg = gst_bus_timed_pop_filtered (bus, HUGEALLOC_BENCH_WARMUP * GST_SECOND,
+      GST_MESSAGE_ERROR);
+  hugealloc_stats (&first);
+  if (msg == NULL)
+    msg = gst_bus_timed_pop_filtered (bus, seconds * GST_SECOND,
+        GST_MESSAGE_ERROR);
+  hugealloc_stats (&last);
+  memory_usage (&rss, &huge);
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+
+  if (msg != NULL) {
+    g_printerr ("Benchmark pipeline failed.\n");
+    gst_message_unref (msg);
+  } else {
+    g_print ("%-16s %10.0f %10.0f %10.0f %10.1f %10.1f %10.1f\n", label,
+        (last.allocs + last.shares - first.allocs - first.shares)
+        / (gdouble) seconds, (last.mallocs - first.mallocs)
+        / (gdouble) seconds, (last.reuses - first.reuses) / (gdouble) seconds,
+        last.arena_used / 1048576.0, rss / 1024.0, huge / 1024.0);
+  }
+  gst_object_unref (bus);
+  gst_object_unref (pipeline);
+}
+
+/* Memory allocations per second of a converting, encoding and payloading
+ * pipeline on the heap against the huge page arena with pools */
+void
+hugealloc_benchmark (gint seconds)
+{
+  gboolean hugetlb;
+
+  g_print ("%dx%d BGRx to H.264 RTP, counted for %d s after %d s\n",
+      HUGEALLOC_BENCH_WIDTH, HUGEALLOC_BENCH_HEIGHT, seconds,
+      HUGEALLOC_BENCH_WARMUP);
+  g_print ("%-16s %10s %10s %10s %10s %10s %10s\n", "allocator",
+      "allocs/s", "mallocs/s", "reused/s", "arena MiB", "RSS MiB",
+      "huge MiB");
+  bench_run ("heap", 0, seconds);
+  bench_run ("huge-page arena", (gsize) HUGEALLOC_DEFAULT_ARENA_MB << 20,
+      seconds);
+}
@@ -1,4 +1,5 @@
 #include "keyboardhandler.h"
+#include "control.h"
 #include <iostream>
 
 /* This function will handle the keyboard */
@@ -7,13 +8,20 @@ handle_menu (CustomData * data, gchar input)
 {
   double current_volume;
   if (input == 'p') {
+    /* Leave fast-forward/rewind and play at normal rate */
+    if (data->seek.rate != 1.0)
+      seek_trick (&data->seek, 1.0);
+    /* Tell the clients to resume before the first new packet reaches them */
+    control_keepalive_stop ();
+    control_send (CONTROL_RESUME);
     /* Change State To PLAYING */
     gst_element_set_state (data->pipeline, GST_STATE_PLAYING);
   } else if (input == 's') {
     /* Change State to PAUSED */
     gst_element_set_state (data->pipeline, GST_STATE_PAUSED);
-    g_printerr
-        ("Do not keep the pipeline for pause state more than 5 seconds\n");
+    /* Clients hold their last frame and are kept alive while paused */
+    control_send (CONTROL_PAUSE);
+    control_keepalive_start ();
   } else if (input == 't') {
     /* Track the current position */
     gint64 cur_pos;
@@ -29,11 +37,28 @@ handle_menu (CustomData * data, gchar input)
 
   } else if (input == 'c') {
     /* seek 10 sec forward */
-    gint64 cur_pos;
-    gst_element_query_position (data->pipeline, GST_FORMAT_TIME, &cur_pos);
-    g_print ("\n Current Position : %ld Second\n ", (cur_pos) / 1000000000);
-    gst_element_seek_simple (data->pipeline, GST_FORMAT_TIME,
-        GstSeekFlags (GST_SEEK_FLAG_FLUSH), (cur_pos + 10 * GST_SECOND));
+    seek_relative (&data->seek, 10 * GST_SECOND);
+  } else if (input == 'b') {
+    /* seek 10 sec backward */
+    seek_relative (&data->seek, -10 * GST_SECOND);
+  } else if (input == 'a') {
+    /* Switch between key unit and accurate seeking */
+    if (data->seek.mode == SEEK_MODE_FAST) {
+      data->seek.mode = SEEK_MODE_ACCURATE;
+      g_print ("\n Accurate seek mode\n");
+    } else {
+      data->seek.mode = SEEK_MODE_FAST;
+      g_print ("\n Fast (key unit) seek mode\n");
+    }
+  } else if (input == 'f') {
+    /* Fast-forward 2x, 4x, 8x, 16x */
+    gdouble rate = data->seek.rate;
+    seek_trick (&data->seek, rate >= 2.0 ? MIN (rate * 2, SEEK_MAX_RATE) : 2.0);
+  } else if (input == 'r') {
+    /* Rewind 2x, 4x, 8x, 16x */
+    gdouble rate = data->seek.rate;
+    seek_trick (&data->seek,
+        rate <= -2.0 ? MAX (rate * 2, -SEEK_MAX_RATE) : -2.0);
   } else if (input == 'k') {
     g_print ("\nInteractive mode - keyboard controls:\n\n"
         "     p         :  play\n"
@@ -42,12 +67,20 @@ handle_menu (CustomData * data, gchar input)
         "     k         :  show keyboard shorcuts\n"
         "     d         :  Duration of media\n"
         "     c         :  Seek 10 sec forward\n"
+        "     b         :  Seek 10 sec backward\n"
+        "     g <sec>   :  Seek to position in seconds\n"
+        "     a         :  Toggle fast/accurate seeking\n"
+        "     f         :  Fast-forward (2x-16x)\n"
+        "     r         :  Rewind (2x-16x)\n"
         "     t         :  Current position of media\n"
         "     m         :  Print metadata\n"
         "     v         :  increase volume\n"
         "     u         :  decrease volume\n" "     q         :  quit\n");
   } else if (input == 'n') {
-    /* Flush the existing Stream Data and Play the next Stream */
+    /* Flush the existing Stream Data and Play the next Stream. Paused
+     * clients are resumed so they play out and wait for the next one */
+    control_keepalive_stop ();
+    control_send (CONTROL_RESUME);
     gst_element_set_state (data->pipeline, GST_STATE_PAUSED);
     gst_event_new_seek (1.0, GST_FORMAT_TIME, GST_SEEK_FLAG_FLUSH,
         GST_SEEK_TYPE_SET, 0, GST_SEEK_TYPE_SET, 0);
@@ -56,6 +89,7 @@ handle_menu (CustomData * data, gchar input)
 
   } else if (input == 'q') {
     /* Exit the Program */
+    control_close_clients ();
     gst_element_set_state (data->pipeline, GST_STATE_NULL);
     g_main_loop_quit (data->loop);
     exit (0);
@@ -65,6 +99,9 @@ handle_menu (CustomData * data, gchar input)
     metadata_fun (data->path);
     g_print ("\n********************************\n");
 
+  } else if ((input == 'v' || input == 'u') && data->volume == NULL) {
+    /* Replayed packets are sent as they were recorded */
+    g_print ("The volume can not be changed on this stream.\n");
   } else if (input == 'v') {
     /* Increasing the volume */
     g_object_get (G_OBJECT (data->volume), "volume", &current_volume, NULL);
@@ -103,7 +140,20 @@ handle_keyboard (GIOChannel * source, GIOCondition cond, CustomData * data)
           NULL) != G_IO_STATUS_NORMAL) {
     return TRUE;
   }
-  handle_menu (data, g_ascii_tolower (str[0]));
+  if (g_ascii_tolower (str[0]) == 'g') {
+    /* Seek to the absolute position in seconds, e.g. "g 90" */
+    gchar *end = NULL;
+    gint64 seconds = g_ascii_strtoll (str + 1, &end, 10);
+
+    g_strchug (end);
+    if (end == str + 1 || seconds < 0 || *end != '\0')
+      g_printerr ("Usage: g <seconds>\n");
+    else
+      seek_absolute (&data->seek, seconds * GST_SECOND);
+  } else {
+    handle_menu (data, g_ascii_tolower (str[0]));
+  }
+  g_free (str);
   return TRUE;
 }
 
@@ -117,6 +167,9 @@ msg_handle (GstBus * bus, GstMessage * msg, CustomData * data)
       break;
     case GST_MESSAGE_EOS:
       g_print ("\n End of Stream Reached.\n");
+      /* The control channel belongs to the interactive session */
+      if (data->session == NULL || data->session->interactive)
+        control_keepalive_stop ();
       gst_element_set_state (data->pipeline, GST_STATE_NULL);
       g_main_loop_quit (data->loop);
       break;
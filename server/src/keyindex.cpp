@@ -0,0 +1,358 @@
+#include "keyindex.h"
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Bytes read ahead at a keyframe offset before seeking to it */
+#define KEYINDEX_PREFETCH_SIZE (2 * 1024 * 1024)
+
+/* Structure for building the index of one file in the background */
+typedef struct _KeyIndexBuild
+{
+  KeyIndex *index;
+  std::string path;
+  std::string sidecar;
+  GstElement *pipeline;
+  guint64 last_offset;
+  GArray *entries;
+} KeyIndexBuild;
+
+/* The index files live in the user cache directory, next to the media they
+ * would be picked up as files to stream */
+static std::string
+sidecar_path (std::string path)
+{
+  gchar *hash = g_compute_checksum_for_string (G_CHECKSUM_SHA1, path.c_str (),
+      -1);
+  gchar *dir = g_build_filename (g_get_user_cache_dir (),
+      "gstreamer-remote-streaming", NULL);
+  gchar *name = g_strconcat (hash, ".kidx", NULL);
+  gchar *file = g_build_filename (dir, name, NULL);
+  std::string sidecar = file;
+
+  g_mkdir_with_parents (dir, 0755);
+  g_free (file);
+  g_free (name);
+  g_free (dir);
+  g_free (hash);
+  return sidecar;
+}
+
+/* Load an index file, NULL if it is missing or older than the media file */
+static GArray *
+load_index (std::string path, std::string sidecar)
+{
+  struct stat st;
+  KeyIndexHeader header;
+  gchar *contents = NULL;
+  gsize length = 0;
+  GArray *entries = NULL;
+
+  if (stat (path.c_str (), &st) < 0)
+    return NULL;
+  if (!g_file_get_contents (sidecar.c_str (), &contents, &length, NULL))
+    return NULL;
+
+  if (length >= sizeof (header)) {
+    memcpy (&header, contents, sizeof (header));
+    if (memcmp (header.magic, KEYINDEX_MAGIC, 4) == 0
+        && header.version == KEYINDEX_VERSION
+        && header.file_size == (guint64) st.st_size
+        && header.file_mtime == (gint64) st.st_mtime
+        && length == sizeof (header) + header.count * sizeof (KeyIndexEntry)) {
+      entries = g_array_sized_new (FALSE, FALSE, sizeof (KeyIndexEntry),
+          header.count);
+      g_array_append_vals (entries, contents + sizeof (header), header.count);
+    }
+  }
+  g_free (contents);
+  return entries;
+}
+
+/* Write the index file, renamed into place so readers never see half of it */
+static void
+save_index (std::string path, std::string sidecar, GArray * entries)
+{
+  struct stat st;
+  KeyIndexHeader header;
+  std::string tmp = sidecar + ".tmp";
+  FILE *file;
+
+  if (stat (path.c_str (), &st) < 0)
+    return;
+
+  memset (&header, 0, sizeof (header));
+  memcpy (header.magic, KEYINDEX_MAGIC, 4);
+  header.version = KEYINDEX_VERSION;
+  header.file_size = st.st_size;
+  header.file_mtime = st.st_mtime;
+  header.count = entries->len;
+
+  file = fopen (tmp.c_str (), "wb");
+  if (file == NULL) {
+    perror ("keyframe index");
+    return;
+  }
+  fwrite (&header, sizeof (header), 1, file);
+  fwrite (entries->data, sizeof (KeyIndexEntry), entries->len, file);
+  if (fclose (file) != 0 || g_rename (tmp.c_str (), sidecar.c_str ()) != 0) {
+    perror ("keyframe index");
+    g_unlink (tmp.c_str ());
+  }
+}
+
+/* Hand the loaded or built entries to the index */
+static void
+set_index (KeyIndex * index, GArray * entries)
+{
+  g_mutex_lock (&index->lock);
+  if (index->entries == NULL) {
+    index->entries = entries;
+    entries = NULL;
+  }
+  g_mutex_unlock (&index->lock);
+
+  if (entries != NULL)
+    g_array_unref (entries);
+}
+
+/* The demuxer of the files that are indexed, NULL for audio only files */
+static const gchar *
+index_demuxer (const gchar * path)
+{
+  if (g_str_has_suffix (path, ".mp4"))
+    return "qtdemux";
+  if (g_str_has_suffix (path, ".avi"))
+    return "avidemux";
+  if (g_str_has_suffix (path, ".webm"))
+    return "matroskademux";
+  return NULL;
+}
+
+/* Remember the byte offset of the last range read by the demuxer */
+static GstPadProbeReturn
+offset_probe (GstPad * pad, GstPadProbeInfo * info, KeyIndexBuild * build)
+{
+  if (info->type & GST_PAD_PROBE_TYPE_PULL)
+    build->last_offset = info->offset;
+  else if (GST_BUFFER_OFFSET_IS_VALID (GST_PAD_PROBE_INFO_BUFFER (info)))
+    build->last_offset = GST_BUFFER_OFFSET (GST_PAD_PROBE_INFO_BUFFER (info));
+  return GST_PAD_PROBE_OK;
+}
+
+/* Record every keyframe leaving the demuxer */
+static GstPadProbeReturn
+keyframe_probe (GstPad * pad, GstPadProbeInfo * info, KeyIndexBuild * build)
+{
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  KeyIndexEntry entry;
+
+  if (GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT))
+    return GST_PAD_PROBE_OK;
+
+  entry.timestamp = GST_BUFFER_PTS_IS_VALID (buffer) ?
+      GST_BUFFER_PTS (buffer) : GST_BUFFER_DTS (buffer);
+  entry.offset = build->last_offset;
+  if (entry.timestamp != GST_CLOCK_TIME_NONE)
+    g_array_append_val (build->entries, entry);
+  return GST_PAD_PROBE_OK;
+}
+
+/* Every demuxer pad goes to a fakesink, only video is indexed */
+static void
+build_pad_added (GstElement * demux, GstPad * pad, KeyIndexBuild * build)
+{
+  GstElement *sink = gst_element_factory_make ("fakesink", NULL);
+  GstCaps *caps = gst_pad_get_current_caps (pad);
+  GstPad *sinkpad;
+
+  g_object_set (G_OBJECT (sink), "sync", FALSE, NULL);
+  gst_bin_add (GST_BIN (build->pipeline), sink);
+  gst_element_sync_state_with_parent (sink);
+  sinkpad = gst_element_get_static_pad (sink, "sink");
+  if (GST_PAD_LINK_FAILED (gst_pad_link (pad, sinkpad)))
+    g_printerr ("Keyframe index: could not link demuxer pad.\n");
+  gst_object_unref (sinkpad);
+
+  if (caps != NULL) {
+    if (g_str_has_prefix (gst_structure_get_name (gst_caps_get_structure (caps,
+                    0)), "video/")) {
+      gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+          (GstPadProbeCallback) keyframe_probe, build, NULL);
+    }
+    gst_caps_unref (caps);
+  }
+}
+
+/* Demux the whole file once without decoding and store its keyframes */
+static gpointer
+build_thread (KeyIndexBuild * build)
+{
+  GstElement *source, *demux;
+  GstMessage *msg;
+  GstBus *bus;
+  GstPad *pad;
+  const gchar *demuxer = index_demuxer (build->path.c_str ());
+
+  build->pipeline = gst_pipeline_new ("keyindex-pipeline");
+  source = gst_element_factory_make ("filesrc", NULL);
+  demux = gst_element_factory_make (demuxer, NULL);
+  if (!build->pipeline || !source || !demux) {
+    g_printerr ("Keyframe index: not all elements could be created.\n");
+    goto done;
+  }
+  gst_bin_add_many (GST_BIN (build->pipeline), source, demux, NULL);
+  g_object_set (G_OBJECT (source), "location", build->path.c_str (), NULL);
+  if (gst_element_link (source, demux) != TRUE) {
+    g_printerr ("Keyframe index: source and demuxer not linked.\n");
+    goto done;
+  }
+
+  pad = gst_element_get_static_pad (demux, "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+      (GstPadProbeCallback) offset_probe, build, NULL);
+  gst_object_unref (pad);
+  g_signal_connect (demux, "pad-added", G_CALLBACK (build_pad_added), build);
+
+  gst_element_set_state (build->pipeline, GST_STATE_PLAYING);
+  bus = gst_element_get_bus (build->pipeline);
+  msg = gst_bus_timed_pop_filtered (bus, GST_CLOCK_TIME_NONE,
+      (GstMessageType) (GST_MESSAGE_EOS | GST_MESSAGE_ERROR));
+  gst_element_set_state (build->pipeline, GST_STATE_NULL);
+
+  if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_EOS && build->entries->len > 0) {
+    g_print ("Keyframe index built: %u keyframes\n", build->entries->len);
+    save_index (build->path, build->sidecar, build->entries);
+    set_index (build->index, g_array_ref (build->entries));
+  } else {
+    g_printerr ("Keyframe index could not be built for %s\n",
+        build->path.c_str ());
+  }
+  gst_message_unref (msg);
+  gst_object_unref (bus);
+
+done:
+  if (build->pipeline)
+    gst_object_unref (build->pipeline);
+  g_array_unref (build->entries);
+  keyindex_unref (build->index);
+  delete build;
+  return NULL;
+}
+
+/* Load the keyframe index of a file, or build it in the background. NULL
+ * for files without video */
+KeyIndex *
+keyindex_prepare (const gchar * path)
+{
+  std::string sidecar;
+  KeyIndex *index;
+  GArray *entries;
+
+  if (index_demuxer (path) == NULL)
+    return NULL;
+  index = g_new0 (KeyIndex, 1);
+  index->ref_count = 1;
+  index->path = g_strdup (path);
+  g_mutex_init (&index->lock);
+
+  sidecar = sidecar_path (path);
+  entries = load_index (path, sidecar);
+  if (entries != NULL) {
+    g_print ("Keyframe index loaded: %u keyframes\n", entries->len);
+    set_index (index, entries);
+    return index;
+  }
+
+  KeyIndexBuild *build = new KeyIndexBuild ();
+  build->index = keyindex_ref (index);
+  build->path = path;
+  build->sidecar = sidecar;
+  build->pipeline = NULL;
+  build->last_offset = 0;
+  build->entries = g_array_new (FALSE, FALSE, sizeof (KeyIndexEntry));
+  g_thread_unref (g_thread_new ("keyindex", (GThreadFunc) build_thread,
+          build));
+  return index;
+}
+
+KeyIndex *
+keyindex_ref (KeyIndex * index)
+{
+  g_atomic_int_inc (&index->ref_count);
+  return index;
+}
+
+void
+keyindex_unref (KeyIndex * index)
+{
+  if (!g_atomic_int_dec_and_test (&index->ref_count))
+    return;
+  if (index->entries != NULL)
+    g_array_unref (index->entries);
+  g_mutex_clear (&index->lock);
+  g_free (index->path);
+  g_free (index);
+}
+
+/* Find the keyframe for a position, snapping as the seek flags ask */
+gboolean
+keyindex_lookup (KeyIndex * index, gint64 position, GstSeekFlags snap,
+    KeyIndexEntry * entry)
+{
+  KeyIndexEntry *entries;
+  guint low = 0, high, found;
+  gboolean ret = FALSE;
+
+  if (index == NULL)
+    return FALSE;
+  g_mutex_lock (&index->lock);
+  if (index->entries == NULL || index->entries->len == 0)
+    goto done;
+
+  /* Binary search for the last keyframe at or before the position */
+  entries = (KeyIndexEntry *) index->entries->data;
+  high = index->entries->len;
+  while (high - low > 1) {
+    guint mid = (low + high) / 2;
+    if ((gint64) entries[mid].timestamp <= position)
+      low = mid;
+    else
+      high = mid;
+  }
+  found = low;
+
+  if (found + 1 < index->entries->len) {
+    gint64 before = position - (gint64) entries[found].timestamp;
+    gint64 after = (gint64) entries[found + 1].timestamp - position;
+    if ((snap & GST_SEEK_FLAG_SNAP_AFTER) && !(snap & GST_SEEK_FLAG_SNAP_BEFORE)
+        && before > 0)
+      found++;
+    else if ((snap & GST_SEEK_FLAG_SNAP_NEAREST) == GST_SEEK_FLAG_SNAP_NEAREST
+        && after < before)
+      found++;
+  }
+  *entry = entries[found];
+  ret = TRUE;
+
+done:
+  g_mutex_unlock (&index->lock);
+  return ret;
+}
+
+/* Ask the kernel to read the keyframe data while the pipeline flushes.
+ * Only a hint, the demuxer still seeks by time and reads what it finds */
+void
+keyindex_prefetch (KeyIndex * index, const KeyIndexEntry * entry)
+{
+  int fd = open (index->path, O_RDONLY);
+
+  if (fd < 0)
+    return;
+  posix_fadvise (fd, entry->offset, KEYINDEX_PREFETCH_SIZE,
+      POSIX_FADV_WILLNEED);
+  close (fd);
+}
@@ -0,0 +1,370 @@
+#include "loadshed.h"
+#include "encprofile.h"
+#include "encselect.h"
+#include <gst/base/gstbasesink.h>
+#include <string.h>
+
+static const gchar *level_names[] = {
+  "full quality", "frame dropping", "faster encoder preset",
+  "lower resolution"
+};
+
+/* videorate ! videoscale ! capsfilter in front of the encoder, passing
+ * everything through until the controller steps in */
+GstElement *
+loadshed_bin_new ()
+{
+  GstElement *bin = gst_bin_new (NULL);
+  GstElement *rate = gst_element_factory_make ("videorate", "shedrate");
+  GstElement *scale = gst_element_factory_make ("videoscale", "shedscale");
+  GstElement *caps = gst_element_factory_make ("capsfilter", "shedcaps");
+  GstPad *pad;
+
+  if (!rate || !scale || !caps) {
+    g_printerr ("Load shedding elements could not be created.\n");
+    gst_object_unref (bin);
+    return NULL;
+  }
+  /* Only drop, never duplicate frames */
+  g_object_set (G_OBJECT (rate), "drop-only", TRUE, NULL);
+  gst_bin_add_many (GST_BIN (bin), rate, scale, caps, NULL);
+  gst_element_link_many (rate, scale, caps, NULL);
+
+  pad = gst_element_get_static_pad (rate, "sink");
+  gst_element_add_pad (bin, gst_ghost_pad_new ("sink", pad));
+  gst_object_unref (pad);
+  pad = gst_element_get_static_pad (caps, "src");
+  gst_element_add_pad (bin, gst_ghost_pad_new ("src", pad));
+  gst_object_unref (pad);
+  return bin;
+}
+
+/* A frame enters the encoder */
+static GstPadProbeReturn
+encoder_sink_probe (GstPad * pad, GstPadProbeInfo * info, LoadShedData * shed)
+{
+  g_mutex_lock (&shed->lock);
+  shed->enter = g_get_monotonic_time ();
+  shed->enter_thread = g_thread_self ();
+  g_mutex_unlock (&shed->lock);
+  return GST_PAD_PROBE_OK;
+}
+
+/* The encoder pushes its output from within the chain call of the frame
+ * that went in, the time in between is what encoding a frame costs the
+ * streaming thread */
+static GstPadProbeReturn
+encoder_src_probe (GstPad * pad, GstPadProbeInfo * info, LoadShedData * shed)
+{
+  g_mutex_lock (&shed->lock);
+  if (shed->enter != 0 && shed->enter_thread == g_thread_self ()) {
+    shed->encode_sum += g_get_monotonic_time () - shed->enter;
+    shed->encode_count++;
+    shed->enter = 0;
+  }
+  g_mutex_unlock (&shed->lock);
+  return GST_PAD_PROBE_OK;
+}
+
+/* Framerate and size of the frames currently going into the encoder */
+static gboolean
+encoder_format (LoadShedData * shed, gint * fps_n, gint * fps_d,
+    gint * width, gint * height)
+{
+  GstPad *pad = gst_element_get_static_pad (shed->encoder, "sink");
+  GstCaps *caps = gst_pad_get_current_caps (pad);
+  gboolean ret = FALSE;
+
+  gst_object_unref (pad);
+  if (caps == NULL)
+    return FALSE;
+  GstStructure *s = gst_caps_get_structure (caps, 0);
+  ret = gst_structure_get_fraction (s, "framerate", fps_n, fps_d)
+      && gst_structure_get_int (s, "width", width)
+      && gst_structure_get_int (s, "height", height) && *fps_n > 0;
+  gst_caps_unref (caps);
+  return ret;
+}
+
+/* A packet reaches the video sink, late when the sink clock is already
+ * past its running time and the latency. Only a pipeline falling behind
+ * the clock makes late packets, a file held back by it does not */
+static GstPadProbeReturn
+sink_probe (GstPad * pad, GstPadProbeInfo * info, LoadShedData * shed)
+{
+  GstElement *sink = shed->sink;
+  GstBuffer *buffer = (info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST)
+      ? gst_buffer_list_get (GST_PAD_PROBE_INFO_BUFFER_LIST (info), 0)
+      : GST_PAD_PROBE_INFO_BUFFER (info);
+  GstClockTime running, now, deadline;
+  const GstSegment *segment;
+  GstEvent *event;
+  GstClock *clock;
+
+  if (buffer == NULL || !GST_BUFFER_PTS_IS_VALID (buffer)
+      || GST_STATE (sink) != GST_STATE_PLAYING)
+    return GST_PAD_PROBE_OK;
+  event = gst_pad_get_sticky_event (pad, GST_EVENT_SEGMENT, 0);
+  if (event == NULL)
+    return GST_PAD_PROBE_OK;
+  gst_event_parse_segment (event, &segment);
+  running = gst_segment_to_running_time (segment, GST_FORMAT_TIME,
+      GST_BUFFER_PTS (buffer));
+  gst_event_unref (event);
+  clock = gst_element_get_clock (sink);
+  if (clock == NULL || !GST_CLOCK_TIME_IS_VALID (running)) {
+    if (clock != NULL)
+      gst_object_unref (clock);
+    return GST_PAD_PROBE_OK;
+  }
+  now = gst_clock_get_time (clock) - gst_element_get_base_time (sink);
+  gst_object_unref (clock);
+  deadline = running + gst_base_sink_get_latency (GST_BASE_SINK (sink))
+      + SHED_LATE_MS * GST_MSECOND;
+
+  g_mutex_lock (&shed->lock);
+  shed->packets++;
+  if (now > deadline)
+    shed->late_packets++;
+  g_mutex_unlock (&shed->lock);
+  return GST_PAD_PROBE_OK;
+}
+
+/* Configure the elements for the given level, every level keeps the
+ * measures of the levels below it */
+static void
+apply_level (LoadShedData * shed, ShedLevel level)
+{
+  GstCaps *caps;
+
+  g_object_set (G_OBJECT (shed->rate), "max-rate",
+      level >= SHED_LEVEL_DROP_FRAMES ?
+      MAX (1, shed->fps_n / shed->fps_d / 2) : G_MAXINT, NULL);
+
+  if (shed->has_preset)
+    g_object_set (G_OBJECT (shed->encoder), "cpu-used",
+        level >= SHED_LEVEL_PRESET ? SHED_VP8_CPU_USED : shed->cpu_used,
+        NULL);
+
+  if (level >= SHED_LEVEL_RESOLUTION)
+    caps = gst_caps_new_simple ("video/x-raw",
+        "width", G_TYPE_INT, GST_ROUND_UP_2 (shed->width / 2),
+        "height", G_TYPE_INT, GST_ROUND_UP_2 (shed->height / 2), NULL);
+  else
+    caps = gst_caps_new_any ();
+  g_object_set (G_OBJECT (shed->capsfilter), "caps", caps, NULL);
+  gst_caps_unref (caps);
+}
+
+/* Move one level down or up, skipping the preset step for encoders that
+ * cannot change speed while playing. x264enc only takes speed-preset in
+ * READY, so it keeps the preset of the session profile and goes from
+ * frame dropping straight to the lower resolution */
+static void
+step (LoadShedData * shed, gint direction, gdouble interval)
+{
+  gint level = shed->level + direction;
+
+  if (level == SHED_LEVEL_PRESET && !shed->has_preset)
+    level += direction;
+  if (level < SHED_LEVEL_NONE || level > SHED_LEVEL_RESOLUTION)
+    return;
+
+  g_print ("Load shed session %u: %s -> %s (encode %.1f of %.1f ms per "
+      "frame, %.0f%% late)\n", shed->session, level_names[shed->level],
+      level_names[level], shed->load * interval * 1000.0, interval * 1000.0,
+      shed->late * 100.0);
+  shed->level = (ShedLevel) level;
+  if (level > SHED_LEVEL_NONE)
+    shed->shed = TRUE;
+  apply_level (shed, shed->level);
+}
+
+static gboolean
+shed_tick (LoadShedData * shed)
+{
+  gint fps_n, fps_d, width, height;
+  gdouble interval;
+  guint64 dropped = 0;
+
+  if (!encoder_format (shed, &fps_n, &fps_d, &width, &height))
+    return G_SOURCE_CONTINUE;
+  /* Remember the full quality format for the levels and the recovery */
+  if (shed->level == SHED_LEVEL_NONE) {
+    shed->fps_n = fps_n;
+    shed->fps_d = fps_d;
+    shed->width = width;
+    shed->height = height;
+  }
+  interval = fps_d / (gdouble) fps_n;
+
+  g_mutex_lock (&shed->lock);
+  shed->load = shed->encode_count ? shed->encode_sum
+      / (gdouble) shed->encode_count / G_USEC_PER_SEC / interval : 0.0;
+  shed->late = shed->packets ? shed->late_packets
+      / (gdouble) shed->packets : 0.0;
+  shed->encode_sum = 0;
+  shed->encode_count = 0;
+  shed->packets = shed->late_packets = 0;
+  g_mutex_unlock (&shed->lock);
+
+  if (shed->load > SHED_OVERLOAD || shed->late > SHED_LATE_HIGH) {
+    shed->overloaded++;
+    shed->idle = 0;
+  } else if (shed->load < SHED_HEADROOM && shed->late == 0.0) {
+    shed->idle++;
+    shed->overloaded = 0;
+  } else {
+    shed->overloaded = 0;
+    shed->idle = 0;
+  }
+
+  if (shed->overloaded >= SHED_OVERLOAD_TICKS) {
+    step (shed, 1, interval);
+    shed->overloaded = 0;
+  } else if (shed->idle >= SHED_RECOVER_TICKS) {
+    step (shed, -1, interval);
+    shed->idle = 0;
+  }
+
+  if (++shed->ticks % SHED_REPORT_INTERVAL == 0) {
+    g_object_get (G_OBJECT (shed->rate), "drop", &dropped, NULL);
+    g_print ("Load shed session %u: %s, encode %.0f%% of frame interval, "
+        "%.0f%% late, %" G_GUINT64_FORMAT " frames dropped, %dx%d\n",
+        shed->session, level_names[shed->level], shed->load * 100.0,
+        shed->late * 100.0, dropped, width, height);
+  }
+  return G_SOURCE_CONTINUE;
+}
+
+/* Watch the encoder and the video sink of a host pipeline and shed load
+ * through the given load shedding bin. Lateness only counts when the
+ * sink syncs to the clock. The controller runs on the main context of the
+ * calling session thread */
+void
+loadshed_setup (LoadShedData * shed, guint session, GstElement * sink,
+    GstElement * bin, GstElement * encoder)
+{
+  GstElementFactory *factory = gst_element_get_factory (encoder);
+  GstPad *pad;
+
+  shed->session = session;
+  shed->sink = sink;
+  shed->encoder = encoder;
+  shed->rate = gst_bin_get_by_name (GST_BIN (bin), "shedrate");
+  shed->capsfilter = gst_bin_get_by_name (GST_BIN (bin), "shedcaps");
+  shed->level = SHED_LEVEL_NONE;
+  shed->shed = FALSE;
+  g_mutex_init (&shed->lock);
+
+  /* vp8enc and vp9enc take a new cpu-used while encoding */
+  shed->has_preset = factory != NULL
+      && (!strcmp (GST_OBJECT_NAME (factory), "vp8enc")
+      || !strcmp (GST_OBJECT_NAME (factory), "vp9enc"));
+  if (shed->has_preset)
+    g_object_get (G_OBJECT (encoder), "cpu-used", &shed->cpu_used, NULL);
+
+  pad = gst_element_get_static_pad (encoder, "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+      (GstPadProbeCallback) encoder_sink_probe, shed, NULL);
+  gst_object_unref (pad);
+  pad = gst_element_get_static_pad (encoder, "src");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+      (GstPadProbeCallback) encoder_src_probe, shed, NULL);
+  gst_object_unref (pad);
+  if (GST_IS_BASE_SINK (sink) && gst_base_sink_get_sync (GST_BASE_SINK
+          (sink))) {
+    pad = gst_element_get_static_pad (sink, "sink");
+    gst_pad_add_probe (pad, (GstPadProbeType) (GST_PAD_PROBE_TYPE_BUFFER
+            | GST_PAD_PROBE_TYPE_BUFFER_LIST),
+        (GstPadProbeCallback) sink_probe, shed, NULL);
+    gst_object_unref (pad);
+  }
+
+  shed->source = g_timeout_source_new (SHED_TICK_MS);
+  g_source_set_callback (shed->source, (GSourceFunc) shed_tick, shed, NULL);
+  g_source_attach (shed->source, g_main_context_get_thread_default ());
+}
+
+/* Stop the controller, called after the pipeline went to NULL */
+void
+loadshed_stop (LoadShedData * shed)
+{
+  if (shed->source != NULL) {
+    g_source_destroy (shed->source);
+    g_source_unref (shed->source);
+    shed->source = NULL;
+  }
+  if (shed->rate != NULL)
+    gst_object_unref (shed->rate);
+  if (shed->capsfilter != NULL)
+    gst_object_unref (shed->capsfilter);
+  shed->rate = shed->capsfilter = NULL;
+  g_mutex_clear (&shed->lock);
+}
+
+static gboolean
+check_done (GMainLoop * loop)
+{
+  g_main_loop_quit (loop);
+  return G_SOURCE_REMOVE;
+}
+
+/* A live stream the encoder keeps up with, sent to a sink syncing to the
+ * clock behind a full queue, must stay at full quality for the seconds.
+ * Returns whether it did */
+gboolean
+loadshed_check (gint seconds)
+{
+  GstElement *pipeline = gst_pipeline_new ("shed-check");
+  GstElement *source = gst_element_factory_make ("videotestsrc", NULL);
+  GstElement *capsfilter = gst_element_factory_make ("capsfilter", NULL);
+  GstElement *queue = gst_element_factory_make ("queue", NULL);
+  GstElement *convert = gst_element_factory_make ("videoconvert", NULL);
+  GstElement *bin = loadshed_bin_new ();
+  GstElement *encoder = encselect_make (ENC_CODEC_H264);
+  GstElement *sink = gst_element_factory_make ("fakesink", NULL);
+  GMainLoop *loop;
+  LoadShedData shed;
+  GstCaps *caps;
+  gboolean passed;
+
+  if (!pipeline || !source || !capsfilter || !queue || !convert || !bin
+      || !encoder || !sink) {
+    g_printerr ("Not all check elements could be created.\n");
+    return FALSE;
+  }
+  caps = gst_caps_new_simple ("video/x-raw", "width", G_TYPE_INT,
+      SHED_CHECK_WIDTH, "height", G_TYPE_INT, SHED_CHECK_HEIGHT,
+      "framerate", GST_TYPE_FRACTION, 30, 1, NULL);
+  g_object_set (G_OBJECT (capsfilter), "caps", caps, NULL);
+  gst_caps_unref (caps);
+  g_object_set (G_OBJECT (source), "is-live", TRUE, NULL);
+  encprofile_apply (encoder, encprofile_default ());
+  g_object_set (G_OBJECT (sink), "sync", TRUE, NULL);
+  gst_bin_add_many (GST_BIN (pipeline), source, capsfilter, queue, convert,
+      bin, encoder, sink, NULL);
+  if (!gst_element_link_many (source, capsfilter, queue, convert, bin,
+          encoder, sink, NULL)) {
+    g_printerr ("Check pipeline not linked.\n");
+    gst_object_unref (pipeline);
+    return FALSE;
+  }
+
+  memset (&shed, 0, sizeof (shed));
+  loop = g_main_loop_new (NULL, FALSE);
+  loadshed_setup (&shed, 0, sink, bin, encoder);
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  g_timeout_add_seconds (seconds, (GSourceFunc) check_done, loop);
+  g_main_loop_run (loop);
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+
+  passed = shed.level == SHED_LEVEL_NONE && !shed.shed;
+  g_print ("Load shed check: %s after %d s, encode %.0f%% of frame "
+      "interval, %.0f%% late: %s\n", level_names[shed.level], seconds,
+      shed.load * 100.0, shed.late * 100.0, passed ? "PASS" : "FAIL");
+  loadshed_stop (&shed);
+  gst_object_unref (pipeline);
+  g_main_loop_unref (loop);
+  return passed;
+}
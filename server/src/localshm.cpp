@@ -0,0 +1,440 @@
+#include "localshm.h"
+#include "control.h"
+#include "encprofile.h"
+#include "encselect.h"
+#include "membudget.h"
+#include "rtpcache.h"
+#include "sysstat.h"
+#include <glib/gstdio.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+
+/* Whether clients on this host are offered the shared memory transport */
+static gboolean local_enabled = FALSE;
+
+/* Structure for an RTP stream with a shmsink: the socket prefix of its
+ * session and the udpsink a local client leaves once it reads from there */
+typedef struct _LocalStream
+{
+  gchar *prefix;
+  guint session;
+  GWeakRef udpsink;
+} LocalStream;
+
+/* Streams with a shmsink, of all sessions */
+static GSList *local_streams = NULL;
+static GMutex local_lock;
+
+/* Extensions whose video goes through a linked payloader */
+static const gchar *video_extensions[] = { "mp4", "webm", "avi", "avsync",
+  NULL
+};
+
+/* Structure for the latency of one benchmark run: the times in us since
+ * start that frames left the encoder, taken off in order as they reach the
+ * receiving sink */
+typedef struct _LocalBench
+{
+  GMutex lock;
+  gint64 start;
+  GQueue sent;
+  guint64 frames;
+  gint64 total;
+  gint64 longest;
+} LocalBench;
+
+/* Take every address of the client off the udpsink */
+static void
+remove_client (GstElement * udpsink, const gchar * address)
+{
+  gchar *clients = NULL;
+  gchar **list;
+  GString *kept = g_string_new (NULL);
+
+  g_object_get (G_OBJECT (udpsink), "clients", &clients, NULL);
+  list = g_strsplit (clients ? clients : "", ",", -1);
+  for (gchar ** entry = list; *entry != NULL; entry++) {
+    gchar *colon = strrchr (*entry, ':');
+
+    if (**entry == '\0' || (colon != NULL
+            && strncmp (*entry, address, colon - *entry) == 0
+            && address[colon - *entry] == '\0'))
+      continue;
+    g_string_append_printf (kept, "%s%s", kept->len ? "," : "", *entry);
+  }
+  g_object_set (G_OBJECT (udpsink), "clients", kept->str, NULL);
+  g_string_free (kept, TRUE);
+  g_strfreev (list);
+  g_free (clients);
+}
+
+/* A client on this host reads the streams of the socket prefix from
+ * shared memory, the udpsinks of those streams stop sending it RTP */
+static void
+local_handler (int client, const gchar * args)
+{
+  struct sockaddr_in peer;
+  socklen_t length = sizeof (peer);
+  gchar address[INET_ADDRSTRLEN];
+
+  if (getpeername (client, (struct sockaddr *) &peer, &length) < 0
+      || peer.sin_family != AF_INET
+      || inet_ntop (AF_INET, &peer.sin_addr, address, sizeof (address))
+      == NULL)
+    return;
+  g_mutex_lock (&local_lock);
+  for (GSList * l = local_streams; l != NULL; l = l->next) {
+    LocalStream *stream = (LocalStream *) l->data;
+    GstElement *udpsink;
+
+    if (g_strcmp0 (stream->prefix, args) != 0)
+      continue;
+    udpsink = (GstElement *) g_weak_ref_get (&stream->udpsink);
+    if (udpsink == NULL)
+      continue;
+    remove_client (udpsink, address);
+    g_print ("RTP session %u: %s reads from shared memory\n",
+        stream->session, address);
+    gst_object_unref (udpsink);
+  }
+  g_mutex_unlock (&local_lock);
+}
+
+void
+localshm_set_enabled (gboolean enabled)
+{
+  local_enabled = enabled;
+  if (enabled)
+    control_add_handler (CONTROL_LOCAL, local_handler);
+}
+
+/* Offer the local transport on a control connection from this host, on
+ * loopback or on the address it connected to. Only a session whose video
+ * gets a shmsink is offered: not mp3, not a simulcast funnel and not the
+ * cache replay. The sockets go in a new private directory, so no file of
+ * an earlier run can be taken for them. The session then also sends
+ * through shared memory */
+gboolean
+localshm_offer (StreamSession * session, int fd, const gchar * extension)
+{
+  struct sockaddr_in self, peer;
+  socklen_t length = sizeof (self);
+  gchar *dir;
+
+  if (!local_enabled || !g_strv_contains (video_extensions, extension)
+      || session->renditions > 1
+      || (strcmp (extension, "mp4") == 0 && rtpcache_available (session,
+              encselect_video_codec (session, ENC_CODEC_H264)))
+      || getsockname (fd, (struct sockaddr *) &self, &length) < 0)
+    return FALSE;
+  length = sizeof (peer);
+  if (getpeername (fd, (struct sockaddr *) &peer, &length) < 0
+      || peer.sin_family != AF_INET)
+    return FALSE;
+  if ((ntohl (peer.sin_addr.s_addr) >> 24) != 127
+      && peer.sin_addr.s_addr != self.sin_addr.s_addr)
+    return FALSE;
+  if (session->local != NULL)
+    return TRUE;
+  dir = g_dir_make_tmp (LOCALSHM_PREFIX "-XXXXXX", NULL);
+  if (dir == NULL)
+    return FALSE;
+  session->local = g_build_filename (dir, "stream", NULL);
+  g_free (dir);
+  return TRUE;
+}
+
+/* Remove the sockets of a session and their directory */
+void
+localshm_release (StreamSession * session)
+{
+  gchar *dir;
+
+  if (session->local == NULL)
+    return;
+  for (guint i = RTP_SESSION_VIDEO; i <= RTP_SESSION_AUDIO; i++) {
+    gchar *path = g_strdup_printf ("%s-%u", session->local, i);
+
+    g_unlink (path);
+    g_free (path);
+  }
+  dir = g_path_get_dirname (session->local);
+  g_rmdir (dir);
+  g_free (dir);
+  g_free (session->local);
+  session->local = NULL;
+}
+
+/* Remember the udpsink of a stream with a shmsink, and forget the streams
+ * whose udpsink is gone */
+static void
+register_stream (StreamSession * stream, guint session, GstElement * udpsink)
+{
+  LocalStream *entry = g_new0 (LocalStream, 1);
+
+  entry->prefix = g_strdup (stream->local);
+  entry->session = session;
+  g_weak_ref_init (&entry->udpsink, udpsink);
+  g_mutex_lock (&local_lock);
+  for (GSList * l = local_streams; l != NULL;) {
+    LocalStream *old = (LocalStream *) l->data;
+    GObject *alive = g_weak_ref_get (&old->udpsink);
+
+    l = l->next;
+    if (alive != NULL) {
+      g_object_unref (alive);
+      continue;
+    }
+    local_streams = g_slist_remove (local_streams, old);
+    g_weak_ref_clear (&old->udpsink);
+    g_free (old->prefix);
+    g_free (old);
+  }
+  local_streams = g_slist_prepend (local_streams, entry);
+  g_mutex_unlock (&local_lock);
+}
+
+/* Tee the encoded stream in front of the payloader of an RTP session into
+ * a shmsink for the local clients. gdppay carries the caps, timestamps and
+ * EOS along. Streams fed by something else than a linked payloader, the
+ * cache replay and a simulcast funnel, stay on RTP only. A local client
+ * that confirms the socket prefix is taken off the udpsink */
+gboolean
+localshm_link (GstElement * pipeline, GstElement * payloader,
+    GstElement * udpsink, guint session, StreamSession * stream)
+{
+  GstElement *tee, *queue, *gdppay, *shmsink;
+  GstPad *sinkpad, *peer, *teepad;
+  gchar *path;
+  gboolean ret;
+
+  sinkpad = gst_element_get_static_pad (payloader, "sink");
+  peer = sinkpad ? gst_pad_get_peer (sinkpad) : NULL;
+  if (peer == NULL) {
+    if (sinkpad != NULL)
+      gst_object_unref (sinkpad);
+    return TRUE;
+  }
+
+  tee = gst_element_factory_make ("tee", NULL);
+  queue = gst_element_factory_make ("queue", NULL);
+  gdppay = gst_element_factory_make ("gdppay", NULL);
+  shmsink = gst_element_factory_make ("shmsink", NULL);
+  if (!tee || !queue || !gdppay || !shmsink) {
+    g_printerr ("Local transport elements could not be created.\n");
+    gst_object_unref (peer);
+    gst_object_unref (sinkpad);
+    return FALSE;
+  }
+
+  /* A socket left behind by an earlier run would fail the bind */
+  path = g_strdup_printf ("%s-%u", stream->local, session);
+  g_unlink (path);
+  g_object_set (G_OBJECT (queue), "leaky", 2, "max-size-time",
+      (guint64) LOCALSHM_QUEUE_MS * GST_MSECOND, "max-size-buffers", 0,
+      "max-size-bytes", 0, NULL);
+  g_object_set (G_OBJECT (shmsink), "socket-path", path, "shm-size",
+      LOCALSHM_SIZE, "wait-for-connection", FALSE, "sync", stream->realtime,
+      "async", FALSE, NULL);
+  membudget_tag (queue, MEMBUDGET_LOCAL);
+  gst_bin_add_many (GST_BIN (pipeline), tee, queue, gdppay, shmsink, NULL);
+
+  gst_pad_unlink (peer, sinkpad);
+  teepad = gst_element_get_static_pad (tee, "sink");
+  ret = GST_PAD_LINK_SUCCESSFUL (gst_pad_link (peer, teepad))
+      && gst_element_link_pads (tee, "src_%u", payloader, "sink")
+      && gst_element_link_many (tee, queue, gdppay, shmsink, NULL);
+  if (ret) {
+    register_stream (stream, session, udpsink);
+    g_print ("RTP session %u: local clients on %s\n", session, path);
+  } else
+    g_printerr ("Local transport of RTP session %u not linked.\n", session);
+
+  gst_object_unref (teepad);
+  gst_object_unref (peer);
+  gst_object_unref (sinkpad);
+  g_free (path);
+  return ret;
+}
+
+static GstPadProbeReturn
+sent_probe (GstPad * pad, GstPadProbeInfo * info, LocalBench * bench)
+{
+  g_mutex_lock (&bench->lock);
+  g_queue_push_tail (&bench->sent,
+      GINT_TO_POINTER ((gint) (g_get_monotonic_time () - bench->start)));
+  g_mutex_unlock (&bench->lock);
+  return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn
+received_probe (GstPad * pad, GstPadProbeInfo * info, LocalBench * bench)
+{
+  gint64 now = g_get_monotonic_time () - bench->start;
+  gint64 latency;
+
+  g_mutex_lock (&bench->lock);
+  if (!g_queue_is_empty (&bench->sent)) {
+    latency = now - GPOINTER_TO_INT (g_queue_pop_head (&bench->sent));
+    bench->frames++;
+    bench->total += latency;
+    bench->longest = MAX (bench->longest, latency);
+  }
+  g_mutex_unlock (&bench->lock);
+  return GST_PAD_PROBE_OK;
+}
+
+/* Encode the 4K test stream for a number of seconds and send it to a
+ * receiving pipeline in this process over "udp", "shm" or nothing at all,
+ * print the CPU above the encoding and the latency from encoder to
+ * receiver, return the CPU seconds used */
+static gdouble
+bench_run (const gchar * transport, gint seconds, gdouble baseline)
+{
+  GstElement *sender = gst_pipeline_new ("local-bench-send");
+  GstElement *receiver = gst_pipeline_new ("local-bench-receive");
+  GstElement *source = gst_element_factory_make ("videotestsrc", NULL);
+  GstElement *capsfilter = gst_element_factory_make ("capsfilter", NULL);
+  GstElement *encoder = encselect_make (ENC_CODEC_H264);
+  GstElement *sink = gst_element_factory_make ("fakesink", NULL);
+  GstElement *send = NULL, *out = NULL, *in = NULL, *unpack = NULL;
+  gchar *path = g_build_filename (g_get_tmp_dir (),
+      LOCALSHM_PREFIX "-bench", NULL);
+  gboolean udp = g_strcmp0 (transport, "udp") == 0;
+  gboolean shm = g_strcmp0 (transport, "shm") == 0;
+  gboolean linked;
+  LocalBench bench;
+  GstCaps *caps;
+  GstMessage *msg;
+  GstBus *bus;
+  GstPad *pad;
+  gdouble cpu;
+
+  memset (&bench, 0, sizeof (bench));
+  g_mutex_init (&bench.lock);
+  bench.start = g_get_monotonic_time ();
+  if (udp) {
+    send = encselect_make_payloader (ENC_CODEC_H264);
+    out = gst_element_factory_make ("udpsink", NULL);
+    in = gst_element_factory_make ("udpsrc", NULL);
+    unpack = gst_element_factory_make ("rtph264depay", NULL);
+  } else if (shm) {
+    send = gst_element_factory_make ("gdppay", NULL);
+    out = gst_element_factory_make ("shmsink", NULL);
+    in = gst_element_factory_make ("shmsrc", NULL);
+    unpack = gst_element_factory_make ("gdpdepay", NULL);
+  }
+  if (!sender || !receiver || !source || !capsfilter || !encoder || !sink
+      || ((udp || shm) && (!send || !out || !in || !unpack))) {
+    g_printerr ("Not all benchmark elements could be created.\n");
+    g_free (path);
+    return -1.0;
+  }
+
+  caps = gst_caps_new_simple ("video/x-raw", "width", G_TYPE_INT,
+      LOCALSHM_BENCH_WIDTH, "height", G_TYPE_INT, LOCALSHM_BENCH_HEIGHT,
+      "framerate", GST_TYPE_FRACTION, 30, 1, NULL);
+  g_object_set (G_OBJECT (capsfilter), "caps", caps, NULL);
+  gst_caps_unref (caps);
+  g_object_set (G_OBJECT (source), "is-live", TRUE, "pattern", 18, NULL);
+  encprofile_apply (encoder, ENC_PROFILE_ULTRA_LOW_LATENCY);
+  encprofile_set_bitrate (encoder, LOCALSHM_BENCH_BITRATE);
+  g_object_set (G_OBJECT (sink), "sync", FALSE, "async", FALSE, NULL);
+
+  gst_bin_add_many (GST_BIN (sender), source, capsfilter, encoder, NULL);
+  linked = gst_element_link_many (source, capsfilter, encoder, NULL);
+  if (udp) {
+    caps = gst_caps_new_simple ("application/x-rtp", "media", G_TYPE_STRING,
+        "video", "clock-rate", G_TYPE_INT, 90000, "encoding-name",
+        G_TYPE_STRING, "H264", "payload", G_TYPE_INT, 96, NULL);
+    g_object_set (G_OBJECT (out), "host", "127.0.0.1", "port",
+        LOCALSHM_BENCH_PORT, "sync", FALSE, "async", FALSE, NULL);
+    g_object_set (G_OBJECT (in), "port", LOCALSHM_BENCH_PORT, "caps", caps,
+        "buffer-size", 8 * 1024 * 1024, NULL);
+    gst_caps_unref (caps);
+  } else if (shm) {
+    g_unlink (path);
+    g_object_set (G_OBJECT (out), "socket-path", path, "shm-size",
+        LOCALSHM_SIZE, "wait-for-connection", FALSE, "sync", FALSE,
+        "async", FALSE, NULL);
+    g_object_set (G_OBJECT (in), "socket-path", path, "is-live", TRUE,
+        NULL);
+  }
+  if (udp || shm) {
+    gst_bin_add_many (GST_BIN (sender), send, out, NULL);
+    gst_bin_add_many (GST_BIN (receiver), in, unpack, sink, NULL);
+    linked = linked && gst_element_link_many (encoder, send, out, NULL)
+        && gst_element_link_many (in, unpack, sink, NULL);
+  } else {
+    gst_bin_add (GST_BIN (sender), sink);
+    linked = linked && gst_element_link (encoder, sink);
+  }
+  if (!linked) {
+    g_printerr ("Benchmark pipelines not linked.\n");
+    gst_object_unref (sender);
+    gst_object_unref (receiver);
+    g_free (path);
+    return -1.0;
+  }
+
+  pad = gst_element_get_static_pad (encoder, "src");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+      (GstPadProbeCallback) sent_probe, &bench, NULL);
+  gst_object_unref (pad);
+  pad = gst_element_get_static_pad (sink, "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+      (GstPadProbeCallback) received_probe, &bench, NULL);
+  gst_object_unref (pad);
+
+  /* The shmsink socket exists once the sender is playing */
+  cpu = sysstat_cpu_seconds ();
+  gst_element_set_state (sender, GST_STATE_PLAYING);
+  gst_element_get_state (sender, NULL, NULL, GST_CLOCK_TIME_NONE);
+  gst_element_set_state (receiver, GST_STATE_PLAYING);
+  bus = gst_element_get_bus (sender);
+  msg = gst_bus_timed_pop_filtered (bus, seconds * GST_SECOND,
+      GST_MESSAGE_ERROR);
+  gst_element_set_state (receiver, GST_STATE_NULL);
+  gst_element_set_state (sender, GST_STATE_NULL);
+  cpu = sysstat_cpu_seconds () - cpu;
+
+  if (msg != NULL) {
+    g_printerr ("Benchmark pipeline failed.\n");
+    gst_message_unref (msg);
+    cpu = -1.0;
+  } else if (udp || shm) {
+    g_print ("%-10s %8" G_GUINT64_FORMAT " %11.1f%% %12.2f %12.2f\n",
+        transport, bench.frames, 100.0 * (cpu - baseline) / seconds,
+        bench.frames ? bench.total / 1000.0 / bench.frames : 0.0,
+        bench.longest / 1000.0);
+  }
+  gst_object_unref (bus);
+  gst_object_unref (sender);
+  gst_object_unref (receiver);
+  g_queue_clear (&bench.sent);
+  g_mutex_clear (&bench.lock);
+  if (shm)
+    g_unlink (path);
+  g_free (path);
+  return cpu;
+}
+
+/* CPU and latency of a local 4K stream over loopback UDP, payloaded and
+ * depayloaded, against the shared memory transport */
+void
+localshm_benchmark (gint seconds)
+{
+  gdouble baseline = bench_run ("none", seconds, 0.0);
+
+  if (baseline < 0.0)
+    return;
+  g_print ("Local %dx%d H.264 at %d kbit/s for %d s, encoding alone "
+      "%.1f%% CPU\n", LOCALSHM_BENCH_WIDTH, LOCALSHM_BENCH_HEIGHT,
+      LOCALSHM_BENCH_BITRATE, seconds, 100.0 * baseline / seconds);
+  g_print ("%-10s %8s %12s %12s %12s\n", "transport", "frames", "CPU",
+      "latency ms", "longest ms");
+  if (bench_run ("udp", seconds, baseline) >= 0.0)
+    bench_run ("shm", seconds, baseline);
+}
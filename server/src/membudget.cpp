@@ -0,0 +1,178 @@
+#include "membudget.h"
+#include <gst/video/video.h>
+#include <gst/base/gstbasesrc.h>
+
+/* Budget of the sessions created from now on, in MiB */
+static gint default_budget_mb = MEMBUDGET_DEFAULT_MB;
+
+/* Share of the budget of one queue of each kind */
+static const gint kind_weight[MEMBUDGET_KINDS] = { 1, 4, 2, 1, 4 };
+
+#define MEMBUDGET_KIND_KEY "membudget-kind"
+
+void
+membudget_set_default (gint budget_mb)
+{
+  default_budget_mb = MAX (budget_mb, 0);
+}
+
+gint
+membudget_default ()
+{
+  return default_budget_mb;
+}
+
+/* Mark what a queue holds, before its pipeline is attached */
+void
+membudget_tag (GstElement * queue, MemBudgetKind kind)
+{
+  g_object_set_data (G_OBJECT (queue), MEMBUDGET_KIND_KEY,
+      GINT_TO_POINTER (kind + 1));
+}
+
+static MemBudgetKind
+queue_kind (GstElement * queue)
+{
+  gint kind = GPOINTER_TO_INT (g_object_get_data (G_OBJECT (queue),
+          MEMBUDGET_KIND_KEY));
+
+  return kind > 0 ? (MemBudgetKind) (kind - 1) : MEMBUDGET_ENCODED;
+}
+
+/* Collect the queues and the video decoders of the pipeline and note a
+ * live source */
+static void
+collect_element (const GValue * item, MemBudgetData * budget)
+{
+  GstElement *element = GST_ELEMENT (g_value_get_object (item));
+  GstElementFactory *factory = gst_element_get_factory (element);
+  const gchar *name = factory != NULL
+      ? gst_plugin_feature_get_name (GST_PLUGIN_FEATURE (factory)) : NULL;
+
+  if (g_strcmp0 (name, "queue") == 0 || g_strcmp0 (name, "spscqueue") == 0)
+    g_ptr_array_add (budget->queues, gst_object_ref (element));
+  else if (GST_IS_VIDEO_DECODER (element))
+    g_ptr_array_add (budget->decoders, gst_object_ref (element));
+  else if (GST_IS_BASE_SRC (element)
+      && gst_base_src_is_live (GST_BASE_SRC (element)))
+    budget->live = TRUE;
+}
+
+/* Frame size times the buffers the pool of the decoder keeps allocated */
+static gsize
+decoder_pool_bytes (GstElement * decoder)
+{
+  GstBufferPool *pool =
+      gst_video_decoder_get_buffer_pool (GST_VIDEO_DECODER (decoder));
+  GstStructure *config;
+  guint size = 0, min = 0, max = 0;
+
+  if (pool == NULL)
+    return 0;
+  config = gst_buffer_pool_get_config (pool);
+  gst_buffer_pool_config_get_params (config, NULL, &size, &min, &max);
+  gst_structure_free (config);
+  gst_object_unref (pool);
+  return (gsize) size * min;
+}
+
+/* Sum what the queues and pools of the session hold and keep the peak */
+static gboolean
+sample_cb (MemBudgetData * budget)
+{
+  gsize queues = 0, pools = 0;
+
+  for (guint i = 0; i < budget->queues->len; i++) {
+    guint level = 0;
+
+    g_object_get (g_ptr_array_index (budget->queues, i),
+        "current-level-bytes", &level, NULL);
+    queues += level;
+  }
+  for (guint i = 0; i < budget->decoders->len; i++)
+    pools += decoder_pool_bytes ((GstElement *)
+        g_ptr_array_index (budget->decoders, i));
+
+  if (queues + pools > budget->session->mem_peak) {
+    budget->session->mem_peak = queues + pools;
+    budget->peak_queues = queues;
+    budget->peak_pools = pools;
+  }
+  return G_SOURCE_CONTINUE;
+}
+
+/* The pipeline of the session is gone, report its peak. The benchmarks
+ * print the peaks of their sessions themselves */
+static void
+budget_report (MemBudgetData * budget, GObject * pipeline)
+{
+  StreamSession *session = budget->session;
+
+  g_source_destroy (budget->source);
+  g_source_unref (budget->source);
+  if (session->realtime) {
+    g_print ("Session %u: peak memory %.1f MiB (queues %.1f, pools %.1f)",
+        session->id, session->mem_peak / 1048576.0,
+        budget->peak_queues / 1048576.0, budget->peak_pools / 1048576.0);
+    if (session->mem_budget_mb > 0)
+      g_print (" of %d MiB\n", session->mem_budget_mb);
+    else
+      g_print ("\n");
+  }
+  g_ptr_array_unref (budget->queues);
+  g_ptr_array_unref (budget->decoders);
+  g_free (budget);
+}
+
+/* Bound the queues of the session pipeline by the session budget and
+ * sample the memory they and the decoder pools hold on the session's main
+ * context while the pipeline exists */
+void
+membudget_attach (StreamSession * session, GstElement * pipeline)
+{
+  MemBudgetData *budget = g_new0 (MemBudgetData, 1);
+  GstIterator *iter = gst_bin_iterate_recurse (GST_BIN (pipeline));
+  gint total = MEMBUDGET_POOL_WEIGHT;
+
+  budget->session = session;
+  budget->queues = g_ptr_array_new_with_free_func (gst_object_unref);
+  budget->decoders = g_ptr_array_new_with_free_func (gst_object_unref);
+  while (gst_iterator_foreach (iter, (GstIteratorForeachFunction)
+          collect_element, budget) == GST_ITERATOR_RESYNC) {
+    g_ptr_array_set_size (budget->queues, 0);
+    g_ptr_array_set_size (budget->decoders, 0);
+    budget->live = FALSE;
+    gst_iterator_resync (iter);
+  }
+  gst_iterator_free (iter);
+  session->mem_peak = 0;
+
+  for (guint i = 0; i < budget->queues->len; i++)
+    total += kind_weight[queue_kind ((GstElement *)
+            g_ptr_array_index (budget->queues, i))];
+  for (guint i = 0; session->mem_budget_mb > 0 && i < budget->queues->len;
+      i++) {
+    GstElement *queue = (GstElement *) g_ptr_array_index (budget->queues, i);
+    MemBudgetKind kind = queue_kind (queue);
+    gsize bytes = ((gsize) session->mem_budget_mb << 20) * kind_weight[kind]
+        / total;
+
+    g_object_set (G_OBJECT (queue), "max-size-bytes",
+        (guint) MIN (MAX (bytes, (gsize) MEMBUDGET_MIN_QUEUE), G_MAXUINT),
+        NULL);
+    /* Sessions that are not real time must not lose frames, and a file
+     * source waits for a full queue without falling behind */
+    if (session->realtime && budget->live && (kind == MEMBUDGET_RAW
+            || kind == MEMBUDGET_LOCAL)
+        && g_object_class_find_property (G_OBJECT_GET_CLASS (queue),
+            "leaky") != NULL)
+      g_object_set (G_OBJECT (queue), "leaky", 2, NULL);
+  }
+
+  budget->source = g_timeout_source_new (MEMBUDGET_SAMPLE_MS);
+  g_source_set_callback (budget->source, (GSourceFunc) sample_cb, budget,
+      NULL);
+  g_source_attach (budget->source, session->context);
+  g_object_weak_ref (G_OBJECT (pipeline), (GWeakNotify) budget_report,
+      budget);
+}
@@ -184,9 +184,6 @@ metadata_fun (std::string path)
   /* Initialize custom data structure */
   memset (&data, 0, sizeof (data));
 
-  /* Initialize GStreamer */
-  gst_init (NULL, NULL);
-
   g_print ("Discovering '%s'\n", uri);
 
   /* Instantiate the Discoverer */
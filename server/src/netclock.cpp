@@ -0,0 +1,81 @@
+#include "header.h"
+#include "control.h"
+#include <gst/net/net.h>
+
+/* Render reports further apart than this belong to different frames */
+#define NETCLOCK_SKEW_WINDOW (500 * GST_MSECOND)
+
+/* Clock shared by every host pipeline and published on NETCLOCK_PORT */
+static GstClock *net_clock = NULL;
+static GstNetTimeProvider *net_provider = NULL;
+static GMutex net_lock;
+
+/* Structure for the render skew of the frame currently being reported */
+typedef struct _RenderSkew
+{
+  GstClockTime first;
+  GstClockTime min;
+  GstClockTime max;
+  guint reports;
+  guint frames;
+  GstClockTime worst;
+  gdouble sum;
+} RenderSkew;
+
+static RenderSkew skew;
+
+/* Account the skew of the frame all clients reported so far */
+static void
+finish_frame ()
+{
+  GstClockTime frame_skew;
+
+  if (skew.reports < 2)
+    return;
+  frame_skew = skew.max - skew.min;
+  skew.frames++;
+  skew.sum += frame_skew;
+  skew.worst = MAX (skew.worst, frame_skew);
+  g_print ("Render skew across %u clients: %.2f ms (mean %.2f ms, "
+      "worst %.2f ms)\n", skew.reports, frame_skew / (gdouble) GST_MSECOND,
+      skew.sum / skew.frames / GST_MSECOND,
+      skew.worst / (gdouble) GST_MSECOND);
+}
+
+/* A client rendered a marked frame at the given shared clock time */
+static void
+render_handler (int client, const gchar * args)
+{
+  GstClockTime time = g_ascii_strtoull (args, NULL, 10);
+
+  if (skew.reports == 0 || time > skew.first + NETCLOCK_SKEW_WINDOW
+      || time + NETCLOCK_SKEW_WINDOW < skew.first) {
+    finish_frame ();
+    skew.first = skew.min = skew.max = time;
+    skew.reports = 0;
+  }
+  skew.min = MIN (skew.min, time);
+  skew.max = MAX (skew.max, time);
+  skew.reports++;
+}
+
+/* Run the pipeline on the clock published to the clients, so that every
+ * client renders the same frame at the same time */
+void
+netclock_publish (GstElement * pipeline)
+{
+  /* Sessions start their pipelines from their own threads */
+  g_mutex_lock (&net_lock);
+  if (net_clock == NULL) {
+    net_clock = gst_system_clock_obtain ();
+    net_provider = gst_net_time_provider_new (net_clock, NULL, NETCLOCK_PORT);
+    if (net_provider == NULL) {
+      g_printerr ("Could not publish the network clock.\n");
+    } else {
+      g_print ("Network clock published on port %d\n", NETCLOCK_PORT);
+    }
+    control_add_handler (CONTROL_RENDER, render_handler);
+  }
+  g_mutex_unlock (&net_lock);
+  gst_pipeline_use_clock (GST_PIPELINE (pipeline), net_clock);
+}
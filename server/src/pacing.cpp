@@ -0,0 +1,350 @@
+#include "pacing.h"
+#include "encprofile.h"
+#include "encselect.h"
+#include "sysstat.h"
+#include <gst/rtp/gstrtpbuffer.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Pacing and socket buffers of the sessions created from now on */
+static gdouble pacing_multiple = PACING_DEFAULT_MULTIPLE;
+static gint pacing_send_buffer = PACING_SEND_BUFFER;
+
+/* Structure for the receiver of the burst loss benchmark */
+typedef struct _PacingBenchReceiver
+{
+  gboolean started;
+  guint16 last;
+  guint64 received;
+  guint64 lost;
+} PacingBenchReceiver;
+
+/* Send the RTP streams at most multiple times their bitrate, 0 sends every
+ * packet as soon as it is produced */
+void
+pacing_set_multiple (gdouble multiple)
+{
+  pacing_multiple = MAX (multiple, 0.0);
+}
+
+void
+pacing_set_socket_buffer (gint bytes)
+{
+  pacing_send_buffer = MAX (bytes, 0);
+}
+
+/* Running time at which size bytes leave the bucket, not before the
+ * running time of their buffer. The bucket refills from one departure to
+ * the next, so a burst is spread over the following frame interval */
+static GstClockTime
+pace_departure (PacerData * pacer, GstClockTime running, gsize size)
+{
+  GstClockTime departure = running;
+
+  if (GST_CLOCK_TIME_IS_VALID (pacer->last) && pacer->last > running)
+    departure = pacer->last;
+  if (GST_CLOCK_TIME_IS_VALID (pacer->last))
+    pacer->tokens = MIN (pacer->burst, pacer->tokens
+        + (departure - pacer->last) * pacer->rate / GST_SECOND);
+  if (pacer->tokens < size) {
+    departure += (GstClockTime) ((size - pacer->tokens) * GST_SECOND
+        / pacer->rate);
+    pacer->tokens = size;
+  }
+  pacer->tokens -= size;
+  pacer->last = departure;
+  pacer->packets++;
+  if (departure > running) {
+    pacer->delayed++;
+    pacer->longest = MAX (pacer->longest,
+        (gint64) GST_TIME_AS_USECONDS (departure - running));
+  }
+  return departure;
+}
+
+/* A buffer held back by the bucket, stamped with its departure for the
+ * udpsink to wait on its clock */
+static GstBuffer *
+pace_retime (PacerData * pacer, GstBuffer * buffer, GstClockTime departure)
+{
+  buffer = gst_buffer_make_writable (buffer);
+  GST_BUFFER_PTS (buffer) = gst_segment_position_from_running_time
+      (&pacer->segment, GST_FORMAT_TIME, departure);
+  GST_BUFFER_DTS (buffer) = GST_CLOCK_TIME_NONE;
+  return buffer;
+}
+
+static void
+pace_report (PacerData * pacer)
+{
+  guint64 sndbuf = 0;
+
+  sysstat_udp_counter ("SndbufErrors", &sndbuf);
+  g_print ("Pacing session %u stream %u: %" G_GUINT64_FORMAT " packets, %"
+      G_GUINT64_FORMAT " held back, longest wait %.1f ms, %" G_GUINT64_FORMAT
+      " UDP send buffer errors\n", pacer->session, pacer->stream,
+      pacer->packets, pacer->delayed, pacer->longest / 1000.0,
+      sndbuf - pacer->sndbuf_errors);
+}
+
+/* Give every packet reaching the udpsink the running time at which the
+ * bucket has room for it. The streaming thread does not sleep, the
+ * synchronizing udpsink holds the packet until then on the pipeline clock,
+ * so a flush or a state change still interrupts the wait. A buffer list
+ * larger than the bucket is sent as the batches the bucket lets through,
+ * pushed from here into the udpsink */
+static GstPadProbeReturn
+pace_probe (GstPad * pad, GstPadProbeInfo * info, PacerData * pacer)
+{
+  GstBufferList *list, *batch = NULL;
+  GstFlowReturn ret = GST_FLOW_OK;
+  GstClockTime running, departure, sent = GST_CLOCK_TIME_NONE;
+  guint batches = 0;
+
+  if (pacer->forwarding)
+    return GST_PAD_PROBE_OK;
+
+  if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+    GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+
+    if (GST_EVENT_TYPE (event) == GST_EVENT_SEGMENT) {
+      gst_event_copy_segment (event, &pacer->segment);
+    } else if (GST_EVENT_TYPE (event) == GST_EVENT_FLUSH_STOP) {
+      pacer->last = GST_CLOCK_TIME_NONE;
+      pacer->tokens = pacer->burst;
+    } else if (GST_EVENT_TYPE (event) == GST_EVENT_EOS) {
+      pace_report (pacer);
+    }
+    return GST_PAD_PROBE_OK;
+  }
+  if (info->type & GST_PAD_PROBE_TYPE_BUFFER) {
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+
+    running = gst_segment_to_running_time (&pacer->segment, GST_FORMAT_TIME,
+        GST_BUFFER_PTS (buffer));
+    if (!GST_CLOCK_TIME_IS_VALID (running))
+      return GST_PAD_PROBE_OK;
+    departure = pace_departure (pacer, running, gst_buffer_get_size (buffer));
+    if (departure > running)
+      info->data = pace_retime (pacer, buffer, departure);
+    return GST_PAD_PROBE_OK;
+  }
+
+  list = GST_PAD_PROBE_INFO_BUFFER_LIST (info);
+  if (gst_buffer_list_length (list) == 0)
+    return GST_PAD_PROBE_OK;
+  running = gst_segment_to_running_time (&pacer->segment, GST_FORMAT_TIME,
+      GST_BUFFER_PTS (gst_buffer_list_get (list, 0)));
+  if (!GST_CLOCK_TIME_IS_VALID (running))
+    return GST_PAD_PROBE_OK;
+
+  /* A new batch starts at every packet the bucket holds back */
+  pacer->forwarding = TRUE;
+  for (guint i = 0; i < gst_buffer_list_length (list) && ret == GST_FLOW_OK;
+      i++) {
+    GstBuffer *buffer = gst_buffer_ref (gst_buffer_list_get (list, i));
+
+    departure = pace_departure (pacer, running, gst_buffer_get_size (buffer));
+    if (batch == NULL || departure > sent) {
+      if (batch != NULL)
+        ret = gst_pad_chain_list (pad, batch);
+      batch = gst_buffer_list_new ();
+      batches++;
+      if (departure > running)
+        buffer = pace_retime (pacer, buffer, departure);
+      sent = departure;
+    }
+    gst_buffer_list_add (batch, buffer);
+  }
+  pacer->forwarding = FALSE;
+
+  /* Nothing held back, the list goes on as it came */
+  if (batches == 1 && sent == running && ret == GST_FLOW_OK) {
+    gst_buffer_list_unref (batch);
+    return GST_PAD_PROBE_OK;
+  }
+  pacer->forwarding = TRUE;
+  if (batch != NULL && ret == GST_FLOW_OK)
+    ret = gst_pad_chain_list (pad, batch);
+  else if (batch != NULL)
+    gst_buffer_list_unref (batch);
+  pacer->forwarding = FALSE;
+
+  gst_buffer_list_unref (list);
+  GST_PAD_PROBE_INFO_FLOW_RETURN (info) = ret;
+  return GST_PAD_PROBE_HANDLED;
+}
+
+/* Pace a synchronizing udpsink at multiple times bitrate kbit/s, nothing
+ * for 0. The pacer lives as long as the udpsink's pad */
+static PacerData *
+pace (GstElement * udpsink, guint session, guint stream, gint bitrate,
+    gdouble multiple)
+{
+  PacerData *pacer;
+  GstPad *pad;
+
+  if (multiple <= 0.0 || bitrate <= 0)
+    return NULL;
+
+  pacer = g_new0 (PacerData, 1);
+  pacer->session = session;
+  pacer->stream = stream;
+  pacer->rate = multiple * bitrate * 1000 / 8.0;
+  pacer->burst = MAX (pacer->rate * PACING_BURST_MS / 1000.0,
+      PACING_MIN_BURST);
+  pacer->tokens = pacer->burst;
+  pacer->last = GST_CLOCK_TIME_NONE;
+  gst_segment_init (&pacer->segment, GST_FORMAT_TIME);
+  sysstat_udp_counter ("SndbufErrors", &pacer->sndbuf_errors);
+
+  pad = gst_element_get_static_pad (udpsink, "sink");
+  gst_pad_add_probe (pad, (GstPadProbeType) (GST_PAD_PROBE_TYPE_BUFFER
+          | GST_PAD_PROBE_TYPE_BUFFER_LIST
+          | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM),
+      (GstPadProbeCallback) pace_probe, pacer, g_free);
+  gst_object_unref (pad);
+  return pacer;
+}
+
+/* Give the udpsink of an RTP stream its send buffer, and pace it in a real
+ * time session. bitrate is the target of the stream in kbit/s */
+void
+pacing_attach (GstElement * udpsink, StreamSession * session, guint stream,
+    gint bitrate)
+{
+  if (pacing_send_buffer > 0)
+    g_object_set (G_OBJECT (udpsink), "buffer-size", pacing_send_buffer,
+        NULL);
+  if (session->realtime)
+    pace (udpsink, session->id, stream, bitrate, pacing_multiple);
+}
+
+/* Count the packets the benchmark receiver got and the gaps between them */
+static GstPadProbeReturn
+receiver_probe (GstPad * pad, GstPadProbeInfo * info,
+    PacingBenchReceiver * receiver)
+{
+  GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+  guint16 seq;
+  gint gap;
+
+  if (!gst_rtp_buffer_map (GST_PAD_PROBE_INFO_BUFFER (info), GST_MAP_READ,
+          &rtp))
+    return GST_PAD_PROBE_OK;
+  seq = gst_rtp_buffer_get_seq (&rtp);
+  gst_rtp_buffer_unmap (&rtp);
+
+  gap = (gint16) (seq - receiver->last);
+  if (receiver->started && gap > 1)
+    receiver->lost += gap - 1;
+  if (!receiver->started || gap > 0)
+    receiver->last = seq;
+  receiver->started = TRUE;
+  receiver->received++;
+  return GST_PAD_PROBE_OK;
+}
+
+/* Stream the benchmark video to the slow receiver for a number of seconds,
+ * paced at multiple times its bitrate or not at all for 0 */
+static gboolean
+bench_run (gdouble multiple, gint seconds)
+{
+  GstElement *pipeline = gst_pipeline_new ("pacing-bench");
+  GstElement *source = gst_element_factory_make ("videotestsrc", NULL);
+  GstElement *capsfilter = gst_element_factory_make ("capsfilter", NULL);
+  GstElement *encoder = encselect_make (ENC_CODEC_H264);
+  GstElement *payloader = encselect_make_payloader (ENC_CODEC_H264);
+  GstElement *udpsink = gst_element_factory_make ("udpsink", NULL);
+  GstElement *udpsrc = gst_element_factory_make ("udpsrc", NULL);
+  GstElement *reader = gst_element_factory_make ("identity", NULL);
+  GstElement *fakesink = gst_element_factory_make ("fakesink", NULL);
+  PacingBenchReceiver receiver;
+  PacerData *pacer;
+  guint64 rcvbuf_before = 0, rcvbuf_after = 0;
+  GstCaps *caps;
+  GstMessage *msg;
+  GstBus *bus;
+  GstPad *pad;
+
+  if (!pipeline || !source || !capsfilter || !encoder || !payloader
+      || !udpsink || !udpsrc || !reader || !fakesink) {
+    g_printerr ("Not all benchmark elements could be created.\n");
+    return FALSE;
+  }
+  memset (&receiver, 0, sizeof (receiver));
+
+  caps = gst_caps_new_simple ("video/x-raw", "width", G_TYPE_INT, 1280,
+      "height", G_TYPE_INT, 720, "framerate", GST_TYPE_FRACTION, 30, 1, NULL);
+  g_object_set (G_OBJECT (capsfilter), "caps", caps, NULL);
+  gst_caps_unref (caps);
+  g_object_set (G_OBJECT (source), "is-live", TRUE, "pattern", 18, NULL);
+  encprofile_apply (encoder, encprofile_default ());
+  encprofile_set_bitrate (encoder, PACING_BENCH_BITRATE);
+  g_object_set (G_OBJECT (udpsink), "host", "127.0.0.1", "port",
+      PACING_BENCH_PORT, "buffer-size", pacing_send_buffer, NULL);
+  g_object_set (G_OBJECT (udpsrc), "port", PACING_BENCH_PORT, "buffer-size",
+      PACING_BENCH_RECV_BUFFER, NULL);
+  g_object_set (G_OBJECT (reader), "sleep-time", PACING_BENCH_READ_US, NULL);
+  g_object_set (G_OBJECT (fakesink), "sync", FALSE, "async", FALSE, NULL);
+
+  gst_bin_add_many (GST_BIN (pipeline), source, capsfilter, encoder,
+      payloader, udpsink, udpsrc, reader, fakesink, NULL);
+  if (!gst_element_link_many (source, capsfilter, encoder, payloader,
+          udpsink, NULL)
+      || !gst_element_link_many (udpsrc, reader, fakesink, NULL)) {
+    g_printerr ("Benchmark pipeline not linked.\n");
+    gst_object_unref (pipeline);
+    return FALSE;
+  }
+
+  pad = gst_element_get_static_pad (udpsrc, "src");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+      (GstPadProbeCallback) receiver_probe, &receiver, NULL);
+  gst_object_unref (pad);
+  pacer = pace (udpsink, 0, RTP_SESSION_VIDEO, PACING_BENCH_BITRATE,
+      multiple);
+
+  sysstat_udp_counter ("RcvbufErrors", &rcvbuf_before);
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  bus = gst_element_get_bus (pipeline);
+  msg = gst_bus_timed_pop_filtered (bus, seconds * GST_SECOND,
+      GST_MESSAGE_ERROR);
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  sysstat_udp_counter ("RcvbufErrors", &rcvbuf_after);
+
+  if (msg != NULL) {
+    g_printerr ("Benchmark pipeline failed.\n");
+    gst_message_unref (msg);
+  } else {
+    gchar *name = multiple > 0.0 ? g_strdup_printf ("%.1fx", multiple)
+        : g_strdup ("off");
+
+    g_print ("%-8s %10" G_GUINT64_FORMAT " %10" G_GUINT64_FORMAT
+        " %9.2f%% %12" G_GUINT64_FORMAT " %10.1f\n", name,
+        receiver.received, receiver.lost, receiver.received + receiver.lost
+        ? 100.0 * receiver.lost / (receiver.received + receiver.lost) : 0.0,
+        rcvbuf_after - rcvbuf_before,
+        pacer != NULL ? pacer->longest / 1000.0 : 0.0);
+    g_free (name);
+  }
+  gst_object_unref (bus);
+  gst_object_unref (pipeline);
+  return msg == NULL;
+}
+
+/* Loss of a keyframe heavy stream over loopback without and with pacing */
+void
+pacing_benchmark (gint seconds)
+{
+  const gdouble multiples[] = { 0.0, 8.0, 4.0, 2.0 };
+
+  g_print ("Burst loss over loopback, %d kbit/s H.264 for %d s, receiver "
+      "reading every %d us through a %d byte buffer\n", PACING_BENCH_BITRATE,
+      seconds, PACING_BENCH_READ_US, PACING_BENCH_RECV_BUFFER);
+  g_print ("%-8s %10s %10s %10s %12s %10s\n", "pacing", "received", "lost",
+      "loss", "rcvbuf errs", "wait ms");
+  for (guint i = 0; i < G_N_ELEMENTS (multiples); i++)
+    if (!bench_run (multiples[i], seconds))
+      return;
+}
@@ -0,0 +1,662 @@
+#include "rtpcache.h"
+#include "keyboardhandler.h"
+#include "encprofile.h"
+#include "encselect.h"
+#include "fanoutsink.h"
+#include <gst/app/gstappsrc.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+/* Size of the fixed RTP header, the replay rewrites its sequence number
+ * and timestamp */
+#define RTP_HEADER_SIZE 12
+
+/* Structure for replaying one stream of a cache file: its packets run from
+ * the end of the header to the caps, cursor is the next record. A seek
+ * starts a new replay at the video keyframe at or before its position:
+ * the packets before start are skipped and shift moves the pts of the
+ * others so that the keyframe plays at the position. The RTP sequence
+ * numbers and timestamps of a replay are offset to carry on from the last
+ * packet sent */
+typedef struct _RtpCacheStream
+{
+  GMappedFile *file;
+  const gchar *data;
+  gsize end;
+  guint stream;
+  GArray *index;
+  struct _RtpCacheStream *video;
+  gint clock_rate;
+  gsize cursor;
+  guint64 start;
+  gint64 shift;
+  gboolean restart;
+  gboolean sent;
+  guint16 seq_offset;
+  guint32 timestamp_offset;
+  guint16 last_seq;
+  guint32 last_timestamp;
+  gint64 last_time;
+} RtpCacheStream;
+
+/* The cache files live in the user cache directory next to the keyframe
+ * indexes. A file is cached per encoder profile, codec and renditions */
+static gchar *
+cache_path (StreamSession * session, EncoderCodec codec)
+{
+  gchar *key = g_strdup_printf ("%s|%s|%s|%d", session->path,
+      encprofile_settings (session->profile)->name,
+      encselect_codec_name (codec), session->renditions);
+  gchar *hash = g_compute_checksum_for_string (G_CHECKSUM_SHA1, key, -1);
+  gchar *dir = g_build_filename (g_get_user_cache_dir (),
+      "gstreamer-remote-streaming", NULL);
+  gchar *name = g_strconcat (hash, ".rtpc", NULL);
+  gchar *file = g_build_filename (dir, name, NULL);
+
+  g_mkdir_with_parents (dir, 0755);
+  g_free (name);
+  g_free (dir);
+  g_free (hash);
+  g_free (key);
+  return file;
+}
+
+/* Map the cache file of a session, NULL if there is none, it is broken or
+ * it is older than the media file */
+static GMappedFile *
+cache_open (StreamSession * session, EncoderCodec codec)
+{
+  struct stat st;
+  gchar *path;
+  GMappedFile *file;
+  const RtpCacheHeader *header;
+  gsize length;
+
+  if (!session->realtime || stat (session->path, &st) < 0)
+    return NULL;
+  path = cache_path (session, codec);
+  file = g_mapped_file_new (path, FALSE, NULL);
+  g_free (path);
+  if (file == NULL)
+    return NULL;
+
+  header = (const RtpCacheHeader *) g_mapped_file_get_contents (file);
+  length = g_mapped_file_get_length (file);
+  if (length < sizeof (RtpCacheHeader)
+      || memcmp (header->magic, RTPCACHE_MAGIC, 4) != 0
+      || header->version != RTPCACHE_VERSION
+      || header->file_size != (guint64) st.st_size
+      || header->file_mtime != (gint64) st.st_mtime
+      || header->caps_offset < sizeof (RtpCacheHeader)
+      || header->caps_offset + header->caps_size[0] + header->caps_size[1]
+      > header->index_offset
+      || header->index_offset + (guint64) header->index_count
+      * sizeof (RtpCacheIndexEntry) != length) {
+    g_mapped_file_unref (file);
+    return NULL;
+  }
+  return file;
+}
+
+/* Whether the session can replay its file from the cache */
+gboolean
+rtpcache_available (StreamSession * session, EncoderCodec codec)
+{
+  GMappedFile *file = cache_open (session, codec);
+
+  if (file == NULL)
+    return FALSE;
+  g_mapped_file_unref (file);
+  return TRUE;
+}
+
+/* Stop recording, the cache file would not replay what the file plays */
+static void
+record_abort (RtpCacheRecord * record, const gchar * reason)
+{
+  if (!record->aborted)
+    g_print ("RTP cache: not recording %s, %s\n", record->path, reason);
+  record->aborted = TRUE;
+}
+
+/* Remember the timestamp of a keyframe leaving the encoder */
+static GstPadProbeReturn
+keyframe_probe (GstPad * pad, GstPadProbeInfo * info, RtpCacheRecord * record)
+{
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  GstClockTime *pts;
+
+  if (GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT)
+      || !GST_BUFFER_PTS_IS_VALID (buffer))
+    return GST_PAD_PROBE_OK;
+
+  pts = g_new (GstClockTime, 1);
+  *pts = GST_BUFFER_PTS (buffer);
+  g_mutex_lock (&record->lock);
+  g_queue_push_tail (&record->keyframes, pts);
+  if (g_queue_get_length (&record->keyframes) > RTPCACHE_MAX_KEYFRAMES)
+    g_free (g_queue_pop_head (&record->keyframes));
+  g_mutex_unlock (&record->lock);
+  return GST_PAD_PROBE_OK;
+}
+
+/* Whether a video packet is the first one of a keyframe. Nothing is seeked
+ * while recording, so the keyframes arrive in encoding order */
+static gboolean
+keyframe_packet (RtpCacheRecord * record, guint64 pts)
+{
+  GstClockTime *head;
+
+  while ((head = (GstClockTime *) g_queue_peek_head (&record->keyframes))
+      && *head < pts)
+    g_free (g_queue_pop_head (&record->keyframes));
+  if (head == NULL || *head != pts)
+    return FALSE;
+  g_free (g_queue_pop_head (&record->keyframes));
+  return TRUE;
+}
+
+/* Append one RTP packet to the cache file. Video is indexed at its
+ * keyframes, audio every RTPCACHE_AUDIO_INDEX_MS */
+static void
+record_packet (RtpCacheRecord * record, guint stream, GstBuffer * buffer)
+{
+  static const guint8 padding[RTPCACHE_ALIGN] = { 0 };
+  RtpCachePacket packet;
+  RtpCacheIndexEntry entry;
+  GstMapInfo map;
+  gsize pad;
+
+  if (!GST_BUFFER_PTS_IS_VALID (buffer)
+      || !gst_buffer_map (buffer, &map, GST_MAP_READ))
+    return;
+
+  memset (&packet, 0, sizeof (packet));
+  packet.pts = GST_BUFFER_PTS (buffer);
+  packet.size = map.size;
+  packet.stream = stream;
+  if (stream == RTP_SESSION_VIDEO && keyframe_packet (record, packet.pts))
+    packet.flags |= RTPCACHE_FLAG_KEY;
+
+  if ((packet.flags & RTPCACHE_FLAG_KEY) || (stream != RTP_SESSION_VIDEO
+          && (record->last_index[stream] == GST_CLOCK_TIME_NONE
+              || packet.pts >= record->last_index[stream]
+              + RTPCACHE_AUDIO_INDEX_MS * GST_MSECOND))) {
+    memset (&entry, 0, sizeof (entry));
+    entry.timestamp = packet.pts;
+    entry.offset = record->offset;
+    entry.stream = stream;
+    g_array_append_val (record->index, entry);
+    record->last_index[stream] = packet.pts;
+  }
+
+  pad = GST_ROUND_UP_N (map.size, RTPCACHE_ALIGN) - map.size;
+  if (fwrite (&packet, sizeof (packet), 1, record->file) != 1
+      || fwrite (map.data, 1, map.size, record->file) != map.size
+      || fwrite (padding, 1, pad, record->file) != pad)
+    record_abort (record, "the cache file could not be written");
+  record->offset += sizeof (packet) + map.size + pad;
+  record->packets++;
+  record->duration = MAX (record->duration, packet.pts
+      + (GST_BUFFER_DURATION_IS_VALID (buffer) ? GST_BUFFER_DURATION (buffer)
+          : 0));
+  gst_buffer_unmap (buffer, &map);
+}
+
+/* Record what reaches the udpsink of a stream */
+static GstPadProbeReturn
+record_probe (RtpCacheRecord * record, guint stream, GstPadProbeInfo * info)
+{
+  g_mutex_lock (&record->lock);
+  if (record->aborted) {
+    g_mutex_unlock (&record->lock);
+    return GST_PAD_PROBE_OK;
+  }
+
+  if (info->type & GST_PAD_PROBE_TYPE_BUFFER) {
+    record_packet (record, stream, GST_PAD_PROBE_INFO_BUFFER (info));
+  } else if (info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+    GstBufferList *list = GST_PAD_PROBE_INFO_BUFFER_LIST (info);
+
+    for (guint i = 0; i < gst_buffer_list_length (list); i++)
+      record_packet (record, stream, gst_buffer_list_get (list, i));
+  } else if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+    GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+    GstCaps *caps;
+
+    if (GST_EVENT_TYPE (event) == GST_EVENT_CAPS) {
+      gst_event_parse_caps (event, &caps);
+      g_free (record->caps[stream]);
+      record->caps[stream] = gst_caps_to_string (caps);
+    } else if (GST_EVENT_TYPE (event) == GST_EVENT_FLUSH_START) {
+      record_abort (record, "the stream was seeked");
+    } else if (GST_EVENT_TYPE (event) == GST_EVENT_EOS) {
+      record->eos[stream] = TRUE;
+    }
+  }
+  g_mutex_unlock (&record->lock);
+  return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn
+video_probe (GstPad * pad, GstPadProbeInfo * info, RtpCacheRecord * record)
+{
+  return record_probe (record, RTP_SESSION_VIDEO, info);
+}
+
+static GstPadProbeReturn
+audio_probe (GstPad * pad, GstPadProbeInfo * info, RtpCacheRecord * record)
+{
+  return record_probe (record, RTP_SESSION_AUDIO, info);
+}
+
+static void
+volume_changed (GObject * volume, GParamSpec * pspec, RtpCacheRecord * record)
+{
+  g_mutex_lock (&record->lock);
+  record_abort (record, "the volume was changed");
+  g_mutex_unlock (&record->lock);
+}
+
+/* Record the packets a host pipeline sends for its file into the cache.
+ * The encoder tells the keyframes, the udpsinks are the ones of the video
+ * and audio RTP sessions */
+gboolean
+rtpcache_record_start (RtpCacheRecord * record, StreamSession * session,
+    EncoderCodec codec, GstElement * encoder, GstElement * video_sink,
+    GstElement * audio_sink, GstElement * volume)
+{
+  GstPadProbeType type = (GstPadProbeType) (GST_PAD_PROBE_TYPE_BUFFER
+      | GST_PAD_PROBE_TYPE_BUFFER_LIST | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM);
+  RtpCacheHeader header;
+  gchar *tmp;
+  GstPad *pad;
+
+  memset (record, 0, sizeof (RtpCacheRecord));
+  g_mutex_init (&record->lock);
+  if (!session->realtime)
+    return FALSE;
+
+  record->path = g_strdup (session->path);
+  record->cache = cache_path (session, codec);
+  tmp = g_strconcat (record->cache, ".tmp", NULL);
+  record->file = g_fopen (tmp, "wb");
+  g_free (tmp);
+  if (record->file == NULL) {
+    perror ("RTP cache");
+    return FALSE;
+  }
+
+  /* The header is written last, once the offsets are known */
+  memset (&header, 0, sizeof (header));
+  fwrite (&header, sizeof (header), 1, record->file);
+  record->offset = sizeof (header);
+  record->index = g_array_new (FALSE, FALSE, sizeof (RtpCacheIndexEntry));
+  for (guint i = 0; i < RTPCACHE_STREAMS; i++)
+    record->last_index[i] = GST_CLOCK_TIME_NONE;
+
+  pad = gst_element_get_static_pad (encoder, "src");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+      (GstPadProbeCallback) keyframe_probe, record, NULL);
+  gst_object_unref (pad);
+  pad = gst_element_get_static_pad (video_sink, "sink");
+  gst_pad_add_probe (pad, type, (GstPadProbeCallback) video_probe, record,
+      NULL);
+  gst_object_unref (pad);
+  pad = gst_element_get_static_pad (audio_sink, "sink");
+  gst_pad_add_probe (pad, type, (GstPadProbeCallback) audio_probe, record,
+      NULL);
+  gst_object_unref (pad);
+  record->volume = GST_ELEMENT (gst_object_ref (volume));
+  record->volume_id = g_signal_connect (volume, "notify::volume",
+      G_CALLBACK (volume_changed), record);
+  return TRUE;
+}
+
+/* Write the caps, the index and the header after the packets */
+static gboolean
+record_finish (RtpCacheRecord * record)
+{
+  struct stat st;
+  RtpCacheHeader header;
+  static const guint8 padding[RTPCACHE_ALIGN] = { 0 };
+  gsize size = 0, pad;
+
+  if (stat (record->path, &st) < 0)
+    return FALSE;
+
+  memset (&header, 0, sizeof (header));
+  memcpy (header.magic, RTPCACHE_MAGIC, 4);
+  header.version = RTPCACHE_VERSION;
+  header.file_size = st.st_size;
+  header.file_mtime = st.st_mtime;
+  header.duration = record->duration;
+  header.packets = record->packets;
+  header.caps_offset = record->offset;
+  for (guint i = 0; i < RTPCACHE_STREAMS; i++) {
+    header.caps_size[i] = strlen (record->caps[i]) + 1;
+    if (fwrite (record->caps[i], 1, header.caps_size[i], record->file)
+        != header.caps_size[i])
+      return FALSE;
+    size += header.caps_size[i];
+  }
+  pad = GST_ROUND_UP_N (size, RTPCACHE_ALIGN) - size;
+  header.index_offset = record->offset + size + pad;
+  header.index_count = record->index->len;
+
+  return fwrite (padding, 1, pad, record->file) == pad
+      && fwrite (record->index->data, sizeof (RtpCacheIndexEntry),
+      record->index->len, record->file) == record->index->len
+      && fseek (record->file, 0, SEEK_SET) == 0
+      && fwrite (&header, sizeof (header), 1, record->file) == 1;
+}
+
+/* Stop recording. The cache file is renamed into place when both streams
+ * were recorded to their end and keep is set, and removed otherwise */
+void
+rtpcache_record_stop (RtpCacheRecord * record, gboolean keep)
+{
+  gchar *tmp;
+  gboolean complete;
+
+  if (record->file != NULL) {
+    g_signal_handler_disconnect (record->volume, record->volume_id);
+    gst_object_unref (record->volume);
+
+    tmp = g_strconcat (record->cache, ".tmp", NULL);
+    complete = keep && !record->aborted;
+    for (guint i = 0; i < RTPCACHE_STREAMS; i++)
+      complete = complete && record->eos[i] && record->caps[i] != NULL;
+    complete = complete && record_finish (record);
+    if (fclose (record->file) == 0 && complete
+        && g_rename (tmp, record->cache) == 0) {
+      g_print ("RTP cache written for %s: %" G_GUINT64_FORMAT " packets\n",
+          record->path, record->packets);
+    } else {
+      g_unlink (tmp);
+    }
+    g_free (tmp);
+    g_array_unref (record->index);
+  }
+
+  for (guint i = 0; i < RTPCACHE_STREAMS; i++)
+    g_free (record->caps[i]);
+  g_queue_clear_full (&record->keyframes, g_free);
+  g_free (record->path);
+  g_free (record->cache);
+  g_mutex_clear (&record->lock);
+  memset (record, 0, sizeof (RtpCacheRecord));
+}
+
+/* A buffer for a cached packet: a copy of its RTP header with the
+ * sequence number and timestamp of the replay, and the rest pointing into
+ * the mapped cache file. The first packet of a replay sets the offsets,
+ * the timestamp goes on by the time since the last packet was sent */
+static GstBuffer *
+replay_buffer (RtpCacheStream * stream, const RtpCachePacket * packet)
+{
+  const guint8 *data = (const guint8 *) (packet + 1);
+  guint8 header[RTP_HEADER_SIZE];
+  guint16 seq;
+  guint32 timestamp;
+  GstBuffer *buffer;
+  gint64 now = g_get_monotonic_time ();
+
+  if (packet->size < RTP_HEADER_SIZE)
+    return NULL;
+  memcpy (header, data, RTP_HEADER_SIZE);
+  seq = GST_READ_UINT16_BE (header + 2);
+  timestamp = GST_READ_UINT32_BE (header + 4);
+  if (stream->restart) {
+    stream->restart = FALSE;
+    if (stream->sent) {
+      stream->seq_offset = stream->last_seq + 1 - seq;
+      stream->timestamp_offset = stream->last_timestamp - timestamp
+          + (guint32) gst_util_uint64_scale (now - stream->last_time,
+          stream->clock_rate, G_USEC_PER_SEC);
+    }
+  }
+  seq += stream->seq_offset;
+  timestamp += stream->timestamp_offset;
+  GST_WRITE_UINT16_BE (header + 2, seq);
+  GST_WRITE_UINT32_BE (header + 4, timestamp);
+  stream->last_seq = seq;
+  stream->last_timestamp = timestamp;
+  stream->last_time = now;
+  stream->sent = TRUE;
+
+  buffer = gst_buffer_new_allocate (NULL, RTP_HEADER_SIZE, NULL);
+  gst_buffer_fill (buffer, 0, header, RTP_HEADER_SIZE);
+  if (packet->size > RTP_HEADER_SIZE)
+    gst_buffer_append_memory (buffer,
+        gst_memory_new_wrapped (GST_MEMORY_FLAG_READONLY,
+            (gpointer) (data + RTP_HEADER_SIZE),
+            packet->size - RTP_HEADER_SIZE, 0,
+            packet->size - RTP_HEADER_SIZE,
+            g_mapped_file_ref (stream->file),
+            (GDestroyNotify) g_mapped_file_unref));
+  return buffer;
+}
+
+/* Push the packets of the next frame of the stream as one buffer list, so
+ * that the udpsink sends them together. After a seek the stream starts at
+ * the keyframe and is paced from its pts on */
+static void
+need_data (GstAppSrc * appsrc, guint length, RtpCacheStream * stream)
+{
+  GstBufferList *list = gst_buffer_list_new ();
+  guint64 pts = GST_CLOCK_TIME_NONE;
+
+  while (stream->cursor + sizeof (RtpCachePacket) <= stream->end
+      && gst_buffer_list_length (list) < RTPCACHE_BATCH) {
+    const RtpCachePacket *packet =
+        (const RtpCachePacket *) (stream->data + stream->cursor);
+    gsize next = stream->cursor + sizeof (RtpCachePacket)
+        + GST_ROUND_UP_N (packet->size, RTPCACHE_ALIGN);
+    guint64 packet_pts = packet->pts + stream->shift;
+    GstBuffer *buffer;
+
+    if (next > stream->end)
+      break;
+    if (packet->stream != stream->stream || packet->pts < stream->start) {
+      stream->cursor = next;
+      continue;
+    }
+    if (pts != GST_CLOCK_TIME_NONE && packet_pts != pts)
+      break;
+
+    pts = packet_pts;
+    stream->cursor = next;
+    buffer = replay_buffer (stream, packet);
+    if (buffer == NULL)
+      continue;
+    GST_BUFFER_PTS (buffer) = pts;
+    gst_buffer_list_add (list, buffer);
+  }
+
+  if (gst_buffer_list_length (list) > 0) {
+    gst_app_src_push_buffer_list (appsrc, list);
+  } else {
+    gst_buffer_list_unref (list);
+    gst_app_src_end_of_stream (appsrc);
+  }
+}
+
+/* Index of the last entry at or before position, the entry count if none */
+static guint
+index_find (GArray * index, guint64 position)
+{
+  RtpCacheIndexEntry *entries = (RtpCacheIndexEntry *) index->data;
+  guint low = 0, high = index->len;
+
+  while (high > low) {
+    guint mid = (low + high) / 2;
+    if (entries[mid].timestamp <= position)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  return low > 0 ? low - 1 : index->len;
+}
+
+/* Start a new replay of the stream from the video keyframe at or before
+ * position, or the audio entry when the file has no video. Both streams
+ * take the same keyframe, so they stay in sync */
+static gboolean
+seek_data (GstAppSrc * appsrc, guint64 position, RtpCacheStream * stream)
+{
+  GArray *keys = stream->video->index->len > 0 ? stream->video->index
+      : stream->index;
+  guint key = index_find (keys, position);
+  guint found;
+
+  stream->start = key < keys->len
+      ? g_array_index (keys, RtpCacheIndexEntry, key).timestamp : 0;
+  stream->shift = (gint64) position - (gint64) stream->start;
+  stream->restart = TRUE;
+  found = index_find (stream->index, stream->start);
+  stream->cursor = found < stream->index->len
+      ? g_array_index (stream->index, RtpCacheIndexEntry, found).offset
+      : sizeof (RtpCacheHeader);
+  return TRUE;
+}
+
+/* Release the streams of a replay that could not be started */
+static int
+replay_abort (StreamSession * session, GstElement * pipeline,
+    RtpCacheStream * streams, GMappedFile * file)
+{
+  for (guint i = 0; i < RTPCACHE_STREAMS; i++)
+    if (streams[i].index != NULL)
+      g_array_unref (streams[i].index);
+  g_mapped_file_unref (file);
+  return pipeline != NULL ? session_abort (session, pipeline) : -1;
+}
+
+/* Replay a file from its cache: the recorded RTP packets go through rtpbin
+ * to the clients on their timestamps, with no decoding nor encoding. Pause
+ * and seeking work as on the host pipelines, the volume and trick modes
+ * need the encoders and are left out */
+int
+rtpcache_pipeline (StreamSession * session, EncoderCodec codec)
+{
+  GMappedFile *file = cache_open (session, codec);
+  const RtpCacheHeader *header;
+  RtpCacheStream streams[RTPCACHE_STREAMS];
+  GstAppSrcCallbacks callbacks;
+  GIOChannel *io_stdin;
+  GstElement *pipeline;
+  GstBus *bus;
+  CustomData data;
+  gsize caps_offset;
+
+  if (file == NULL) {
+    g_printerr ("No RTP cache for %s\n", session->path);
+    return -1;
+  }
+  header = (const RtpCacheHeader *) g_mapped_file_get_contents (file);
+  memset (&data, 0, sizeof (data));
+  memset (streams, 0, sizeof (streams));
+  memset (&callbacks, 0, sizeof (callbacks));
+  callbacks.need_data = (void (*)(GstAppSrc *, guint, gpointer)) need_data;
+  callbacks.seek_data = (gboolean (*)(GstAppSrc *, guint64, gpointer))
+      seek_data;
+
+  pipeline = gst_pipeline_new ("cache-pipeline");
+  caps_offset = header->caps_offset;
+  for (guint i = 0; i < RTPCACHE_STREAMS; i++) {
+    RtpCacheStream *stream = &streams[i];
+    GstElement *appsrc = gst_element_factory_make ("appsrc", NULL);
+    GstElement *udpsink = fanoutsink_make ();
+    RtpCacheIndexEntry *entries = (RtpCacheIndexEntry *)
+        ((const gchar *) header + header->index_offset);
+    GstCaps *caps;
+
+    if (!pipeline || !appsrc || !udpsink) {
+      g_printerr ("Not all the elements could be created.\n");
+      return replay_abort (session, pipeline, streams, file);
+    }
+
+    memset (stream, 0, sizeof (RtpCacheStream));
+    stream->file = file;
+    stream->data = (const gchar *) header;
+    stream->end = header->caps_offset;
+    stream->stream = i;
+    stream->video = &streams[RTP_SESSION_VIDEO];
+    stream->cursor = sizeof (RtpCacheHeader);
+    stream->index = g_array_new (FALSE, FALSE, sizeof (RtpCacheIndexEntry));
+    for (guint j = 0; j < header->index_count; j++)
+      if (entries[j].stream == i)
+        g_array_append_val (stream->index, entries[j]);
+
+    caps = gst_caps_from_string ((const gchar *) header + caps_offset);
+    caps_offset += header->caps_size[i];
+    gst_structure_get_int (gst_caps_get_structure (caps, 0), "clock-rate",
+        &stream->clock_rate);
+    gst_app_src_set_caps (GST_APP_SRC (appsrc), caps);
+    gst_caps_unref (caps);
+    g_object_set (G_OBJECT (appsrc), "format", GST_FORMAT_TIME, NULL);
+    gst_app_src_set_stream_type (GST_APP_SRC (appsrc),
+        GST_APP_STREAM_TYPE_SEEKABLE);
+    gst_app_src_set_duration (GST_APP_SRC (appsrc), header->duration);
+    gst_app_src_set_callbacks (GST_APP_SRC (appsrc), &callbacks, stream,
+        NULL);
+
+    gst_bin_add_many (GST_BIN (pipeline), appsrc, udpsink, NULL);
+    session_set_clients (session, udpsink, i);
+    /* Audio must not hold the preroll, as on the host pipelines */
+    if (i == RTP_SESSION_AUDIO)
+      g_object_set (G_OBJECT (udpsink), "async", FALSE, NULL);
+    if (rtp_session_link (pipeline, appsrc, udpsink, i, session) != TRUE) {
+      g_printerr ("Cache to udpsink not linked.\n");
+      return replay_abort (session, pipeline, streams, file);
+    }
+  }
+  g_print ("Session %u: replaying %s from the RTP cache, %" G_GUINT64_FORMAT
+      " packets\n", session->id, session->path, header->packets);
+
+  session_attach (session, pipeline);
+  netclock_publish (pipeline);
+  if (gst_element_set_state (pipeline,
+          GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+    g_printerr ("Could not set the pipeline for playing.\n");
+    return replay_abort (session, pipeline, streams, file);
+  }
+
+  bus = gst_element_get_bus (pipeline);
+  gst_bus_add_signal_watch (bus);
+  session->loop = g_main_loop_new (session->context, FALSE);
+
+  data.session = session;
+  data.pipeline = pipeline;
+  data.loop = session->loop;
+  data.path = session->path;
+  data.seek.pipeline = pipeline;
+  seek_setup (&data.seek);
+  g_signal_connect (bus, "message", G_CALLBACK (msg_handle), &data);
+
+  guint id = 0;
+  if (session->interactive) {
+    g_print ("\n\nPress 'k' to see a list of keyboard shortcuts\n\n");
+#ifdef G_OS_WIN32
+    io_stdin = g_io_channel_win32_new_fd (fileno (stdin));
+#else
+    io_stdin = g_io_channel_unix_new (fileno (stdin));
+#endif
+    id = g_io_add_watch (io_stdin, G_IO_IN, (GIOFunc) handle_keyboard, &data);
+  }
+
+  g_main_loop_run (session->loop);
+
+  if (id != 0)
+    g_source_remove (id);
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (pipeline);
+  gst_object_unref (bus);
+  g_main_loop_unref (session->loop);
+  for (guint i = 0; i < RTPCACHE_STREAMS; i++)
+    g_array_unref (streams[i].index);
+  g_mapped_file_unref (file);
+  return 0;
+}
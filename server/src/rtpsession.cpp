@@ -0,0 +1,130 @@
+#include "header.h"
+#include "encprofile.h"
+#include "pacing.h"
+#include "localshm.h"
+#include "hugealloc.h"
+#include "membudget.h"
+#include "spscqueue.h"
+#include <string.h>
+
+/* Build the RTCP client list from the RTP one, same hosts on another port */
+static gchar *
+rtcp_clients (const gchar * clients, gint port)
+{
+  gchar **list = g_strsplit (clients ? clients : "", ",", -1);
+  GString *result = g_string_new (NULL);
+
+  for (gchar ** client = list; *client != NULL; client++) {
+    gchar *colon = strrchr (*client, ':');
+    if (colon != NULL)
+      *colon = '\0';
+    if (**client == '\0')
+      continue;
+    g_string_append_printf (result, "%s%s:%d", result->len ? "," : "",
+        *client, port);
+  }
+  g_strfreev (list);
+  return g_string_free (result, FALSE);
+}
+
+/* Buffer the RTP packets of a real time session between rtpbin and its
+ * udpsink. The encoder then runs unsynchronised until the queue holds
+ * ahead_ms of packets, the udpsink syncing on their timestamps is the paced
+ * sender. Without encode-ahead rtpbin feeds the udpsink directly */
+static GstElement *
+ahead_queue (GstElement * pipeline, StreamSession * stream)
+{
+  GstElement *queue;
+
+  if (!stream->realtime || stream->ahead_ms <= 0)
+    return NULL;
+  queue = spscqueue_make ();
+  if (queue == NULL)
+    return NULL;
+  g_object_set (G_OBJECT (queue), "max-size-time",
+      (guint64) stream->ahead_ms * GST_MSECOND, "max-size-buffers", 0,
+      "max-size-bytes", 0, NULL);
+  membudget_tag (queue, MEMBUDGET_PACKETS);
+  gst_bin_add (GST_BIN (pipeline), queue);
+  return queue;
+}
+
+/* Send the payloader output through the pipeline's rtpbin so that the
+ * clients get RTCP sender reports, which they use to line up audio and
+ * video on one NTP timeline. The RTCP ports follow the port base of the
+ * streaming session */
+gboolean
+rtp_session_link (GstElement * pipeline, GstElement * payloader,
+    GstElement * udpsink, guint session, StreamSession * stream)
+{
+  GstElement *rtpbin, *rtcp_sink, *rtcp_src, *queue;
+  gchar *clients = NULL, *rtcp_list;
+  gchar *send_rtp_sink, *send_rtp_src, *send_rtcp_src, *recv_rtcp_sink;
+  gint shift = stream->port_base - RTP_PORT_BASE;
+  gboolean ret;
+
+  /* One rtpbin per pipeline, all sessions share its CNAME */
+  rtpbin = gst_bin_get_by_name (GST_BIN (pipeline), "rtpbin");
+  if (rtpbin == NULL) {
+    rtpbin = gst_element_factory_make ("rtpbin", "rtpbin");
+    if (rtpbin == NULL) {
+      g_printerr ("rtpbin could not be created.\n");
+      return FALSE;
+    }
+    /* Sender reports carry the time of the published network clock */
+    g_object_set (G_OBJECT (rtpbin), "ntp-time-source", 3,
+        "rtcp-sync-send-time", FALSE, NULL);
+    gst_bin_add (GST_BIN (pipeline), GST_ELEMENT (gst_object_ref (rtpbin)));
+  }
+
+  rtcp_sink = gst_element_factory_make ("udpsink", NULL);
+  rtcp_src = gst_element_factory_make ("udpsrc", NULL);
+  if (!rtcp_sink || !rtcp_src) {
+    g_printerr ("RTCP elements could not be created.\n");
+    gst_object_unref (rtpbin);
+    return FALSE;
+  }
+
+  /* Sender reports go to the same clients as the RTP packets */
+  g_object_get (G_OBJECT (udpsink), "clients", &clients, NULL);
+  rtcp_list = rtcp_clients (clients, RTCP_PORT_BASE + shift + session);
+  g_object_set (G_OBJECT (rtcp_sink), "clients", rtcp_list, "sync", FALSE,
+      "async", FALSE, NULL);
+  g_object_set (G_OBJECT (rtcp_src), "port",
+      RTCP_RR_PORT_BASE + shift + session, NULL);
+  gst_bin_add_many (GST_BIN (pipeline), rtcp_sink, rtcp_src, NULL);
+
+  send_rtp_sink = g_strdup_printf ("send_rtp_sink_%u", session);
+  send_rtp_src = g_strdup_printf ("send_rtp_src_%u", session);
+  send_rtcp_src = g_strdup_printf ("send_rtcp_src_%u", session);
+  recv_rtcp_sink = g_strdup_printf ("recv_rtcp_sink_%u", session);
+
+  /* Keyframes leave the udpsink spread over the pacing rate */
+  pacing_attach (udpsink, stream, session, session == RTP_SESSION_VIDEO
+      ? encprofile_settings (stream->profile)->bitrate : PACING_AUDIO_BITRATE);
+
+  /* Encoded frames the payloader cuts packets from on the huge page arena */
+  hugealloc_attach (payloader, "sink");
+
+  queue = ahead_queue (pipeline, stream);
+  ret = (stream->local == NULL || localshm_link (pipeline, payloader,
+          udpsink, session, stream))
+      && gst_element_link_pads (payloader, "src", rtpbin, send_rtp_sink)
+      && (queue != NULL
+      ? gst_element_link_pads (rtpbin, send_rtp_src, queue, "sink")
+      && gst_element_link (queue, udpsink)
+      : gst_element_link_pads (rtpbin, send_rtp_src, udpsink, "sink"))
+      && gst_element_link_pads (rtpbin, send_rtcp_src, rtcp_sink, "sink")
+      && gst_element_link_pads (rtcp_src, "src", rtpbin, recv_rtcp_sink);
+  if (!ret)
+    g_printerr ("RTP session %u not linked.\n", session);
+
+  g_free (send_rtp_sink);
+  g_free (send_rtp_src);
+  g_free (send_rtcp_src);
+  g_free (recv_rtcp_sink);
+  g_free (rtcp_list);
+  g_free (clients);
+  gst_object_unref (rtpbin);
+  return ret;
+}
@@ -0,0 +1,425 @@
+#include "scheduler.h"
+#include "simulcast.h"
+#include "encselect.h"
+#include <glib/gstdio.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+/* Cores the sessions may commit, and the committed part */
+static gdouble budget = 0.0;
+static gdouble committed = 0.0;
+static guint running = 0;
+
+/* CPUs this process may run on and the cost placed on each of them */
+static gint cpu_count = 0;
+static gint *cpu_ids = NULL;
+static gdouble *cpu_load = NULL;
+
+/* Sessions in submission order, queued ones are admitted in this order */
+static GList *entries = NULL;
+
+static GMainLoop *sched_loop = NULL;
+static guint sched_ticks = 0;
+static glong clock_ticks = 100;
+static gchar *stats_path = NULL;
+
+/* Transcode cost per megapixel per second, refined while running */
+static gdouble cost_h264 = SCHED_COST_H264;
+static gdouble cost_vp8 = SCHED_COST_VP8;
+static gdouble cost_vp9 = SCHED_COST_VP9;
+static gdouble cost_av1 = SCHED_COST_AV1;
+static gdouble cost_h265 = SCHED_COST_H265;
+
+static const gchar *state_names[] = { "queued", "running", "done" };
+
+/* Megapixels per second the session decodes and encodes, the smaller
+ * simulcast renditions count by their share of the pixels */
+static gdouble
+pixel_rate (SchedEntry * entry)
+{
+  return entry->width * (gdouble) entry->height * entry->fps / 1000000.0
+      * simulcast_cost_factor (entry->session->renditions, entry->height);
+}
+
+static gdouble *
+codec_cost (const gchar * codec)
+{
+  if (!strcmp (codec, "h264"))
+    return &cost_h264;
+  if (!strcmp (codec, "vp8"))
+    return &cost_vp8;
+  if (!strcmp (codec, "vp9"))
+    return &cost_vp9;
+  if (!strcmp (codec, "av1"))
+    return &cost_av1;
+  if (!strcmp (codec, "h265"))
+    return &cost_h265;
+  return NULL;
+}
+
+/* Estimate the cost of the session from the output codec of its host
+ * pipeline and the resolution and framerate of its video */
+static void
+estimate (SchedEntry * entry)
+{
+  const gchar *path = entry->session->path;
+  const gchar *extension = strrchr (path, '.');
+  GstDiscoverer *discoverer = gst_discoverer_new (5 * GST_SECOND, NULL);
+  gchar *uri = gst_filename_to_uri (path, NULL);
+  GstDiscovererInfo *info = NULL;
+  gdouble *cost;
+
+  entry->codec = "audio";
+  if (extension && (!g_ascii_strcasecmp (extension, ".webm")
+          || !g_ascii_strcasecmp (extension, ".avi")))
+    entry->codec = encselect_codec_name (encselect_video_codec
+        (entry->session, ENC_CODEC_VP8));
+  else if (extension && !g_ascii_strcasecmp (extension, ".mp4"))
+    entry->codec = encselect_codec_name (encselect_video_codec
+        (entry->session, ENC_CODEC_H264));
+
+  if (discoverer != NULL && uri != NULL)
+    info = gst_discoverer_discover_uri (discoverer, uri, NULL);
+  if (info != NULL) {
+    GList *streams = gst_discoverer_info_get_video_streams (info);
+    if (streams != NULL) {
+      GstDiscovererVideoInfo *video = (GstDiscovererVideoInfo *) streams->data;
+      guint denom = gst_discoverer_video_info_get_framerate_denom (video);
+      entry->width = gst_discoverer_video_info_get_width (video);
+      entry->height = gst_discoverer_video_info_get_height (video);
+      entry->fps = denom ?
+          gst_discoverer_video_info_get_framerate_num (video) /
+          (gdouble) denom : 0.0;
+      if (entry->fps <= 0.0)
+        entry->fps = 30.0;
+    }
+    gst_discoverer_stream_info_list_free (streams);
+    gst_discoverer_info_unref (info);
+  }
+  if (discoverer != NULL)
+    g_object_unref (discoverer);
+  g_free (uri);
+
+  cost = codec_cost (entry->codec);
+  entry->cost = SCHED_COST_SESSION + (cost ? *cost * pixel_rate (entry) : 0.0);
+}
+
+/* Pin the session to the least loaded CPUs, one per core it costs, and
+ * lower the priority of the heavy sessions */
+static void
+place (SchedEntry * entry)
+{
+  gint count = CLAMP ((gint) ceil (entry->cost), 1, cpu_count);
+  gdouble share = entry->cost / count;
+
+  CPU_ZERO (&entry->cores);
+  for (gint i = 0; i < count; i++) {
+    gint best = -1;
+    for (gint c = 0; c < cpu_count; c++) {
+      if (CPU_ISSET (cpu_ids[c], &entry->cores))
+        continue;
+      if (best < 0 || cpu_load[c] < cpu_load[best])
+        best = c;
+    }
+    CPU_SET (cpu_ids[best], &entry->cores);
+    cpu_load[best] += share;
+  }
+  entry->core_count = count;
+  entry->nice = MIN (SCHED_MAX_NICE,
+      (gint) entry->cost * SCHED_NICE_PER_CORE);
+}
+
+static void
+release (SchedEntry * entry)
+{
+  gdouble share = entry->cost / entry->core_count;
+
+  for (gint c = 0; c < cpu_count; c++)
+    if (CPU_ISSET (cpu_ids[c], &entry->cores))
+      cpu_load[c] -= share;
+  committed -= entry->cost;
+  running--;
+}
+
+static void
+admit (SchedEntry * entry)
+{
+  place (entry);
+  committed += entry->cost;
+  running++;
+  entry->state = SCHED_RUNNING;
+  entry->started = g_get_monotonic_time ();
+  /* The encoder gets a thread per CPU the session is pinned to */
+  if (entry->session->encoder_threads <= 0)
+    entry->session->encoder_threads = entry->core_count;
+  g_print ("Session %u admitted: %s %dx%d@%.0f, %.2f cores on %d CPU(s), "
+      "nice %d\n", entry->session->id, entry->codec, entry->width,
+      entry->height, entry->fps, entry->cost, entry->core_count, entry->nice);
+  session_start (entry->session);
+}
+
+/* Admit queued sessions first come first served while they fit in the
+ * budget. A session costing more than the whole budget runs alone */
+static void
+admit_queued ()
+{
+  for (GList * l = entries; l != NULL; l = l->next) {
+    SchedEntry *entry = (SchedEntry *) l->data;
+    if (entry->state != SCHED_QUEUED)
+      continue;
+    if (running > 0 && committed + entry->cost > budget)
+      break;
+    admit (entry);
+  }
+}
+
+/* Use the CPU time measured for a finished session to correct the cost
+ * model of its codec */
+static void
+learn (SchedEntry * entry)
+{
+  gdouble seconds = entry->session->elapsed / (gdouble) G_USEC_PER_SEC;
+  gdouble measured, *cost = codec_cost (entry->codec);
+
+  if (seconds < 5 * SCHED_TICK)
+    return;
+  measured = entry->cpu_ticks / (gdouble) clock_ticks / seconds;
+  g_print ("Session %u finished after %.0f s: %.2f cores measured, "
+      "%.2f estimated\n", entry->session->id, seconds, measured, entry->cost);
+  if (cost == NULL || pixel_rate (entry) <= 0.0
+      || measured <= SCHED_COST_SESSION)
+    return;
+  *cost = (1.0 - SCHED_LEARN_RATE) * *cost + SCHED_LEARN_RATE
+      * (measured - SCHED_COST_SESSION) / pixel_rate (entry);
+  g_print ("Cost model %s: %.4f cores per megapixel/s\n", entry->codec,
+      *cost);
+}
+
+static SchedEntry *
+find_entry (guint id)
+{
+  for (GList * l = entries; l != NULL; l = l->next)
+    if (((SchedEntry *) l->data)->session->id == id)
+      return (SchedEntry *) l->data;
+  return NULL;
+}
+
+/* Sum the CPU time of the threads of every session, they are named
+ * "sess<id>..." by the session and the scheduler */
+static void
+sample ()
+{
+  GDir *dir = g_dir_open ("/proc/self/task", 0, NULL);
+  GHashTable *totals = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+  const gchar *tid;
+
+  if (dir == NULL)
+    return;
+  while ((tid = g_dir_read_name (dir)) != NULL) {
+    gchar *file = g_build_filename ("/proc/self/task", tid, "stat", NULL);
+    gchar *contents = NULL, *name, *end;
+    unsigned long utime = 0, stime = 0;
+
+    if (g_file_get_contents (file, &contents, NULL, NULL)
+        && (name = strchr (contents, '(')) != NULL
+        && (end = strrchr (contents, ')')) != NULL
+        && g_str_has_prefix (name + 1, "sess")
+        && sscanf (end + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u "
+            "%lu %lu", &utime, &stime) == 2) {
+      gpointer id = GUINT_TO_POINTER (strtoul (name + 5, NULL, 10));
+      gint64 *total = (gint64 *) g_hash_table_lookup (totals, id);
+      if (total == NULL) {
+        total = g_new0 (gint64, 1);
+        g_hash_table_insert (totals, id, total);
+      }
+      *total += utime + stime;
+    }
+    g_free (contents);
+    g_free (file);
+  }
+  g_dir_close (dir);
+
+  GHashTableIter iter;
+  gpointer key, value;
+  g_hash_table_iter_init (&iter, totals);
+  while (g_hash_table_iter_next (&iter, &key, &value)) {
+    SchedEntry *entry = find_entry (GPOINTER_TO_UINT (key));
+    gint64 total = *(gint64 *) value;
+    if (entry == NULL || entry->state != SCHED_RUNNING)
+      continue;
+    entry->cpu_cores = MAX (0, total - entry->cpu_ticks)
+        / (gdouble) clock_ticks / SCHED_TICK;
+    entry->cpu_ticks = MAX (entry->cpu_ticks, total);
+  }
+  g_hash_table_destroy (totals);
+}
+
+/* Write the per-session accounting, and print it now and then */
+static void
+export_stats (gboolean print)
+{
+  GString *stats = g_string_new ("# id state estimate_cores cpu_cores "
+      "cpu_seconds nice cpus path\n");
+  guint queued = 0;
+
+  for (GList * l = entries; l != NULL; l = l->next) {
+    SchedEntry *entry = (SchedEntry *) l->data;
+    queued += entry->state == SCHED_QUEUED;
+    g_string_append_printf (stats, "%u %s %.2f %.2f %.1f %d %d %s\n",
+        entry->session->id, state_names[entry->state], entry->cost,
+        entry->state == SCHED_RUNNING ? entry->cpu_cores : 0.0,
+        entry->cpu_ticks / (gdouble) clock_ticks, entry->nice,
+        entry->core_count, entry->session->path);
+  }
+  g_string_append_printf (stats, "# committed %.2f of %.2f cores, "
+      "%u running, %u queued\n", committed, budget, running, queued);
+  if (stats_path != NULL)
+    g_file_set_contents (stats_path, stats->str, stats->len, NULL);
+  if (print)
+    g_print ("\n%s\n", stats->str);
+  g_string_free (stats, TRUE);
+}
+
+static gboolean
+tick (gpointer user_data)
+{
+  gboolean active = FALSE;
+
+  sample ();
+  for (GList * l = entries; l != NULL; l = l->next) {
+    SchedEntry *entry = (SchedEntry *) l->data;
+    if (entry->state == SCHED_RUNNING
+        && g_atomic_int_get (&entry->session->finished)) {
+      if (session_join (entry->session) != 0)
+        g_printerr ("Session %u: %s could not be streamed\n",
+            entry->session->id, entry->session->path);
+      release (entry);
+      entry->state = SCHED_DONE;
+      learn (entry);
+    }
+  }
+  admit_queued ();
+
+  for (GList * l = entries; l != NULL; l = l->next)
+    active |= ((SchedEntry *) l->data)->state != SCHED_DONE;
+  export_stats (++sched_ticks % SCHED_REPORT_INTERVAL == 0 || !active);
+  if (!active) {
+    g_main_loop_quit (sched_loop);
+    return G_SOURCE_REMOVE;
+  }
+  return G_SOURCE_CONTINUE;
+}
+
+/* Budget in cores for all sessions, 0 for a share of the available ones */
+void
+scheduler_init (gdouble cores)
+{
+  cpu_set_t allowed;
+  gchar *dir;
+
+  CPU_ZERO (&allowed);
+  sched_getaffinity (0, sizeof (allowed), &allowed);
+  cpu_ids = g_new0 (gint, CPU_SETSIZE);
+  for (gint c = 0; c < CPU_SETSIZE; c++)
+    if (CPU_ISSET (c, &allowed))
+      cpu_ids[cpu_count++] = c;
+  cpu_load = g_new0 (gdouble, cpu_count);
+  clock_ticks = sysconf (_SC_CLK_TCK);
+
+  budget = cores > 0.0 ? cores : SCHED_BUDGET_SHARE * cpu_count;
+  dir = g_build_filename (g_get_user_runtime_dir (),
+      "gstreamer-remote-streaming", NULL);
+  g_mkdir_with_parents (dir, 0755);
+  stats_path = g_build_filename (dir, "sessions.stats", NULL);
+  g_free (dir);
+  g_print ("Scheduler: budget %.2f of %d cores, accounting in %s\n", budget,
+      cpu_count, stats_path);
+}
+
+/* Admit the session when its estimated cost fits in the budget, queue it
+ * otherwise. The scheduler owns the session from now on */
+gboolean
+scheduler_submit (StreamSession * session)
+{
+  SchedEntry *entry = g_new0 (SchedEntry, 1);
+
+  entry->session = session;
+  entry->state = SCHED_QUEUED;
+  session->sched = entry;
+  estimate (entry);
+  entries = g_list_append (entries, entry);
+  admit_queued ();
+  if (entry->state == SCHED_QUEUED)
+    g_print ("Session %u queued: %.2f cores, %.2f of %.2f committed\n",
+        session->id, entry->cost, committed, budget);
+  return entry->state == SCHED_RUNNING;
+}
+
+/* Name, pin and prioritise the calling thread. Threads it starts later,
+ * like the encoder's own, inherit all three */
+static void
+apply_thread (SchedEntry * entry, const gchar * name)
+{
+  gchar *thread_name = g_strdup_printf ("sess%u:%s", entry->session->id,
+      name);
+
+  prctl (PR_SET_NAME, thread_name, 0, 0, 0);
+  pthread_setaffinity_np (pthread_self (), sizeof (cpu_set_t),
+      &entry->cores);
+  setpriority (PRIO_PROCESS, syscall (SYS_gettid), entry->nice);
+  g_free (thread_name);
+}
+
+/* Streaming threads announce themselves from the thread itself */
+static GstBusSyncReply
+sync_handler (GstBus * bus, GstMessage * msg, SchedEntry * entry)
+{
+  if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_STREAM_STATUS) {
+    GstStreamStatusType type;
+    GstElement *owner;
+
+    gst_message_parse_stream_status (msg, &type, &owner);
+    if (type == GST_STREAM_STATUS_TYPE_ENTER)
+      apply_thread (entry, GST_ELEMENT_NAME (owner));
+  }
+  return GST_BUS_PASS;
+}
+
+/* Place the session thread and the streaming threads of its pipeline on
+ * the session's CPUs, called from the session thread */
+void
+scheduler_attach (StreamSession * session, GstElement * pipeline)
+{
+  SchedEntry *entry = (SchedEntry *) session->sched;
+  GstBus *bus = gst_element_get_bus (pipeline);
+
+  apply_thread (entry, "main");
+  gst_bus_set_sync_handler (bus, (GstBusSyncHandler) sync_handler, entry,
+      NULL);
+  gst_object_unref (bus);
+}
+
+/* Account and schedule the sessions until all of them finished */
+void
+scheduler_run ()
+{
+  sched_loop = g_main_loop_new (NULL, FALSE);
+  g_timeout_add_seconds (SCHED_TICK, tick, NULL);
+  g_main_loop_run (sched_loop);
+  g_main_loop_unref (sched_loop);
+
+  for (GList * l = entries; l != NULL; l = l->next) {
+    SchedEntry *entry = (SchedEntry *) l->data;
+    session_free (entry->session);
+    g_free (entry);
+  }
+  g_list_free (entries);
+  entries = NULL;
+}
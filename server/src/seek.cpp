@@ -0,0 +1,244 @@
+#include "seek.h"
+#include "control.h"
+#include <gst/video/video.h>
+
+/* Rewrite trick mode timestamps to running time, so the encoder always sees
+ * a normal rate 1.0 stream, and force a keyframe after every seek */
+static GstPadProbeReturn
+video_encoder_probe (GstPad * pad, GstPadProbeInfo * info, SeekData * seek)
+{
+  if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+    GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+
+    if (GST_EVENT_TYPE (event) == GST_EVENT_FLUSH_STOP) {
+      g_atomic_int_set (&seek->force_key_unit, TRUE);
+    } else if (GST_EVENT_TYPE (event) == GST_EVENT_SEGMENT) {
+      const GstSegment *segment;
+      gst_event_parse_segment (event, &segment);
+      gst_segment_copy_into (segment, &seek->segment);
+      seek->normalize = (segment->format == GST_FORMAT_TIME
+          && segment->rate != 1.0);
+      if (seek->normalize) {
+        GstSegment normal;
+        GstEvent *normal_event;
+
+        gst_segment_init (&normal, GST_FORMAT_TIME);
+        normal_event = gst_event_new_segment (&normal);
+        gst_event_set_seqnum (normal_event, gst_event_get_seqnum (event));
+        gst_event_unref (event);
+        GST_PAD_PROBE_INFO_DATA (info) = normal_event;
+      }
+    }
+  } else if (info->type & GST_PAD_PROBE_TYPE_BUFFER) {
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+
+    if (seek->video_input != NULL
+        && g_atomic_int_compare_and_exchange (&seek->force_key_unit, TRUE,
+            FALSE)) {
+      /* Ahead of this frame, through to every encoder */
+      gst_pad_send_event (pad,
+          gst_video_event_new_downstream_force_key_unit (GST_CLOCK_TIME_NONE,
+              GST_CLOCK_TIME_NONE, GST_CLOCK_TIME_NONE, TRUE, 0));
+    } else if (seek->video_input == NULL
+        && g_atomic_int_compare_and_exchange (&seek->force_key_unit, TRUE,
+            FALSE)) {
+      /* Sent from downstream of the encoder, it applies to the next frame */
+      GstPad *srcpad = gst_element_get_static_pad (seek->video_encoder, "src");
+      gst_pad_send_event (srcpad,
+          gst_video_event_new_upstream_force_key_unit (GST_CLOCK_TIME_NONE,
+              TRUE, 0));
+      gst_object_unref (srcpad);
+    }
+
+    if (seek->normalize && GST_BUFFER_PTS_IS_VALID (buffer)) {
+      guint64 running_time = gst_segment_to_running_time (&seek->segment,
+          GST_FORMAT_TIME, GST_BUFFER_PTS (buffer));
+      if (running_time == GST_CLOCK_TIME_NONE)
+        return GST_PAD_PROBE_DROP;
+
+      buffer = gst_buffer_make_writable (buffer);
+      GST_BUFFER_PTS (buffer) = running_time;
+      GST_BUFFER_DTS (buffer) = GST_CLOCK_TIME_NONE;
+      if (GST_BUFFER_DURATION_IS_VALID (buffer))
+        GST_BUFFER_DURATION (buffer) =
+            GST_BUFFER_DURATION (buffer) / ABS (seek->segment.rate);
+      GST_PAD_PROBE_INFO_DATA (info) = buffer;
+    }
+  }
+  return GST_PAD_PROBE_OK;
+}
+
+/* Print the time from the seek request to the first encoded keyframe */
+static GstPadProbeReturn
+seek_latency_probe (GstPad * pad, GstPadProbeInfo * info, SeekData * seek)
+{
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+
+  if (!GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT)
+      && !g_atomic_int_get (&seek->force_key_unit)
+      && g_atomic_int_compare_and_exchange (&seek->pending, TRUE, FALSE)) {
+    g_print ("\n Seek to first frame : %" G_GINT64_FORMAT " ms\n",
+        (g_get_monotonic_time () - seek->seek_start) / 1000);
+  }
+  return GST_PAD_PROBE_OK;
+}
+
+/* Audio is not sent during trick modes */
+static GstPadProbeReturn
+audio_encoder_probe (GstPad * pad, GstPadProbeInfo * info, SeekData * seek)
+{
+  if (g_atomic_int_get (&seek->trick))
+    return GST_PAD_PROBE_DROP;
+  return GST_PAD_PROBE_OK;
+}
+
+/* Install the probes used by seeking on the encoders of a host pipeline */
+void
+seek_setup (SeekData * seek)
+{
+  GstPad *pad;
+
+  seek->rate = 1.0;
+  seek->mode = SEEK_MODE_FAST;
+  gst_segment_init (&seek->segment, GST_FORMAT_TIME);
+
+  if (seek->video_encoder) {
+    pad = gst_element_get_static_pad (seek->video_input ? seek->video_input
+        : seek->video_encoder, "sink");
+    gst_pad_add_probe (pad, (GstPadProbeType) (GST_PAD_PROBE_TYPE_BUFFER
+            | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM),
+        (GstPadProbeCallback) video_encoder_probe, seek, NULL);
+    gst_object_unref (pad);
+
+    pad = gst_element_get_static_pad (seek->video_encoder, "src");
+    gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+        (GstPadProbeCallback) seek_latency_probe, seek, NULL);
+    gst_object_unref (pad);
+  }
+
+  if (seek->audio_encoder) {
+    pad = gst_element_get_static_pad (seek->audio_encoder, "sink");
+    gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+        (GstPadProbeCallback) audio_encoder_probe, seek, NULL);
+    gst_object_unref (pad);
+  }
+}
+
+/* Send a flushing seek to the pipeline and notify the clients */
+static gboolean
+do_seek (SeekData * seek, gdouble rate, gint64 position, GstSeekFlags flags)
+{
+  GstEvent *event;
+  gchar *command;
+
+  if (position < 0)
+    position = 0;
+
+  if (rate > 0) {
+    event = gst_event_new_seek (rate, GST_FORMAT_TIME, flags,
+        GST_SEEK_TYPE_SET, position, GST_SEEK_TYPE_NONE, GST_CLOCK_TIME_NONE);
+  } else {
+    event = gst_event_new_seek (rate, GST_FORMAT_TIME, flags,
+        GST_SEEK_TYPE_SET, 0, GST_SEEK_TYPE_SET, position);
+  }
+
+  /* The clients drop what they buffered before the new keyframe arrives */
+  command = g_strdup_printf ("%s %" G_GINT64_FORMAT " %.1f", CONTROL_SEEK,
+      position, rate);
+  control_send (command);
+  g_free (command);
+
+  seek->seek_start = g_get_monotonic_time ();
+  g_atomic_int_set (&seek->pending, TRUE);
+  seek->rate = rate;
+  g_atomic_int_set (&seek->trick, rate != 1.0);
+  if (!gst_element_send_event (seek->pipeline, event)) {
+    g_printerr ("Seek failed.\n");
+    g_atomic_int_set (&seek->pending, FALSE);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+/* Seek to a position at normal rate using the configured seek mode */
+static gboolean
+seek_position (SeekData * seek, gint64 position, GstSeekFlags snap)
+{
+  GstSeekFlags flags = GST_SEEK_FLAG_FLUSH;
+  KeyIndexEntry entry;
+
+  /* With a keyframe index the target keyframe is already known, so the
+   * seek goes to its exact timestamp and the kernel starts reading its
+   * bytes during the flush. This is still a time seek: the pull mode
+   * demuxers take no byte seeks and look the offset up themselves, so a
+   * file they have to scan costs what it did, only warmer */
+  if (seek->mode == SEEK_MODE_FAST
+      && keyindex_lookup (seek->index, position, snap, &entry)) {
+    keyindex_prefetch (seek->index, &entry);
+    return do_seek (seek, 1.0, entry.timestamp,
+        (GstSeekFlags) (flags | GST_SEEK_FLAG_KEY_UNIT));
+  }
+
+  if (seek->mode == SEEK_MODE_ACCURATE)
+    flags = (GstSeekFlags) (flags | GST_SEEK_FLAG_ACCURATE);
+  else
+    flags = (GstSeekFlags) (flags | GST_SEEK_FLAG_KEY_UNIT | snap);
+
+  return do_seek (seek, 1.0, position, flags);
+}
+
+/* Seek to an absolute position */
+gboolean
+seek_absolute (SeekData * seek, gint64 position)
+{
+  g_print ("\n Seek to %" GST_TIME_FORMAT "\n", GST_TIME_ARGS (position));
+  return seek_position (seek, position, GST_SEEK_FLAG_SNAP_NEAREST);
+}
+
+/* Seek forward or backward from the current position */
+gboolean
+seek_relative (SeekData * seek, gint64 offset)
+{
+  gint64 position;
+
+  if (!gst_element_query_position (seek->pipeline, GST_FORMAT_TIME,
+          &position)) {
+    g_printerr ("Could not query the current position.\n");
+    return FALSE;
+  }
+  g_print ("\n Current Position : %ld Second\n ", position / GST_SECOND);
+
+  /* Snap in the seek direction so that the seek always moves */
+  return seek_position (seek, position + offset,
+      offset >= 0 ? GST_SEEK_FLAG_SNAP_AFTER : GST_SEEK_FLAG_SNAP_BEFORE);
+}
+
+/* Fast-forward (rate > 1) or rewind (rate < 0) decoding key units only,
+ * rate 1.0 returns to normal playback at the current position */
+gboolean
+seek_trick (SeekData * seek, gdouble rate)
+{
+  gint64 position;
+  GstSeekFlags flags;
+
+  if (!gst_element_query_position (seek->pipeline, GST_FORMAT_TIME,
+          &position)) {
+    g_printerr ("Could not query the current position.\n");
+    return FALSE;
+  }
+
+  if (rate == 1.0)
+    return seek_position (seek, position, GST_SEEK_FLAG_SNAP_NEAREST);
+
+  if (!seek->video_encoder) {
+    g_printerr ("Fast-forward and rewind need a video stream.\n");
+    return FALSE;
+  }
+
+  rate = CLAMP (rate, -SEEK_MAX_RATE, SEEK_MAX_RATE);
+  flags = (GstSeekFlags) (GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT
+      | GST_SEEK_FLAG_TRICKMODE | GST_SEEK_FLAG_TRICKMODE_KEY_UNITS
+      | GST_SEEK_FLAG_TRICKMODE_NO_AUDIO);
+  g_print ("\n Playback rate %.0fx\n", rate);
+  return do_seek (seek, rate, position, flags);
+}
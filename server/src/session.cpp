@@ -0,0 +1,200 @@
+#include "scheduler.h"
+#include "encprofile.h"
+#include "encselect.h"
+#include "simulcast.h"
+#include "membudget.h"
+#include "topology.h"
+#include "keyindex.h"
+#include "localshm.h"
+#include "control.h"
+#include <string.h>
+
+/* Number of sessions created so far, used for the thread names */
+static gint session_count = 0;
+
+/* Encode-ahead time of the sessions created from now on */
+static gint session_ahead_ms = SESSION_AHEAD_MS;
+
+/* Let the encoders of a session run up to ahead_ms of media ahead of the
+ * paced sending */
+void
+session_set_encode_ahead (gint ahead_ms)
+{
+  session_ahead_ms = MAX (ahead_ms, 0);
+}
+
+/* Create a session streaming the file to the comma separated hosts, with
+ * video on port_base and audio on port_base + 1 */
+StreamSession *
+session_new (const gchar * path, const gchar * hosts, gint port_base,
+    gboolean interactive)
+{
+  StreamSession *session = g_new0 (StreamSession, 1);
+
+  session->id = g_atomic_int_add (&session_count, 1);
+  session->path = g_strdup (path);
+  session->hosts = g_strdup (hosts);
+  session->port_base = port_base;
+  session->interactive = interactive;
+  session->realtime = TRUE;
+  session->profile = encprofile_default ();
+  session->video_codec = encselect_default_video_codec ();
+  session->renditions = simulcast_renditions ();
+  session->ahead_ms = session_ahead_ms;
+  session->mem_budget_mb = membudget_default ();
+  session->position = -1;
+  /* Only the interactive session seeks */
+  if (interactive)
+    session->keyindex = keyindex_prepare (path);
+  return session;
+}
+
+void
+session_free (StreamSession * session)
+{
+  if (session->context != NULL)
+    g_main_context_unref (session->context);
+  if (session->keyindex != NULL)
+    keyindex_unref (session->keyindex);
+  localshm_release (session);
+  g_free (session->path);
+  g_free (session->hosts);
+  g_free (session);
+}
+
+/* Send the RTP session to every host of the session on its port. Sessions
+ * that are not real time, like the benchmark ones, send as fast as the
+ * pipeline produces */
+void
+session_set_clients (StreamSession * session, GstElement * udpsink,
+    guint rtp_session)
+{
+  gchar **hosts = g_strsplit (session->hosts, ",", -1);
+  GString *clients = g_string_new (NULL);
+
+  for (gchar ** host = hosts; *host != NULL; host++) {
+    if (**host == '\0')
+      continue;
+    g_string_append_printf (clients, "%s%s:%d", clients->len ? "," : "",
+        *host, session->port_base + rtp_session);
+  }
+  g_object_set (G_OBJECT (udpsink), "clients", clients->str,
+      "sync", session->realtime, NULL);
+  g_string_free (clients, TRUE);
+  g_strfreev (hosts);
+}
+
+/* Remember the pipeline of the session before it starts streaming and
+ * bound its queues by the session memory budget, a scheduled session gets
+ * its threads placed */
+void
+session_attach (StreamSession * session, GstElement * pipeline)
+{
+  session->pipeline = pipeline;
+  membudget_attach (session, pipeline);
+  topology_attach (session, pipeline);
+  if (session->sched != NULL)
+    scheduler_attach (session, pipeline);
+}
+
+/* Drop the pipeline of a session that could not be started and return
+ * the error for the session runner */
+int
+session_abort (StreamSession * session, GstElement * pipeline)
+{
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (pipeline);
+  session->pipeline = NULL;
+  return -1;
+}
+
+/* Run the host pipeline for the session file, blocks until it ends */
+int
+session_run (StreamSession * session)
+{
+  const gchar *extension = strrchr (session->path, '.');
+
+  if (extension == NULL) {
+    g_printerr ("Unsuported format.\n");
+    return -1;
+  }
+  extension++;
+  if (!g_ascii_strcasecmp (extension, "mp4"))
+    return hostmp4_pipeline (session);
+  if (!g_ascii_strcasecmp (extension, "avi"))
+    return hostavi_pipeline (session);
+  if (!g_ascii_strcasecmp (extension, "mp3"))
+    return hostmp3_pipeline (session);
+  if (!g_ascii_strcasecmp (extension, "webm"))
+    return hostwebm_pipeline (session);
+  g_printerr ("Unsuported format.\n");
+  return -1;
+}
+
+/* Worker thread of a session, its bus watch attaches to the session's
+ * own main context */
+static gpointer
+session_thread (StreamSession * session)
+{
+  gint64 start = g_get_monotonic_time ();
+
+  g_main_context_push_thread_default (session->context);
+  session->result = session_run (session);
+  /* The clients handed to the session are done with it */
+  control_close_clients ();
+  g_main_context_pop_thread_default (session->context);
+  session->elapsed = g_get_monotonic_time () - start;
+  g_atomic_int_set (&session->finished, TRUE);
+  return NULL;
+}
+
+/* Run the session on a new main context in its own thread */
+void
+session_start (StreamSession * session)
+{
+  /* The scheduler accounts the CPU time of the "sess<id>" threads */
+  gchar *name = g_strdup_printf ("sess%u", session->id);
+
+  if (session->context == NULL)
+    session->context = g_main_context_new ();
+  session->thread = g_thread_new (name, (GThreadFunc) session_thread,
+      session);
+  g_print ("Session %u: %s -> %s, ports from %d\n", session->id,
+      session->path, session->hosts, session->port_base);
+  g_free (name);
+}
+
+/* Remember how far the session got and leave its main loop */
+static gboolean
+stop_cb (StreamSession * session)
+{
+  gst_element_query_position (session->pipeline, GST_FORMAT_TIME,
+      &session->position);
+  gst_element_set_state (session->pipeline, GST_STATE_NULL);
+  g_main_loop_quit (session->loop);
+  return G_SOURCE_REMOVE;
+}
+
+/* Stop a running session from any thread. The idle source only runs
+ * inside the session's main loop, a session that already ended keeps
+ * position -1 */
+void
+session_stop (StreamSession * session)
+{
+  GSource *source = g_idle_source_new ();
+
+  g_source_set_callback (source, (GSourceFunc) stop_cb, session, NULL);
+  g_source_attach (source, session->context);
+  g_source_unref (source);
+}
+
+/* Wait for the session thread to end */
+int
+session_join (StreamSession * session)
+{
+  if (session->thread != NULL) {
+    g_thread_join (session->thread);
+    session->thread = NULL;
+  }
+  return session->result;
+}
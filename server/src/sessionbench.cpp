@@ -0,0 +1,132 @@
+#include "header.h"
+#include "simulcast.h"
+#include "sysstat.h"
+
+/* Benchmark sessions stream to the loopback, on ports away from the
+ * interactive session */
+#define SESSIONBENCH_HOST "127.0.0.1"
+#define SESSIONBENCH_PORT_BASE 6000
+
+/* Run the given number of sessions of the file as fast as they can go for
+ * the given time and return their summed speed, 1.0 is one session in
+ * real time */
+static gdouble
+bench_run (const gchar * path, gint count, gint seconds, gint cores)
+{
+  StreamSession **sessions = g_new0 (StreamSession *, count);
+  gdouble cpu = sysstat_cpu_seconds ();
+  gint64 wall = g_get_monotonic_time ();
+  gdouble total = 0.0, slowest = G_MAXDOUBLE;
+  gsize peak = 0;
+  gboolean short_file = FALSE;
+
+  for (gint i = 0; i < count; i++) {
+    sessions[i] = session_new (path, SESSIONBENCH_HOST,
+        SESSIONBENCH_PORT_BASE + i * SESSION_PORT_SPAN, FALSE);
+    sessions[i]->realtime = FALSE;
+    session_start (sessions[i]);
+  }
+  g_usleep (seconds * G_USEC_PER_SEC);
+  for (gint i = 0; i < count; i++)
+    session_stop (sessions[i]);
+  for (gint i = 0; i < count; i++)
+    session_join (sessions[i]);
+  cpu = (sysstat_cpu_seconds () - cpu) * G_USEC_PER_SEC;
+  wall = g_get_monotonic_time () - wall;
+
+  for (gint i = 0; i < count; i++) {
+    gdouble speed;
+
+    if (sessions[i]->position < 0 || sessions[i]->elapsed <= 0) {
+      short_file = TRUE;
+      speed = 0.0;
+    } else {
+      speed = sessions[i]->position / 1000.0 / sessions[i]->elapsed;
+    }
+    total += speed;
+    slowest = MIN (slowest, speed);
+    peak = MAX (peak, sessions[i]->mem_peak);
+    session_free (sessions[i]);
+  }
+  g_free (sessions);
+
+  g_print ("%8d %10.2fx %10.2fx %10.2fx %7.0f%% %10.1f\n", count,
+      total / count, slowest, total, 100.0 * cpu / wall / cores,
+      peak / 1048576.0);
+  if (short_file)
+    g_print ("         a session ended early, use a longer file\n");
+  return total;
+}
+
+/* Measure how many sessions of the file one core sustains. Every session
+ * streams the same file with the encoder settings of the host pipelines,
+ * so the output quality is the same for every count. The session count is
+ * doubled up to twice the number of cores, the summed speed levels off
+ * once all cores are busy */
+void
+session_benchmark (const gchar * path, gint seconds)
+{
+  gint cores = g_get_num_processors ();
+  gdouble best = 0.0;
+
+  g_print ("\nSessions per core: %s, %d s per run, %d cores\n\n", path,
+      seconds, cores);
+  g_print ("sessions      speed    slowest  aggregate     cpu   peak MiB\n");
+  for (gint count = 1; count <= 2 * cores; count *= 2) {
+    best = MAX (best, bench_run (path, count, seconds, cores));
+    if (count < 2 * cores && count * 2 > 2 * cores)
+      best = MAX (best, bench_run (path, 2 * cores, seconds, cores));
+  }
+  g_print ("\nReal time sessions: %.1f, per core: %.2f\n\n", best,
+      best / cores);
+}
+
+/* Stream the file alone with the given number of renditions as fast as it
+ * goes and return the CPU time per second of video, in ms */
+static gdouble
+simulcast_run (const gchar * path, gint renditions, gint seconds)
+{
+  StreamSession *session = session_new (path, SESSIONBENCH_HOST,
+      SESSIONBENCH_PORT_BASE, FALSE);
+  gdouble cpu = sysstat_cpu_seconds ();
+  gdouble speed = 0.0, per_second = 0.0;
+
+  session->realtime = FALSE;
+  session->renditions = renditions;
+  session_start (session);
+  g_usleep (seconds * G_USEC_PER_SEC);
+  session_stop (session);
+  session_join (session);
+  cpu = (sysstat_cpu_seconds () - cpu) * G_USEC_PER_SEC;
+
+  if (session->position > 0 && session->elapsed > 0) {
+    speed = session->position / 1000.0 / session->elapsed;
+    per_second = cpu / 1000.0 / (session->position / (gdouble) GST_SECOND);
+  } else {
+    g_print ("         the session ended early, use a longer file\n");
+  }
+  session_free (session);
+  g_print ("%10d %10.2fx %12.1f", renditions, speed, per_second);
+  return per_second;
+}
+
+/* Measure what every extra simulcast rendition costs on top of the shared
+ * decode and convert: the file is streamed with one rendition, then with
+ * each added rung of the ladder */
+void
+simulcast_benchmark (const gchar * path, gint seconds)
+{
+  gdouble previous = 0.0;
+
+  g_print ("\nSimulcast renditions: %s, %d s per run\n\n", path, seconds);
+  g_print ("renditions      speed  cpu ms/s     marginal\n");
+  for (gint n = 1; n <= SIMULCAST_MAX_RENDITIONS; n++) {
+    gdouble per_second = simulcast_run (path, n, seconds);
+    if (n > 1 && previous > 0.0 && per_second > 0.0)
+      g_print (" %+11.1f\n", per_second - previous);
+    else
+      g_print ("\n");
+    previous = per_second;
+  }
+  g_print ("\n");
+}
@@ -0,0 +1,684 @@
+#include "simulcast.h"
+#include "encprofile.h"
+#include "fanoutsink.h"
+#include "hugealloc.h"
+#include "membudget.h"
+#include "topology.h"
+#include "pacing.h"
+#include <gst/rtp/gstrtpbuffer.h>
+#include <gst/video/video.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Heights and bitrates (kbit/s) of the renditions below the first one */
+static const gint ladder[SIMULCAST_MAX_RENDITIONS - 1][2] = {
+  {720, 1200},
+  {360, 400},
+};
+
+/* Renditions of the sessions created from now on */
+static gint default_renditions = SIMULCAST_DEFAULT_RENDITIONS;
+
+void
+simulcast_set_renditions (gint renditions)
+{
+  default_renditions = CLAMP (renditions, 1, SIMULCAST_MAX_RENDITIONS);
+}
+
+gint
+simulcast_renditions ()
+{
+  return default_renditions;
+}
+
+/* Encoding cost of the renditions relative to the first one alone, by
+ * pixel count. Decoding and converting are shared */
+gdouble
+simulcast_cost_factor (gint renditions, gint height)
+{
+  gdouble factor = 1.0;
+
+  for (gint i = 0; i < renditions - 1 && height > 0; i++)
+    if (ladder[i][0] < height)
+      factor += (ladder[i][0] / (gdouble) height)
+          * (ladder[i][0] / (gdouble) height);
+  return factor;
+}
+
+/* Structure for one operating point: a rendition with its temporal
+ * layers up to layer */
+typedef struct _SimulcastPoint
+{
+  gint rendition;
+  gint layer;
+  gdouble bitrate;
+} SimulcastPoint;
+
+/* Operating points of the enabled renditions from the highest bitrate to
+ * the lowest, returns their number */
+static gint
+operating_points (SimulcastData * simulcast, SimulcastPoint * points)
+{
+  gint n = 0;
+
+  for (guint r = 0; r < simulcast->count; r++) {
+    SimulcastRendition *rendition = &simulcast->renditions[r];
+
+    if (!rendition->enabled)
+      continue;
+    for (gint l = 0; l < rendition->layers; l++) {
+      SimulcastPoint point = { (gint) r, l, rendition->bitrate
+            * encprofile_layer_share (rendition->layers, l)
+      };
+      gint i = n++;
+
+      while (i > 0 && points[i - 1].bitrate < point.bitrate) {
+        points[i] = points[i - 1];
+        i--;
+      }
+      points[i] = point;
+    }
+  }
+  return n;
+}
+
+/* The source size is known, enable the rungs below it */
+static GstPadProbeReturn
+caps_probe (GstPad * pad, GstPadProbeInfo * info, SimulcastData * simulcast)
+{
+  GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+  GstStructure *s;
+  GstCaps *caps;
+  gint height = 0;
+
+  if (GST_EVENT_TYPE (event) != GST_EVENT_CAPS)
+    return GST_PAD_PROBE_OK;
+  gst_event_parse_caps (event, &caps);
+  s = gst_caps_get_structure (caps, 0);
+  if (!gst_structure_get_int (s, "height", &height))
+    return GST_PAD_PROBE_OK;
+
+  g_mutex_lock (&simulcast->lock);
+  simulcast->renditions[0].height = height;
+  for (guint i = 1; i < simulcast->count; i++)
+    simulcast->renditions[i].enabled =
+        simulcast->renditions[i].height < height;
+  g_mutex_unlock (&simulcast->lock);
+  return GST_PAD_PROBE_OK;
+}
+
+/* A disabled rendition encodes nothing */
+static GstPadProbeReturn
+enabled_probe (GstPad * pad, GstPadProbeInfo * info,
+    SimulcastRendition * rendition)
+{
+  return rendition->enabled ? GST_PAD_PROBE_OK : GST_PAD_PROBE_DROP;
+}
+
+/* Remember the timestamp of a keyframe leaving the encoder. Its packets
+ * keep it through the payloader and rtpbin, the router finds them by it
+ * however many frames the encode-ahead buffer holds in between */
+static GstPadProbeReturn
+keyframe_probe (GstPad * pad, GstPadProbeInfo * info,
+    SimulcastRendition * rendition)
+{
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  SimulcastData *simulcast = rendition->simulcast;
+  GstClockTime *pts;
+
+  if (GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT)
+      || !GST_BUFFER_PTS_IS_VALID (buffer))
+    return GST_PAD_PROBE_OK;
+
+  pts = g_new (GstClockTime, 1);
+  *pts = GST_BUFFER_PTS (buffer);
+  g_mutex_lock (&simulcast->lock);
+  g_queue_push_tail (&rendition->keyframes, pts);
+  if (g_queue_get_length (&rendition->keyframes) > SIMULCAST_MAX_KEYFRAMES)
+    g_free (g_queue_pop_head (&rendition->keyframes));
+  g_mutex_unlock (&simulcast->lock);
+  return GST_PAD_PROBE_OK;
+}
+
+/* Whether the packet is the first one of a remembered keyframe. The ones
+ * before it were flushed by a seek and are forgotten with it */
+static gboolean
+keyframe_packet (SimulcastRendition * rendition, GstBuffer * buffer)
+{
+  GList *link = rendition->keyframes.head;
+
+  if (!GST_BUFFER_PTS_IS_VALID (buffer))
+    return FALSE;
+  while (link != NULL
+      && *(GstClockTime *) link->data != GST_BUFFER_PTS (buffer))
+    link = link->next;
+  if (link == NULL)
+    return FALSE;
+  while (rendition->keyframes.head != link)
+    g_free (g_queue_pop_head (&rendition->keyframes));
+  g_free (g_queue_pop_head (&rendition->keyframes));
+  return TRUE;
+}
+
+/* Frame start, temporal layer and layer sync bit from the VP8 payload
+ * descriptor (RFC 7741). A packet without a layer is on the base one */
+static void
+vp8_descriptor (const guint8 * data, guint size, SimulcastPacket * packet)
+{
+  guint i = 2;
+  guint8 extension;
+
+  if (size < 1)
+    return;
+  packet->start = (data[0] & 0x10) && (data[0] & 0x07) == 0;
+  if (size < 2 || !(data[0] & 0x80))
+    return;
+  extension = data[1];
+  /* Picture ID on 7 or 15 bits, then TL0PICIDX */
+  if (extension & 0x80)
+    i += (i < size && (data[i] & 0x80)) ? 2 : 1;
+  if (extension & 0x40)
+    i++;
+  if ((extension & 0x20) && i < size) {
+    packet->tid = data[i] >> 6;
+    packet->sync = (data[i] >> 5) & 1;
+  }
+}
+
+/* Tell the client probes what the packet entering the router is. The
+ * rtpfunnel pushes one packet at a time, and a buffer list holds packets
+ * of one frame, so the first packet tells */
+static GstPadProbeReturn
+packet_probe (GstPad * pad, GstPadProbeInfo * info, SimulcastData * simulcast)
+{
+  SimulcastPacket *packet = &simulcast->packet;
+  GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+  GstBuffer *buffer;
+
+  if (info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST)
+    buffer = gst_buffer_list_get (GST_PAD_PROBE_INFO_BUFFER_LIST (info), 0);
+  else
+    buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  if (buffer == NULL || !gst_rtp_buffer_map (buffer, GST_MAP_READ, &rtp))
+    return GST_PAD_PROBE_DROP;
+
+  g_mutex_lock (&simulcast->lock);
+  memset (packet, 0, sizeof (SimulcastPacket));
+  packet->ssrc = gst_rtp_buffer_get_ssrc (&rtp);
+  for (guint i = 0; i < simulcast->count; i++) {
+    SimulcastRendition *rendition = &simulcast->renditions[i];
+
+    if (rendition->ssrc != packet->ssrc)
+      continue;
+    packet->key = keyframe_packet (rendition, buffer);
+    if (rendition->layers > 1)
+      vp8_descriptor ((const guint8 *) gst_rtp_buffer_get_payload (&rtp),
+          gst_rtp_buffer_get_payload_len (&rtp), packet);
+  }
+  g_mutex_unlock (&simulcast->lock);
+  gst_rtp_buffer_unmap (&rtp);
+  return GST_PAD_PROBE_OK;
+}
+
+/* Move the client to its pending operating point if the packet allows it:
+ * another rendition at its keyframe, fewer layers at any frame start, and
+ * more layers where the new top layer syncs */
+static void
+client_move (SimulcastData * simulcast, SimulcastClient * client,
+    const SimulcastPacket * packet)
+{
+  SimulcastRendition *target;
+
+  if (client->pending < 0)
+    return;
+  target = &simulcast->renditions[client->pending];
+  if (packet->ssrc != target->ssrc)
+    return;
+  if (client->pending != client->rendition) {
+    if (!packet->key)
+      return;
+  } else if (!packet->start || (client->pending_layer > client->layer
+          && !packet->key && !(packet->sync
+              && packet->tid == client->pending_layer))) {
+    return;
+  }
+  g_print ("Session %u: %s moves to %dp, %d of %d layers (measured %.0f "
+      "kbit/s)\n", simulcast->session, client->host, target->height,
+      client->pending_layer + 1, target->layers, client->estimate);
+  client->rendition = client->pending;
+  client->layer = client->pending_layer;
+  client->pending = -1;
+  client->good = 0;
+}
+
+/* Give the packet its number in the client's own sequence */
+static void
+renumber (GstBuffer * buffer, guint16 seq)
+{
+  GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+
+  if (!gst_rtp_buffer_map (buffer, GST_MAP_WRITE, &rtp))
+    return;
+  gst_rtp_buffer_set_seq (&rtp, seq);
+  gst_rtp_buffer_unmap (&rtp);
+}
+
+/* Let only the packets of the client's rendition up to its top layer
+ * through to its udpsink. Dropping layers leaves holes in the sequence
+ * numbers, so layered packets are renumbered per client, every client
+ * renumbers its own copy */
+static GstPadProbeReturn
+client_probe (GstPad * pad, GstPadProbeInfo * info, SimulcastClient * client)
+{
+  SimulcastData *simulcast = client->simulcast;
+  const SimulcastPacket *packet = &simulcast->packet;
+  SimulcastRendition *rendition;
+  GstPadProbeReturn ret = GST_PAD_PROBE_OK;
+
+  g_mutex_lock (&simulcast->lock);
+  client_move (simulcast, client, packet);
+  rendition = &simulcast->renditions[client->rendition];
+  if (packet->ssrc != rendition->ssrc || packet->tid > client->layer) {
+    ret = GST_PAD_PROBE_DROP;
+  } else if (rendition->layers > 1
+      && (info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST)) {
+    GstBufferList *list =
+        gst_buffer_list_make_writable (GST_PAD_PROBE_INFO_BUFFER_LIST (info));
+
+    for (guint i = 0; i < gst_buffer_list_length (list); i++)
+      renumber (gst_buffer_list_get_writable (list, i), client->seq++);
+    GST_PAD_PROBE_INFO_DATA (info) = list;
+  } else if (rendition->layers > 1) {
+    GstBuffer *buffer =
+        gst_buffer_make_writable (GST_PAD_PROBE_INFO_BUFFER (info));
+
+    renumber (buffer, client->seq++);
+    GST_PAD_PROBE_INFO_DATA (info) = buffer;
+  }
+  g_mutex_unlock (&simulcast->lock);
+  return ret;
+}
+
+/* Estimate what the client receives from its latest receiver report and
+ * step it down on loss, or up after a run of clean reports */
+static void
+client_report (SimulcastData * simulcast, SimulcastClient * client,
+    const GstStructure * stats)
+{
+  SimulcastRendition *current = &simulcast->renditions[client->rendition];
+  SimulcastPoint points[SIMULCAST_MAX_RENDITIONS * ENC_MAX_LAYERS];
+  guint ssrc = 0, fraction = 0, seq = 0;
+  gint n, at = 0, target;
+  gdouble loss;
+
+  if (!gst_structure_get_uint (stats, "rb-ssrc", &ssrc)
+      || !gst_structure_get_uint (stats, "rb-fractionlost", &fraction)
+      || !gst_structure_get_uint (stats, "rb-exthighestseq", &seq)
+      || ssrc != current->ssrc || seq == client->last_seq)
+    return;
+  client->last_seq = seq;
+  loss = fraction / 256.0;
+  client->estimate = current->bitrate
+      * encprofile_layer_share (current->layers, client->layer) * (1.0 - loss);
+
+  n = operating_points (simulcast, points);
+  for (gint i = 0; i < n; i++)
+    if (points[i].rendition == client->rendition
+        && points[i].layer == client->layer)
+      at = i;
+  target = at;
+  if (loss > SIMULCAST_LOSS_HIGH) {
+    client->good = 0;
+    target = MIN (at + 1, n - 1);
+  } else if (loss < SIMULCAST_LOSS_LOW) {
+    if (++client->good >= SIMULCAST_UP_REPORTS) {
+      client->good = 0;
+      target = MAX (at - 1, 0);
+    }
+  } else {
+    client->good = 0;
+  }
+  if (target == at || (points[target].rendition == client->pending
+          && points[target].layer == client->pending_layer))
+    return;
+
+  client->pending = points[target].rendition;
+  client->pending_layer = points[target].layer;
+  if (client->pending == client->rendition)
+    return;
+
+  /* Switch at the next keyframe of the target rendition, asked for now */
+  SimulcastRendition *next = &simulcast->renditions[client->pending];
+  GstPad *pad = gst_element_get_static_pad (next->encoder, "src");
+
+  gst_pad_send_event (pad,
+      gst_video_event_new_upstream_force_key_unit (GST_CLOCK_TIME_NONE, TRUE,
+          0));
+  gst_object_unref (pad);
+}
+
+/* Go through the receiver reports the video RTP session got */
+static gboolean
+simulcast_tick (SimulcastData * simulcast)
+{
+  GstElement *rtpbin = gst_bin_get_by_name (GST_BIN (simulcast->pipeline),
+      "rtpbin");
+  GObject *session = NULL;
+  GValueArray *sources = NULL;
+
+  if (rtpbin == NULL)
+    return G_SOURCE_CONTINUE;
+  g_signal_emit_by_name (rtpbin, "get-internal-session", RTP_SESSION_VIDEO,
+      &session);
+  if (session != NULL)
+    g_object_get (session, "sources", &sources, NULL);
+
+  G_GNUC_BEGIN_IGNORE_DEPRECATIONS;
+  for (guint i = 0; sources != NULL && i < sources->n_values; i++) {
+    GObject *source = g_value_get_object (&sources->values[i]);
+    GstStructure *stats = NULL;
+    gboolean internal = TRUE, have_rb = FALSE;
+    const gchar *from;
+
+    g_object_get (source, "stats", &stats, NULL);
+    if (stats == NULL)
+      continue;
+    gst_structure_get_boolean (stats, "internal", &internal);
+    gst_structure_get_boolean (stats, "have-rb", &have_rb);
+    from = gst_structure_get_string (stats, "rtcp-from");
+    if (!internal && have_rb && from != NULL) {
+      g_mutex_lock (&simulcast->lock);
+      for (GSList * l = simulcast->clients; l != NULL; l = l->next) {
+        SimulcastClient *client = (SimulcastClient *) l->data;
+        if (g_str_has_prefix (from, client->host)
+            && from[strlen (client->host)] == ':')
+          client_report (simulcast, client, stats);
+      }
+      g_mutex_unlock (&simulcast->lock);
+    }
+    gst_structure_free (stats);
+  }
+  if (sources != NULL)
+    g_value_array_free (sources);
+  G_GNUC_END_IGNORE_DEPRECATIONS;
+
+  if (session != NULL)
+    g_object_unref (session);
+  gst_object_unref (rtpbin);
+  return G_SOURCE_CONTINUE;
+}
+
+/* A client switching renditions needs the codec configuration with the
+ * keyframe, H.264 sends it in-band with every IDR frame. The router reads
+ * the temporal layer of a VP8 packet from the extended descriptor, written
+ * with a 15-bit picture ID */
+static void
+payloader_setup (GstElement * payloader, SimulcastRendition * rendition)
+{
+  GObjectClass *klass = G_OBJECT_GET_CLASS (payloader);
+
+  g_object_set (G_OBJECT (payloader), "ssrc", rendition->ssrc, NULL);
+  if (g_object_class_find_property (klass, "config-interval") != NULL)
+    g_object_set (G_OBJECT (payloader), "config-interval", -1, NULL);
+  if (rendition->layers > 1
+      && g_object_class_find_property (klass, "picture-id-mode") != NULL)
+    gst_util_set_object_arg (G_OBJECT (payloader), "picture-id-mode",
+        "15-bit");
+}
+
+/* Encoder and payloader of a rendition below the first one, the same
+ * elements as the first one's with the ladder bitrate */
+static gboolean
+rendition_link (SimulcastData * simulcast, StreamSession * session,
+    SimulcastRendition * rendition, GstElement * queue,
+    GstElement * encoder, GstElement * payloader, GstElement * funnel)
+{
+  GstElement *scale = gst_element_factory_make ("videoscale", NULL);
+  GstElement *capsfilter = gst_element_factory_make ("capsfilter", NULL);
+  GstElement *enc = gst_element_factory_make (GST_OBJECT_NAME
+      (gst_element_get_factory (encoder)), NULL);
+  GstElement *pay = gst_element_factory_make (GST_OBJECT_NAME
+      (gst_element_get_factory (payloader)), NULL);
+  GstCaps *caps;
+  GstPad *pad;
+  guint pt = 96;
+
+  if (!scale || !capsfilter || !enc || !pay)
+    return FALSE;
+  gst_bin_add_many (GST_BIN (simulcast->pipeline), scale, capsfilter, enc,
+      pay, NULL);
+
+  /* videoscale keeps the aspect ratio for the width */
+  caps = gst_caps_new_simple ("video/x-raw", "height", G_TYPE_INT,
+      rendition->height, NULL);
+  g_object_set (G_OBJECT (capsfilter), "caps", caps, NULL);
+  gst_caps_unref (caps);
+  encprofile_apply (enc, session->profile);
+  encprofile_set_threads (enc, session->encoder_threads);
+  encprofile_set_bitrate (enc, rendition->bitrate);
+  rendition->layers = encprofile_set_layers (enc, SIMULCAST_VP8_LAYERS,
+      rendition->bitrate) ? SIMULCAST_VP8_LAYERS : 1;
+  g_object_get (G_OBJECT (payloader), "pt", &pt, NULL);
+  g_object_set (G_OBJECT (pay), "pt", pt, NULL);
+  payloader_setup (pay, rendition);
+  rendition->encoder = enc;
+
+  pad = gst_element_get_static_pad (queue, "src");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+      (GstPadProbeCallback) enabled_probe, rendition, NULL);
+  gst_object_unref (pad);
+  return gst_element_link_many (queue, scale, capsfilter, enc, pay, funnel,
+      NULL);
+}
+
+/* Give every client of the session its own udpsink after the router, the
+ * first one keeps the session's udpsink */
+static gboolean
+clients_link (SimulcastData * simulcast, StreamSession * session,
+    GstElement * router, GstElement * udpsink)
+{
+  gchar *clients = NULL;
+  gchar **list;
+  gboolean linked = TRUE;
+
+  g_object_get (G_OBJECT (udpsink), "clients", &clients, NULL);
+  list = g_strsplit (clients ? clients : "", ",", -1);
+  for (gchar ** entry = list; *entry != NULL && linked; entry++) {
+    gchar *colon = strrchr (*entry, ':');
+    SimulcastClient *client;
+    GstPad *sinkpad, *peer;
+
+    if (colon == NULL)
+      continue;
+    client = g_new0 (SimulcastClient, 1);
+    client->simulcast = simulcast;
+    client->host = g_strndup (*entry, colon - *entry);
+    client->port = atoi (colon + 1);
+    client->layer = simulcast->renditions[0].layers - 1;
+    client->pending = -1;
+    client->seq = g_random_int ();
+    simulcast->clients = g_slist_append (simulcast->clients, client);
+
+    if (simulcast->clients->next == NULL) {
+      client->udpsink = udpsink;
+    } else {
+      client->udpsink = fanoutsink_make ();
+      if (client->udpsink == NULL) {
+        linked = FALSE;
+        break;
+      }
+      g_object_set (G_OBJECT (client->udpsink), "sync", session->realtime,
+          "async", FALSE, NULL);
+      gst_bin_add (GST_BIN (simulcast->pipeline), client->udpsink);
+      pacing_attach (client->udpsink, session, RTP_SESSION_VIDEO,
+          simulcast->renditions[0].bitrate);
+    }
+    g_object_set (G_OBJECT (client->udpsink), "clients", *entry, NULL);
+    linked = gst_element_link (router, client->udpsink);
+    if (!linked)
+      break;
+    sinkpad = gst_element_get_static_pad (client->udpsink, "sink");
+    peer = gst_pad_get_peer (sinkpad);
+    gst_pad_add_probe (peer, (GstPadProbeType) (GST_PAD_PROBE_TYPE_BUFFER
+            | GST_PAD_PROBE_TYPE_BUFFER_LIST),
+        (GstPadProbeCallback) client_probe, client, NULL);
+    gst_object_unref (peer);
+    gst_object_unref (sinkpad);
+  }
+  g_strfreev (list);
+  g_free (clients);
+
+  /* Nobody to send to, nothing will reach the session's udpsink */
+  if (simulcast->clients == NULL)
+    g_object_set (G_OBJECT (udpsink), "async", FALSE, NULL);
+  return linked;
+}
+
+/* Link the decoded video after convert to the session's clients. With
+ * more than one rendition the video is split after convert, every
+ * rendition is encoded in its own thread and payloaded with its own SSRC,
+ * and all of them go through the video RTP session so that the sender
+ * reports cover each one. VP8 renditions are encoded in temporal layers.
+ * A router after the rtpbin forwards every client the packets of its
+ * rendition up to its top layer, all clients start on the first rendition
+ * with all layers. With one rendition this is convert ! shed ! encoder !
+ * payloader as before, without layers */
+gboolean
+simulcast_link (SimulcastData * simulcast, StreamSession * session,
+    GstElement * pipeline, GstElement * convert, GstElement * shed,
+    GstElement * encoder, GstElement * payloader, GstElement * udpsink)
+{
+  GstElement *funnel, *router;
+  GstPad *sinkpad, *peer, *routerpad;
+  guint ssrc = g_random_int ();
+  gint bitrate = encprofile_settings (session->profile)->bitrate;
+  gint layers;
+
+  memset (simulcast, 0, sizeof (SimulcastData));
+  simulcast->session = session->id;
+  simulcast->pipeline = pipeline;
+  simulcast->count = CLAMP (session->renditions, 1, SIMULCAST_MAX_RENDITIONS);
+  g_mutex_init (&simulcast->lock);
+  /* Raw frames of the convert stage in pools on the huge page arena */
+  hugealloc_attach (convert, "src");
+  if (simulcast->count == 1)
+    return topology_link (session, pipeline, convert, shed, TOPOLOGY_ENCODE)
+        && gst_element_link_many (shed, encoder, payloader, NULL)
+        && rtp_session_link (pipeline, payloader, udpsink, RTP_SESSION_VIDEO,
+        session);
+
+  simulcast->tee = gst_element_factory_make ("tee", NULL);
+  funnel = gst_element_factory_make ("rtpfunnel", NULL);
+  router = gst_element_factory_make ("tee", NULL);
+  if (!simulcast->tee || !funnel || !router) {
+    g_printerr ("Simulcast elements could not be created.\n");
+    return FALSE;
+  }
+  g_object_set (G_OBJECT (router), "allow-not-linked", TRUE, NULL);
+  /* Layers cost the encoder, they are only worth it where the router
+   * drops them */
+  layers = encprofile_set_layers (encoder, SIMULCAST_VP8_LAYERS, bitrate)
+      ? SIMULCAST_VP8_LAYERS : 1;
+  gst_bin_add_many (GST_BIN (pipeline), simulcast->tee, funnel, router, NULL);
+  if (!gst_element_link (convert, simulcast->tee))
+    return FALSE;
+
+  for (guint i = 0; i < simulcast->count; i++) {
+    SimulcastRendition *rendition = &simulcast->renditions[i];
+    GstElement *queue = gst_element_factory_make ("queue", NULL);
+    gboolean linked;
+
+    rendition->simulcast = simulcast;
+    rendition->index = i;
+    rendition->ssrc = ssrc + i;
+    if (queue == NULL)
+      return FALSE;
+    g_object_set (G_OBJECT (queue), "max-size-buffers",
+        SIMULCAST_QUEUE_BUFFERS, "max-size-bytes", 0, "max-size-time",
+        (guint64) 0, NULL);
+    membudget_tag (queue, MEMBUDGET_RAW);
+    gst_bin_add (GST_BIN (pipeline), queue);
+    if (i == 0) {
+      rendition->bitrate = bitrate;
+      rendition->layers = layers;
+      rendition->enabled = TRUE;
+      rendition->encoder = encoder;
+      linked = gst_element_link_many (simulcast->tee, queue, shed, encoder,
+          payloader, funnel, NULL);
+      payloader_setup (payloader, rendition);
+    } else {
+      rendition->height = ladder[i - 1][0];
+      rendition->bitrate = ladder[i - 1][1];
+      linked = gst_element_link (simulcast->tee, queue)
+          && rendition_link (simulcast, session, rendition, queue, encoder,
+          payloader, funnel);
+    }
+    if (!linked) {
+      g_printerr ("Rendition %u not linked.\n", i);
+      return FALSE;
+    }
+  }
+
+  /* Every keyframe may move clients to its rendition */
+  for (guint i = 0; i < simulcast->count; i++) {
+    GstPad *pad = gst_element_get_static_pad (simulcast->renditions[i].encoder,
+        "src");
+    gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+        (GstPadProbeCallback) keyframe_probe, &simulcast->renditions[i], NULL);
+    gst_object_unref (pad);
+  }
+
+  /* rtpbin ! router ! the clients' udpsinks */
+  if (!rtp_session_link (pipeline, funnel, udpsink, RTP_SESSION_VIDEO,
+          session))
+    return FALSE;
+  sinkpad = gst_element_get_static_pad (udpsink, "sink");
+  peer = gst_pad_get_peer (sinkpad);
+  gst_pad_unlink (peer, sinkpad);
+  routerpad = gst_element_get_static_pad (router, "sink");
+  gst_pad_link (peer, routerpad);
+  gst_pad_add_probe (routerpad, (GstPadProbeType) (GST_PAD_PROBE_TYPE_BUFFER
+          | GST_PAD_PROBE_TYPE_BUFFER_LIST),
+      (GstPadProbeCallback) packet_probe, simulcast, NULL);
+  gst_object_unref (routerpad);
+  gst_object_unref (peer);
+  gst_object_unref (sinkpad);
+  if (!clients_link (simulcast, session, router, udpsink))
+    return FALSE;
+
+  GstPad *teepad = gst_element_get_static_pad (simulcast->tee, "sink");
+  gst_pad_add_probe (teepad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+      (GstPadProbeCallback) caps_probe, simulcast, NULL);
+  gst_object_unref (teepad);
+
+  simulcast->source = g_timeout_source_new (SIMULCAST_TICK_MS);
+  g_source_set_callback (simulcast->source, (GSourceFunc) simulcast_tick,
+      simulcast, NULL);
+  g_source_attach (simulcast->source, g_main_context_get_thread_default ());
+  g_print ("Session %u: %u video renditions, %d temporal layers\n",
+      session->id, simulcast->count, layers);
+  return TRUE;
+}
+
+static void
+client_free (SimulcastClient * client)
+{
+  g_free (client->host);
+  g_free (client);
+}
+
+/* Stop following the clients, called after the pipeline went to NULL */
+void
+simulcast_stop (SimulcastData * simulcast)
+{
+  if (simulcast->source != NULL) {
+    g_source_destroy (simulcast->source);
+    g_source_unref (simulcast->source);
+    simulcast->source = NULL;
+  }
+  g_slist_free_full (simulcast->clients, (GDestroyNotify) client_free);
+  simulcast->clients = NULL;
+  for (guint i = 0; i < simulcast->count; i++)
+    g_queue_clear_full (&simulcast->renditions[i].keyframes, g_free);
+  g_mutex_clear (&simulcast->lock);
+}
@@ -0,0 +1,768 @@
+#include "spscqueue.h"
+#include "sysstat.h"
+
+enum
+{
+  PROP_0,
+  PROP_MAX_SIZE_BUFFERS,
+  PROP_MAX_SIZE_BYTES,
+  PROP_MAX_SIZE_TIME,
+  PROP_SPIN,
+  PROP_CURRENT_LEVEL_BUFFERS,
+  PROP_CURRENT_LEVEL_BYTES,
+  PROP_CURRENT_LEVEL_TIME,
+  PROP_PARKS
+};
+
+#define LOAD(ptr) __atomic_load_n ((ptr), __ATOMIC_ACQUIRE)
+#define STORE(ptr, value) __atomic_store_n ((ptr), (value), __ATOMIC_RELEASE)
+
+/* Stores the other side must see before it reads whether we park */
+#define PUBLISH(ptr, value) __atomic_store_n ((ptr), (value), __ATOMIC_SEQ_CST)
+
+#if defined (__x86_64__) || defined (__i386__)
+#define SPSC_RELAX() __builtin_ia32_pause ()
+#elif defined (__aarch64__)
+#define SPSC_RELAX() __asm__ __volatile__ ("yield")
+#else
+#define SPSC_RELAX() do { } while (0)
+#endif
+
+/* Whether the host pipelines use spscqueues on their RTP branches */
+static gboolean spsc_enabled = FALSE;
+
+/* Structure for the latency the benchmark sink measures */
+typedef struct _SpscBenchLatency
+{
+  guint64 count;
+  gint64 total;
+  gint64 longest;
+} SpscBenchLatency;
+
+static GstStaticPadTemplate sink_template = GST_STATIC_PAD_TEMPLATE ("sink",
+    GST_PAD_SINK, GST_PAD_ALWAYS, GST_STATIC_CAPS_ANY);
+
+static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC, GST_PAD_ALWAYS, GST_STATIC_CAPS_ANY);
+
+G_DEFINE_TYPE (GstSpscQueue, spsc_queue, GST_TYPE_ELEMENT);
+
+/* Buffers, bytes and running time of an item, events and queries count
+ * for nothing */
+static void
+item_size (GstMiniObject * item, GstSegment * segment, guint * buffers,
+    guint64 * bytes, guint64 * time)
+{
+  GstBuffer *buffer = NULL;
+
+  *buffers = 0;
+  *bytes = 0;
+  *time = GST_CLOCK_TIME_NONE;
+  if (GST_IS_BUFFER (item)) {
+    buffer = GST_BUFFER_CAST (item);
+    *buffers = 1;
+    *bytes = gst_buffer_get_size (buffer);
+  } else if (GST_IS_BUFFER_LIST (item)) {
+    GstBufferList *list = GST_BUFFER_LIST_CAST (item);
+
+    *buffers = gst_buffer_list_length (list);
+    *bytes = gst_buffer_list_calculate_size (list);
+    if (*buffers > 0)
+      buffer = gst_buffer_list_get (list, 0);
+  }
+  if (buffer != NULL && segment->format == GST_FORMAT_TIME
+      && GST_BUFFER_DTS_OR_PTS (buffer) != GST_CLOCK_TIME_NONE)
+    *time = gst_segment_to_running_time (segment, GST_FORMAT_TIME,
+        GST_BUFFER_DTS_OR_PTS (buffer));
+}
+
+static guint
+level_buffers (GstSpscQueue * queue)
+{
+  return (guint) (LOAD (&queue->in_buffers) - LOAD (&queue->out_buffers));
+}
+
+static guint64
+level_bytes (GstSpscQueue * queue)
+{
+  return LOAD (&queue->in_bytes) - LOAD (&queue->out_bytes);
+}
+
+static guint64
+level_time (GstSpscQueue * queue)
+{
+  guint64 in = LOAD (&queue->in_time), out = LOAD (&queue->out_time);
+
+  if (in == GST_CLOCK_TIME_NONE || out == GST_CLOCK_TIME_NONE || in <= out)
+    return 0;
+  return in - out;
+}
+
+/* Room for one more item, within the size limits for data */
+static gboolean
+has_space (GstSpscQueue * queue, gboolean data)
+{
+  if (queue->head - LOAD (&queue->tail) >= queue->capacity)
+    return FALSE;
+  if (!data)
+    return TRUE;
+  return (queue->max_buffers == 0 || level_buffers (queue) <
+      queue->max_buffers) && (queue->max_bytes == 0
+      || level_bytes (queue) < queue->max_bytes) && (queue->max_time == 0
+      || level_time (queue) < queue->max_time);
+}
+
+/* Whether upstream has to stop waiting for the ring */
+static gboolean
+stopped (GstSpscQueue * queue)
+{
+  return LOAD (&queue->flushing) || LOAD (&queue->srcresult) != GST_FLOW_OK;
+}
+
+/* Wake the other side if it parked */
+static void
+wake (GstSpscQueue * queue, gint * waiting)
+{
+  if (!__atomic_load_n (waiting, __ATOMIC_SEQ_CST))
+    return;
+  g_mutex_lock (&queue->lock);
+  g_cond_broadcast (&queue->cond);
+  g_mutex_unlock (&queue->lock);
+}
+
+static void
+wake_all (GstSpscQueue * queue)
+{
+  g_mutex_lock (&queue->lock);
+  g_cond_broadcast (&queue->cond);
+  g_mutex_unlock (&queue->lock);
+}
+
+/* Upstream waits for room for an item, spinning first. FALSE when the
+ * queue flushes or downstream stopped */
+static gboolean
+wait_space (GstSpscQueue * queue, gboolean data)
+{
+  for (guint i = 0; !has_space (queue, data); i++) {
+    if (stopped (queue))
+      return FALSE;
+    if (i < queue->spin) {
+      SPSC_RELAX ();
+      continue;
+    }
+    g_mutex_lock (&queue->lock);
+    PUBLISH (&queue->producer_waiting, 1);
+    __atomic_fetch_add (&queue->parks, 1, __ATOMIC_RELAXED);
+    while (!has_space (queue, data) && !stopped (queue))
+      g_cond_wait (&queue->cond, &queue->lock);
+    PUBLISH (&queue->producer_waiting, 0);
+    g_mutex_unlock (&queue->lock);
+  }
+  return !LOAD (&queue->flushing);
+}
+
+/* Upstream adds an item it made room for */
+static void
+ring_push (GstSpscQueue * queue, GstMiniObject * item)
+{
+  guint buffers;
+  guint64 bytes, time;
+
+  item_size (item, &queue->sink_segment, &buffers, &bytes, &time);
+  STORE (&queue->in_buffers, queue->in_buffers + buffers);
+  STORE (&queue->in_bytes, queue->in_bytes + bytes);
+  if (time != GST_CLOCK_TIME_NONE)
+    STORE (&queue->in_time, time);
+  queue->ring[queue->head & (queue->capacity - 1)] = item;
+  PUBLISH (&queue->head, queue->head + 1);
+  wake (queue, &queue->consumer_waiting);
+}
+
+/* The streaming thread takes the oldest item, spinning first, and gives
+ * its room back. NULL when the queue flushes */
+static GstMiniObject *
+ring_pop (GstSpscQueue * queue)
+{
+  GstMiniObject *item;
+  guint buffers;
+  guint64 bytes, time;
+
+  for (guint i = 0; LOAD (&queue->head) == queue->tail; i++) {
+    if (LOAD (&queue->flushing))
+      return NULL;
+    if (i < queue->spin) {
+      SPSC_RELAX ();
+      continue;
+    }
+    g_mutex_lock (&queue->lock);
+    PUBLISH (&queue->consumer_waiting, 1);
+    __atomic_fetch_add (&queue->parks, 1, __ATOMIC_RELAXED);
+    while (LOAD (&queue->head) == queue->tail && !LOAD (&queue->flushing))
+      g_cond_wait (&queue->cond, &queue->lock);
+    PUBLISH (&queue->consumer_waiting, 0);
+    g_mutex_unlock (&queue->lock);
+  }
+  if (LOAD (&queue->flushing))
+    return NULL;
+
+  item = queue->ring[queue->tail & (queue->capacity - 1)];
+  if (GST_IS_EVENT (item)
+      && GST_EVENT_TYPE (GST_EVENT_CAST (item)) == GST_EVENT_SEGMENT)
+    gst_event_copy_segment (GST_EVENT_CAST (item), &queue->src_segment);
+  item_size (item, &queue->src_segment, &buffers, &bytes, &time);
+  STORE (&queue->out_buffers, queue->out_buffers + buffers);
+  STORE (&queue->out_bytes, queue->out_bytes + bytes);
+  if (time != GST_CLOCK_TIME_NONE)
+    STORE (&queue->out_time, time);
+  PUBLISH (&queue->tail, queue->tail + 1);
+  wake (queue, &queue->producer_waiting);
+  return item;
+}
+
+/* Drop what the ring holds, with both sides stopped. Queries belong to
+ * the thread that asked them */
+static void
+ring_clear (GstSpscQueue * queue)
+{
+  while (queue->ring != NULL && queue->tail != queue->head) {
+    GstMiniObject *item = queue->ring[queue->tail & (queue->capacity - 1)];
+
+    if (!GST_IS_QUERY (item))
+      gst_mini_object_unref (item);
+    queue->tail++;
+  }
+  queue->head = queue->tail = 0;
+  queue->in_buffers = queue->out_buffers = 0;
+  queue->in_bytes = queue->out_bytes = 0;
+  queue->in_time = queue->out_time = GST_CLOCK_TIME_NONE;
+  gst_segment_init (&queue->sink_segment, GST_FORMAT_TIME);
+  gst_segment_init (&queue->src_segment, GST_FORMAT_TIME);
+}
+
+/* The streaming thread: push the oldest item downstream */
+static void
+spsc_queue_loop (GstPad * pad)
+{
+  GstSpscQueue *queue = GST_SPSC_QUEUE (GST_PAD_PARENT (pad));
+  GstMiniObject *item = ring_pop (queue);
+  GstFlowReturn ret = GST_FLOW_OK;
+
+  if (item == NULL) {
+    gst_pad_pause_task (pad);
+    return;
+  }
+
+  if (GST_IS_BUFFER (item)) {
+    ret = gst_pad_push (queue->srcpad, GST_BUFFER_CAST (item));
+  } else if (GST_IS_BUFFER_LIST (item)) {
+    ret = gst_pad_push_list (queue->srcpad, GST_BUFFER_LIST_CAST (item));
+  } else if (GST_IS_EVENT (item)) {
+    gboolean eos = GST_EVENT_TYPE (GST_EVENT_CAST (item)) == GST_EVENT_EOS;
+
+    gst_pad_push_event (queue->srcpad, GST_EVENT_CAST (item));
+    if (eos)
+      ret = GST_FLOW_EOS;
+  } else if (GST_IS_QUERY (item)) {
+    gboolean result = gst_pad_peer_query (queue->srcpad,
+        GST_QUERY_CAST (item));
+
+    g_mutex_lock (&queue->lock);
+    queue->query_result = result;
+    queue->query_handled = TRUE;
+    g_cond_broadcast (&queue->cond);
+    g_mutex_unlock (&queue->lock);
+  }
+  if (ret == GST_FLOW_OK)
+    return;
+
+  /* Like queue, a fatal flow error ends the stream downstream */
+  if (ret == GST_FLOW_NOT_LINKED || ret < GST_FLOW_EOS) {
+    GST_ELEMENT_FLOW_ERROR (queue, ret);
+    gst_pad_push_event (queue->srcpad, gst_event_new_eos ());
+  }
+  PUBLISH (&queue->srcresult, (gint) ret);
+  wake_all (queue);
+  gst_pad_pause_task (pad);
+}
+
+static GstFlowReturn
+enqueue_data (GstSpscQueue * queue, GstMiniObject * item)
+{
+  GstFlowReturn ret = (GstFlowReturn) LOAD (&queue->srcresult);
+
+  if (ret == GST_FLOW_OK && !wait_space (queue, TRUE))
+    ret = (GstFlowReturn) LOAD (&queue->srcresult);
+  if (ret == GST_FLOW_OK && LOAD (&queue->flushing))
+    ret = GST_FLOW_FLUSHING;
+  if (ret != GST_FLOW_OK) {
+    gst_mini_object_unref (item);
+    return ret;
+  }
+  ring_push (queue, item);
+  return GST_FLOW_OK;
+}
+
+static GstFlowReturn
+spsc_queue_chain (GstPad * pad, GstObject * parent, GstBuffer * buffer)
+{
+  return enqueue_data (GST_SPSC_QUEUE (parent), GST_MINI_OBJECT_CAST (buffer));
+}
+
+static GstFlowReturn
+spsc_queue_chain_list (GstPad * pad, GstObject * parent,
+    GstBufferList * list)
+{
+  return enqueue_data (GST_SPSC_QUEUE (parent), GST_MINI_OBJECT_CAST (list));
+}
+
+static void
+start_flushing (GstSpscQueue * queue)
+{
+  PUBLISH (&queue->flushing, 1);
+  PUBLISH (&queue->srcresult, (gint) GST_FLOW_FLUSHING);
+  wake_all (queue);
+}
+
+static void
+stop_flushing (GstSpscQueue * queue)
+{
+  ring_clear (queue);
+  PUBLISH (&queue->srcresult, (gint) GST_FLOW_OK);
+  PUBLISH (&queue->flushing, 0);
+}
+
+static gboolean
+spsc_queue_sink_event (GstPad * pad, GstObject * parent, GstEvent * event)
+{
+  GstSpscQueue *queue = GST_SPSC_QUEUE (parent);
+  GstFlowReturn ret;
+
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_FLUSH_START:
+      start_flushing (queue);
+      gst_pad_push_event (queue->srcpad, event);
+      gst_pad_pause_task (queue->srcpad);
+      return TRUE;
+    case GST_EVENT_FLUSH_STOP:
+      stop_flushing (queue);
+      gst_pad_push_event (queue->srcpad, event);
+      return gst_pad_start_task (queue->srcpad,
+          (GstTaskFunction) spsc_queue_loop, queue->srcpad, NULL);
+    default:
+      break;
+  }
+  if (!GST_EVENT_IS_SERIALIZED (event))
+    return gst_pad_push_event (queue->srcpad, event);
+
+  /* A new stream after the end of the last one starts streaming again */
+  ret = (GstFlowReturn) LOAD (&queue->srcresult);
+  if (ret == GST_FLOW_EOS && (GST_EVENT_TYPE (event) == GST_EVENT_SEGMENT
+          || GST_EVENT_TYPE (event) == GST_EVENT_STREAM_START)) {
+    gst_pad_stop_task (queue->srcpad);
+    stop_flushing (queue);
+    gst_pad_start_task (queue->srcpad, (GstTaskFunction) spsc_queue_loop,
+        queue->srcpad, NULL);
+  }
+  if (GST_EVENT_TYPE (event) == GST_EVENT_SEGMENT)
+    gst_event_copy_segment (event, &queue->sink_segment);
+  if (!wait_space (queue, FALSE) || stopped (queue)) {
+    gst_event_unref (event);
+    return FALSE;
+  }
+  ring_push (queue, GST_MINI_OBJECT_CAST (event));
+  return TRUE;
+}
+
+/* Serialized queries wait in the ring behind the data before them, the
+ * streaming thread answers them */
+static gboolean
+spsc_queue_sink_query (GstPad * pad, GstObject * parent, GstQuery * query)
+{
+  GstSpscQueue *queue = GST_SPSC_QUEUE (parent);
+  gboolean result;
+
+  if (!GST_QUERY_IS_SERIALIZED (query))
+    return gst_pad_query_default (pad, parent, query);
+  if (!wait_space (queue, FALSE) || stopped (queue))
+    return FALSE;
+
+  g_mutex_lock (&queue->lock);
+  queue->query_handled = FALSE;
+  g_mutex_unlock (&queue->lock);
+  ring_push (queue, GST_MINI_OBJECT_CAST (query));
+
+  g_mutex_lock (&queue->lock);
+  PUBLISH (&queue->producer_waiting, 1);
+  while (!queue->query_handled && !stopped (queue))
+    g_cond_wait (&queue->cond, &queue->lock);
+  PUBLISH (&queue->producer_waiting, 0);
+  result = queue->query_handled && queue->query_result;
+  g_mutex_unlock (&queue->lock);
+  return result;
+}
+
+/* The ring holds the buffer limit and room for the events and queries in
+ * between, it is sized when streaming starts */
+static void
+ring_alloc (GstSpscQueue * queue)
+{
+  guint slots = queue->max_buffers > 0
+      ? queue->max_buffers + SPSC_EVENT_SLOTS : SPSC_UNBOUNDED_SLOTS;
+  guint capacity = 1;
+
+  while (capacity < slots)
+    capacity <<= 1;
+  if (capacity == queue->capacity)
+    return;
+  g_free (queue->ring);
+  queue->ring = g_new0 (GstMiniObject *, capacity);
+  queue->capacity = capacity;
+}
+
+static gboolean
+spsc_queue_src_activate_mode (GstPad * pad, GstObject * parent,
+    GstPadMode mode, gboolean active)
+{
+  GstSpscQueue *queue = GST_SPSC_QUEUE (parent);
+
+  if (mode != GST_PAD_MODE_PUSH)
+    return FALSE;
+  if (active) {
+    ring_clear (queue);
+    ring_alloc (queue);
+    stop_flushing (queue);
+    return gst_pad_start_task (pad, (GstTaskFunction) spsc_queue_loop, pad,
+        NULL);
+  }
+  start_flushing (queue);
+  gst_pad_stop_task (pad);
+  /* Upstream may still be about to add an item */
+  GST_PAD_STREAM_LOCK (queue->sinkpad);
+  ring_clear (queue);
+  GST_PAD_STREAM_UNLOCK (queue->sinkpad);
+  return TRUE;
+}
+
+static gboolean
+spsc_queue_sink_activate_mode (GstPad * pad, GstObject * parent,
+    GstPadMode mode, gboolean active)
+{
+  GstSpscQueue *queue = GST_SPSC_QUEUE (parent);
+
+  if (mode != GST_PAD_MODE_PUSH)
+    return FALSE;
+  if (!active) {
+    start_flushing (queue);
+    /* Wait until a chain call that was parked has left */
+    GST_PAD_STREAM_LOCK (pad);
+    GST_PAD_STREAM_UNLOCK (pad);
+  }
+  return TRUE;
+}
+
+static void
+spsc_queue_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstSpscQueue *queue = GST_SPSC_QUEUE (object);
+
+  switch (prop_id) {
+    case PROP_MAX_SIZE_BUFFERS:
+      queue->max_buffers = g_value_get_uint (value);
+      break;
+    case PROP_MAX_SIZE_BYTES:
+      queue->max_bytes = g_value_get_uint (value);
+      break;
+    case PROP_MAX_SIZE_TIME:
+      queue->max_time = g_value_get_uint64 (value);
+      break;
+    case PROP_SPIN:
+      queue->spin = g_value_get_uint (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+  /* A waiting upstream thread checks the new limits */
+  wake_all (queue);
+}
+
+static void
+spsc_queue_get_property (GObject * object, guint prop_id, GValue * value,
+    GParamSpec * pspec)
+{
+  GstSpscQueue *queue = GST_SPSC_QUEUE (object);
+
+  switch (prop_id) {
+    case PROP_MAX_SIZE_BUFFERS:
+      g_value_set_uint (value, queue->max_buffers);
+      break;
+    case PROP_MAX_SIZE_BYTES:
+      g_value_set_uint (value, queue->max_bytes);
+      break;
+    case PROP_MAX_SIZE_TIME:
+      g_value_set_uint64 (value, queue->max_time);
+      break;
+    case PROP_SPIN:
+      g_value_set_uint (value, queue->spin);
+      break;
+    case PROP_CURRENT_LEVEL_BUFFERS:
+      g_value_set_uint (value, level_buffers (queue));
+      break;
+    case PROP_CURRENT_LEVEL_BYTES:
+      g_value_set_uint (value, (guint) MIN (level_bytes (queue), G_MAXUINT));
+      break;
+    case PROP_CURRENT_LEVEL_TIME:
+      g_value_set_uint64 (value, level_time (queue));
+      break;
+    case PROP_PARKS:
+      g_value_set_uint64 (value, LOAD (&queue->parks));
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+spsc_queue_finalize (GObject * object)
+{
+  GstSpscQueue *queue = GST_SPSC_QUEUE (object);
+
+  ring_clear (queue);
+  g_free (queue->ring);
+  g_mutex_clear (&queue->lock);
+  g_cond_clear (&queue->cond);
+  G_OBJECT_CLASS (spsc_queue_parent_class)->finalize (object);
+}
+
+static void
+spsc_queue_class_init (GstSpscQueueClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GstElementClass *element_class = GST_ELEMENT_CLASS (klass);
+  GParamFlags readwrite = (GParamFlags) (G_PARAM_READWRITE
+      | G_PARAM_STATIC_STRINGS);
+  GParamFlags readable = (GParamFlags) (G_PARAM_READABLE
+      | G_PARAM_STATIC_STRINGS);
+
+  gobject_class->set_property = spsc_queue_set_property;
+  gobject_class->get_property = spsc_queue_get_property;
+  gobject_class->finalize = spsc_queue_finalize;
+
+  g_object_class_install_property (gobject_class, PROP_MAX_SIZE_BUFFERS,
+      g_param_spec_uint ("max-size-buffers", "Max. size (buffers)",
+          "Max. number of buffers in the queue (0=disable)", 0, G_MAXUINT,
+          SPSC_DEFAULT_MAX_BUFFERS, readwrite));
+  g_object_class_install_property (gobject_class, PROP_MAX_SIZE_BYTES,
+      g_param_spec_uint ("max-size-bytes", "Max. size (kB)",
+          "Max. amount of data in the queue (bytes, 0=disable)", 0,
+          G_MAXUINT, SPSC_DEFAULT_MAX_BYTES, readwrite));
+  g_object_class_install_property (gobject_class, PROP_MAX_SIZE_TIME,
+      g_param_spec_uint64 ("max-size-time", "Max. size (ns)",
+          "Max. amount of data in the queue (in ns, 0=disable)", 0,
+          G_MAXUINT64, SPSC_DEFAULT_MAX_TIME, readwrite));
+  g_object_class_install_property (gobject_class, PROP_SPIN,
+      g_param_spec_uint ("spin", "Spin",
+          "Polls of the ring before a waiting side parks", 0, G_MAXUINT,
+          SPSC_DEFAULT_SPIN, readwrite));
+  g_object_class_install_property (gobject_class, PROP_CURRENT_LEVEL_BUFFERS,
+      g_param_spec_uint ("current-level-buffers", "Current level (buffers)",
+          "Current number of buffers in the queue", 0, G_MAXUINT, 0,
+          readable));
+  g_object_class_install_property (gobject_class, PROP_CURRENT_LEVEL_BYTES,
+      g_param_spec_uint ("current-level-bytes", "Current level (kB)",
+          "Current amount of data in the queue (bytes)", 0, G_MAXUINT, 0,
+          readable));
+  g_object_class_install_property (gobject_class, PROP_CURRENT_LEVEL_TIME,
+      g_param_spec_uint64 ("current-level-time", "Current level (ns)",
+          "Current amount of data in the queue (in ns)", 0, G_MAXUINT64, 0,
+          readable));
+  g_object_class_install_property (gobject_class, PROP_PARKS,
+      g_param_spec_uint64 ("parks", "Parks",
+          "Times either side stopped spinning and parked", 0, G_MAXUINT64, 0,
+          readable));
+
+  gst_element_class_set_static_metadata (element_class, "SPSC queue",
+      "Generic", "Lock-free queue between one upstream and one streaming "
+      "thread", "gstreamer-remote-streaming");
+  gst_element_class_add_static_pad_template (element_class, &sink_template);
+  gst_element_class_add_static_pad_template (element_class, &src_template);
+}
+
+static void
+spsc_queue_init (GstSpscQueue * queue)
+{
+  queue->sinkpad = gst_pad_new_from_static_template (&sink_template, "sink");
+  gst_pad_set_chain_function (queue->sinkpad, spsc_queue_chain);
+  gst_pad_set_chain_list_function (queue->sinkpad, spsc_queue_chain_list);
+  gst_pad_set_event_function (queue->sinkpad, spsc_queue_sink_event);
+  gst_pad_set_query_function (queue->sinkpad, spsc_queue_sink_query);
+  gst_pad_set_activatemode_function (queue->sinkpad,
+      spsc_queue_sink_activate_mode);
+  GST_PAD_SET_PROXY_CAPS (queue->sinkpad);
+  gst_element_add_pad (GST_ELEMENT (queue), queue->sinkpad);
+
+  queue->srcpad = gst_pad_new_from_static_template (&src_template, "src");
+  gst_pad_set_activatemode_function (queue->srcpad,
+      spsc_queue_src_activate_mode);
+  GST_PAD_SET_PROXY_CAPS (queue->srcpad);
+  gst_element_add_pad (GST_ELEMENT (queue), queue->srcpad);
+
+  queue->max_buffers = SPSC_DEFAULT_MAX_BUFFERS;
+  queue->max_bytes = SPSC_DEFAULT_MAX_BYTES;
+  queue->max_time = SPSC_DEFAULT_MAX_TIME;
+  queue->spin = SPSC_DEFAULT_SPIN;
+  queue->flushing = 1;
+  queue->srcresult = GST_FLOW_FLUSHING;
+  g_mutex_init (&queue->lock);
+  g_cond_init (&queue->cond);
+  ring_clear (queue);
+}
+
+static gpointer
+register_element (gpointer data)
+{
+  gst_element_register (NULL, "spscqueue", GST_RANK_NONE,
+      GST_TYPE_SPSC_QUEUE);
+  return NULL;
+}
+
+static void
+ensure_registered ()
+{
+  static GOnce once = G_ONCE_INIT;
+
+  g_once (&once, (GThreadFunc) register_element, NULL);
+}
+
+/* Queue the RTP branches of the host pipelines with spscqueues */
+void
+spscqueue_set_enabled (gboolean enabled)
+{
+  spsc_enabled = enabled;
+}
+
+/* A queue between two threads of a host pipeline, a queue unless the
+ * lock-free mode is on. Both take the same size limits */
+GstElement *
+spscqueue_make ()
+{
+  if (!spsc_enabled)
+    return gst_element_factory_make ("queue", NULL);
+  ensure_registered ();
+  return gst_element_factory_make ("spscqueue", NULL);
+}
+
+/* Every buffer carries the time it was pushed in its offset */
+static void
+bench_handoff (GstElement * sink, GstBuffer * buffer, GstPad * pad,
+    SpscBenchLatency * latency)
+{
+  gint64 delay = g_get_monotonic_time () - (gint64) GST_BUFFER_OFFSET (buffer);
+
+  latency->count++;
+  latency->total += delay;
+  latency->longest = MAX (latency->longest, delay);
+}
+
+/* Push empty buffers through one queue element into a fakesink at the
+ * given rate for a number of seconds, from a thread of our own, and print
+ * the rate reached, the CPU used and the latency through the queue */
+static void
+bench_run (const gchar * factory, guint rate, gint seconds)
+{
+  GstElement *pipeline = gst_pipeline_new ("spsc-bench");
+  GstElement *queue = gst_element_factory_make (factory, NULL);
+  GstElement *sink = gst_element_factory_make ("fakesink", NULL);
+  GstPad *srcpad = gst_pad_new ("bench", GST_PAD_SRC);
+  GstPad *sinkpad;
+  SpscBenchLatency latency = { 0, 0, 0 };
+  GstSegment segment;
+  GstMessage *msg;
+  GstBus *bus;
+  gint64 start, now, end;
+  guint64 sent = 0;
+  gdouble cpu;
+
+  if (!pipeline || !queue || !sink) {
+    g_printerr ("Not all benchmark elements could be created.\n");
+    return;
+  }
+  g_object_set (G_OBJECT (sink), "sync", FALSE, "signal-handoffs", TRUE,
+      NULL);
+  g_signal_connect (sink, "handoff", G_CALLBACK (bench_handoff), &latency);
+  gst_bin_add_many (GST_BIN (pipeline), queue, sink, NULL);
+  sinkpad = gst_element_get_static_pad (queue, "sink");
+  if (!gst_element_link (queue, sink)
+      || GST_PAD_LINK_FAILED (gst_pad_link (srcpad, sinkpad))) {
+    g_printerr ("Benchmark pipeline not linked.\n");
+    gst_object_unref (sinkpad);
+    gst_object_unref (srcpad);
+    gst_object_unref (pipeline);
+    return;
+  }
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  gst_pad_set_active (srcpad, TRUE);
+  gst_pad_push_event (srcpad, gst_event_new_stream_start ("spsc-bench"));
+  gst_pad_push_event (srcpad, gst_event_new_caps (gst_caps_new_empty_simple
+          ("application/x-spsc-bench")));
+  gst_segment_init (&segment, GST_FORMAT_TIME);
+  gst_pad_push_event (srcpad, gst_event_new_segment (&segment));
+
+  cpu = sysstat_cpu_seconds ();
+  start = g_get_monotonic_time ();
+  end = start + (gint64) seconds * G_USEC_PER_SEC;
+  while ((now = g_get_monotonic_time ()) < end) {
+    guint64 due = (guint64) (now - start) * rate / G_USEC_PER_SEC;
+    GstFlowReturn ret = GST_FLOW_OK;
+
+    for (; sent < due && ret == GST_FLOW_OK; sent++) {
+      GstBuffer *buffer = gst_buffer_new ();
+
+      GST_BUFFER_OFFSET (buffer) = g_get_monotonic_time ();
+      ret = gst_pad_push (srcpad, buffer);
+    }
+    if (ret != GST_FLOW_OK)
+      break;
+    g_usleep (SPSC_BENCH_TICK_US);
+  }
+  gst_pad_push_event (srcpad, gst_event_new_eos ());
+  bus = gst_element_get_bus (pipeline);
+  msg = gst_bus_timed_pop_filtered (bus, 5 * GST_SECOND,
+      (GstMessageType) (GST_MESSAGE_EOS | GST_MESSAGE_ERROR));
+  now = g_get_monotonic_time ();
+  cpu = sysstat_cpu_seconds () - cpu;
+  if (msg != NULL)
+    gst_message_unref (msg);
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+
+  g_print ("%-10s %10u %12.0f %7.0f%% %10.1f %10" G_GINT64_FORMAT "\n",
+      factory, rate, latency.count * 1e6 / (now - start),
+      100.0 * cpu * G_USEC_PER_SEC / (now - start), latency.count
+      ? (gdouble) latency.total / latency.count : 0.0, latency.longest);
+
+  gst_pad_set_active (srcpad, FALSE);
+  gst_object_unref (bus);
+  gst_object_unref (sinkpad);
+  gst_object_unref (srcpad);
+  gst_object_unref (pipeline);
+}
+
+/* Buffers per second, CPU and latency of queue, queue2 and spscqueue,
+ * each with its default size limits, from 10k to 1M buffers a second */
+void
+spscqueue_benchmark (gint seconds)
+{
+  static const guint rates[] = { 10000, 100000, 1000000 };
+  static const gchar *factories[] = { "queue", "queue2", "spscqueue" };
+
+  ensure_registered ();
+  g_print ("Queue elements, %d s per run, CPU of the whole process\n\n",
+      seconds);
+  g_print ("%-10s %10s %12s %8s %10s %10s\n", "element", "rate",
+      "buffers/s", "cpu", "mean us", "max us");
+  for (guint i = 0; i < G_N_ELEMENTS (rates); i++)
+    for (guint j = 0; j < G_N_ELEMENTS (factories); j++)
+      bench_run (factories[j], rates[i], seconds);
+}
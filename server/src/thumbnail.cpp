@@ -44,9 +44,6 @@ set_pipelinemp4 (std::string input_path, std::string output_path)
   data.seek_done = FALSE;
   data.duration = GST_CLOCK_TIME_NONE;
 
-  /* Initialize GStreamer */
-  gst_init (NULL, NULL);
-
   /* Create the elements */
   data.pipeline = gst_pipeline_new ("thumbpipe");
   data.src = gst_element_factory_make ("filesrc", "src");
@@ -166,9 +163,6 @@ set_pipelineavi (std::string input_path, std::string output_path)
   data.seek_done = FALSE;
   data.duration = GST_CLOCK_TIME_NONE;
 
-  /* Initialize GStreamer */
-  gst_init (NULL, NULL);
-
   /* Create the elements */
   data.pipeline = gst_pipeline_new ("thumbpipe");
   data.src = gst_element_factory_make ("filesrc", "src");
@@ -288,9 +282,6 @@ set_pipelinewebm (std::string input_path, std::string output_path)
   data.seek_done = FALSE;
   data.duration = GST_CLOCK_TIME_NONE;
 
-  /* Initialize GStreamer */
-  gst_init (NULL, NULL);
-
   /* Create the elements */
   data.pipeline = gst_pipeline_new ("thumbpipe");
   data.src = gst_element_factory_make ("filesrc", "src");
@@ -403,7 +394,6 @@ directory_set (std::string path)
 {
 
   std::string thumbnail_path = "/home/ee212798//Desktop/gstreamer-remote-streaming/server/";
-  gst_init (NULL, NULL);
   GError *error = NULL;
 
   /* Check suffix of given path and call function to create image */
@@ -0,0 +1,384 @@
+#include "topology.h"
+#include "encprofile.h"
+#include "encselect.h"
+#include "membudget.h"
+#include <gst/video/video.h>
+
+/* Whether the host pipelines place their thread boundaries themselves */
+static gboolean topology_auto = FALSE;
+
+/* Warm-up results by file, codec and profile. The lock guards the table
+ * and whether a result is ready, not the warm-up itself */
+static GMutex cache_lock;
+static GHashTable *cache = NULL;
+
+/* Latency the benchmark collects, NULL outside of it */
+static TopologyLatency *bench_latency = NULL;
+
+/* Structure for one warm-up run, the wall time of the measured frames */
+typedef struct _TopologyWarmup
+{
+  GstElement *first;
+  gint frames;
+  gint64 start;
+  gint64 end;
+  gint done;
+} TopologyWarmup;
+
+void
+topology_set_auto (gboolean enabled)
+{
+  topology_auto = enabled;
+}
+
+/* Elements of the video branch, " | " where a new thread starts */
+static gchar *
+layout (gint boundaries)
+{
+  return g_strdup_printf ("decode%sconvert%sencode",
+      boundaries & TOPOLOGY_DECODE ? " | " : " ",
+      boundaries & TOPOLOGY_ENCODE ? " | " : " ");
+}
+
+static GstPadProbeReturn
+warmup_probe (GstPad * pad, GstPadProbeInfo * info, TopologyWarmup * warmup)
+{
+  warmup->frames++;
+  if (warmup->frames == TOPOLOGY_WARMUP_SKIP)
+    warmup->start = g_get_monotonic_time ();
+  else if (warmup->frames == TOPOLOGY_WARMUP_SKIP + TOPOLOGY_WARMUP_FRAMES) {
+    warmup->end = g_get_monotonic_time ();
+    g_atomic_int_set (&warmup->done, TRUE);
+  }
+  return GST_PAD_PROBE_OK;
+}
+
+/* Link the decoded video to the first element of the stage */
+static void
+warmup_pad_added (GstElement * decoder, GstPad * pad, TopologyWarmup * warmup)
+{
+  GstCaps *caps = gst_pad_get_current_caps (pad);
+  GstPad *sinkpad = gst_element_get_static_pad (warmup->first, "sink");
+
+  if (caps == NULL)
+    caps = gst_pad_query_caps (pad, NULL);
+  if (g_str_has_prefix (gst_structure_get_name (gst_caps_get_structure (caps,
+                  0)), "video/") && !gst_pad_is_linked (sinkpad)
+      && !GST_PAD_LINK_FAILED (gst_pad_link (pad, sinkpad)))
+    gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+        (GstPadProbeCallback) warmup_probe, warmup, NULL);
+  gst_caps_unref (caps);
+  gst_object_unref (sinkpad);
+}
+
+/* Wall time per frame in ms of the first stages of the video branch of
+ * the file on one thread: decode, then convert, then encode. -1 when the
+ * file did not play long enough */
+static gdouble
+stage_time (StreamSession * session, EncoderCodec codec, gint stages)
+{
+  GstElement *pipeline = gst_pipeline_new ("topology-warmup");
+  GstElement *source = gst_element_factory_make ("filesrc", NULL);
+  GstElement *decoder = gst_element_factory_make ("decodebin", NULL);
+  GstElement *convert = gst_element_factory_make ("videoconvert", NULL);
+  GstElement *encoder = encselect_make (codec);
+  GstElement *sink = gst_element_factory_make ("fakesink", NULL);
+  TopologyWarmup warmup = { NULL, 0, 0, 0, FALSE };
+  gint64 deadline = g_get_monotonic_time ()
+      + TOPOLOGY_WARMUP_TIMEOUT * G_USEC_PER_SEC;
+  GstMessage *msg = NULL;
+  gboolean linked;
+  GstBus *bus;
+
+  if (!pipeline || !source || !decoder || !convert || !encoder || !sink) {
+    g_printerr ("Not all warm-up elements could be created.\n");
+    return -1.0;
+  }
+  g_object_set (G_OBJECT (source), "location", session->path, NULL);
+  g_object_set (G_OBJECT (sink), "sync", FALSE, NULL);
+  encprofile_apply (encoder, session->profile);
+  encprofile_set_threads (encoder, session->encoder_threads);
+  gst_bin_add_many (GST_BIN (pipeline), source, decoder, sink, NULL);
+  if (stages == 1) {
+    warmup.first = sink;
+    linked = TRUE;
+    gst_object_unref (gst_object_ref_sink (convert));
+    gst_object_unref (gst_object_ref_sink (encoder));
+  } else if (stages == 2) {
+    warmup.first = convert;
+    gst_bin_add (GST_BIN (pipeline), convert);
+    linked = gst_element_link (convert, sink);
+    gst_object_unref (gst_object_ref_sink (encoder));
+  } else {
+    warmup.first = convert;
+    gst_bin_add_many (GST_BIN (pipeline), convert, encoder, NULL);
+    linked = gst_element_link_many (convert, encoder, sink, NULL);
+  }
+  g_signal_connect (decoder, "pad-added", G_CALLBACK (warmup_pad_added),
+      &warmup);
+  if (!linked || !gst_element_link (source, decoder)) {
+    g_printerr ("Warm-up pipeline not linked.\n");
+    gst_object_unref (pipeline);
+    return -1.0;
+  }
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  bus = gst_element_get_bus (pipeline);
+  while (!g_atomic_int_get (&warmup.done) && msg == NULL
+      && g_get_monotonic_time () < deadline)
+    msg = gst_bus_timed_pop_filtered (bus, 20 * GST_MSECOND,
+        (GstMessageType) (GST_MESSAGE_EOS | GST_MESSAGE_ERROR));
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  if (msg != NULL)
+    gst_message_unref (msg);
+  gst_object_unref (bus);
+  gst_object_unref (pipeline);
+
+  if (!warmup.done)
+    return -1.0;
+  return (warmup.end - warmup.start) / 1000.0 / TOPOLOGY_WARMUP_FRAMES;
+}
+
+/* A heavy element right after another heavy one on the same thread gets a
+ * thread of its own */
+static void
+choose (TopologyChoice * choice)
+{
+  gdouble cost[3] = { choice->decode_ms, choice->convert_ms,
+    choice->encode_ms
+  };
+  const gint boundary[3] = { 0, TOPOLOGY_DECODE, TOPOLOGY_ENCODE };
+  gdouble total = cost[0] + cost[1] + cost[2];
+  gboolean thread_heavy = FALSE;
+
+  choice->boundaries = 0;
+  for (guint i = 0; i < 3 && total > 0.0; i++) {
+    gboolean heavy = cost[i] >= TOPOLOGY_HEAVY_SHARE * total;
+
+    if (thread_heavy && heavy)
+      choice->boundaries |= boundary[i];
+    else
+      thread_heavy = thread_heavy || heavy;
+  }
+}
+
+static void
+measure (StreamSession * session, EncoderCodec codec, TopologyChoice * choice)
+{
+  gdouble decode = stage_time (session, codec, 1);
+  gdouble convert = decode < 0.0 ? -1.0 : stage_time (session, codec, 2);
+  gdouble encode = convert < 0.0 ? -1.0 : stage_time (session, codec, 3);
+  gchar *chosen, *stock;
+
+  if (encode < 0.0) {
+    g_printerr ("Warm-up of %s failed, keeping the stock topology.\n",
+        session->path);
+    return;
+  }
+  choice->decode_ms = decode;
+  choice->convert_ms = MAX (convert - decode, 0.0);
+  choice->encode_ms = MAX (encode - convert, 0.0);
+  choose (choice);
+
+  chosen = layout (choice->boundaries);
+  stock = layout (0);
+  g_print ("Topology of %s: %s, stock %s (decode %.2f, convert %.2f, "
+      "encode %.2f ms per frame)\n", session->path, chosen, stock,
+      choice->decode_ms, choice->convert_ms, choice->encode_ms);
+  g_free (chosen);
+  g_free (stock);
+}
+
+static void
+choice_free (TopologyChoice * choice)
+{
+  g_cond_clear (&choice->cond);
+  g_free (choice);
+}
+
+/* Choose the thread boundaries of the video branch of the session before
+ * its host pipeline is linked. The warm-up runs once per file, codec and
+ * profile, sessions of the same file wait for the first one's result
+ * while other files warm up at the same time */
+void
+topology_prepare (StreamSession * session, EncoderCodec codec)
+{
+  TopologyChoice *choice;
+  gchar *key;
+
+  session->topology = 0;
+  if (!topology_auto)
+    return;
+
+  key = g_strdup_printf ("%s:%s:%d", session->path,
+      encselect_codec_name (codec), session->profile);
+  g_mutex_lock (&cache_lock);
+  if (cache == NULL)
+    cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+        (GDestroyNotify) choice_free);
+  choice = (TopologyChoice *) g_hash_table_lookup (cache, key);
+  if (choice == NULL) {
+    choice = g_new0 (TopologyChoice, 1);
+    g_cond_init (&choice->cond);
+    g_hash_table_insert (cache, key, choice);
+    g_mutex_unlock (&cache_lock);
+    measure (session, codec, choice);
+    g_mutex_lock (&cache_lock);
+    choice->ready = TRUE;
+    g_cond_broadcast (&choice->cond);
+  } else {
+    g_free (key);
+    while (!choice->ready)
+      g_cond_wait (&choice->cond, &cache_lock);
+  }
+  session->topology = choice->boundaries;
+  g_mutex_unlock (&cache_lock);
+}
+
+/* Link two elements of the video branch, through a queue when the session
+ * starts a new thread there */
+gboolean
+topology_link (StreamSession * session, GstElement * pipeline,
+    GstElement * upstream, GstElement * downstream, TopologyBoundary boundary)
+{
+  GstElement *queue;
+
+  if (!(session->topology & boundary))
+    return gst_element_link (upstream, downstream);
+  queue = gst_element_factory_make ("queue", NULL);
+  if (queue == NULL)
+    return FALSE;
+  g_object_set (G_OBJECT (queue), "max-size-buffers", TOPOLOGY_QUEUE_BUFFERS,
+      "max-size-bytes", 0, "max-size-time", (guint64) 0, NULL);
+  membudget_tag (queue, MEMBUDGET_BOUNDARY);
+  gst_bin_add (GST_BIN (pipeline), queue);
+  return gst_element_link_many (upstream, queue, downstream, NULL);
+}
+
+static GstPadProbeReturn
+decoded_probe (GstPad * pad, GstPadProbeInfo * info,
+    TopologyLatency * latency)
+{
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  guint64 *pts;
+  gint64 *decoded;
+
+  if (!GST_BUFFER_PTS_IS_VALID (buffer))
+    return GST_PAD_PROBE_OK;
+  pts = g_new (guint64, 1);
+  decoded = g_new (gint64, 1);
+  *pts = GST_BUFFER_PTS (buffer);
+  *decoded = g_get_monotonic_time ();
+  g_mutex_lock (&latency->lock);
+  g_hash_table_insert (latency->decoded, pts, decoded);
+  g_mutex_unlock (&latency->lock);
+  return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn
+encoded_probe (GstPad * pad, GstPadProbeInfo * info,
+    TopologyLatency * latency)
+{
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  gint64 now = g_get_monotonic_time ();
+  gint64 *decoded;
+
+  g_mutex_lock (&latency->lock);
+  decoded = (gint64 *) g_hash_table_lookup (latency->decoded,
+      &GST_BUFFER_PTS (buffer));
+  if (decoded != NULL) {
+    latency->frames++;
+    latency->total += now - *decoded;
+    latency->longest = MAX (latency->longest, now - *decoded);
+    g_hash_table_remove (latency->decoded, &GST_BUFFER_PTS (buffer));
+  }
+  g_mutex_unlock (&latency->lock);
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+attach_element (const GValue * item, TopologyLatency * latency)
+{
+  GstElement *element = GST_ELEMENT (g_value_get_object (item));
+  GstPad *pad;
+
+  if (!GST_IS_VIDEO_DECODER (element) && !GST_IS_VIDEO_ENCODER (element))
+    return;
+  pad = gst_element_get_static_pad (element, "src");
+  if (pad == NULL)
+    return;
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, GST_IS_VIDEO_DECODER
+      (element) ? (GstPadProbeCallback) decoded_probe :
+      (GstPadProbeCallback) encoded_probe, latency, NULL);
+  gst_object_unref (pad);
+}
+
+/* During the benchmark, time every frame from the decoder to the encoder
+ * output of the session pipeline */
+void
+topology_attach (StreamSession * session, GstElement * pipeline)
+{
+  GstIterator *iter;
+
+  if (bench_latency == NULL)
+    return;
+  iter = gst_bin_iterate_recurse (GST_BIN (pipeline));
+  gst_iterator_foreach (iter, (GstIteratorForeachFunction) attach_element,
+      bench_latency);
+  gst_iterator_free (iter);
+}
+
+/* Run one session of the file alone, as fast as it goes or in real time,
+ * and return its speed, 1.0 is real time */
+static gdouble
+bench_session (const gchar * path, gboolean realtime, gint seconds)
+{
+  StreamSession *session = session_new (path, TOPOLOGY_BENCH_HOST,
+      TOPOLOGY_BENCH_PORT_BASE, FALSE);
+  gdouble speed = 0.0;
+
+  session->realtime = realtime;
+  session->renditions = 1;
+  session_start (session);
+  g_usleep (seconds * G_USEC_PER_SEC);
+  session_stop (session);
+  session_join (session);
+  if (session->position > 0 && session->elapsed > 0)
+    speed = session->position / 1000.0 / session->elapsed;
+  session_free (session);
+  return speed;
+}
+
+/* Throughput as fast as it goes and decoder to encoder latency in real
+ * time of the file in the stock and in the chosen topology */
+void
+topology_benchmark (const gchar * path, gint seconds)
+{
+  TopologyLatency latency;
+
+  g_mutex_init (&latency.lock);
+  g_print ("\nThread topology: %s, %d s per run\n\n", path, seconds);
+  g_print ("topology      speed    mean ms     max ms\n");
+  for (gint automatic = 0; automatic < 2; automatic++) {
+    gdouble speed;
+
+    topology_set_auto (automatic);
+    speed = bench_session (path, FALSE, seconds);
+
+    latency.decoded = g_hash_table_new_full (g_int64_hash, g_int64_equal,
+        g_free, g_free);
+    latency.frames = 0;
+    latency.total = latency.longest = 0;
+    bench_latency = &latency;
+    bench_session (path, TRUE, seconds);
+    bench_latency = NULL;
+    g_hash_table_unref (latency.decoded);
+
+    g_print ("%-8s %10.2fx %10.2f %10.2f\n", automatic ? "auto" : "stock",
+        speed, latency.frames ? latency.total / 1000.0 / latency.frames
+        : 0.0, latency.longest / 1000.0);
+  }
+  topology_set_auto (FALSE);
+  g_mutex_clear (&latency.lock);
+  g_print ("\n");
+}